@@ -1,37 +1,74 @@
 #include "src/admin/dns_admin_service_client.h"
 
 #include <chrono>
-#include <thread>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <vector>
 
 #include "absl/log/log.h"
 
 namespace tiny_dns {
 
-void RefreshTtl(DnsAdminServiceClient* client, proto::Record record) {
-  LOG(INFO) << "Automatically refreshing record: " << record;
-  while (!client->terminate_threads_) {
-    std::this_thread::sleep_for(std::chrono::seconds(record.ttl()));
+namespace {
 
-    grpc::ClientContext context;
-    proto::InsertOrUpdateRequest request;
-    *request.mutable_record() = record;
-    proto::InsertOrUpdateResponse response;
-    const grpc::Status status = client->stub_->InsertOrUpdate(&context, request, &response);
-    if (!status.ok()) {
-      LOG(ERROR) << "Attempt to refresh DNS record: " << record
-        << " failed: " << status.error_code() << " - " << status.error_message();
-    } else {
-      LOG(INFO) << "Successfully refreshed DNS record: " << record;
-    }
-  }
+// NOTE: bounds how long a refresh, and so destruction, can be held up by an
+// unresponsive server.
+constexpr auto kRefreshDeadline = std::chrono::seconds(10);
+
+} // namespace
+
+DnsAdminServiceClient::DnsAdminServiceClient(
+    std::shared_ptr<grpc::Channel> channel, RefreshSchedulerOptions refresh_options)
+  : stub_(proto::DnsAdminService::NewStub(channel)) {
+  refresh_scheduler_ = std::make_unique<RefreshScheduler>(
+      [this](std::span<const uint64_t> ids) { return RefreshRecords(ids); },
+      refresh_options);
 }
 
 DnsAdminServiceClient::~DnsAdminServiceClient() {
-  terminate_threads_ = true;
-  for (std::thread& thread : refresh_ttl_threads_) {
-    thread.join();
+  {
+    std::scoped_lock lock(refresh_mutex_);
+    stopping_ = true;
+    if (refresh_context_ != nullptr) { refresh_context_->TryCancel(); }
+  }
+  refresh_scheduler_.reset();
+}
+
+std::vector<bool> DnsAdminServiceClient::RefreshRecords(std::span<const uint64_t> ids) {
+  proto::InsertOrUpdateBatchRequest request;
+  grpc::ClientContext context;
+  context.set_deadline(std::chrono::system_clock::now() + kRefreshDeadline);
+  {
+    std::scoped_lock lock(refresh_mutex_);
+    if (stopping_) { return std::vector<bool>(ids.size(), false); }
+    for (uint64_t id : ids) { *request.add_records() = refresh_records_.at(id); }
+    refresh_context_ = &context;
+  }
+  proto::InsertOrUpdateBatchResponse response;
+  const grpc::Status status = stub_->InsertOrUpdateBatch(&context, request, &response);
+  {
+    std::scoped_lock lock(refresh_mutex_);
+    refresh_context_ = nullptr;
+  }
+
+  std::vector<bool> refreshed(ids.size(), false);
+  if (!status.ok()) {
+    LOG(ERROR) << "Attempt to refresh " << ids.size() << " DNS records failed: "
+      << status.error_code() << " - " << status.error_message();
+    return refreshed;
+  }
+  for (int i = 0; i < response.statuses_size() && i < (int) ids.size(); i++) {
+    const proto::RecordStatus& record_status = response.statuses(i);
+    refreshed[i] = (record_status.code() == grpc::StatusCode::OK);
+    if (!refreshed[i]) {
+      LOG(ERROR) << "Attempt to refresh DNS record: " << request.records(i)
+        << " failed: " << record_status.code() << " - " << record_status.message();
+    }
   }
+  VLOG(1) << "Refreshed " << ids.size() << " DNS records.";
+  return refreshed;
 }
 
 grpc::Status DnsAdminServiceClient::InsertOrUpdate(
@@ -51,11 +88,31 @@ grpc::Status DnsAdminServiceClient::InsertOrUpdate(
       << status.error_code() << " - " << status.error_message();
   }
   if (auto_refresh_ttl) {
-    refresh_ttl_threads_.push_back(std::thread(RefreshTtl, this, request_copy.record()));
+    LOG(INFO) << "Automatically refreshing record: " << request_copy.record();
+    // NOTE: holds the lock across Add, so the id is registered before it can come due.
+    std::scoped_lock lock(refresh_mutex_);
+    const uint64_t id = refresh_scheduler_->Add(std::chrono::seconds(request_copy.record().ttl()));
+    refresh_records_[id] = request_copy.record();
   }
   return grpc::Status::OK;
 }
 
+grpc::Status DnsAdminServiceClient::InsertOrUpdateBatch(
+    const proto::InsertOrUpdateBatchRequest& request,
+    proto::InsertOrUpdateBatchResponse& response) {
+  proto::InsertOrUpdateBatchRequest request_copy = request;
+  for (proto::Record& record : *request_copy.mutable_records()) {
+    if (record.ttl() < kMinimumAllowedTtl) { record.set_ttl(kMinimumAllowedTtl); }
+  }
+  grpc::ClientContext context;
+  const grpc::Status status = stub_->InsertOrUpdateBatch(&context, request_copy, &response);
+  if (!status.ok()) {
+    LOG(ERROR) << "Call to InsertOrUpdateBatch failed: "
+      << status.error_code() << " - " << status.error_message();
+  }
+  return status;
+}
+
 grpc::Status DnsAdminServiceClient::Lookup(
     const proto::LookupRequest& request,
     proto::LookupResponse& response) {
@@ -68,4 +125,16 @@ grpc::Status DnsAdminServiceClient::Lookup(
   return status;
 }
 
+grpc::Status DnsAdminServiceClient::LookupBatch(
+    const proto::LookupBatchRequest& request,
+    proto::LookupBatchResponse& response) {
+  grpc::ClientContext context;
+  const grpc::Status status = stub_->LookupBatch(&context, request, &response);
+  if (!status.ok()) {
+    LOG(ERROR) << "Call to LookupBatch failed: "
+      << status.error_code() << " - " << status.error_message();
+  }
+  return status;
+}
+
 } // tiny_dns
@@ -1,13 +1,16 @@
 #ifndef SRC_ADMIN_DNS_ADMIN_SERVICE_CLIENT_H_
 #define SRC_ADMIN_DNS_ADMIN_SERVICE_CLIENT_H_
 
-#include <atomic>
-#include <thread>
-#include <vector>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "grpcpp/grpcpp.h"
 #include "src/admin/dns_admin_service.grpc.pb.h"
+#include "src/common/refresh_scheduler.h"
 
 namespace tiny_dns {
 
@@ -16,29 +19,48 @@ static const int32_t kMinimumAllowedTtl = 60;
 
 // gRPC client for the DNS admin service. Intended to be used to refresh
 // DNS record entries regularly.
+//
+// Auto-refreshed records share one RefreshScheduler thread: records that come
+// due around the same time are re-sent together in one InsertOrUpdateBatch.
 class DnsAdminServiceClient {
  public:
-  explicit DnsAdminServiceClient(std::shared_ptr<grpc::Channel> channel) :
-    stub_(proto::DnsAdminService::NewStub(channel)), refresh_ttl_threads_(), terminate_threads_() {}
+  explicit DnsAdminServiceClient(
+      std::shared_ptr<grpc::Channel> channel, RefreshSchedulerOptions refresh_options = {});
+  // NOTE: cancels any refresh in flight.
   ~DnsAdminServiceClient();
 
   // NOTE: if auto_refresh_ttl is true, upon successful connection, will
-  // refresh the ttl based on the provided cadence.
+  // refresh the record about once per ttl, until the client is destroyed.
   grpc::Status InsertOrUpdate(
       const proto::InsertOrUpdateRequest& request,
       proto::InsertOrUpdateResponse& response,
       bool auto_refresh_ttl = false);
 
+  // NOTE: ttls below the minimum are raised as in InsertOrUpdate. Records
+  // can fail individually, see response.statuses.
+  grpc::Status InsertOrUpdateBatch(
+      const proto::InsertOrUpdateBatchRequest& request,
+      proto::InsertOrUpdateBatchResponse& response);
+
   grpc::Status Lookup(
       const proto::LookupRequest& request,
       proto::LookupResponse& response);
 
+  // NOTE: questions can fail individually, see response.results.
+  grpc::Status LookupBatch(
+      const proto::LookupBatchRequest& request,
+      proto::LookupBatchResponse& response);
+
  private:
-  std::unique_ptr<proto::DnsAdminService::Stub> stub_;
-  std::vector<std::thread> refresh_ttl_threads_;
-  std::atomic<bool> terminate_threads_;
+  std::vector<bool> RefreshRecords(std::span<const uint64_t> ids);
 
-  friend void RefreshTtl(DnsAdminServiceClient*, proto::Record);
+  std::unique_ptr<proto::DnsAdminService::Stub> stub_;
+  std::mutex refresh_mutex_;
+  absl::flat_hash_map<uint64_t, proto::Record> refresh_records_;
+  grpc::ClientContext* refresh_context_ = nullptr;
+  bool stopping_ = false;
+  // NOTE: last, so it's stopped before anything it refreshes with goes away.
+  std::unique_ptr<RefreshScheduler> refresh_scheduler_;
 };
 
 } // tiny_dns
@@ -1,108 +1,291 @@
 #include "src/admin/dns_admin_service_impl.h"
 
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <stdlib.h>
+#include <variant>
+#include <vector>
 
+#include "absl/cleanup/cleanup.h"
+#include "absl/log/log.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
 #include "grpcpp/grpcpp.h"
 #include "src/admin/dns_admin_service.grpc.pb.h"
+#include "src/common/histogram.h"
+#include "src/common/metrics.h"
 #include "src/dns/record_store.h"
 #include "src/dns/dns_packet.h"
+#include "src/dns/query_log.h"
+#include "src/dns/query_trace.h"
+#include "src/dns/rdata_codec.h"
+#include "src/dns/resolver.h"
+#include "src/dns/server_metrics.h"
+#include "src/dns/zone_file.h"
 
 namespace tiny_dns {
 namespace {
 
+constexpr size_t kDefaultStreamBufferEntries = 64 * 1024;
+// NOTE: a stream's buffer is held by the server, so a client can't ask for
+// more than this.
+constexpr size_t kMaxStreamBufferEntries = 1024 * 1024;
+constexpr size_t kMaxFrameEntries = 256;
+constexpr auto kFrameInterval = std::chrono::milliseconds(100);
+// NOTE: streamed records are applied in batches of this many.
+constexpr size_t kStreamBatchSize = 1024;
+// NOTE: a batch's misses are submitted to the forwarder all at once, this
+// keeps them within its default queue.
+constexpr int kMaxLookupBatchSize = 4096;
+// NOTE: a batch is converted and applied whole, under the shard locks, so
+// it's held to the same size.
+constexpr int kMaxInsertBatchSize = kMaxLookupBatchSize;
+
+grpc::Status InvalidArgument(std::string message) {
+  return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, std::move(message));
+}
+
+// NOTE: resolves path, relative to zone_directory, to the file it names.
+// Symlinks and ".." are followed first, so neither can lead outside it.
+grpc::Status ResolveZonePath(
+    const std::string& zone_directory, const std::string& path, std::string& resolved) {
+  if (zone_directory.empty()) {
+    return grpc::Status(
+        grpc::StatusCode::FAILED_PRECONDITION, "No zone directory is configured.");
+  }
+  std::error_code error;
+  const std::filesystem::path directory = std::filesystem::weakly_canonical(zone_directory, error);
+  if (error) {
+    return grpc::Status(grpc::StatusCode::INTERNAL, absl::StrCat(
+          "Unable to resolve the zone directory: ", error.message()));
+  }
+  const std::filesystem::path file = std::filesystem::weakly_canonical(directory / path, error);
+  if (error) {
+    return InvalidArgument(absl::StrCat("Unable to resolve zone file path: ", error.message()));
+  }
+  const auto [directory_end, file_end] =
+    std::mismatch(directory.begin(), directory.end(), file.begin(), file.end());
+  if (directory_end != directory.end() || file_end == file.end()) {
+    return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, absl::StrCat(
+          "Zone file path is outside the zone directory: ", path));
+  }
+  resolved = file.string();
+  return grpc::Status::OK;
+}
+
+grpc::Status ToUint16(std::string_view field, int32_t value, uint16_t& out) {
+  if (value < 0 || value > std::numeric_limits<uint16_t>::max()) {
+    return InvalidArgument(absl::StrCat(field, " exceeds uint16 bounds: ", value));
+  }
+  out = (uint16_t) value;
+  return grpc::Status::OK;
+}
+
+// NOTE: a TXT record's data is its <character-string>s, each length prefixed.
+grpc::Status ToTxtBytes(const proto::Txt& txt, std::pmr::vector<uint8_t>& bytes) {
+  for (const std::string& string : txt.strings()) {
+    if (string.size() > std::numeric_limits<uint8_t>::max()) {
+      return InvalidArgument(absl::StrCat("TXT string longer than 255 bytes: ", string.size()));
+    }
+    bytes.push_back((uint8_t) string.size());
+    bytes.insert(bytes.end(), string.begin(), string.end());
+  }
+  return grpc::Status::OK;
+}
+
+void FromTxtBytes(std::span<const uint8_t> bytes, proto::Txt& txt) {
+  size_t pos = 0;
+  while (pos < bytes.size()) {
+    const size_t size = std::min<size_t>(bytes[pos], bytes.size() - pos - 1);
+    txt.add_strings(reinterpret_cast<const char*>(bytes.data() + pos + 1), size);
+    pos += 1 + size;
+  }
+}
+
 grpc::Status ProtoRecordToRecord(
     const proto::Record& proto_record, Record& record) {
   record = {};
   record.qname = proto_record.qname();
   if (proto_record.qtype() > std::numeric_limits<uint16_t>::max()) {
-    return grpc::Status(
-        grpc::StatusCode::INVALID_ARGUMENT,
+    return InvalidArgument(
         absl::StrCat("Query type is greater than uint16 max: ", proto_record.qtype()));
   }
   record.qtype = QueryTypeFromShort((uint16_t) proto_record.qtype());
   record.dns_class = 1;
-  record.ttl = (uint16_t) proto_record.ttl();
+  record.ttl = proto_record.ttl();
   switch (proto_record.data_case()) {
     case proto::Record::kA: {
       const std::vector<std::string> addr =
         absl::StrSplit(proto_record.a().addr(), ".");
       if (addr.size() != 4) {
-        return grpc::Status(
-            grpc::StatusCode::INVALID_ARGUMENT,
-            "Data type A requires exactly 4 elements.");
+        return InvalidArgument("Data type A requires exactly 4 elements.");
       }
       Record::A data = {};
       for (size_t i = 0; i < 4; i++) {
         int32_t part = 0;
         if (!absl::SimpleAtoi(addr[i], &part)) {
-          return grpc::Status(
-              grpc::StatusCode::INVALID_ARGUMENT,
+          return InvalidArgument(
               absl::StrCat("Unable to parse IPv4 address from: ", proto_record.a().addr()));
         }
         if (part > std::numeric_limits<uint8_t>::max()) {
-          return grpc::Status(
-              grpc::StatusCode::INVALID_ARGUMENT,
-              absl::StrCat("IPv4 part is greater than uint8 max: ", part));
+          return InvalidArgument(absl::StrCat("IPv4 part is greater than uint8 max: ", part));
         }
         data.ip_address[i] = (uint8_t) part;
       }
       record.data = std::move(data);
     } break;
-    case proto::Record::kUri: {
-      if (proto_record.uri().priority() > std::numeric_limits<uint16_t>::max()) {
-        return grpc::Status(
-            grpc::StatusCode::INVALID_ARGUMENT,
-            absl::StrCat("Priority exceeds uint16 bounds: ", proto_record.uri().priority()));
+    case proto::Record::kAaaa: {
+      std::array<uint8_t, 16> bytes = {};
+      if (inet_pton(AF_INET6, proto_record.aaaa().addr().c_str(), bytes.data()) != 1) {
+        return InvalidArgument(
+            absl::StrCat("Unable to parse IPv6 address from: ", proto_record.aaaa().addr()));
       }
-      if (proto_record.uri().weight() > std::numeric_limits<uint16_t>::max()) {
-        return grpc::Status(
-            grpc::StatusCode::INVALID_ARGUMENT,
-            absl::StrCat("Weight exceeds uint16 bounds: ", proto_record.uri().weight()));
+      Record::AAAA data = {};
+      for (size_t i = 0; i < data.ip_address.size(); i++) {
+        data.ip_address[i] = (uint16_t) (bytes[2 * i] << 8 | bytes[2 * i + 1]);
       }
+      record.data = std::move(data);
+    } break;
+    case proto::Record::kNs: {
+      record.data = Record::NS { .host = std::pmr::string(proto_record.ns().host()) };
+    } break;
+    case proto::Record::kCname: {
+      record.data = Record::CNAME { .host = std::pmr::string(proto_record.cname().host()) };
+    } break;
+    case proto::Record::kPtr: {
+      record.data = Record::PTR { .host = std::pmr::string(proto_record.ptr().host()) };
+    } break;
+    case proto::Record::kMx: {
+      Record::MX data = {};
+      if (grpc::Status status = ToUint16("Priority", proto_record.mx().priority(), data.priority);
+          !status.ok()) { return status; }
+      data.host = proto_record.mx().host();
+      record.data = std::move(data);
+    } break;
+    case proto::Record::kSoa: {
+      const proto::Soa& soa = proto_record.soa();
+      record.data = Record::SOA {
+        .mname = std::pmr::string(soa.mname()),
+        .rname = std::pmr::string(soa.rname()),
+        .serial = soa.serial(),
+        .refresh = soa.refresh(),
+        .retry = soa.retry(),
+        .expire = soa.expire(),
+        .minimum = soa.minimum(),
+      };
+    } break;
+    case proto::Record::kTxt: {
+      Record::TXT data = {};
+      if (grpc::Status status = ToTxtBytes(proto_record.txt(), data.bytes);
+          !status.ok()) { return status; }
+      record.data = std::move(data);
+    } break;
+    case proto::Record::kSrv: {
+      Record::SRV data = {};
+      if (grpc::Status status = ToUint16("Priority", proto_record.srv().priority(), data.priority);
+          !status.ok()) { return status; }
+      if (grpc::Status status = ToUint16("Weight", proto_record.srv().weight(), data.weight);
+          !status.ok()) { return status; }
+      if (grpc::Status status = ToUint16("Port", proto_record.srv().port(), data.port);
+          !status.ok()) { return status; }
+      data.target = proto_record.srv().target();
+      record.data = std::move(data);
+    } break;
+    case proto::Record::kUri: {
       Record::URI data = {};
-      data.priority = (uint16_t) proto_record.uri().priority();
-      data.weight = (uint16_t) proto_record.uri().weight();
+      if (grpc::Status status = ToUint16("Priority", proto_record.uri().priority(), data.priority);
+          !status.ok()) { return status; }
+      if (grpc::Status status = ToUint16("Weight", proto_record.uri().weight(), data.weight);
+          !status.ok()) { return status; }
       data.target = proto_record.uri().target();
       record.data = std::move(data);
     } break;
+    case proto::Record::kUnknown: {
+      const std::string& rdata = proto_record.unknown().rdata();
+      record.data = Record::UNKNOWN { .bytes = std::pmr::vector<uint8_t>(rdata.begin(), rdata.end()) };
+    } break;
     default: {
-      return grpc::Status(
-          grpc::StatusCode::INVALID_ARGUMENT,
-          "Unrecognized record data type provided.");
+      return InvalidArgument("Unrecognized record data type provided.");
     } break;
   }
+  // NOTE: the same check as Record::ToBytes, which would otherwise fail every
+  // response holding the record. Unknown data may carry any type.
+  const RdataCodec& codec = kRdataCodecs[record.data.index()];
+  if (codec.type != QueryType::UNKNOWN && codec.type != record.qtype) {
+    return InvalidArgument(absl::StrCat(
+          "Record of type ", QueryTypeToString(record.qtype), " holds ", codec.name, " data."));
+  }
   return grpc::Status::OK;
 }
 
-// NOTE: returns true if translation is supported, false otherwise.
-bool RecordToProtoRecord(
+void RecordToProtoRecord(
     const Record& record, proto::Record& proto_record) {
   proto_record = {};
   *proto_record.mutable_qname() = record.qname;
+  proto_record.set_qtype(static_cast<proto::QueryType>(QueryTypeToShort(record.qtype)));
   proto_record.set_ttl(record.ttl);
-  switch (record.qtype) {
-    case QueryType::A: {
-      proto_record.set_qtype(proto::QueryType::QUERY_TYPE_A);
-      const Record::A& a = std::get<Record::A>(record.data);
-      const std::string addr = absl::StrCat(
-          a.ip_address[0], ".", a.ip_address[1], ".", a.ip_address[2], ".", a.ip_address[3]);
-      *proto_record.mutable_a()->mutable_addr() = addr;
-    } break;
-    case QueryType::URI: {
-      proto_record.set_qtype(proto::QueryType::QUERY_TYPE_URI);
-      const Record::URI& uri = std::get<Record::URI>(record.data);
-      proto_record.mutable_uri()->set_priority(uri.priority);
-      proto_record.mutable_uri()->set_weight(uri.weight);
-      *proto_record.mutable_uri()->mutable_target() = uri.target;
-    } break;
-    default: { return false; }
-  }
-  return true;
+  std::visit([&](const auto& data) {
+    using Data = std::decay_t<decltype(data)>;
+    if constexpr (std::is_same_v<Data, Record::A>) {
+      *proto_record.mutable_a()->mutable_addr() = absl::StrCat(
+          data.ip_address[0], ".", data.ip_address[1], ".",
+          data.ip_address[2], ".", data.ip_address[3]);
+    } else if constexpr (std::is_same_v<Data, Record::AAAA>) {
+      std::array<uint8_t, 16> bytes = {};
+      for (size_t i = 0; i < data.ip_address.size(); i++) {
+        bytes[2 * i] = data.ip_address[i] >> 8;
+        bytes[2 * i + 1] = data.ip_address[i] & 0xff;
+      }
+      char addr[INET6_ADDRSTRLEN] = {};
+      inet_ntop(AF_INET6, bytes.data(), addr, sizeof(addr));
+      *proto_record.mutable_aaaa()->mutable_addr() = addr;
+    } else if constexpr (std::is_same_v<Data, Record::NS>) {
+      *proto_record.mutable_ns()->mutable_host() = data.host;
+    } else if constexpr (std::is_same_v<Data, Record::CNAME>) {
+      *proto_record.mutable_cname()->mutable_host() = data.host;
+    } else if constexpr (std::is_same_v<Data, Record::PTR>) {
+      *proto_record.mutable_ptr()->mutable_host() = data.host;
+    } else if constexpr (std::is_same_v<Data, Record::MX>) {
+      proto_record.mutable_mx()->set_priority(data.priority);
+      *proto_record.mutable_mx()->mutable_host() = data.host;
+    } else if constexpr (std::is_same_v<Data, Record::SOA>) {
+      proto::Soa& soa = *proto_record.mutable_soa();
+      *soa.mutable_mname() = data.mname;
+      *soa.mutable_rname() = data.rname;
+      soa.set_serial(data.serial);
+      soa.set_refresh(data.refresh);
+      soa.set_retry(data.retry);
+      soa.set_expire(data.expire);
+      soa.set_minimum(data.minimum);
+    } else if constexpr (std::is_same_v<Data, Record::TXT>) {
+      FromTxtBytes(data.bytes, *proto_record.mutable_txt());
+    } else if constexpr (std::is_same_v<Data, Record::SRV>) {
+      proto::Srv& srv = *proto_record.mutable_srv();
+      srv.set_priority(data.priority);
+      srv.set_weight(data.weight);
+      srv.set_port(data.port);
+      *srv.mutable_target() = data.target;
+    } else if constexpr (std::is_same_v<Data, Record::URI>) {
+      proto_record.mutable_uri()->set_priority(data.priority);
+      proto_record.mutable_uri()->set_weight(data.weight);
+      *proto_record.mutable_uri()->mutable_target() = data.target;
+    } else {
+      proto_record.mutable_unknown()->mutable_rdata()->assign(
+          data.bytes.begin(), data.bytes.end());
+    }
+  }, record.data);
 }
 
 grpc::Status ProtoQuestionToQuestion(
@@ -119,6 +302,39 @@ grpc::Status ProtoQuestionToQuestion(
   return grpc::Status::OK;
 }
 
+void ToLatencyStats(const ShardedHistogram& stage_ns, proto::LatencyStats& stats) {
+  const Histogram histogram = stage_ns.Snapshot();
+  stats.set_count(histogram.Count());
+  stats.set_sum_ns(stage_ns.Sum());
+  stats.set_p50_ns(histogram.Percentile(50));
+  stats.set_p90_ns(histogram.Percentile(90));
+  stats.set_p99_ns(histogram.Percentile(99));
+  stats.set_p999_ns(histogram.Percentile(99.9));
+  stats.set_max_ns(histogram.Max());
+}
+
+// NOTE: entries that can't be decoded still go out, without a question.
+void ToProtoQueryLogEntry(const QueryLogEntry& entry, proto::QueryLogEntry& proto_entry) {
+  const TraceEntry& query = entry.query;
+  proto_entry.set_timestamp_ns(query.timestamp_ns);
+  *proto_entry.mutable_client_addr() = absl::StrCat(
+      query.client_addr[0], ".", query.client_addr[1], ".",
+      query.client_addr[2], ".", query.client_addr[3]);
+  proto_entry.set_client_port(query.client_port);
+  const absl::StatusOr<Question> question = ParseRawQuestion(query.Question());
+  if (question.ok()) {
+    *proto_entry.mutable_question()->mutable_qname() = question->qname;
+    proto_entry.mutable_question()->set_qtype(
+        static_cast<proto::QueryType>(QueryTypeToShort(question->qtype)));
+  }
+  proto_entry.set_recursion_desired(query.recursion_desired);
+  proto_entry.set_response_code(ResponseCodeToByte(query.response_code));
+  proto_entry.set_cache_hit(entry.cache_hit);
+  proto_entry.set_forwarded(entry.forwarded);
+  proto_entry.set_upstream_rtt_ns(entry.upstream_rtt_ns);
+  proto_entry.set_service_time_ns(query.service_time_ns);
+}
+
 } // namespace
 
 grpc::Status DnsAdminServiceImpl::InsertOrUpdate(
@@ -136,6 +352,75 @@ grpc::Status DnsAdminServiceImpl::InsertOrUpdate(
   return grpc::Status::OK;
 }
 
+void DnsAdminServiceImpl::ApplyBatch(
+    std::span<const proto::Record* const> proto_records,
+    proto::InsertOrUpdateBatchResponse& response) {
+  const int first = response.statuses_size();
+  std::vector<Record> records;
+  std::vector<int> status_indices;
+  records.reserve(proto_records.size());
+  status_indices.reserve(proto_records.size());
+  for (const proto::Record* proto_record : proto_records) {
+    proto::RecordStatus& record_status = *response.add_statuses();
+    Record record = {};
+    const grpc::Status status = ProtoRecordToRecord(*proto_record, record);
+    record_status.set_code(status.error_code());
+    if (!status.ok()) {
+      *record_status.mutable_message() = status.error_message();
+      continue;
+    }
+    records.push_back(std::move(record));
+    status_indices.push_back(response.statuses_size() - 1);
+  }
+  const std::vector<bool> updated = record_store_->InsertOrUpdateBatch(std::move(records));
+  for (size_t i = 0; i < updated.size(); i++) {
+    response.mutable_statuses(status_indices[i])->set_updated(updated[i]);
+  }
+  VLOG(1) << "Applied " << updated.size() << " of "
+    << response.statuses_size() - first << " records in batch.";
+}
+
+grpc::Status DnsAdminServiceImpl::InsertOrUpdateBatch(
+    grpc::ServerContext* context,
+    const proto::InsertOrUpdateBatchRequest* request,
+    proto::InsertOrUpdateBatchResponse* response) {
+  if (request->records_size() > kMaxInsertBatchSize) {
+    return InvalidArgument(absl::StrCat(
+          "Batch of ", request->records_size(), " records exceeds the maximum of ",
+          kMaxInsertBatchSize));
+  }
+  std::vector<const proto::Record*> proto_records;
+  proto_records.reserve(request->records_size());
+  for (const proto::Record& proto_record : request->records()) {
+    proto_records.push_back(&proto_record);
+  }
+  ApplyBatch(proto_records, *response);
+  return grpc::Status::OK;
+}
+
+grpc::Status DnsAdminServiceImpl::InsertOrUpdateStream(
+    grpc::ServerContext* context,
+    grpc::ServerReader<proto::InsertOrUpdateRequest>* reader,
+    proto::InsertOrUpdateBatchResponse* response) {
+  std::vector<proto::InsertOrUpdateRequest> requests(kStreamBatchSize);
+  std::vector<const proto::Record*> proto_records;
+  proto_records.reserve(kStreamBatchSize);
+  bool reading = true;
+  while (reading) {
+    proto_records.clear();
+    while (proto_records.size() < kStreamBatchSize) {
+      proto::InsertOrUpdateRequest& request = requests[proto_records.size()];
+      if (!reader->Read(&request)) {
+        reading = false;
+        break;
+      }
+      proto_records.push_back(&request.record());
+    }
+    ApplyBatch(proto_records, *response);
+  }
+  return grpc::Status::OK;
+}
+
 grpc::Status DnsAdminServiceImpl::Lookup(
     grpc::ServerContext* context,
     const proto::LookupRequest* request,
@@ -153,34 +438,163 @@ grpc::Status DnsAdminServiceImpl::Lookup(
     }
     dns_request.questions.push_back(std::move(question));
   }
-  const absl::StatusOr<std::array<uint8_t, 512>> dns_request_raw = dns_request.ToBytes();
-  if (!dns_request_raw.ok()) {
+  StageTimer timer(/*enabled=*/false);
+  const DnsPacket dns_response =
+    resolver_->Resolve(dns_request, std::pmr::get_default_resource(), timer);
+  if (dns_response.header.response_code != ResponseCode::NO_ERROR) {
     return grpc::Status(
         grpc::StatusCode::INTERNAL,
-        absl::StrCat("Error generating request packet to forward to DNS server: ", dns_request_raw.status()));
+        absl::StrCat("Error returned from DNS server: ", ResponseCodeToString(dns_response.header.response_code)));
   }
-  std::array<uint8_t, 512> dns_response_raw = {};
-  const absl::Status forward_status = dns_server_->Call(*dns_request_raw, dns_response_raw);
-  if (!forward_status.ok()) {
-    return grpc::Status(
-        grpc::StatusCode::UNAVAILABLE,
-        absl::StrCat("Error forwarding the packet to the DNS server: ", forward_status));
+  for (const Record& answer : dns_response.answers) {
+    RecordToProtoRecord(answer, *response->add_answers());
   }
-  const absl::StatusOr<DnsPacket> dns_response = DnsPacket::FromBytes(dns_response_raw);
-  if (!dns_response.ok()) {
-    return grpc::Status(
-        grpc::StatusCode::INTERNAL,
-        absl::StrCat("Error translating packet from the DNS server: ", dns_response.status()));
+  return grpc::Status::OK;
+}
+
+grpc::Status DnsAdminServiceImpl::LookupBatch(
+    grpc::ServerContext* context,
+    const proto::LookupBatchRequest* request,
+    proto::LookupBatchResponse* response) {
+  if (request->questions_size() > kMaxLookupBatchSize) {
+    return InvalidArgument(absl::StrCat(
+          "Batch of ", request->questions_size(), " questions exceeds the maximum of ",
+          kMaxLookupBatchSize));
+  }
+  std::vector<Question> questions;
+  std::vector<int> result_indices;
+  questions.reserve(request->questions_size());
+  result_indices.reserve(request->questions_size());
+  for (const proto::Question& proto_question : request->questions()) {
+    proto::LookupResult& result = *response->add_results();
+    Question question = {};
+    const grpc::Status status = ProtoQuestionToQuestion(proto_question, question);
+    result.set_code(status.error_code());
+    if (!status.ok()) {
+      *result.mutable_message() = status.error_message();
+      continue;
+    }
+    questions.push_back(std::move(question));
+    result_indices.push_back(response->results_size() - 1);
+  }
+
+  const std::vector<absl::StatusOr<DnsPacket>> dns_responses =
+    resolver_->ResolveBatch(questions, request->recursion_desired());
+  for (size_t i = 0; i < dns_responses.size(); i++) {
+    proto::LookupResult& result = *response->mutable_results(result_indices[i]);
+    const absl::StatusOr<DnsPacket>& dns_response = dns_responses[i];
+    // NOTE: absl and gRPC status codes share their values.
+    if (!dns_response.ok()) {
+      result.set_code(static_cast<int32_t>(dns_response.status().code()));
+      *result.mutable_message() = dns_response.status().message();
+      continue;
+    }
+    const ResponseCode response_code = dns_response->header.response_code;
+    if (response_code != ResponseCode::NO_ERROR) {
+      result.set_code(response_code == ResponseCode::NX_DOMAIN
+          ? grpc::StatusCode::NOT_FOUND : grpc::StatusCode::INTERNAL);
+      *result.mutable_message() =
+        absl::StrCat("Error returned from DNS server: ", ResponseCodeToString(response_code));
+      continue;
+    }
+    for (const Record& answer : dns_response->answers) {
+      RecordToProtoRecord(answer, *result.add_answers());
+    }
+  }
+  VLOG(1) << "Resolved a batch of " << questions.size() << " questions.";
+  return grpc::Status::OK;
+}
+
+grpc::Status DnsAdminServiceImpl::LoadZoneFile(
+    grpc::ServerContext* context,
+    const proto::LoadZoneFileRequest* request,
+    proto::LoadZoneFileResponse* response) {
+  std::string path;
+  if (grpc::Status status = ResolveZonePath(zone_directory_, request->path(), path);
+      !status.ok()) {
+    return status;
   }
-  if (dns_response->header.response_code != ResponseCode::NO_ERROR) {
+  ZoneFileOptions options;
+  options.origin = request->origin();
+  const absl::StatusOr<ZoneLoadStats> stats =
+    tiny_dns::LoadZoneFile(path, *record_store_, options);
+  if (!stats.ok()) {
+    LOG(ERROR) << "Error loading zone file: " << stats.status();
     return grpc::Status(
-        grpc::StatusCode::INTERNAL,
-        absl::StrCat("Error returned from DNS server: ", ResponseCodeToString(dns_response->header.response_code)));
+        static_cast<grpc::StatusCode>(stats.status().code()),
+        std::string(stats.status().message()));
   }
-  for (const Record& answer : dns_response->answers) {
-    proto::Record proto_answer;
-    if (RecordToProtoRecord(answer, proto_answer)) { *response->mutable_answers()->Add() = proto_answer; }
-    else { LOG(WARNING) << "Translation for record is not supported: " << answer.DebugString(); }
+  response->set_records(stats->records);
+  response->set_bytes(stats->bytes);
+  response->set_parse_ns(stats->parse_ns);
+  response->set_insert_ns(stats->insert_ns);
+  response->set_seconds_per_million_records(stats->SecondsPerMillionRecords());
+  return grpc::Status::OK;
+}
+
+grpc::Status DnsAdminServiceImpl::GetStats(
+    grpc::ServerContext* context,
+    const proto::GetStatsRequest* request,
+    proto::GetStatsResponse* response) {
+  const ServerMetrics& metrics = *metrics_;
+  response->set_queries(metrics.queries.Value());
+  response->set_cache_hits(metrics.cache_hits.Value());
+  response->set_cache_misses(metrics.cache_misses.Value());
+  response->set_forwards(metrics.forwards.Value());
+  response->set_forward_errors(metrics.forward_errors.Value());
+  response->set_cname_chases(metrics.cname_chases.Value());
+  response->set_rate_limit_drops(metrics.rate_limit_drops.Value());
+  response->set_rate_limit_slips(metrics.rate_limit_slips.Value());
+  response->set_shed_forwards(metrics.shed_forwards.Value());
+  response->set_shed_deadlines(metrics.shed_deadlines.Value());
+  response->set_shed_overload(metrics.shed_overload.Value());
+  response->set_hot_name_hits(metrics.hot_name_hits.Value());
+  response->set_hot_name_misses(metrics.hot_name_misses.Value());
+  response->set_hot_name_invalidations(metrics.hot_name_invalidations.Value());
+  response->set_serv_fail(metrics.serv_fail.Value());
+  response->set_form_error(metrics.form_error.Value());
+  response->set_send_errors(metrics.send_errors.Value());
+  const RecordStoreStats store_stats = record_store_->GetStats();
+  response->set_record_store_size(store_stats.size);
+  response->set_expired_records(store_stats.expired);
+  response->set_pending_expirations(store_stats.pending_expirations);
+
+  auto& stage_latencies = *response->mutable_stage_latencies();
+  ToLatencyStats(metrics.receive_ns, stage_latencies["receive"]);
+  ToLatencyStats(metrics.parse_ns, stage_latencies["parse"]);
+  ToLatencyStats(metrics.lookup_ns, stage_latencies["lookup"]);
+  ToLatencyStats(metrics.forward_ns, stage_latencies["forward"]);
+  ToLatencyStats(metrics.encode_ns, stage_latencies["encode"]);
+  ToLatencyStats(metrics.send_ns, stage_latencies["send"]);
+  ToLatencyStats(metrics.total_ns, stage_latencies["total"]);
+  *response->mutable_prometheus_text() = PrometheusText(metrics, store_stats);
+  return grpc::Status::OK;
+}
+
+grpc::Status DnsAdminServiceImpl::StreamQueryLog(
+    grpc::ServerContext* context,
+    const proto::StreamQueryLogRequest* request,
+    grpc::ServerWriter<proto::QueryLogFrame>* writer) {
+  if (query_log_ == nullptr) {
+    return grpc::Status(grpc::StatusCode::UNAVAILABLE, "Query log is not enabled.");
+  }
+  const size_t buffer_entries = request->buffer_entries() > 0
+    ? std::min<size_t>(request->buffer_entries(), kMaxStreamBufferEntries)
+    : kDefaultStreamBufferEntries;
+  const std::shared_ptr<QueryLogSubscription> subscription =
+    query_log_->Subscribe(buffer_entries);
+  absl::Cleanup unsubscribe = [&] { query_log_->Unsubscribe(subscription); };
+  while (!context->IsCancelled()) {
+    const std::vector<QueryLogEntry> entries =
+      subscription->Next(kMaxFrameEntries, kFrameInterval);
+    if (entries.empty()) { continue; }
+    proto::QueryLogFrame frame;
+    for (const QueryLogEntry& entry : entries) {
+      ToProtoQueryLogEntry(entry, *frame.add_entries());
+    }
+    frame.set_dropped(subscription->dropped());
+    // NOTE: fails once the client has gone away.
+    if (!writer->Write(frame)) { break; }
   }
   return grpc::Status::OK;
 }
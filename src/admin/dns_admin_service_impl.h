@@ -2,12 +2,16 @@
 #define SRC_ADMIN_DNS_ADMIN_SERVICE_IMPL_H_
 
 #include <memory>
+#include <span>
+#include <string>
 #include <utility>
 
 #include "grpcpp/grpcpp.h"
 #include "src/admin/dns_admin_service.grpc.pb.h"
 #include "src/dns/record_store.h"
-#include "src/dns/client.h"
+#include "src/dns/query_log.h"
+#include "src/dns/resolver.h"
+#include "src/dns/server_metrics.h"
 
 namespace tiny_dns {
 
@@ -15,10 +19,17 @@ namespace tiny_dns {
 // registering DNS records manually from some other service.
 class DnsAdminServiceImpl final : public proto::DnsAdminService::Service {
  public:
+  // NOTE: LoadZoneFile only loads files under zone_directory, and is refused
+  // altogether without one.
   DnsAdminServiceImpl(
       std::shared_ptr<RecordStore> record_store,
-      std::shared_ptr<Client> dns_server) :
-    record_store_(std::move(record_store)), dns_server_(std::move(dns_server)) {}
+      std::shared_ptr<Resolver> resolver,
+      std::shared_ptr<const ServerMetrics> metrics,
+      std::shared_ptr<QueryLog> query_log,
+      std::string zone_directory = "") :
+    record_store_(std::move(record_store)), resolver_(std::move(resolver)),
+    metrics_(std::move(metrics)), query_log_(std::move(query_log)),
+    zone_directory_(std::move(zone_directory)) {}
 
  private:
   grpc::Status InsertOrUpdate(
@@ -26,13 +37,51 @@ class DnsAdminServiceImpl final : public proto::DnsAdminService::Service {
       const proto::InsertOrUpdateRequest* request,
       proto::InsertOrUpdateResponse* response) override;
 
+  grpc::Status InsertOrUpdateBatch(
+      grpc::ServerContext* context,
+      const proto::InsertOrUpdateBatchRequest* request,
+      proto::InsertOrUpdateBatchResponse* response) override;
+
+  grpc::Status InsertOrUpdateStream(
+      grpc::ServerContext* context,
+      grpc::ServerReader<proto::InsertOrUpdateRequest>* reader,
+      proto::InsertOrUpdateBatchResponse* response) override;
+
   grpc::Status Lookup(
       grpc::ServerContext* context,
       const proto::LookupRequest* request,
       proto::LookupResponse* response) override;
 
+  grpc::Status LookupBatch(
+      grpc::ServerContext* context,
+      const proto::LookupBatchRequest* request,
+      proto::LookupBatchResponse* response) override;
+
+  grpc::Status LoadZoneFile(
+      grpc::ServerContext* context,
+      const proto::LoadZoneFileRequest* request,
+      proto::LoadZoneFileResponse* response) override;
+
+  grpc::Status GetStats(
+      grpc::ServerContext* context,
+      const proto::GetStatsRequest* request,
+      proto::GetStatsResponse* response) override;
+
+  grpc::Status StreamQueryLog(
+      grpc::ServerContext* context,
+      const proto::StreamQueryLogRequest* request,
+      grpc::ServerWriter<proto::QueryLogFrame>* writer) override;
+
+  // NOTE: translates and applies a batch, appending a status per record.
+  void ApplyBatch(
+      std::span<const proto::Record* const> proto_records,
+      proto::InsertOrUpdateBatchResponse& response);
+
   std::shared_ptr<RecordStore> record_store_;
-  std::shared_ptr<Client> dns_server_;
+  std::shared_ptr<Resolver> resolver_;
+  std::shared_ptr<const ServerMetrics> metrics_;
+  std::shared_ptr<QueryLog> query_log_;
+  const std::string zone_directory_;
 };
 
 } // tiny_dns
@@ -0,0 +1,200 @@
+#include "src/admin/dns_admin_service_impl.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "grpcpp/grpcpp.h"
+#include "src/admin/dns_admin_service.grpc.pb.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/record_store.h"
+#include "src/dns/resolver.h"
+#include "src/dns/server_metrics.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::SizeIs;
+
+proto::Record CreateProtoRecord(std::string_view qname, std::string_view addr) {
+  proto::Record record;
+  record.set_qname(std::string(qname));
+  record.set_qtype(proto::QUERY_TYPE_A);
+  record.set_ttl(300);
+  record.mutable_a()->set_addr(std::string(addr));
+  return record;
+}
+
+Question CreateQuestion(std::string_view qname) {
+  Question question = {};
+  question.qname = qname;
+  question.qtype = QueryType::A;
+  return question;
+}
+
+class DnsAdminServiceImplTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    record_store_ = std::make_shared<RecordStore>();
+    metrics_ = std::make_shared<ServerMetrics>();
+    service_ = std::make_unique<DnsAdminServiceImpl>(
+        record_store_, std::make_shared<Resolver>(record_store_, nullptr, metrics_),
+        metrics_, nullptr, testing::TempDir());
+    grpc::ServerBuilder builder;
+    builder.RegisterService(service_.get());
+    server_ = builder.BuildAndStart();
+    stub_ = proto::DnsAdminService::NewStub(
+        server_->InProcessChannel(grpc::ChannelArguments()));
+  }
+
+  void TearDown() override { server_->Shutdown(); }
+
+  std::shared_ptr<RecordStore> record_store_;
+  std::shared_ptr<ServerMetrics> metrics_;
+  std::unique_ptr<DnsAdminServiceImpl> service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<proto::DnsAdminService::Stub> stub_;
+};
+
+TEST_F(DnsAdminServiceImplTest, InsertOrUpdateBatchReportsEachRecord) {
+  proto::InsertOrUpdateBatchRequest request;
+  *request.add_records() = CreateProtoRecord("a.example", "10.0.0.1");
+  *request.add_records() = CreateProtoRecord("b.example", "10.0.0");
+  *request.add_records() = CreateProtoRecord("c.example", "10.0.0.3");
+  *request.add_records() = CreateProtoRecord("a.example", "10.0.0.1");
+
+  grpc::ClientContext context;
+  proto::InsertOrUpdateBatchResponse response;
+  ASSERT_TRUE(stub_->InsertOrUpdateBatch(&context, request, &response).ok());
+  ASSERT_THAT(response.statuses(), SizeIs(4));
+  EXPECT_THAT(response.statuses(0).code(), Eq(grpc::StatusCode::OK));
+  EXPECT_FALSE(response.statuses(0).updated());
+  EXPECT_THAT(response.statuses(1).code(), Eq(grpc::StatusCode::INVALID_ARGUMENT));
+  EXPECT_FALSE(response.statuses(1).message().empty());
+  EXPECT_THAT(response.statuses(2).code(), Eq(grpc::StatusCode::OK));
+  // NOTE: the same record again, later in the batch.
+  EXPECT_THAT(response.statuses(3).code(), Eq(grpc::StatusCode::OK));
+  EXPECT_TRUE(response.statuses(3).updated());
+
+  EXPECT_THAT(record_store_->Query(CreateQuestion("a.example")), SizeIs(1));
+  EXPECT_THAT(record_store_->Query(CreateQuestion("b.example")), SizeIs(0));
+  EXPECT_THAT(record_store_->Query(CreateQuestion("c.example")), SizeIs(1));
+}
+
+TEST_F(DnsAdminServiceImplTest, InsertOrUpdateBatchRejectsOversizedBatches) {
+  proto::InsertOrUpdateBatchRequest request;
+  for (int i = 0; i < 4097; i++) {
+    *request.add_records() = CreateProtoRecord(
+        "host-" + std::to_string(i) + ".example", "10.0.0.1");
+  }
+  grpc::ClientContext context;
+  proto::InsertOrUpdateBatchResponse response;
+  EXPECT_THAT(stub_->InsertOrUpdateBatch(&context, request, &response).error_code(),
+      Eq(grpc::StatusCode::INVALID_ARGUMENT));
+  EXPECT_THAT(record_store_->GetStats().size, Eq(0));
+
+  // NOTE: the maximum itself is allowed.
+  request.mutable_records()->RemoveLast();
+  grpc::ClientContext max_context;
+  ASSERT_TRUE(stub_->InsertOrUpdateBatch(&max_context, request, &response).ok());
+  EXPECT_THAT(response.statuses(), SizeIs(4096));
+  EXPECT_THAT(record_store_->GetStats().size, Eq(4096));
+}
+
+TEST_F(DnsAdminServiceImplTest, RejectsDataOfAnotherType) {
+  proto::InsertOrUpdateRequest request;
+  *request.mutable_record() = CreateProtoRecord("a.example", "10.0.0.1");
+  request.mutable_record()->set_qtype(proto::QUERY_TYPE_CNAME);
+  grpc::ClientContext context;
+  proto::InsertOrUpdateResponse response;
+  EXPECT_THAT(stub_->InsertOrUpdate(&context, request, &response).error_code(),
+      Eq(grpc::StatusCode::INVALID_ARGUMENT));
+
+  proto::InsertOrUpdateBatchRequest batch_request;
+  *batch_request.add_records() = request.record();
+  *batch_request.add_records() = CreateProtoRecord("b.example", "10.0.0.2");
+  proto::Record& unknown = *batch_request.add_records();
+  unknown.set_qname("c.example");
+  unknown.set_qtype(proto::QUERY_TYPE_A);
+  unknown.mutable_unknown()->set_rdata(std::string("\x0a\x00\x00\x03", 4));
+  grpc::ClientContext batch_context;
+  proto::InsertOrUpdateBatchResponse batch_response;
+  ASSERT_TRUE(stub_->InsertOrUpdateBatch(&batch_context, batch_request, &batch_response).ok());
+  ASSERT_THAT(batch_response.statuses(), SizeIs(3));
+  EXPECT_THAT(batch_response.statuses(0).code(), Eq(grpc::StatusCode::INVALID_ARGUMENT));
+  EXPECT_FALSE(batch_response.statuses(0).message().empty());
+  EXPECT_THAT(batch_response.statuses(1).code(), Eq(grpc::StatusCode::OK));
+  // NOTE: unknown data is raw bytes, which may be of any type.
+  EXPECT_THAT(batch_response.statuses(2).code(), Eq(grpc::StatusCode::OK));
+
+  EXPECT_THAT(record_store_->Query(CreateQuestion("a.example")), SizeIs(0));
+  EXPECT_THAT(record_store_->Query(CreateQuestion("b.example")), SizeIs(1));
+}
+
+TEST_F(DnsAdminServiceImplTest, InsertOrUpdateStreamAppliesEveryRecord) {
+  // NOTE: more than the service applies at once, and not a multiple of it.
+  constexpr int kRecords = 2500;
+  grpc::ClientContext context;
+  proto::InsertOrUpdateBatchResponse response;
+  std::unique_ptr<grpc::ClientWriter<proto::InsertOrUpdateRequest>> writer =
+    stub_->InsertOrUpdateStream(&context, &response);
+  for (int i = 0; i < kRecords; i++) {
+    proto::InsertOrUpdateRequest request;
+    // NOTE: every 100th record is invalid.
+    *request.mutable_record() = CreateProtoRecord(
+        "host-" + std::to_string(i) + ".example", i % 100 == 0 ? "10.0.0.256" : "10.0.0.1");
+    ASSERT_TRUE(writer->Write(request));
+  }
+  ASSERT_TRUE(writer->WritesDone());
+  ASSERT_TRUE(writer->Finish().ok());
+
+  ASSERT_THAT(response.statuses(), SizeIs(kRecords));
+  for (int i = 0; i < kRecords; i++) {
+    EXPECT_THAT(response.statuses(i).code(), Eq(
+          i % 100 == 0 ? grpc::StatusCode::INVALID_ARGUMENT : grpc::StatusCode::OK)) << i;
+  }
+  EXPECT_THAT(record_store_->GetStats().size, Eq(kRecords - kRecords / 100));
+  EXPECT_THAT(record_store_->Query(CreateQuestion("host-2499.example")), SizeIs(1));
+  EXPECT_THAT(record_store_->Query(CreateQuestion("host-2400.example")), SizeIs(0));
+}
+
+TEST_F(DnsAdminServiceImplTest, EmptyStreamAppliesNothing) {
+  grpc::ClientContext context;
+  proto::InsertOrUpdateBatchResponse response;
+  std::unique_ptr<grpc::ClientWriter<proto::InsertOrUpdateRequest>> writer =
+    stub_->InsertOrUpdateStream(&context, &response);
+  ASSERT_TRUE(writer->WritesDone());
+  ASSERT_TRUE(writer->Finish().ok());
+  EXPECT_THAT(response.statuses(), SizeIs(0));
+  EXPECT_THAT(record_store_->GetStats().size, Eq(0));
+}
+
+TEST_F(DnsAdminServiceImplTest, LoadZoneFileStaysInsideZoneDirectory) {
+  FILE* file = fopen((testing::TempDir() + "/admin_test.zone").c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fputs("$TTL 60\nzone.example. A 10.0.0.1\n", file);
+  fclose(file);
+
+  proto::LoadZoneFileRequest request;
+  request.set_path("admin_test.zone");
+  grpc::ClientContext context;
+  proto::LoadZoneFileResponse response;
+  const grpc::Status status = stub_->LoadZoneFile(&context, request, &response);
+  ASSERT_TRUE(status.ok()) << status.error_message();
+  EXPECT_THAT(response.records(), Eq(1));
+  EXPECT_THAT(record_store_->Query(CreateQuestion("zone.example")), SizeIs(1));
+
+  for (const std::string path : {"/etc/passwd", "../admin_test.zone", ""}) {
+    grpc::ClientContext outside_context;
+    request.set_path(path);
+    EXPECT_THAT(stub_->LoadZoneFile(&outside_context, request, &response).error_code(),
+        Eq(grpc::StatusCode::PERMISSION_DENIED)) << path;
+  }
+}
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,102 @@
+#include "src/common/async_log_sink.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log_entry.h"
+#include "src/common/mpmc_queue.h"
+
+namespace tiny_dns {
+namespace {
+
+constexpr auto kIdleInterval = std::chrono::milliseconds(5);
+constexpr size_t kBatchSize = 16 * 1024;
+
+} // namespace
+
+AsyncLogSink::AsyncLogSink(int fd, size_t capacity)
+  : fd_(fd), ring_(capacity), appended_(0), written_(0), dropped_(0), stopping_(false) {
+  write_thread_ = std::thread(&AsyncLogSink::WriteLines, this);
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  stopping_ = true;
+  write_thread_.join();
+}
+
+void AsyncLogSink::Send(const absl::LogEntry& entry) {
+  Append(entry.text_message_with_prefix_and_newline(),
+      entry.log_severity() == absl::LogSeverity::kFatal);
+}
+
+void AsyncLogSink::Flush() {
+  const uint64_t appended = appended_.load();
+  while (written_.load() < appended) { std::this_thread::sleep_for(kIdleInterval / 5); }
+}
+
+void AsyncLogSink::Append(std::string_view line, bool synchronous) {
+  if (synchronous) {
+    Flush();
+    WriteFully(line.data(), line.size());
+    return;
+  }
+  Line entry;
+  entry.size = std::min(line.size(), kMaxLineSize);
+  memcpy(entry.text.data(), line.data(), entry.size);
+  if (entry.size == kMaxLineSize) { entry.text[kMaxLineSize - 1] = '\n'; }
+  if (!ring_.TryPush(entry)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  appended_.fetch_add(1);
+}
+
+void AsyncLogSink::WriteLines() {
+  Line line;
+  std::array<char, kBatchSize> batch;
+  while (true) {
+    // NOTE: read stopping_ first, so lines appended before it was set are
+    // still written out by the drain below.
+    const bool stopping = stopping_.load();
+    size_t batch_size = 0;
+    uint64_t batch_lines = 0;
+    while (ring_.TryPop(line)) {
+      if (batch_size + line.size > batch.size()) {
+        WriteFully(batch.data(), batch_size);
+        written_.fetch_add(batch_lines);
+        batch_size = 0;
+        batch_lines = 0;
+      }
+      memcpy(batch.data() + batch_size, line.text.data(), line.size);
+      batch_size += line.size;
+      batch_lines++;
+    }
+    if (batch_lines > 0) {
+      WriteFully(batch.data(), batch_size);
+      written_.fetch_add(batch_lines);
+      continue;
+    }
+    if (stopping) { return; }
+    std::this_thread::sleep_for(kIdleInterval);
+  }
+}
+
+// NOTE: errors are ignored, there is nowhere left to report them.
+void AsyncLogSink::WriteFully(const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd_, data, size);
+    if (written < 0 && errno == EINTR) { continue; }
+    if (written <= 0) { return; }
+    data += written;
+    size -= written;
+  }
+}
+
+} // tiny_dns
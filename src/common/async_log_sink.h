@@ -0,0 +1,70 @@
+#ifndef SRC_COMMON_ASYNC_LOG_SINK_H_
+#define SRC_COMMON_ASYNC_LOG_SINK_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+#include "absl/log/log_entry.h"
+#include "absl/log/log_sink.h"
+#include "src/common/mpmc_queue.h"
+
+// A log sink that moves formatting-free writes off the logging thread.
+// Send() copies the formatted line into a bounded lock-free ring and returns;
+// a background thread drains the ring and write()s the lines out in batches.
+// When the ring is full lines are dropped (and counted) rather than blocking
+// the caller. FATAL lines are written synchronously, after what's queued.
+//
+// Register with absl::AddLogSink() and raise the stderr threshold, so absl's
+// own synchronous stderr sink stops writing the same lines.
+
+namespace tiny_dns {
+
+class AsyncLogSink final : public absl::LogSink {
+ public:
+  static constexpr size_t kDefaultCapacity = 4096;
+  // NOTE: longer lines are truncated.
+  static constexpr size_t kMaxLineSize = 512;
+
+  explicit AsyncLogSink(int fd = STDERR_FILENO, size_t capacity = kDefaultCapacity);
+  // NOTE: writes out anything still in the ring.
+  ~AsyncLogSink() override;
+
+  AsyncLogSink(const AsyncLogSink&) = delete;
+  AsyncLogSink& operator=(const AsyncLogSink&) = delete;
+
+  void Send(const absl::LogEntry& entry) override;
+  // NOTE: blocks until every line appended before the call has been written.
+  void Flush() override;
+
+  // NOTE: line should end with a newline, as absl's formatted lines do.
+  void Append(std::string_view line, bool synchronous = false);
+
+  uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Line {
+    uint16_t size = 0;
+    std::array<char, kMaxLineSize> text;
+  };
+
+  void WriteLines();
+  void WriteFully(const char* data, size_t size);
+
+  const int fd_;
+  MpmcQueue<Line> ring_;
+  std::atomic<uint64_t> appended_;
+  std::atomic<uint64_t> written_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<bool> stopping_;
+  std::thread write_thread_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_ASYNC_LOG_SINK_H_
@@ -0,0 +1,92 @@
+#include "src/common/async_log_sink.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "absl/log/log.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::EndsWith;
+using ::testing::Eq;
+using ::testing::Gt;
+using ::testing::HasSubstr;
+using ::testing::SizeIs;
+
+std::string ReadAll(FILE* file) {
+  std::string contents;
+  rewind(file);
+  char buffer[4096];
+  size_t read = 0;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) { contents.append(buffer, read); }
+  return contents;
+}
+
+TEST(AsyncLogSinkTest, FlushWritesAppendedLinesInOrder) {
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  AsyncLogSink sink(fileno(file));
+  for (int i = 0; i < 100; i++) { sink.Append("line " + std::to_string(i) + "\n"); }
+  sink.Flush();
+
+  std::string expected;
+  for (int i = 0; i < 100; i++) { expected += "line " + std::to_string(i) + "\n"; }
+  EXPECT_THAT(ReadAll(file), Eq(expected));
+  EXPECT_THAT(sink.written(), Eq(100));
+  EXPECT_THAT(sink.dropped(), Eq(0));
+  fclose(file);
+}
+
+TEST(AsyncLogSinkTest, TruncatesLongLines) {
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  AsyncLogSink sink(fileno(file));
+  sink.Append(std::string(2 * AsyncLogSink::kMaxLineSize, 'x') + "\n");
+  sink.Flush();
+
+  const std::string contents = ReadAll(file);
+  EXPECT_THAT(contents, SizeIs(AsyncLogSink::kMaxLineSize));
+  EXPECT_THAT(contents, EndsWith("x\n"));
+  fclose(file);
+}
+
+TEST(AsyncLogSinkTest, DropsInsteadOfBlockingWhenBehind) {
+  int pipe_fds[2];
+  ASSERT_EQ(pipe(pipe_fds), 0);
+  {
+    AsyncLogSink sink(pipe_fds[1], /*capacity=*/16);
+    // NOTE: nothing reads the pipe yet, so the writer stalls once the pipe
+    // buffer is full and the ring fills up behind it.
+    const std::string line(AsyncLogSink::kMaxLineSize - 1, 'x');
+    for (int i = 0; i < 1024; i++) { sink.Append(line + "\n"); }
+    EXPECT_THAT(sink.dropped(), Gt(0));
+
+    std::thread reader([&] {
+      char buffer[4096];
+      while (read(pipe_fds[0], buffer, sizeof(buffer)) > 0) {}
+    });
+    sink.Flush();
+    EXPECT_THAT(sink.written() + sink.dropped(), Eq(1024));
+    close(pipe_fds[1]);
+    reader.join();
+  }
+  close(pipe_fds[0]);
+}
+
+TEST(AsyncLogSinkTest, ReceivesLogEntries) {
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  AsyncLogSink sink(fileno(file));
+  LOG(INFO).ToSinkOnly(&sink) << "hello from " << 42;
+  sink.Flush();
+  EXPECT_THAT(ReadAll(file), HasSubstr("hello from 42\n"));
+  fclose(file);
+}
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,135 @@
+#include "src/common/cpu_affinity.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "src/common/status_macros.h"
+
+namespace tiny_dns {
+namespace {
+
+absl::StatusOr<int> ParseCpu(std::string_view cpu) {
+  int value = 0;
+  if (!absl::SimpleAtoi(cpu, &value) || value < 0 || value >= CPU_SETSIZE) {
+    return absl::InvalidArgumentError(absl::StrCat("Invalid CPU: ", cpu));
+  }
+  return value;
+}
+
+cpu_set_t ToCpuSet(std::span<const int> cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) { CPU_SET(cpu, &set); }
+  return set;
+}
+
+std::vector<int> AllCpus() {
+  std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+  for (size_t i = 0; i < cpus.size(); i++) { cpus[i] = i; }
+  return cpus;
+}
+
+} // namespace
+
+absl::StatusOr<std::vector<int>> ParseCpuList(std::string_view list) {
+  std::vector<int> cpus;
+  list = absl::StripAsciiWhitespace(list);
+  if (list.empty()) { return cpus; }
+  for (const std::string_view range : absl::StrSplit(list, ',')) {
+    const std::pair<std::string_view, std::string_view> bounds =
+      absl::StrSplit(range, absl::MaxSplits('-', 1));
+    ASSIGN_OR_RETURN(const int first, ParseCpu(bounds.first));
+    int last = first;
+    if (!bounds.second.empty()) { ASSIGN_OR_RETURN(last, ParseCpu(bounds.second)); }
+    if (last < first) {
+      return absl::InvalidArgumentError(absl::StrCat("Invalid CPU range: ", range));
+    }
+    for (int cpu = first; cpu <= last; cpu++) { cpus.push_back(cpu); }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::string FormatCpuList(std::span<const int> cpus) {
+  std::vector<std::string> ranges;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) { j++; }
+    ranges.push_back(i == j ?
+        absl::StrCat(cpus[i]) : absl::StrCat(cpus[i], "-", cpus[j]));
+    i = j + 1;
+  }
+  return absl::StrJoin(ranges, ",");
+}
+
+absl::Status PinCurrentThread(std::span<const int> cpus) {
+  if (cpus.empty()) { return absl::OkStatus(); }
+  const cpu_set_t set = ToCpuSet(cpus);
+  if (const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); error != 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+          "Unable to pin thread to CPUs: ", FormatCpuList(cpus), ", error: ", error));
+  }
+  return absl::OkStatus();
+}
+
+std::vector<std::vector<int>> NumaNodeCpus(
+    std::span<const int> within, std::string_view sysfs_root) {
+  // NOTE: ordered by node number.
+  std::map<int, std::vector<int>> nodes;
+  std::error_code error;
+  for (const std::filesystem::directory_entry& entry :
+       std::filesystem::directory_iterator(sysfs_root, error)) {
+    const std::string name = entry.path().filename().string();
+    int node = 0;
+    if (!name.starts_with("node") || !absl::SimpleAtoi(name.substr(4), &node)) { continue; }
+    std::ifstream file(entry.path() / "cpulist");
+    std::string list;
+    std::getline(file, list);
+    absl::StatusOr<std::vector<int>> cpus = ParseCpuList(list);
+    if (cpus.ok()) { nodes[node] = *std::move(cpus); }
+  }
+  if (nodes.empty()) { nodes[0] = AllCpus(); }
+
+  std::vector<int> allowed(within.begin(), within.end());
+  std::sort(allowed.begin(), allowed.end());
+  std::vector<std::vector<int>> node_cpus;
+  for (auto& [node, cpus] : nodes) {
+    if (!allowed.empty()) {
+      std::erase_if(cpus, [&](int cpu) { return !std::ranges::binary_search(allowed, cpu); });
+    }
+    if (!cpus.empty()) { node_cpus.push_back(std::move(cpus)); }
+  }
+  return node_cpus;
+}
+
+ScopedCpuAffinity::ScopedCpuAffinity(std::span<const int> cpus) : pinned_(false) {
+  if (cpus.empty()) { return; }
+  if (pthread_getaffinity_np(pthread_self(), sizeof(previous_), &previous_) != 0) { return; }
+  pinned_ = PinCurrentThread(cpus).ok();
+}
+
+ScopedCpuAffinity::~ScopedCpuAffinity() {
+  if (pinned_) { pthread_setaffinity_np(pthread_self(), sizeof(previous_), &previous_); }
+}
+
+} // tiny_dns
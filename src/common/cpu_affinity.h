@@ -0,0 +1,55 @@
+#ifndef SRC_COMMON_CPU_AFFINITY_H_
+#define SRC_COMMON_CPU_AFFINITY_H_
+
+#include <sched.h>
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+// Pinning threads to CPUs, and finding which CPUs share a NUMA node, from
+// sysfs rather than libnuma. Memory is placed with Linux's default first
+// touch policy: a page lands on the node of the CPU that first writes it, so
+// work done on a thread pinned to a node allocates there.
+
+namespace tiny_dns {
+
+inline constexpr std::string_view kSysfsNodeRoot = "/sys/devices/system/node";
+
+// NOTE: parses the kernel's cpulist format, e.g. "0-3,8,10-11", as used by
+// taskset and sysfs. An empty list parses to no CPUs.
+absl::StatusOr<std::vector<int>> ParseCpuList(std::string_view list);
+std::string FormatCpuList(std::span<const int> cpus);
+
+// NOTE: a no-op for no CPUs. Threads the pinned thread starts inherit its
+// affinity.
+absl::Status PinCurrentThread(std::span<const int> cpus);
+
+// NOTE: the CPUs of each NUMA node, keeping only those in within unless it's
+// empty, and leaving out nodes with none left. Without NUMA information (e.g.
+// not Linux, or a single node) every CPU is on the one node.
+std::vector<std::vector<int>> NumaNodeCpus(
+    std::span<const int> within = {}, std::string_view sysfs_root = kSysfsNodeRoot);
+
+// Pins the current thread to cpus for its lifetime, then restores the
+// affinity it had before.
+class ScopedCpuAffinity {
+ public:
+  explicit ScopedCpuAffinity(std::span<const int> cpus);
+  ~ScopedCpuAffinity();
+
+  ScopedCpuAffinity(const ScopedCpuAffinity&) = delete;
+  ScopedCpuAffinity& operator=(const ScopedCpuAffinity&) = delete;
+
+ private:
+  bool pinned_;
+  cpu_set_t previous_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_CPU_AFFINITY_H_
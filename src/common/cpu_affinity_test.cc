@@ -0,0 +1,88 @@
+#include "src/common/cpu_affinity.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::Not;
+using ::testing::SizeIs;
+
+std::vector<int> CurrentCpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) { cpus.push_back(cpu); }
+  }
+  return cpus;
+}
+
+TEST(CpuAffinityTest, ParsesCpuLists) {
+  EXPECT_THAT(*ParseCpuList("0-3,8,10-11"), ElementsAre(0, 1, 2, 3, 8, 10, 11));
+  EXPECT_THAT(*ParseCpuList(" 5,1,1-2\n"), ElementsAre(1, 2, 5));
+  EXPECT_THAT(*ParseCpuList(""), IsEmpty());
+  EXPECT_FALSE(ParseCpuList("3-1").ok());
+  EXPECT_FALSE(ParseCpuList("a").ok());
+  EXPECT_FALSE(ParseCpuList("1,,2").ok());
+  EXPECT_THAT(FormatCpuList(*ParseCpuList("0-3,8,10-11")), Eq("0-3,8,10-11"));
+}
+
+TEST(CpuAffinityTest, GroupsCpusByNode) {
+  const std::filesystem::path root = testing::TempDir() + "/cpu_affinity_test_nodes";
+  std::filesystem::create_directories(root / "node0");
+  std::filesystem::create_directories(root / "node1");
+  std::filesystem::create_directories(root / "power");
+  std::ofstream(root / "node0" / "cpulist") << "0-3,8-11\n";
+  std::ofstream(root / "node1" / "cpulist") << "4-7,12-15\n";
+
+  std::vector<std::vector<int>> nodes = NumaNodeCpus({}, root.string());
+  ASSERT_THAT(nodes, SizeIs(2));
+  EXPECT_THAT(nodes[0], ElementsAre(0, 1, 2, 3, 8, 9, 10, 11));
+  EXPECT_THAT(nodes[1], ElementsAre(4, 5, 6, 7, 12, 13, 14, 15));
+
+  const std::vector<int> within = {9, 2, 3};
+  nodes = NumaNodeCpus(within, root.string());
+  ASSERT_THAT(nodes, SizeIs(1));
+  EXPECT_THAT(nodes[0], ElementsAre(2, 3, 9));
+}
+
+TEST(CpuAffinityTest, WithoutNumaEveryCpuIsOnOneNode) {
+  const std::vector<std::vector<int>> nodes =
+    NumaNodeCpus({}, testing::TempDir() + "/no_such_directory");
+  ASSERT_THAT(nodes, SizeIs(1));
+  EXPECT_THAT(nodes[0], SizeIs(std::max(1u, std::thread::hardware_concurrency())));
+}
+
+TEST(CpuAffinityTest, ScopedAffinityRestoresThePrevious) {
+  const std::vector<int> before = CurrentCpus();
+  ASSERT_THAT(before, Not(IsEmpty()));
+  {
+    const std::vector<int> first = {before[0]};
+    ScopedCpuAffinity pinned(first);
+    EXPECT_THAT(CurrentCpus(), ElementsAre(before[0]));
+  }
+  EXPECT_THAT(CurrentCpus(), Eq(before));
+  // NOTE: no CPUs leaves the thread alone.
+  EXPECT_TRUE(PinCurrentThread({}).ok());
+  EXPECT_THAT(CurrentCpus(), Eq(before));
+}
+
+} // namespace
+} // tiny_dns
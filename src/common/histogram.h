@@ -0,0 +1,113 @@
+#ifndef SRC_COMMON_HISTOGRAM_H_
+#define SRC_COMMON_HISTOGRAM_H_
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// A fixed size, log-linear (HDR style) histogram for latencies and the like.
+// Values below kSubBuckets are recorded exactly; above that every power of two
+// range is split into kSubBuckets linear buckets, so any recorded value is
+// reported with a relative error of at most 1 / kSubBuckets (~3%).
+//
+// Recording is a couple of shifts and an increment, and never allocates.
+// It isn't thread-safe: keep one per thread and Merge() them.
+
+namespace tiny_dns {
+
+class Histogram {
+ public:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+  static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  Histogram() { Reset(); }
+
+  void Record(uint64_t value) { Record(value, 1); }
+  void Record(uint64_t value, uint64_t count) {
+    counts_[BucketIndex(value)] += count;
+    count_ += count;
+    sum_ += value * count;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void Merge(const Histogram& other) {
+    for (size_t i = 0; i < kBucketCount; i++) { counts_[i] += other.counts_[i]; }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  void Reset() {
+    counts_.fill(0);
+    count_ = 0;
+    sum_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+  }
+
+  // NOTE: percentile is in [0, 100]. Returns the highest value equivalent to
+  // the bucket the percentile falls in (clamped to the max seen), 0 if empty.
+  uint64_t Percentile(double percentile) const {
+    if (count_ == 0) { return 0; }
+    percentile = std::clamp(percentile, 0.0, 100.0);
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+    rank = std::clamp<uint64_t>(rank, 1, count_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; i++) {
+      seen += counts_[i];
+      if (seen >= rank) { return std::clamp(BucketUpperBound(i), min_, max_); }
+    }
+    return max_;
+  }
+
+  uint64_t Count() const { return count_; }
+  uint64_t Sum() const { return sum_; }
+  uint64_t Min() const { return count_ == 0 ? 0 : min_; }
+  uint64_t Max() const { return max_; }
+  double Mean() const { return count_ == 0 ? 0.0 : static_cast<double>(sum_) / count_; }
+
+  // NOTE: number of recorded values known to be <= value, at bucket precision.
+  uint64_t CountAtOrBelow(uint64_t value) const {
+    uint64_t count = 0;
+    for (size_t i = 0; i < kBucketCount && BucketUpperBound(i) <= value; i++) {
+      count += counts_[i];
+    }
+    return count;
+  }
+
+  // NOTE: for exporting the raw distribution, buckets are in increasing order.
+  size_t BucketCount() const { return kBucketCount; }
+  uint64_t BucketCountAt(size_t index) const { return counts_[index]; }
+  static uint64_t BucketUpperBound(size_t index) {
+    if (index < kSubBuckets) { return index; }
+    const int shift = static_cast<int>(index / kSubBuckets) - 1;
+    const uint64_t sub_bucket = index % kSubBuckets + kSubBuckets;
+    if (shift + kSubBucketBits + 1 >= 64 && sub_bucket == 2 * kSubBuckets - 1) {
+      return std::numeric_limits<uint64_t>::max();
+    }
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+  static size_t BucketIndex(uint64_t value) {
+    if (value < kSubBuckets) { return value; }
+    const int shift = std::bit_width(value) - 1 - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+  }
+
+ private:
+  std::array<uint64_t, kBucketCount> counts_;
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_HISTOGRAM_H_
@@ -0,0 +1,74 @@
+#include "src/common/histogram.h"
+
+#include <cstdint>
+#include <limits>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::AllOf;
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::Le;
+
+TEST(HistogramTest, EmptyHistogramReportsZero) {
+  Histogram histogram;
+  EXPECT_THAT(histogram.Count(), Eq(0));
+  EXPECT_THAT(histogram.Min(), Eq(0));
+  EXPECT_THAT(histogram.Max(), Eq(0));
+  EXPECT_THAT(histogram.Percentile(99), Eq(0));
+}
+
+TEST(HistogramTest, SmallValuesAreExact) {
+  Histogram histogram;
+  for (uint64_t i = 1; i <= 20; i++) { histogram.Record(i); }
+  EXPECT_THAT(histogram.Percentile(50), Eq(10));
+  EXPECT_THAT(histogram.Percentile(100), Eq(20));
+  EXPECT_THAT(histogram.Min(), Eq(1));
+  EXPECT_THAT(histogram.Mean(), Eq(10.5));
+}
+
+TEST(HistogramTest, PercentilesAreWithinRelativeError) {
+  Histogram histogram;
+  for (uint64_t i = 1; i <= 100000; i++) { histogram.Record(i * 1000); }
+  EXPECT_THAT(histogram.Percentile(50), AllOf(Ge(50000000), Le(50000000 * 33 / 32)));
+  EXPECT_THAT(histogram.Percentile(99), AllOf(Ge(99000000), Le(99000000 * 33 / 32)));
+  EXPECT_THAT(histogram.Percentile(99.9), AllOf(Ge(99900000), Le(100000000)));
+  EXPECT_THAT(histogram.Max(), Eq(100000000));
+}
+
+TEST(HistogramTest, HandlesExtremeValues) {
+  Histogram histogram;
+  histogram.Record(0);
+  histogram.Record(std::numeric_limits<uint64_t>::max());
+  EXPECT_THAT(histogram.Percentile(0), Eq(0));
+  EXPECT_THAT(histogram.Percentile(100), Eq(std::numeric_limits<uint64_t>::max()));
+}
+
+TEST(HistogramTest, MergeCombinesCounts) {
+  Histogram a;
+  Histogram b;
+  a.Record(10, 3);
+  b.Record(1000, 1);
+  a.Merge(b);
+  EXPECT_THAT(a.Count(), Eq(4));
+  EXPECT_THAT(a.Percentile(75), Eq(10));
+  EXPECT_THAT(a.Percentile(100), Eq(1000));
+  EXPECT_THAT(a.Sum(), Eq(1030));
+}
+
+TEST(HistogramTest, CountAtOrBelow) {
+  Histogram histogram;
+  for (uint64_t i = 1; i <= 10; i++) { histogram.Record(i); }
+  histogram.Record(1000000);
+  EXPECT_THAT(histogram.CountAtOrBelow(0), Eq(0));
+  EXPECT_THAT(histogram.CountAtOrBelow(5), Eq(5));
+  EXPECT_THAT(histogram.CountAtOrBelow(999999), Eq(10));
+  EXPECT_THAT(histogram.CountAtOrBelow(std::numeric_limits<uint64_t>::max()), Eq(11));
+}
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,96 @@
+#ifndef SRC_COMMON_METRICS_H_
+#define SRC_COMMON_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "src/common/histogram.h"
+
+// Counters and histograms cheap enough to update on every query. Each thread
+// writes to its own cache line aligned shard with a relaxed fetch_add, so
+// updates never contend; reads sum the shards and are only approximately
+// consistent with each other, which is fine for monitoring.
+
+namespace tiny_dns {
+
+inline constexpr size_t kMetricShards = 16;
+
+// NOTE: threads are assigned shards round robin on first use.
+inline size_t MetricShard() {
+  static std::atomic<size_t> next_shard = 0;
+  thread_local const size_t shard =
+    next_shard.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+  return shard;
+}
+
+class ShardedCounter {
+ public:
+  ShardedCounter() = default;
+  ShardedCounter(const ShardedCounter&) = delete;
+  ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+  void Increment(uint64_t count = 1) {
+    shards_[MetricShard()].value.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  uint64_t Value() const {
+    uint64_t total = 0;
+    for (const Shard& shard : shards_) { total += shard.value.load(std::memory_order_relaxed); }
+    return total;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value = 0;
+  };
+  std::array<Shard, kMetricShards> shards_;
+};
+
+// NOTE: same bucketing as Histogram, Snapshot() merges the shards into one.
+// Min and max of the snapshot are only known to bucket precision.
+class ShardedHistogram {
+ public:
+  ShardedHistogram() : shards_(std::make_unique<Shard[]>(kMetricShards)) {}
+  ShardedHistogram(const ShardedHistogram&) = delete;
+  ShardedHistogram& operator=(const ShardedHistogram&) = delete;
+
+  void Record(uint64_t value) {
+    Shard& shard = shards_[MetricShard()];
+    shard.counts[Histogram::BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  Histogram Snapshot() const {
+    Histogram histogram;
+    for (size_t i = 0; i < kMetricShards; i++) {
+      for (size_t bucket = 0; bucket < Histogram::kBucketCount; bucket++) {
+        const uint64_t count = shards_[i].counts[bucket].load(std::memory_order_relaxed);
+        if (count > 0) { histogram.Record(Histogram::BucketUpperBound(bucket), count); }
+      }
+    }
+    return histogram;
+  }
+
+  // NOTE: exact, unlike Snapshot().Sum() which is at bucket precision.
+  uint64_t Sum() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < kMetricShards; i++) {
+      total += shards_[i].sum.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, Histogram::kBucketCount> counts = {};
+    std::atomic<uint64_t> sum = 0;
+  };
+  std::unique_ptr<Shard[]> shards_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_METRICS_H_
@@ -0,0 +1,56 @@
+#include "src/common/metrics.h"
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/common/histogram.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::AllOf;
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::Le;
+
+TEST(ShardedCounterTest, SumsIncrementsFromAllThreads) {
+  ShardedCounter counter;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2 * kMetricShards; i++) {
+    threads.emplace_back([&counter] {
+      for (int j = 0; j < 1000; j++) { counter.Increment(); }
+      counter.Increment(5);
+    });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+  EXPECT_THAT(counter.Value(), Eq(2 * kMetricShards * 1005));
+}
+
+TEST(ShardedHistogramTest, SnapshotMergesAllThreads) {
+  ShardedHistogram histogram;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&histogram] {
+      for (uint64_t value = 1; value <= 1000; value++) { histogram.Record(value * 1000); }
+    });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+
+  const Histogram snapshot = histogram.Snapshot();
+  EXPECT_THAT(snapshot.Count(), Eq(4000));
+  EXPECT_THAT(histogram.Sum(), Eq(4 * 500500 * 1000));
+  EXPECT_THAT(snapshot.Percentile(50), AllOf(Ge(500000), Le(500000 * 33 / 32)));
+  EXPECT_THAT(snapshot.Max(), AllOf(Ge(1000000), Le(1000000 * 33 / 32)));
+}
+
+TEST(ShardedHistogramTest, EmptySnapshot) {
+  ShardedHistogram histogram;
+  EXPECT_THAT(histogram.Snapshot().Count(), Eq(0));
+  EXPECT_THAT(histogram.Sum(), Eq(0));
+}
+
+} // namespace
+} // tiny_dns
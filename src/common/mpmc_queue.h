@@ -0,0 +1,97 @@
+#ifndef SRC_COMMON_MPMC_QUEUE_H_
+#define SRC_COMMON_MPMC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+// A bounded, lock-free multi-producer multi-consumer queue (D. Vyukov's
+// design). Each slot carries a sequence number that tells producers and
+// consumers whether it is free for the current lap, so TryPush / TryPop are
+// a CAS on a shared index plus a copy, and never block or allocate.
+//
+// NOTE: this is for hot paths that must never wait, e.g. handing records to a
+// background thread: when full, TryPush fails and the caller decides whether
+// to drop. Capacity is rounded up to a power of two.
+
+namespace tiny_dns {
+
+template <typename T>
+class MpmcQueue {
+ public:
+  explicit MpmcQueue(size_t capacity)
+    : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+      slots_(std::make_unique<Slot[]>(mask_ + 1)), push_index_(0), pop_index_(0) {
+    for (size_t i = 0; i <= mask_; i++) { slots_[i].sequence.store(i, std::memory_order_relaxed); }
+  }
+
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  // NOTE: false if the queue is full.
+  bool TryPush(const T& value) {
+    size_t index = push_index_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[index & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(index);
+      if (diff == 0) {
+        if (push_index_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.sequence.store(index + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        index = push_index_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // NOTE: false if the queue is empty.
+  bool TryPop(T& value) {
+    size_t index = pop_index_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[index & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(index + 1);
+      if (diff == 0) {
+        if (pop_index_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed)) {
+          value = std::move(slot.value);
+          slot.sequence.store(index + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        index = pop_index_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  // NOTE: hardware_destructive_interference_size warns on some compilers.
+  static constexpr size_t kCacheLineSize = 64;
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  const size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+  alignas(kCacheLineSize) std::atomic<size_t> push_index_;
+  alignas(kCacheLineSize) std::atomic<size_t> pop_index_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_MPMC_QUEUE_H_
@@ -0,0 +1,74 @@
+#include "src/common/mpmc_queue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+
+TEST(MpmcQueueTest, PopsInPushOrder) {
+  MpmcQueue<int> queue(4);
+  for (int i = 0; i < 4; i++) { EXPECT_TRUE(queue.TryPush(i)); }
+  int value = -1;
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.TryPop(value));
+    EXPECT_THAT(value, Eq(i));
+  }
+  EXPECT_FALSE(queue.TryPop(value));
+}
+
+TEST(MpmcQueueTest, PushFailsWhenFull) {
+  MpmcQueue<int> queue(3);
+  EXPECT_THAT(queue.capacity(), Eq(4));
+  for (int i = 0; i < 4; i++) { EXPECT_TRUE(queue.TryPush(i)); }
+  EXPECT_FALSE(queue.TryPush(4));
+  int value = -1;
+  ASSERT_TRUE(queue.TryPop(value));
+  EXPECT_TRUE(queue.TryPush(4));
+}
+
+TEST(MpmcQueueTest, ConcurrentProducersAndConsumersSeeEveryValueOnce) {
+  constexpr int kProducers = 4;
+  constexpr int kConsumers = 2;
+  constexpr uint64_t kPerProducer = 20000;
+  MpmcQueue<uint64_t> queue(64);
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<uint64_t> popped = 0;
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < kProducers; p++) {
+    threads.emplace_back([&queue, p] {
+      for (uint64_t i = 1; i <= kPerProducer; i++) {
+        while (!queue.TryPush(p * kPerProducer + i)) { std::this_thread::yield(); }
+      }
+    });
+  }
+  for (int c = 0; c < kConsumers; c++) {
+    threads.emplace_back([&] {
+      uint64_t value = 0;
+      while (popped.load() < kProducers * kPerProducer) {
+        if (!queue.TryPop(value)) {
+          std::this_thread::yield();
+          continue;
+        }
+        sum += value;
+        popped++;
+      }
+    });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+
+  const uint64_t n = kProducers * kPerProducer;
+  EXPECT_THAT(popped.load(), Eq(n));
+  EXPECT_THAT(sum.load(), Eq(n * (n + 1) / 2));
+}
+
+} // namespace
+} // tiny_dns
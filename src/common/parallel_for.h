@@ -0,0 +1,38 @@
+#ifndef SRC_COMMON_PARALLEL_FOR_H_
+#define SRC_COMMON_PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+
+namespace tiny_dns {
+
+// NOTE: 0 means one per core.
+inline size_t ResolveThreadCount(size_t threads) {
+  if (threads > 0) { return threads; }
+  return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// NOTE: calls fn(i) for every i in [0, n) on up to threads threads (0 for
+// one per core), handing out indices one at a time so uneven work balances.
+// Returns once every call has.
+inline void ParallelFor(size_t n, size_t threads, absl::FunctionRef<void(size_t)> fn) {
+  threads = std::min(ResolveThreadCount(threads), n);
+  std::atomic<size_t> next = 0;
+  auto work = [&] {
+    for (size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) { fn(i); }
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(threads > 0 ? threads - 1 : 0);
+  for (size_t t = 1; t < threads; t++) { workers.emplace_back(work); }
+  work();
+  for (std::thread& worker : workers) { worker.join(); }
+}
+
+} // tiny_dns
+
+#endif // SRC_COMMON_PARALLEL_FOR_H_
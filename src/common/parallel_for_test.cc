@@ -0,0 +1,31 @@
+#include "src/common/parallel_for.h"
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Each;
+using ::testing::Eq;
+
+TEST(ParallelForTest, CallsEveryIndexOnce) {
+  std::vector<std::atomic<int>> calls(1000);
+  ParallelFor(calls.size(), 4, [&](size_t i) { calls[i].fetch_add(1); });
+  for (const std::atomic<int>& count : calls) { EXPECT_THAT(count.load(), Eq(1)); }
+}
+
+TEST(ParallelForTest, HandlesFewerIndicesThanThreads) {
+  std::vector<int> calls(2, 0);
+  ParallelFor(calls.size(), 8, [&](size_t i) { calls[i]++; });
+  EXPECT_THAT(calls, Each(Eq(1)));
+  ParallelFor(0, 8, [&](size_t i) { calls[i]++; });
+  EXPECT_THAT(calls, Each(Eq(1)));
+}
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,127 @@
+#include "src/common/refresh_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace tiny_dns {
+namespace {
+
+// NOTE: the backoff doubles at most this many times.
+constexpr uint32_t kMaxBackoffDoublings = 20;
+
+} // namespace
+
+RefreshScheduler::RefreshScheduler(Refresh refresh, RefreshSchedulerOptions options)
+  : refresh_(std::move(refresh)), options_(options), rng_(options.seed) {
+  thread_ = std::thread(&RefreshScheduler::Run, this);
+}
+
+RefreshScheduler::~RefreshScheduler() {
+  {
+    std::scoped_lock lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+uint64_t RefreshScheduler::Add(std::chrono::milliseconds period) {
+  uint64_t id = 0;
+  {
+    std::scoped_lock lock(mutex_);
+    id = next_id_++;
+    Entry& entry = entries_[id];
+    entry.period = period;
+    Schedule(id, entry, Clock::now(), period);
+  }
+  cv_.notify_one();
+  return id;
+}
+
+void RefreshScheduler::Remove(uint64_t id) {
+  std::scoped_lock lock(mutex_);
+  entries_.erase(id);
+}
+
+size_t RefreshScheduler::size() const {
+  std::scoped_lock lock(mutex_);
+  return entries_.size();
+}
+
+uint64_t RefreshScheduler::batches() const {
+  std::scoped_lock lock(mutex_);
+  return batches_;
+}
+
+void RefreshScheduler::Schedule(
+    uint64_t id, Entry& entry, Clock::time_point now, std::chrono::milliseconds delay) {
+  std::uniform_real_distribution<double> unit(0, 1);
+  const auto jitter = std::chrono::duration_cast<Clock::duration>(
+      delay * (options_.jitter * unit(rng_)));
+  entry.due = now + delay - jitter;
+  deadlines_.emplace(entry.due, id);
+}
+
+std::vector<uint64_t> RefreshScheduler::TakeDue(Clock::time_point now) {
+  std::vector<uint64_t> ids;
+  const Clock::time_point horizon = now + options_.coalesce_window;
+  while (!deadlines_.empty() && deadlines_.top().first <= horizon
+      && ids.size() < options_.max_batch_size) {
+    const auto [due, id] = deadlines_.top();
+    deadlines_.pop();
+    auto it = entries_.find(id);
+    if (it == entries_.end() || it->second.due != due) { continue; }
+    // NOTE: rescheduled once the refresh returns.
+    it->second.due = Clock::time_point::max();
+    ids.push_back(id);
+  }
+  return ids;
+}
+
+void RefreshScheduler::Run() {
+  std::unique_lock lock(mutex_);
+  while (!stopping_) {
+    if (deadlines_.empty()) {
+      cv_.wait(lock, [this] { return stopping_ || !deadlines_.empty(); });
+      continue;
+    }
+    // NOTE: Add notifies, so an earlier deadline added meanwhile is picked up.
+    const Clock::time_point due = deadlines_.top().first;
+    if (Clock::now() < due) {
+      cv_.wait_until(lock, due);
+      continue;
+    }
+    const std::vector<uint64_t> ids = TakeDue(Clock::now());
+    if (ids.empty()) { continue; }
+    batches_++;
+
+    lock.unlock();
+    const std::vector<bool> refreshed = refresh_(ids);
+    lock.lock();
+
+    const Clock::time_point now = Clock::now();
+    for (size_t i = 0; i < ids.size(); i++) {
+      auto it = entries_.find(ids[i]);
+      if (it == entries_.end()) { continue; }
+      Entry& entry = it->second;
+      if (i < refreshed.size() && refreshed[i]) {
+        entry.failures = 0;
+        Schedule(ids[i], entry, now, entry.period);
+        continue;
+      }
+      const std::chrono::milliseconds backoff = std::min({
+          options_.initial_backoff * (int64_t{1} << std::min(entry.failures, kMaxBackoffDoublings)),
+          options_.max_backoff, entry.period});
+      entry.failures++;
+      Schedule(ids[i], entry, now, backoff);
+    }
+  }
+}
+
+} // tiny_dns
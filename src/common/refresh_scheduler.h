@@ -0,0 +1,91 @@
+#ifndef SRC_COMMON_REFRESH_SCHEDULER_H_
+#define SRC_COMMON_REFRESH_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+// Runs periodic refreshes for many entries from a single thread. Deadlines are
+// kept in a min-heap; when the earliest comes due, every entry due within the
+// coalescing window is refreshed with it, in one call. Each deadline is pulled
+// in by a random jitter so entries added together drift apart rather than
+// refreshing in lock step forever, and refreshes that fail are retried with
+// exponential backoff (never later than the entry's period).
+
+namespace tiny_dns {
+
+struct RefreshSchedulerOptions {
+  // NOTE: entries due within this long of the earliest one are refreshed early.
+  std::chrono::milliseconds coalesce_window = std::chrono::seconds(1);
+  // NOTE: each deadline is brought forward by up to this fraction of its period.
+  double jitter = 0.1;
+  std::chrono::milliseconds initial_backoff = std::chrono::seconds(1);
+  std::chrono::milliseconds max_backoff = std::chrono::seconds(60);
+  size_t max_batch_size = 1024;
+  uint64_t seed = 1;
+};
+
+class RefreshScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // NOTE: called on the scheduler thread with the ids that are due. Returns
+  // whether each was refreshed, in the same order.
+  using Refresh = std::function<std::vector<bool>(std::span<const uint64_t> ids)>;
+
+  explicit RefreshScheduler(Refresh refresh, RefreshSchedulerOptions options = {});
+  // NOTE: waits for an in-progress refresh, then stops. Nothing else is refreshed.
+  ~RefreshScheduler();
+
+  RefreshScheduler(const RefreshScheduler&) = delete;
+  RefreshScheduler& operator=(const RefreshScheduler&) = delete;
+
+  // NOTE: first refreshed about one period from now. Returns an id for Remove.
+  uint64_t Add(std::chrono::milliseconds period);
+  void Remove(uint64_t id);
+
+  size_t size() const;
+  // NOTE: the number of times refresh has been called.
+  uint64_t batches() const;
+
+ private:
+  struct Entry {
+    std::chrono::milliseconds period;
+    Clock::time_point due;
+    uint32_t failures = 0;
+  };
+  using Deadline = std::pair<Clock::time_point, uint64_t>;
+
+  void Run();
+  // NOTE: both require mutex_ to be held.
+  void Schedule(uint64_t id, Entry& entry, Clock::time_point now, std::chrono::milliseconds delay);
+  std::vector<uint64_t> TakeDue(Clock::time_point now);
+
+  const Refresh refresh_;
+  const RefreshSchedulerOptions options_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  absl::flat_hash_map<uint64_t, Entry> entries_;
+  // NOTE: may hold stale deadlines for removed or rescheduled entries, these
+  // are skipped when they reach the top.
+  std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines_;
+  std::mt19937_64 rng_;
+  uint64_t next_id_ = 0;
+  uint64_t batches_ = 0;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_REFRESH_SCHEDULER_H_
@@ -0,0 +1,121 @@
+#include "src/common/refresh_scheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::UnorderedElementsAre;
+
+using std::chrono::milliseconds;
+
+// NOTE: records each call, and fails ids in fail_ids.
+class Recorder {
+ public:
+  std::vector<bool> Refresh(std::span<const uint64_t> ids) {
+    std::scoped_lock lock(mutex_);
+    calls_.emplace_back(ids.begin(), ids.end());
+    std::vector<bool> refreshed;
+    for (uint64_t id : ids) { refreshed.push_back(id != fail_id_); }
+    return refreshed;
+  }
+
+  void Fail(uint64_t id) {
+    std::scoped_lock lock(mutex_);
+    fail_id_ = id;
+  }
+
+  std::vector<std::vector<uint64_t>> calls() {
+    std::scoped_lock lock(mutex_);
+    return calls_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::vector<uint64_t>> calls_;
+  uint64_t fail_id_ = UINT64_MAX;
+};
+
+RefreshScheduler::Refresh RefreshWith(Recorder& recorder) {
+  return [&recorder](std::span<const uint64_t> ids) { return recorder.Refresh(ids); };
+}
+
+TEST(RefreshSchedulerTest, CoalescesEntriesDueInTheSameWindow) {
+  Recorder recorder;
+  RefreshSchedulerOptions options;
+  options.coalesce_window = milliseconds(50);
+  RefreshScheduler scheduler(RefreshWith(recorder), options);
+  const uint64_t a = scheduler.Add(milliseconds(100));
+  const uint64_t b = scheduler.Add(milliseconds(110));
+  const uint64_t c = scheduler.Add(milliseconds(120));
+  // NOTE: well outside the window of the others.
+  scheduler.Add(milliseconds(10000));
+
+  std::this_thread::sleep_for(milliseconds(160));
+  const std::vector<std::vector<uint64_t>> calls = recorder.calls();
+  ASSERT_THAT(calls.size(), Eq(1));
+  EXPECT_THAT(calls[0], UnorderedElementsAre(a, b, c));
+}
+
+TEST(RefreshSchedulerTest, RefreshesEachPeriod) {
+  Recorder recorder;
+  RefreshSchedulerOptions options;
+  options.coalesce_window = milliseconds(0);
+  RefreshScheduler scheduler(RefreshWith(recorder), options);
+  scheduler.Add(milliseconds(20));
+
+  std::this_thread::sleep_for(milliseconds(210));
+  // NOTE: jitter only ever brings deadlines forward.
+  EXPECT_THAT(recorder.calls().size(), Ge(10));
+}
+
+TEST(RefreshSchedulerTest, RetriesFailuresWithBackoff) {
+  Recorder recorder;
+  RefreshSchedulerOptions options;
+  options.coalesce_window = milliseconds(0);
+  options.jitter = 0;
+  options.initial_backoff = milliseconds(10);
+  RefreshScheduler scheduler(RefreshWith(recorder), options);
+  const uint64_t id = scheduler.Add(milliseconds(50));
+  recorder.Fail(id);
+
+  // NOTE: refreshed at 50ms, then retried at 60ms, 80ms and 120ms.
+  std::this_thread::sleep_for(milliseconds(100));
+  EXPECT_THAT(recorder.calls().size(), Eq(3));
+}
+
+TEST(RefreshSchedulerTest, RemovedEntriesAreNotRefreshed) {
+  Recorder recorder;
+  RefreshScheduler scheduler(RefreshWith(recorder));
+  const uint64_t id = scheduler.Add(milliseconds(20));
+  scheduler.Remove(id);
+  EXPECT_THAT(scheduler.size(), Eq(0));
+
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_THAT(recorder.calls().size(), Eq(0));
+  EXPECT_THAT(scheduler.batches(), Eq(0));
+}
+
+TEST(RefreshSchedulerTest, DestructionDoesNotWaitForDeadlines) {
+  Recorder recorder;
+  const auto start = std::chrono::steady_clock::now();
+  {
+    RefreshScheduler scheduler(RefreshWith(recorder));
+    scheduler.Add(std::chrono::hours(1));
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+  EXPECT_THAT(recorder.calls().size(), Eq(0));
+}
+
+} // namespace
+} // tiny_dns
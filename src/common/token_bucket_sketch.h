@@ -0,0 +1,72 @@
+#ifndef SRC_COMMON_TOKEN_BUCKET_SKETCH_H_
+#define SRC_COMMON_TOKEN_BUCKET_SKETCH_H_
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Token buckets for an unbounded set of keys in fixed memory, laid out like a
+// count-min sketch: kRows rows of cells, a key hashing to one cell per row.
+// Keys sharing a cell share its bucket, so a key is allowed if any of its
+// cells has a token, i.e. it's only limited once every one of them is drained
+// (by it, or by it and whatever collides with it). Colliding with a heavy
+// hitter in one row costs a light key nothing as long as its other cell is
+// its own.
+//
+// Each cell is one atomic word, a GCRA "theoretical arrival time": the time
+// at which the bucket would be full again. Taking a token pushes it one
+// emission interval (1 / rate) later, which is allowed while it stays within
+// burst intervals of now. Updates are a single CAS per row, no locks. The
+// rows aren't updated together, so under contention a key can be allowed up
+// to kRows times its burst.
+
+namespace tiny_dns {
+
+class TokenBucketSketch {
+ public:
+  static constexpr size_t kRows = 2;
+
+  // NOTE: cells_per_row is rounded up to a power of two. rate is in tokens
+  // per second, burst in tokens; both must be positive.
+  TokenBucketSketch(size_t cells_per_row, double rate, double burst) :
+    mask_(std::bit_ceil(std::max<size_t>(cells_per_row, 1)) - 1),
+    interval_ns_(std::max<int64_t>(1, static_cast<int64_t>(1e9 / rate))),
+    tolerance_ns_(static_cast<int64_t>(std::max(burst, 1.0) * interval_ns_)),
+    cells_(std::make_unique<std::atomic<int64_t>[]>(kRows * (mask_ + 1))) {}
+
+  // NOTE: takes a token from the buckets of the key with this hash, as of
+  // now_ns on any monotonic clock. False if none had one.
+  bool TryTake(uint64_t hash, int64_t now_ns) {
+    // NOTE: double hashing, the high half picks the step between rows.
+    const uint64_t step = (hash >> 32) | 1;
+    bool taken = false;
+    for (size_t row = 0; row < kRows; row++) {
+      std::atomic<int64_t>& cell = cells_[row * (mask_ + 1) + ((hash + row * step) & mask_)];
+      int64_t arrival = cell.load(std::memory_order_relaxed);
+      while (true) {
+        const int64_t next = std::max(arrival, now_ns) + interval_ns_;
+        if (next - now_ns > tolerance_ns_) { break; }
+        if (cell.compare_exchange_weak(arrival, next, std::memory_order_relaxed)) {
+          taken = true;
+          break;
+        }
+      }
+    }
+    return taken;
+  }
+
+  size_t MemoryBytes() const { return kRows * (mask_ + 1) * sizeof(std::atomic<int64_t>); }
+
+ private:
+  const size_t mask_;
+  const int64_t interval_ns_;
+  const int64_t tolerance_ns_;
+  std::unique_ptr<std::atomic<int64_t>[]> cells_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_TOKEN_BUCKET_SKETCH_H_
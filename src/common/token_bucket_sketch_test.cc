@@ -0,0 +1,73 @@
+#include "src/common/token_bucket_sketch.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::Le;
+
+constexpr int64_t kSecond = 1'000'000'000;
+
+TEST(TokenBucketSketchTest, AllowsBurstThenRate) {
+  TokenBucketSketch sketch(1024, /*rate=*/10, /*burst=*/5);
+  int64_t now = 100 * kSecond;
+  for (int i = 0; i < 5; i++) { EXPECT_TRUE(sketch.TryTake(42, now)) << i; }
+  EXPECT_FALSE(sketch.TryTake(42, now));
+
+  // NOTE: one token every 100ms.
+  now += kSecond / 10;
+  EXPECT_TRUE(sketch.TryTake(42, now));
+  EXPECT_FALSE(sketch.TryTake(42, now));
+
+  // NOTE: refills to the burst, no further.
+  now += 10 * kSecond;
+  int taken = 0;
+  while (sketch.TryTake(42, now)) { taken++; }
+  EXPECT_THAT(taken, Eq(5));
+}
+
+TEST(TokenBucketSketchTest, KeysAreIndependent) {
+  TokenBucketSketch sketch(1024, /*rate=*/1, /*burst=*/1);
+  const int64_t now = kSecond;
+  EXPECT_TRUE(sketch.TryTake(1, now));
+  EXPECT_FALSE(sketch.TryTake(1, now));
+  EXPECT_TRUE(sketch.TryTake(2, now));
+  EXPECT_TRUE(sketch.TryTake(3, now));
+}
+
+TEST(TokenBucketSketchTest, MemoryIsFixed) {
+  TokenBucketSketch sketch(1000, /*rate=*/1, /*burst=*/1);
+  EXPECT_THAT(sketch.MemoryBytes(), Eq(TokenBucketSketch::kRows * 1024 * sizeof(int64_t)));
+  for (uint64_t key = 0; key < 100'000; key++) {
+    sketch.TryTake(key * 0x9e3779b97f4a7c15, kSecond);
+  }
+  EXPECT_THAT(sketch.MemoryBytes(), Eq(TokenBucketSketch::kRows * 1024 * sizeof(int64_t)));
+}
+
+TEST(TokenBucketSketchTest, ConcurrentTakesAreBounded) {
+  TokenBucketSketch sketch(1024, /*rate=*/1, /*burst=*/100);
+  std::atomic<int> taken = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 1000; i++) {
+        if (sketch.TryTake(7, kSecond)) { taken++; }
+      }
+    });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+  EXPECT_THAT(taken.load(), Ge(100));
+  EXPECT_THAT(taken.load(), Le(100 * TokenBucketSketch::kRows));
+}
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,53 @@
+#ifndef SRC_COMMON_ZIPFIAN_H_
+#define SRC_COMMON_ZIPFIAN_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+// Draws ranks in [0, n) with Zipfian popularity, 0 being the most popular.
+// theta controls the skew; 0.99 is the YCSB default and close to what DNS
+// name popularity looks like in practice.
+//
+// NOTE: Gray et al., "Quickly Generating Billion-Record Synthetic Databases".
+// Setup is O(n), sampling is O(1). Immutable once built, so it can be shared
+// between threads that each bring their own Rng.
+
+namespace tiny_dns {
+
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t n, double theta)
+    : n_(n), theta_(theta), alpha_(1.0 / (1.0 - theta)), zeta_n_(Zeta(n, theta)),
+      eta_((1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - Zeta(2, theta) / zeta_n_)),
+      half_pow_theta_(1.0 + std::pow(0.5, theta)) {}
+
+  template <typename Rng>
+  uint64_t operator()(Rng& rng) const {
+    const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    const double uz = u * zeta_n_;
+    if (uz < 1.0) { return 0; }
+    if (uz < half_pow_theta_) { return 1; }
+    const uint64_t rank = n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_);
+    return std::min(rank, n_ - 1);
+  }
+
+ private:
+  static double Zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) { sum += 1.0 / std::pow(i, theta); }
+    return sum;
+  }
+
+  const uint64_t n_;
+  const double theta_;
+  const double alpha_;
+  const double zeta_n_;
+  const double eta_;
+  const double half_pow_theta_;
+};
+
+} // tiny_dns
+
+#endif // SRC_COMMON_ZIPFIAN_H_
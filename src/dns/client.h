@@ -1,11 +1,20 @@
 #ifndef SRC_DNS_CLIENT_H_
 #define SRC_DNS_CLIENT_H_
 
+#include <array>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <string>
 #include <utility>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 #include "absl/log/log.h"
 #include "absl/strings/str_cat.h"
@@ -14,27 +23,44 @@
 
 namespace tiny_dns {
 
-// Represents a UDP connection with an external server.
-// Not thread safe; intended to be owned by a single thread.
+// Represents a UDP connection with an external server. The socket is
+// connected to it, so datagrams from any other address are never received,
+// e.g. forged responses.
+// Call is thread safe: concurrent calls take turns on the socket, so none can
+// discard or receive another's response. The pieces it's made of aren't
+// synchronized; callers sharing the client hold Lock() around them.
 class Client {
  public:
-  Client(int32_t socket_fd, struct sockaddr_in dest_addr)
-    : socket_fd_(socket_fd), dest_addr_(dest_addr) {}
+  explicit Client(int32_t socket_fd) : socket_fd_(socket_fd), mutex_() {}
   ~Client() { close(socket_fd_); }
 
+  // NOTE: a zero timeout waits for a response forever.
   static absl::StatusOr<std::shared_ptr<Client>> Create(
-      std::string local_address, std::string client_address, int32_t client_port) {
+      std::string local_address, std::string client_address, int32_t client_port,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
     int32_t socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (socket_fd < 0) {
       return absl::FailedPreconditionError(
           absl::StrCat("Unable to open socket: ", socket_fd));
     }
+    if (timeout.count() > 0) {
+      struct timeval receive_timeout = {
+        .tv_sec = static_cast<time_t>(timeout.count() / 1000),
+        .tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000),
+      };
+      if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO,
+            &receive_timeout, sizeof(receive_timeout)) < 0) {
+        close(socket_fd);
+        return absl::FailedPreconditionError("Unable to set receive timeout.");
+      }
+    }
 
     struct sockaddr_in src_addr;
     memset(&src_addr, 0, sizeof(src_addr));
     src_addr.sin_family = AF_INET;
     src_addr.sin_port = htons(0);
     if (inet_pton(AF_INET, local_address.c_str(), &src_addr.sin_addr) <= 0) {
+      close(socket_fd);
       return absl::FailedPreconditionError(
           absl::StrCat("Unable to translate address: ", local_address));
     }
@@ -54,30 +80,63 @@ class Client {
       return absl::FailedPreconditionError(
           absl::StrCat("Unable to translate address: ", client_address));
     }
+    if (connect(socket_fd, (const struct sockaddr*) &dest_addr, sizeof(dest_addr)) < 0) {
+      close(socket_fd);
+      return absl::FailedPreconditionError(
+          absl::StrCat("Unable to connect to: ", client_address));
+    }
+
+    return std::make_shared<Client>(socket_fd);
+  }
 
-    return std::make_shared<Client>(socket_fd, dest_addr);
+  // NOTE: only request.size() bytes are sent, callers should pass the encoded
+  // prefix of their buffer rather than the whole thing.
+  // NOTE: responses that arrived after an earlier call gave up are discarded
+  // first, so they can't be mistaken for the response to this one.
+  template<size_t M>
+  absl::Status Call(std::span<const uint8_t> request, std::array<uint8_t, M>& response) {
+    std::unique_lock lock = Lock();
+    DiscardPending(response);
+    if (absl::Status status = Send(request); !status.ok()) { return status; }
+    return Receive(response).status();
   }
 
-  template<size_t N, size_t M>
-  absl::Status Call(const std::array<uint8_t, N>& request, std::array<uint8_t, M>& response) {
-    if (sendto(socket_fd_, request.data(), sizeof(request), 0,
-          (const struct sockaddr*) &dest_addr_, sizeof(dest_addr_)) < 0) {
+  // NOTE: the pieces of Call, for pipelining several requests over the
+  // socket: send them all, then receive the responses in whatever order
+  // they arrive. Callers match them up, e.g. by DNS ID.
+  // NOTE: held by Call for a whole round trip.
+  std::unique_lock<std::mutex> Lock() { return std::unique_lock(mutex_); }
+
+  template<size_t M>
+  void DiscardPending(std::array<uint8_t, M>& buffer) {
+    while (recv(socket_fd_, buffer.data(), buffer.size(), MSG_DONTWAIT) >= 0) {}
+  }
+
+  absl::Status Send(std::span<const uint8_t> request) {
+    if (send(socket_fd_, request.data(), request.size(), 0) < 0) {
       return absl::FailedPreconditionError(
           absl::StrCat("Error sending data to client server."));
     }
+    return absl::OkStatus();
+  }
 
-    socklen_t addr_len = sizeof(dest_addr_);
-    if (recvfrom(socket_fd_, response.data(), sizeof(response), MSG_WAITALL,
-          (struct sockaddr*) &dest_addr_, &addr_len) < 0) {
+  // NOTE: returns the size of the response received.
+  template<size_t M>
+  absl::StatusOr<size_t> Receive(std::array<uint8_t, M>& response) {
+    const ssize_t size = recv(socket_fd_, response.data(), sizeof(response), MSG_WAITALL);
+    if (size < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return absl::DeadlineExceededError("Timed out waiting for client server.");
+      }
       return absl::FailedPreconditionError(
           absl::StrCat("Error receiving data from client server."));
     }
-    return absl::OkStatus();
+    return (size_t) size;
   }
 
  private:
   const int32_t socket_fd_;
-  const struct sockaddr_in dest_addr_;
+  std::mutex mutex_;
 };
 
 } // tiny_dns
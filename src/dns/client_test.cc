@@ -0,0 +1,71 @@
+#include "src/dns/client.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/mock_upstream.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+
+TEST(ClientTest, ConcurrentCallsGetTheirOwnResponses) {
+  MockUpstreamOptions options;
+  options.synthesize_answers = true;
+  options.delay = std::chrono::microseconds(200);
+  absl::StatusOr<std::unique_ptr<MockUpstream>> upstream =
+    MockUpstream::Create(std::move(options));
+  ASSERT_TRUE(upstream.ok());
+  absl::StatusOr<std::shared_ptr<Client>> client = Client::Create(
+      "127.0.0.1", "127.0.0.1", (*upstream)->port(), std::chrono::milliseconds(1000));
+  ASSERT_TRUE(client.ok());
+
+  constexpr int kThreads = 8;
+  constexpr int kCalls = 50;
+  std::vector<int> mismatches(kThreads, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kCalls; i++) {
+        DnsPacket request = {};
+        // NOTE: the same ID on every thread, only the name tells them apart.
+        request.header.id = 0x1234;
+        Question question = {};
+        question.qname = "host-" + std::to_string(t) + ".example";
+        question.qtype = QueryType::A;
+        request.questions.push_back(std::move(question));
+        std::array<uint8_t, 512> request_raw = {};
+        const absl::StatusOr<std::span<const uint8_t>> encoded = request.ToBytes(request_raw);
+        std::array<uint8_t, 512> response_raw = {};
+        if (!encoded.ok() || !(*client)->Call(*encoded, response_raw).ok()) {
+          mismatches[t]++;
+          continue;
+        }
+        const absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(response_raw);
+        if (!response.ok() || response->questions.size() != 1
+            || response->questions[0].qname != request.questions[0].qname) {
+          mismatches[t]++;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+  EXPECT_THAT(mismatches, Eq(std::vector<int>(kThreads, 0)));
+  EXPECT_THAT((*upstream)->stats().queries, Eq(kThreads * kCalls));
+}
+
+} // namespace
+} // tiny_dns
@@ -1,8 +1,13 @@
 #include "src/dns/dns_packet.h"
 
 #include <array>
+#include <bit>
 #include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <span>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 #include <utility>
@@ -12,147 +17,261 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
-#include "absl/strings/str_split.h"
-#include "absl/strings/str_join.h"
 #include "src/common/status_macros.h"
+#include "src/dns/rdata_codec.h"
 
 namespace tiny_dns {
 
-absl::StatusOr<uint8_t> BufferReader::ReadU8() {
-  if (cursor_ > &bytes_.back()) {
+namespace {
+
+// NOTE: unaligned big-endian loads / stores. memcpy compiles down to a single
+// mov, the byte swap to a bswap / rol.
+uint16_t LoadBigEndian16(const uint8_t* p) {
+  uint16_t x;
+  memcpy(&x, p, sizeof(x));
+  if constexpr (std::endian::native == std::endian::little) { x = __builtin_bswap16(x); }
+  return x;
+}
+
+uint32_t LoadBigEndian32(const uint8_t* p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  if constexpr (std::endian::native == std::endian::little) { x = __builtin_bswap32(x); }
+  return x;
+}
+
+void StoreBigEndian16(uint8_t* p, uint16_t x) {
+  if constexpr (std::endian::native == std::endian::little) { x = __builtin_bswap16(x); }
+  memcpy(p, &x, sizeof(x));
+}
+
+void StoreBigEndian32(uint8_t* p, uint32_t x) {
+  if constexpr (std::endian::native == std::endian::little) { x = __builtin_bswap32(x); }
+  memcpy(p, &x, sizeof(x));
+}
+
+} // namespace
+
+absl::Status BufferReader::CheckRemaining(const size_t n) const {
+  if (Remaining() < n) {
     return absl::InvalidArgumentError(
         "Malformed packet detected! Attempting to read beyond buffer limit.");
   }
-  uint8_t result = ((uint8_t) *cursor_);
-  cursor_ += 1;
-  return result;
+  return absl::OkStatus();
 }
 
-absl::StatusOr<uint16_t> BufferReader::ReadU16() {
-  uint16_t result = 0;
-  uint8_t chunk = 0;
-
-  ASSIGN_OR_RETURN(chunk, ReadU8());
-  result |= chunk;
-  result <<= 8;
+absl::StatusOr<uint8_t> BufferReader::ReadU8() {
+  RETURN_IF_ERROR(CheckRemaining(1));
+  return bytes_[pos_++];
+}
 
-  ASSIGN_OR_RETURN(chunk, ReadU8());
-  result |= chunk;
+absl::StatusOr<uint16_t> BufferReader::ReadU16() {
+  RETURN_IF_ERROR(CheckRemaining(2));
+  const uint16_t result = LoadBigEndian16(bytes_.data() + pos_);
+  pos_ += 2;
   return result;
 }
 
 absl::StatusOr<uint32_t> BufferReader::ReadU32() {
-  uint32_t result = 0;
-  uint8_t chunk = 0;
-
-  ASSIGN_OR_RETURN(chunk, ReadU8());
-  result |= chunk;
-  result <<= 8;
-
-  ASSIGN_OR_RETURN(chunk, ReadU8());
-  result |= chunk;
-  result <<= 8;
+  RETURN_IF_ERROR(CheckRemaining(4));
+  const uint32_t result = LoadBigEndian32(bytes_.data() + pos_);
+  pos_ += 4;
+  return result;
+}
 
-  ASSIGN_OR_RETURN(chunk, ReadU8());
-  result |= chunk;
-  result <<= 8;
+absl::Status BufferReader::ReadBytes(uint8_t* out, const size_t n) {
+  RETURN_IF_ERROR(CheckRemaining(n));
+  memcpy(out, bytes_.data() + pos_, n);
+  pos_ += n;
+  return absl::OkStatus();
+}
 
-  ASSIGN_OR_RETURN(chunk, ReadU8());
-  result |= chunk;
-  return result;
+absl::StatusOr<std::pmr::string>
+BufferReader::ReadQName(std::pmr::memory_resource* resource) {
+  std::pmr::string qname(resource);
+  RETURN_IF_ERROR(ReadQNameInto(qname, 0));
+  return qname;
 }
 
-absl::StatusOr<std::string>
-BufferReader::ReadQName(size_t num_jumps) {
+absl::Status BufferReader::ReadQNameInto(std::pmr::string& qname, size_t num_jumps) {
   static const size_t kMaxJumps = 5;
   if (num_jumps > kMaxJumps) {
     return absl::InvalidArgumentError(
         "Attempting to exceed jump protection limit!");
   }
 
-  std::vector<std::string> labels;
   while (true) {
-    ASSIGN_OR_RETURN(uint8_t chunk, ReadU8());
+    RETURN_IF_ERROR(CheckRemaining(1));
+    const uint8_t chunk = bytes_[pos_];
 
     // NOTE: jump, get rest of labels from offset.
     if ((chunk & 0xc0) == 0xc0) {
-      const uint8_t a = chunk;
-      ASSIGN_OR_RETURN(const uint8_t b, ReadU8());
-      const uint16_t offset = (((((uint16_t) a) << 8) | b) ^ 0xc000);
+      RETURN_IF_ERROR(CheckRemaining(2));
+      const uint16_t offset = LoadBigEndian16(bytes_.data() + pos_) ^ 0xc000;
+      pos_ += 2;
 
       BufferReader reader(bytes_, offset);
-      ASSIGN_OR_RETURN(auto jumped_labels, reader.ReadQName(num_jumps + 1));
-      labels.push_back(jumped_labels);
-      return absl::StrJoin(labels, ".");
+      return reader.ReadQNameInto(qname, num_jumps + 1);
     }
 
     // NOTE: last byte in label list.
-    else if (chunk == 0) { break; }
+    else if (chunk == 0) {
+      pos_ += 1;
+      break;
+    }
 
-    // NOTE: read from stream directly.
+    // NOTE: read from stream directly, the whole label at once.
     else {
-      std::string label;
       const uint8_t label_len = chunk;
-      label.reserve(label_len);
-      // SPEEDUP: read whole string.
-      for (uint8_t i = 0; i < label_len; i++) {
-        ASSIGN_OR_RETURN(const uint8_t c, ReadU8());
-        label += c;
-      }
-      labels.push_back(label);
+      RETURN_IF_ERROR(CheckRemaining(1 + label_len));
+      if (!qname.empty()) { qname += '.'; }
+      qname.append(reinterpret_cast<const char*>(bytes_.data() + pos_ + 1), label_len);
+      pos_ += 1 + label_len;
     }
   }
-  return absl::StrJoin(labels, ".");
+  return absl::OkStatus();
 }
 
-absl::Status BufferWriter::WriteU8(const uint8_t x) {
-  if (cursor_ > &bytes_.back()) {
+absl::Status BufferWriter::CheckRemaining(const size_t n) const {
+  if (pos_ > bytes_.size() || bytes_.size() - pos_ < n) {
     return absl::InternalError("Attempting to write beyond buffer limit!");
   }
-  *cursor_ = x;
-  cursor_++;
+  return absl::OkStatus();
+}
+
+absl::Status BufferWriter::WriteU8(const uint8_t x) {
+  RETURN_IF_ERROR(CheckRemaining(1));
+  bytes_[pos_++] = x;
   return absl::OkStatus();
 }
 
 absl::Status BufferWriter::WriteU16(const uint16_t x) {
-  RETURN_IF_ERROR(WriteU8(x >> 8));
-  RETURN_IF_ERROR(WriteU8(x >> 0));
+  RETURN_IF_ERROR(CheckRemaining(2));
+  StoreBigEndian16(bytes_.data() + pos_, x);
+  pos_ += 2;
   return absl::OkStatus();
 }
 
 absl::Status BufferWriter::WriteU32(const uint32_t x) {
-  RETURN_IF_ERROR(WriteU8(x >> 24));
-  RETURN_IF_ERROR(WriteU8(x >> 16));
-  RETURN_IF_ERROR(WriteU8(x >> 8));
-  RETURN_IF_ERROR(WriteU8(x >> 0));
+  RETURN_IF_ERROR(CheckRemaining(4));
+  StoreBigEndian32(bytes_.data() + pos_, x);
+  pos_ += 4;
   return absl::OkStatus();
 }
 
-absl::StatusOr<uint16_t> BufferWriter::WriteQName(const std::string& qname) {
-  uint16_t length = 0;
-  bool jumped = false;
-  std::vector<std::string> labels = absl::StrSplit(qname, ".");
-  for (size_t i = 0; i < labels.size(); i++) {
-    std::string merged_label = absl::StrJoin(labels.begin() + i, labels.end(), ".");
-    if (auto it = label_map_.find(merged_label); it != label_map_.end()) {
-      uint16_t jump = 0xc000 | it->second;
-      RETURN_IF_ERROR(WriteU16(jump));
-      length++;
-      jumped = true;
-      break;
+absl::Status BufferWriter::PatchU16(const size_t pos, const uint16_t x) {
+  if (pos + 2 > pos_) {
+    return absl::InternalError("Attempting to patch beyond written bytes!");
+  }
+  StoreBigEndian16(bytes_.data() + pos, x);
+  return absl::OkStatus();
+}
+
+absl::Status BufferWriter::WriteBytes(const uint8_t* data, const size_t n) {
+  RETURN_IF_ERROR(CheckRemaining(n));
+  memcpy(bytes_.data() + pos_, data, n);
+  pos_ += n;
+  return absl::OkStatus();
+}
+
+namespace {
+
+// NOTE: FNV-1a over a single label (length byte included), seeded with the
+// hash of the labels to its right so that every suffix has its own hash.
+uint32_t HashLabel(uint32_t seed, std::string_view label) {
+  static constexpr uint32_t kPrime = 16777619u;
+  uint32_t hash = seed;
+  hash = (hash ^ (uint8_t) label.size()) * kPrime;
+  for (char c : label) { hash = (hash ^ (uint8_t) c) * kPrime; }
+  return hash;
+}
+
+} // namespace
+
+bool BufferWriter::SuffixMatches(
+    size_t offset, std::string_view qname,
+    const std::array<QNameLabel, kMaxLabels>& labels,
+    size_t first_label, size_t num_labels) const {
+  // NOTE: the buffer only ever contains names we wrote ourselves, and those
+  // only point backwards, but bound the walk anyway.
+  size_t num_jumps = 0;
+  for (size_t i = first_label; i < num_labels; i++) {
+    while (offset < pos_ && (bytes_[offset] & 0xc0) == 0xc0) {
+      if (++num_jumps > kMaxLabels || offset + 1 >= pos_) { return false; }
+      offset = LoadBigEndian16(bytes_.data() + offset) ^ 0xc000;
     }
-    label_map_[merged_label] = (uint16_t) (cursor_ - bytes_.begin());
-    RETURN_IF_ERROR(WriteU8(labels[i].size()));
-    for (uint8_t c : labels[i]) {
-      RETURN_IF_ERROR(WriteU8(c));
+    const QNameLabel& label = labels[i];
+    if (offset + 1 + label.length > pos_) { return false; }
+    if (bytes_[offset] != label.length) { return false; }
+    if (memcmp(bytes_.data() + offset + 1, qname.data() + label.start, label.length) != 0) {
+      return false;
     }
-    length += labels[i].size() + 1;
+    offset += 1 + label.length;
   }
-  if (!jumped) {
-    RETURN_IF_ERROR(WriteU8(0));
-    length++;
+  while (offset < pos_ && (bytes_[offset] & 0xc0) == 0xc0) {
+    if (++num_jumps > kMaxLabels || offset + 1 >= pos_) { return false; }
+    offset = LoadBigEndian16(bytes_.data() + offset) ^ 0xc000;
   }
-  return length;
+  return offset < pos_ && bytes_[offset] == 0;
+}
+
+absl::StatusOr<uint16_t> BufferWriter::WriteQName(std::string_view qname, bool compress) {
+  static const size_t kMaxQNameLength = 253;
+  static const size_t kMaxLabelLength = 63;
+  if (qname.size() > kMaxQNameLength) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("QName exceeds maximum length: ", qname.size()));
+  }
+  if (!qname.empty() && qname.back() == '.') { qname.remove_suffix(1); }
+
+  std::array<QNameLabel, kMaxLabels> labels;
+  size_t num_labels = 0;
+  for (size_t start = 0; start < qname.size();) {
+    size_t end = qname.find('.', start);
+    if (end == std::string_view::npos) { end = qname.size(); }
+    if (end == start || end - start > kMaxLabelLength) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid label length in qname: ", std::string(qname)));
+    }
+    labels[num_labels++] = QNameLabel {
+      .start = (uint8_t) start,
+      .length = (uint8_t) (end - start),
+    };
+    start = end + 1;
+  }
+
+  std::array<uint32_t, kMaxLabels> suffix_hashes;
+  uint32_t hash = 2166136261u;
+  for (size_t i = num_labels; i > 0; i--) {
+    const QNameLabel& label = labels[i - 1];
+    hash = HashLabel(hash, qname.substr(label.start, label.length));
+    suffix_hashes[i - 1] = hash;
+  }
+
+  const size_t start_pos = pos_;
+  for (size_t i = 0; i < num_labels; i++) {
+    for (size_t j = 0; compress && j < num_compression_entries_; j++) {
+      const CompressionEntry& entry = compression_table_[j];
+      if (entry.hash != suffix_hashes[i]) { continue; }
+      if (!SuffixMatches(entry.offset, qname, labels, i, num_labels)) { continue; }
+      RETURN_IF_ERROR(WriteU16(0xc000 | entry.offset));
+      return (uint16_t) (pos_ - start_pos);
+    }
+    // NOTE: pointers only have 14 bits of offset.
+    if (num_compression_entries_ < kMaxCompressionEntries && pos_ < 0x4000) {
+      compression_table_[num_compression_entries_++] = CompressionEntry {
+        .hash = suffix_hashes[i],
+        .offset = (uint16_t) pos_,
+      };
+    }
+    const QNameLabel& label = labels[i];
+    RETURN_IF_ERROR(CheckRemaining(1 + label.length));
+    bytes_[pos_] = label.length;
+    memcpy(bytes_.data() + pos_ + 1, qname.data() + label.start, label.length);
+    pos_ += 1 + label.length;
+  }
+  RETURN_IF_ERROR(WriteU8(0));
+  return (uint16_t) (pos_ - start_pos);
 }
 
 ResponseCode ResponseCodeFromByte(const uint8_t byte) {
@@ -177,38 +296,22 @@ std::string ResponseCodeToString(const ResponseCode code) {
   }
 }
 
+// NOTE: unknown types are passed through as is, see QueryType.
 QueryType QueryTypeFromShort(const uint16_t x) {
-  using enum QueryType;
-  switch (x) {
-    case 1: return A;
-    case 2: return NS;
-    case 5: return CNAME;
-    case 15: return MX;
-    case 28: return AAAA;
-    case 256: return URI;
-    default: {
-      LOG(WARNING) << "Observed unknown QueryType: " << x;
-      return static_cast<QueryType>(x);
-    }
-  }
+  return static_cast<QueryType>(x);
 }
 
 uint16_t QueryTypeToShort(const QueryType type) {
   return static_cast<uint16_t>(type);
 }
 
+// NOTE: types without a codec are named as in RFC 3597, e.g. TYPE65.
 std::string QueryTypeToString(const QueryType type) {
-  using enum QueryType;
-  switch (type) {
-    case UNKNOWN: return "UNKNOWN";
-    case A: return "A";
-    case NS: return "NS";
-    case CNAME: return "CNAME";
-    case MX: return "MX";
-    case AAAA: return "AAAA";
-    case URI: return "URI";
-    default: CHECK(false); return "";
+  const size_t index = RdataCodecIndex(type);
+  if (index == 0 && type != QueryType::UNKNOWN) {
+    return absl::StrCat("TYPE", QueryTypeToShort(type));
   }
+  return std::string(kRdataCodecs[index].name);
 }
 
 absl::StatusOr<Header> Header::FromBytes(
@@ -296,10 +399,11 @@ std::string Header::DebugString() const {
   return result;
 }
 
-absl::StatusOr<Question> Question::FromBytes(BufferReader& reader) {
-  Question question = {};
+absl::StatusOr<Question> Question::FromBytes(
+    BufferReader& reader, std::pmr::memory_resource* resource) {
+  Question question(resource);
   {
-    ASSIGN_OR_RETURN(question.qname, reader.ReadQName());
+    ASSIGN_OR_RETURN(question.qname, reader.ReadQName(resource));
     ASSIGN_OR_RETURN(const uint16_t qtype_raw, reader.ReadU16());
     question.qtype = QueryTypeFromShort(qtype_raw);
     ASSIGN_OR_RETURN(question.dns_class, reader.ReadU16());
@@ -324,157 +428,45 @@ std::string Question::DebugString() const {
   return result;
 }
 
-absl::StatusOr<Record> Record::FromBytes(BufferReader& reader) {
-  Record answer = {};
+Record::Record(const Record& other, const allocator_type& alloc)
+  : qname(other.qname, alloc), qtype(other.qtype), dns_class(other.dns_class),
+    ttl(other.ttl), data(kRdataCodecs[other.data.index()].copy(other.data, alloc)) {}
+
+// NOTE: strings are only stolen if the allocators compare equal, otherwise
+// this degrades to a copy into the new allocator.
+Record::Record(Record&& other, const allocator_type& alloc)
+  : Record(other.qname.get_allocator() == alloc ? std::move(other) : Record(other, alloc)) {}
+
+absl::StatusOr<Record> Record::FromBytes(
+    BufferReader& reader, std::pmr::memory_resource* resource) {
+  Record answer(resource);
   uint16_t length = 0;
   {
-    ASSIGN_OR_RETURN(answer.qname, reader.ReadQName());
+    ASSIGN_OR_RETURN(answer.qname, reader.ReadQName(resource));
     ASSIGN_OR_RETURN(const uint16_t qtype_raw, reader.ReadU16());
     answer.qtype = QueryTypeFromShort(qtype_raw);
     ASSIGN_OR_RETURN(answer.dns_class, reader.ReadU16());
     ASSIGN_OR_RETURN(answer.ttl, reader.ReadU32());
     ASSIGN_OR_RETURN(length, reader.ReadU16());
   }
-  switch (answer.qtype) {
-    case QueryType::A: {
-      if (length != 4) {
-        LOG(WARNING) << "Unexpected length for type A. Expected 4, got: " << length;
-      }
-      Record::A a = {};
-      ASSIGN_OR_RETURN(a.ip_address[0], reader.ReadU8());
-      ASSIGN_OR_RETURN(a.ip_address[1], reader.ReadU8());
-      ASSIGN_OR_RETURN(a.ip_address[2], reader.ReadU8());
-      ASSIGN_OR_RETURN(a.ip_address[3], reader.ReadU8());
-      answer.data = std::move(a);
-    } break;
-    case QueryType::NS: {
-      Record::NS ns = {};
-      ASSIGN_OR_RETURN(ns.host, reader.ReadQName());
-      answer.data = std::move(ns);
-    } break;
-    case QueryType::CNAME: {
-      Record::CNAME cname = {};
-      ASSIGN_OR_RETURN(cname.host, reader.ReadQName());
-      answer.data = std::move(cname);
-    } break;
-    case QueryType::MX: {
-      Record::MX mx = {};
-      ASSIGN_OR_RETURN(mx.priority, reader.ReadU16());
-      ASSIGN_OR_RETURN(mx.host, reader.ReadQName());
-      answer.data = std::move(mx);
-    } break;
-    case QueryType::AAAA: {
-      if (length != 16) {
-        LOG(WARNING) << "Unexpected length for type AAAA. Expected 16, got: " << length;
-      }
-      Record::AAAA aaaa = {};
-      ASSIGN_OR_RETURN(aaaa.ip_address[0], reader.ReadU16());
-      ASSIGN_OR_RETURN(aaaa.ip_address[1], reader.ReadU16());
-      ASSIGN_OR_RETURN(aaaa.ip_address[2], reader.ReadU16());
-      ASSIGN_OR_RETURN(aaaa.ip_address[3], reader.ReadU16());
-      ASSIGN_OR_RETURN(aaaa.ip_address[4], reader.ReadU16());
-      ASSIGN_OR_RETURN(aaaa.ip_address[5], reader.ReadU16());
-      ASSIGN_OR_RETURN(aaaa.ip_address[6], reader.ReadU16());
-      ASSIGN_OR_RETURN(aaaa.ip_address[7], reader.ReadU16());
-      answer.data = std::move(aaaa);
-    } break;
-    case QueryType::URI: {
-      Record::URI uri = {};
-      ASSIGN_OR_RETURN(uri.priority, reader.ReadU16());
-      ASSIGN_OR_RETURN(uri.weight, reader.ReadU16());
-      ASSIGN_OR_RETURN(uri.target, reader.ReadQName());
-      answer.data = std::move(uri);
-    } break;
-    case QueryType::UNKNOWN:
-    default: {
-      Record::UNKNOWN unknown = {};
-      unknown.bytes.reserve(length);
-      for (size_t i = 0; i < length; i++) {
-        ASSIGN_OR_RETURN(uint8_t byte, reader.ReadU8());
-        unknown.bytes.push_back(byte);
-      }
-      answer.data = unknown;
-    } break;
-  }
+  RETURN_IF_ERROR(RdataCodecFor(answer.qtype).decode(reader, length, resource, answer.data));
   return answer;
 }
 
 absl::Status Record::ToBytes(BufferWriter& writer) const {
+  const RdataCodec& codec = kRdataCodecs[data.index()];
+  // NOTE: UNKNOWN data may carry any type, the raw bytes are written as is.
+  if (codec.type != QueryType::UNKNOWN && codec.type != qtype) {
+    return absl::InternalError(absl::StrCat(
+          "Record of type ", QueryTypeToString(qtype), " holds ", codec.name, " data."));
+  }
   {
     RETURN_IF_ERROR(writer.WriteQName(qname).status());
     RETURN_IF_ERROR(writer.WriteU16(QueryTypeToShort(qtype)));
     RETURN_IF_ERROR(writer.WriteU16(dns_class));
     RETURN_IF_ERROR(writer.WriteU32(ttl));
   }
-  switch (qtype) {
-    case QueryType::A: {
-      CHECK(std::holds_alternative<Record::A>(data));
-      const Record::A& a = std::get<Record::A>(data);
-      RETURN_IF_ERROR(writer.WriteU16(4));
-      RETURN_IF_ERROR(writer.WriteU8(a.ip_address[0]));
-      RETURN_IF_ERROR(writer.WriteU8(a.ip_address[1]));
-      RETURN_IF_ERROR(writer.WriteU8(a.ip_address[2]));
-      RETURN_IF_ERROR(writer.WriteU8(a.ip_address[3]));
-    } break;
-    case QueryType::NS: {
-      CHECK(std::holds_alternative<Record::NS>(data));
-      const Record::NS& ns = std::get<Record::NS>(data);
-      BufferWriter len_ptr = writer;
-      RETURN_IF_ERROR(writer.WriteU16(0)); // NOTE: write length after label block size is known.
-      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(ns.host));
-      RETURN_IF_ERROR(len_ptr.WriteU16(len));
-    } break;
-    case QueryType::CNAME: {
-      CHECK(std::holds_alternative<Record::CNAME>(data));
-      const Record::CNAME& cname = std::get<Record::CNAME>(data);
-      BufferWriter len_ptr = writer;
-      RETURN_IF_ERROR(writer.WriteU16(0));
-      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(cname.host));
-      RETURN_IF_ERROR(len_ptr.WriteU16(len));
-    } break;
-    case QueryType::MX: {
-      CHECK(std::holds_alternative<Record::MX>(data));
-      const Record::MX& mx = std::get<Record::MX>(data);
-      BufferWriter len_ptr = writer;
-      RETURN_IF_ERROR(writer.WriteU16(0));
-      RETURN_IF_ERROR(writer.WriteU16(mx.priority));
-      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(mx.host));
-      RETURN_IF_ERROR(len_ptr.WriteU16(2 + len));
-    } break;
-    case QueryType::AAAA: {
-      CHECK(std::holds_alternative<Record::AAAA>(data));
-      const Record::AAAA& aaaa = std::get<Record::AAAA>(data);
-      RETURN_IF_ERROR(writer.WriteU16(16));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[0]));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[1]));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[2]));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[3]));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[4]));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[5]));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[6]));
-      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[7]));
-    } break;
-    case QueryType::URI: {
-      CHECK(std::holds_alternative<Record::URI>(data));
-      const Record::URI& uri = std::get<Record::URI>(data);
-      BufferWriter len_ptr = writer;
-      RETURN_IF_ERROR(writer.WriteU16(0));
-      RETURN_IF_ERROR(writer.WriteU16(uri.priority));
-      RETURN_IF_ERROR(writer.WriteU16(uri.weight));
-      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(uri.target));
-      RETURN_IF_ERROR(len_ptr.WriteU16(4 + len));
-    } break;
-    case QueryType::UNKNOWN:
-    default: {
-      CHECK(std::holds_alternative<Record::UNKNOWN>(data));
-      const Record::UNKNOWN& unknown = std::get<Record::UNKNOWN>(data);
-      RETURN_IF_ERROR(writer.WriteU16(unknown.bytes.size()));
-      for (size_t i = 0; i < unknown.bytes.size(); i++) {
-        RETURN_IF_ERROR(writer.WriteU8(unknown.bytes[i]));
-      }
-    } break;
-  }
-  return absl::OkStatus();
+  return codec.encode(data, writer);
 }
 
 std::string Record::DebugString() const {
@@ -484,52 +476,15 @@ std::string Record::DebugString() const {
   result += absl::StrCat("qtype: ", QueryTypeToString(qtype), " ");
   result += absl::StrCat("dns_class: ", dns_class, " ");
   result += absl::StrCat("ttl: ", ttl, " ");
-  switch (qtype) {
-    case QueryType::A: {
-      CHECK(std::holds_alternative<Record::A>(data));
-      const std::array<uint8_t, 4>& addr = std::get<Record::A>(data).ip_address;
-      result += absl::StrCat("IPv4: ", addr[0], ".", addr[1], ".", addr[2], ".", addr[3], " ");
-    } break;
-    case QueryType::NS: {
-      CHECK(std::holds_alternative<Record::NS>(data));
-      result += absl::StrCat("NS host: ", std::get<Record::NS>(data).host, " ");
-    } break;
-    case QueryType::CNAME: {
-      CHECK(std::holds_alternative<Record::CNAME>(data));
-      result += absl::StrCat("CNAME host: ", std::get<Record::CNAME>(data).host, " ");
-    } break;
-    case QueryType::MX: {
-      CHECK(std::holds_alternative<Record::MX>(data));
-      result += absl::StrCat("MX priority: ", std::get<Record::MX>(data).priority, " ");
-      result += absl::StrCat("MX host: ", std::get<Record::MX>(data).host, " ");
-    } break;
-    case QueryType::AAAA: {
-      CHECK(std::holds_alternative<Record::AAAA>(data));
-      const std::array<uint16_t, 8>& addr = std::get<Record::AAAA>(data).ip_address;
-      result += absl::StrFormat(
-          "IPv6: %0x:%0x:%0x:%0x:%0x:%0x:%0x:%0x ",
-          addr[0], addr[1], addr[2], addr[3], addr[4], addr[5], addr[6], addr[7]);
-    } break;
-    case QueryType::URI: {
-      CHECK(std::holds_alternative<Record::URI>(data));
-      result += absl::StrCat("URI priority: ", std::get<Record::URI>(data).priority, " ");
-      result += absl::StrCat("URI weight: ", std::get<Record::URI>(data).weight, " ");
-      result += absl::StrCat("URI target: ", std::get<Record::URI>(data).target, " ");
-    } break;
-    case QueryType::UNKNOWN:
-    default: {
-      CHECK(std::holds_alternative<Record::UNKNOWN>(data));
-      result += absl::StrCat("Unknown byte length: ", std::get<Record::UNKNOWN>(data).bytes.size(), " ");
-    } break;
-  }
+  kRdataCodecs[data.index()].debug(data, result);
   result += "}";
   return result;
 }
 
 absl::StatusOr<DnsPacket> DnsPacket::FromBytes(
-    const std::array<uint8_t, 512>& bytes) {
+    const std::array<uint8_t, 512>& bytes, std::pmr::memory_resource* resource) {
   BufferReader reader(bytes);
-  DnsPacket packet = {};
+  DnsPacket packet(resource);
 
   uint16_t questions_count, answers_count, authorities_count, additional_count;
   ASSIGN_OR_RETURN(packet.header, Header::FromBytes(
@@ -540,19 +495,19 @@ absl::StatusOr<DnsPacket> DnsPacket::FromBytes(
   packet.additional.reserve(additional_count);
 
   for (size_t i = 0; i < questions_count; i++) {
-    ASSIGN_OR_RETURN(Question question, Question::FromBytes(reader));
+    ASSIGN_OR_RETURN(Question question, Question::FromBytes(reader, resource));
     packet.questions.push_back(std::move(question));
   }
   for (size_t i = 0; i < answers_count; i++) {
-    ASSIGN_OR_RETURN(Record record, Record::FromBytes(reader));
+    ASSIGN_OR_RETURN(Record record, Record::FromBytes(reader, resource));
     packet.answers.push_back(std::move(record));
   }
   for (size_t i = 0; i < authorities_count; i++) {
-    ASSIGN_OR_RETURN(Record record, Record::FromBytes(reader));
+    ASSIGN_OR_RETURN(Record record, Record::FromBytes(reader, resource));
     packet.authorities.push_back(std::move(record));
   }
   for (size_t i = 0; i < additional_count; i++) {
-    ASSIGN_OR_RETURN(Record record, Record::FromBytes(reader));
+    ASSIGN_OR_RETURN(Record record, Record::FromBytes(reader, resource));
     packet.additional.push_back(std::move(record));
   }
 
@@ -565,8 +520,8 @@ absl::StatusOr<uint16_t> DnsPacket::FromBytesIdOnly(
   return reader.ReadU16();
 }
 
-absl::StatusOr<std::array<uint8_t, 512>> DnsPacket::ToBytes() const {
-  std::array<uint8_t, 512> bytes = {};
+absl::StatusOr<std::span<const uint8_t>> DnsPacket::ToBytes(
+    std::array<uint8_t, 512>& bytes) const {
   BufferWriter writer(bytes);
   RETURN_IF_ERROR(header.ToBytes(
         writer, questions.size(), answers.size(), authorities.size(), additional.size()));
@@ -582,7 +537,7 @@ absl::StatusOr<std::array<uint8_t, 512>> DnsPacket::ToBytes() const {
   for (const Record& record : additional) {
     RETURN_IF_ERROR(record.ToBytes(writer));
   }
-  return bytes;
+  return writer.Written();
 }
 
 std::string DnsPacket::DebugString() const {
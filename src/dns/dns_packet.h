@@ -3,48 +3,103 @@
 
 #include <array>
 #include <cstdint>
+#include <memory_resource>
+#include <span>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <variant>
 #include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
-#include "absl/container/btree_map.h"
 
 // This file interfaces with the DNS protocol. E.g. encoding / decoding DNS packets.
+//
+// NOTE: Question, Record and DnsPacket are allocator-aware (std::pmr), so that a
+// request can be decoded and its response built entirely out of a per-request
+// arena. Types default to the global heap when no memory resource is given.
 
 namespace tiny_dns {
 
 class BufferReader {
  public:
   BufferReader(const std::array<uint8_t, 512>& bytes, size_t pos = 0)
-    : bytes_(bytes), cursor_(bytes_.data() + pos) {}
+    : bytes_(bytes), pos_(pos) {}
 
   absl::StatusOr<uint8_t> ReadU8();
   absl::StatusOr<uint16_t> ReadU16();
   absl::StatusOr<uint32_t> ReadU32();
-  absl::StatusOr<std::string> ReadQName(size_t num_jumps = 0);
+  absl::Status ReadBytes(uint8_t* out, size_t n);
+  absl::StatusOr<std::pmr::string> ReadQName(
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+  size_t Position() const { return pos_; }
+  size_t Remaining() const {
+    return pos_ < bytes_.size() ? bytes_.size() - pos_ : 0;
+  }
 
  private:
+  // NOTE: fields are bounds checked once up front, not per byte.
+  absl::Status CheckRemaining(size_t n) const;
+  absl::Status ReadQNameInto(std::pmr::string& qname, size_t num_jumps);
+
   const std::array<uint8_t, 512>& bytes_;
-  const uint8_t* cursor_;
+  size_t pos_;
 };
 
 class BufferWriter {
  public:
   BufferWriter(std::array<uint8_t, 512>& bytes, size_t pos = 0)
-    : bytes_(bytes), cursor_(bytes_.data() + pos), label_map_() {}
+    : bytes_(bytes), pos_(pos), num_compression_entries_(0) {}
 
   absl::Status WriteU8(uint8_t x);
   absl::Status WriteU16(uint16_t x);
   absl::Status WriteU32(uint32_t x);
-  absl::StatusOr<uint16_t> WriteQName(const std::string& qname);
+  absl::Status WriteBytes(const uint8_t* data, size_t n);
+  // NOTE: overwrites a previously written u16, e.g. a length prefix that is
+  // only known once what follows it has been written.
+  absl::Status PatchU16(size_t pos, uint16_t x);
+  // NOTE: returns the number of bytes written. If compress is set, compresses
+  // against names previously written by this writer where possible.
+  absl::StatusOr<uint16_t> WriteQName(std::string_view qname, bool compress = true);
+
+  size_t Position() const { return pos_; }
+
+  // NOTE: the bytes written so far, i.e. the encoded length of the packet
+  // (assuming the writer started at the beginning of the buffer).
+  std::span<const uint8_t> Written() const {
+    return std::span<const uint8_t>(bytes_.data(), pos_);
+  }
 
  private:
+  // NOTE: a qname is at most 253 characters, so at most 127 labels.
+  static constexpr size_t kMaxLabels = 127;
+  struct QNameLabel {
+    uint8_t start;
+    uint8_t length;
+  };
+
+  // NOTE: name compression table. Rather than storing suffix strings, each
+  // entry is the hash of a label sequence and the offset in the output buffer
+  // it was written at. Hash matches are verified against the buffer itself.
+  // Names written once the table is full are simply not compressed against.
+  static constexpr size_t kMaxCompressionEntries = 32;
+  struct CompressionEntry {
+    uint32_t hash;
+    uint16_t offset;
+  };
+
+  absl::Status CheckRemaining(size_t n) const;
+  bool SuffixMatches(
+      size_t offset, std::string_view qname,
+      const std::array<QNameLabel, kMaxLabels>& labels,
+      size_t first_label, size_t num_labels) const;
+
   std::array<uint8_t, 512>& bytes_;
-  uint8_t* cursor_;
-  absl::btree_map<std::string, uint16_t> label_map_;
+  size_t pos_;
+  std::array<CompressionEntry, kMaxCompressionEntries> compression_table_;
+  size_t num_compression_entries_;
 };
 
 enum class ResponseCode : uint8_t {
@@ -67,8 +122,12 @@ enum class QueryType : uint16_t {
   A = 1,
   NS = 2,
   CNAME = 5,
+  SOA = 6,
+  PTR = 12,
   MX = 15,
+  TXT = 16,
   AAAA = 28,
+  SRV = 33,
   URI = 256,
 };
 QueryType QueryTypeFromShort(uint16_t x);
@@ -100,30 +159,58 @@ struct Header {
 };
 
 struct Question {
-  static absl::StatusOr<Question> FromBytes(BufferReader& reader);
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  Question() = default;
+  explicit Question(const allocator_type& alloc) : qname(alloc) {}
+  Question(const Question& other, const allocator_type& alloc)
+    : qname(other.qname, alloc), qtype(other.qtype), dns_class(other.dns_class) {}
+  Question(Question&& other, const allocator_type& alloc)
+    : qname(std::move(other.qname), alloc), qtype(other.qtype),
+      dns_class(other.dns_class) {}
+  Question(const Question&) = default;
+  Question(Question&&) = default;
+  Question& operator=(const Question&) = default;
+  Question& operator=(Question&&) = default;
+
+  static absl::StatusOr<Question> FromBytes(
+      BufferReader& reader,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
   absl::Status ToBytes(BufferWriter& writer) const;
   std::string DebugString() const;
 
-  std::string qname;
-  QueryType qtype;
+  std::pmr::string qname;
+  QueryType qtype = QueryType::UNKNOWN;
   uint16_t dns_class = 1;
 };
 
 struct Record {
-  static absl::StatusOr<Record> FromBytes(BufferReader& reader);
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  Record() = default;
+  explicit Record(const allocator_type& alloc) : qname(alloc) {}
+  Record(const Record& other, const allocator_type& alloc);
+  Record(Record&& other, const allocator_type& alloc);
+  Record(const Record&) = default;
+  Record(Record&&) = default;
+  Record& operator=(const Record&) = default;
+  Record& operator=(Record&&) = default;
+
+  static absl::StatusOr<Record> FromBytes(
+      BufferReader& reader,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
   absl::Status ToBytes(BufferWriter& writer) const;
   std::string DebugString() const;
 
-  std::string qname;
+  std::pmr::string qname;
   // NOTE: preserved separately from data to keep unknown qtype values.
   // And because switch on variant is garbage.
-  QueryType qtype;
+  QueryType qtype = QueryType::UNKNOWN;
   uint16_t dns_class = 1;
-  uint32_t ttl;
-  time_t retrieval_time;
+  uint32_t ttl = 0;
 
   struct UNKNOWN {
-    std::vector<uint8_t> bytes;
+    std::pmr::vector<uint8_t> bytes;
     bool operator==(const UNKNOWN& other) const {
       return bytes == other.bytes;
     }
@@ -135,20 +222,20 @@ struct Record {
     }
   };
   struct NS {
-    std::string host;
+    std::pmr::string host;
     bool operator==(const NS& other) const {
       return host == other.host;
     }
   };
   struct CNAME {
-    std::string host;
+    std::pmr::string host;
     bool operator==(const CNAME& other) const {
       return host == other.host;
     }
   };
   struct MX {
     uint16_t priority;
-    std::string host;
+    std::pmr::string host;
     bool operator==(const MX& other) const {
       return priority == other.priority && host == other.host;
     }
@@ -162,29 +249,67 @@ struct Record {
   struct URI {
     uint16_t priority;
     uint16_t weight;
-    std::string target;
+    std::pmr::string target;
     bool operator==(const URI& other) const {
       return
         priority == other.priority && weight == other.weight
         && target == other.target;
     }
   };
-  std::variant<UNKNOWN, A, NS, CNAME, MX, AAAA, URI> data;
+  struct SOA {
+    std::pmr::string mname;
+    std::pmr::string rname;
+    uint32_t serial;
+    uint32_t refresh;
+    uint32_t retry;
+    uint32_t expire;
+    uint32_t minimum;
+    bool operator==(const SOA& other) const = default;
+  };
+  struct PTR {
+    std::pmr::string host;
+    bool operator==(const PTR& other) const = default;
+  };
+  // NOTE: kept as the raw sequence of <character-string>s.
+  struct TXT {
+    std::pmr::vector<uint8_t> bytes;
+    bool operator==(const TXT& other) const = default;
+  };
+  struct SRV {
+    uint16_t priority;
+    uint16_t weight;
+    uint16_t port;
+    std::pmr::string target;
+    bool operator==(const SRV& other) const = default;
+  };
+  // NOTE: wire layouts for each of these live in rdata_codec.h.
+  using Data = std::variant<UNKNOWN, A, NS, CNAME, MX, AAAA, URI, SOA, PTR, TXT, SRV>;
+  Data data;
 };
 
 struct DnsPacket {
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  DnsPacket() = default;
+  explicit DnsPacket(const allocator_type& alloc)
+    : questions(alloc), answers(alloc), authorities(alloc), additional(alloc) {}
+
   static absl::StatusOr<DnsPacket> FromBytes(
-      const std::array<uint8_t, 512>& bytes);
+      const std::array<uint8_t, 512>& bytes,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
   static absl::StatusOr<uint16_t> FromBytesIdOnly(
       const std::array<uint8_t, 512>& bytes);
-  absl::StatusOr<std::array<uint8_t, 512>> ToBytes() const;
+  // NOTE: encodes into the provided buffer and returns the encoded prefix of it.
+  // Only the returned span should be put on the wire.
+  absl::StatusOr<std::span<const uint8_t>> ToBytes(
+      std::array<uint8_t, 512>& bytes) const;
   std::string DebugString() const;
 
-  Header header;
-  std::vector<Question> questions;
-  std::vector<Record> answers;
-  std::vector<Record> authorities;
-  std::vector<Record> additional;
+  Header header = {};
+  std::pmr::vector<Question> questions;
+  std::pmr::vector<Record> answers;
+  std::pmr::vector<Record> authorities;
+  std::pmr::vector<Record> additional;
 };
 
 } // tiny_dns
@@ -0,0 +1,428 @@
+#include "src/dns/dns_packet.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "benchmark/benchmark.h"
+#include "src/dns/legacy_record_codec.h"
+#include "src/dns/test_util.h"
+
+// Benchmarks for the dns_packet codec. Every benchmark reports ns/op, and
+// where it makes sense bytes/s over the wire bytes processed and the number of
+// global heap allocations per op ("allocs/op").
+//
+// Corpora:
+// * Single question queries, short and long qnames.
+// * Responses with several compressed answers, CNAME chains, and a mix of MX,
+//   URI and AAAA answers with additional records.
+// * A response filled up to the 512 byte limit.
+// * Adversarial names: maximum length names, and pointer chains right up to
+//   the jump limit (and one past it).
+
+namespace tiny_dns {
+namespace {
+
+// NOTE: construct an AllocationCounter before the timing loop, and report it
+// after, to get the average number of allocations per iteration.
+void ReportAllocations(const AllocationCounter& allocations, benchmark::State& state) {
+  state.counters["allocs/op"] = benchmark::Counter(
+      static_cast<double>(allocations.Count()) / state.iterations());
+}
+
+Record MakeRecord(std::string qname, QueryType qtype, Record::Data data) {
+  Record record = {};
+  record.qname = std::move(qname);
+  record.qtype = qtype;
+  record.ttl = 300;
+  record.data = std::move(data);
+  return record;
+}
+
+DnsPacket MakeQuery(std::string_view qname, QueryType qtype) {
+  return CreateRequestPacket(qname, qtype, /*recursion_desired=*/true, 0x862a);
+}
+
+DnsPacket MakeResponse(std::string_view qname, QueryType qtype) {
+  DnsPacket packet = MakeQuery(qname, qtype);
+  packet.header.query_response = true;
+  packet.header.recursion_available = true;
+  return packet;
+}
+
+DnsPacket QueryShort() {
+  return MakeQuery("google.com", QueryType::A);
+}
+
+DnsPacket QueryLong() {
+  return MakeQuery("a-service-name.team.region-1.cluster.internal.example.com", QueryType::AAAA);
+}
+
+DnsPacket ResponseCompressedA() {
+  DnsPacket packet = MakeResponse("www.google.com", QueryType::A);
+  for (uint8_t i = 0; i < 4; i++) {
+    packet.answers.push_back(MakeRecord(
+          "www.google.com", QueryType::A, Record::A { .ip_address = {142, 250, 72, i} }));
+  }
+  return packet;
+}
+
+DnsPacket ResponseCnameChain() {
+  DnsPacket packet = MakeResponse("www.example.com", QueryType::A);
+  packet.answers.push_back(MakeRecord(
+        "www.example.com", QueryType::CNAME, Record::CNAME { .host = "edge.cdn.example.net" }));
+  packet.answers.push_back(MakeRecord(
+        "edge.cdn.example.net", QueryType::CNAME,
+        Record::CNAME { .host = "edge-7.pop.cdn.example.net" }));
+  packet.answers.push_back(MakeRecord(
+        "edge-7.pop.cdn.example.net", QueryType::A, Record::A { .ip_address = {93, 184, 216, 34} }));
+  return packet;
+}
+
+DnsPacket ResponseMixed() {
+  DnsPacket packet = MakeResponse("example.com", QueryType::MX);
+  packet.answers.push_back(MakeRecord(
+        "example.com", QueryType::MX, Record::MX { .priority = 10, .host = "mx1.example.com" }));
+  packet.answers.push_back(MakeRecord(
+        "example.com", QueryType::MX, Record::MX { .priority = 20, .host = "mx2.example.com" }));
+  packet.answers.push_back(MakeRecord(
+        "_grpc.example.com", QueryType::URI,
+        Record::URI { .priority = 1, .weight = 10, .target = "ipv4:10.0.0.1:4000" }));
+  packet.answers.push_back(MakeRecord(
+        "_grpc.example.com", QueryType::URI,
+        Record::URI { .priority = 1, .weight = 10, .target = "ipv4:10.0.0.2:4000" }));
+  packet.additional.push_back(MakeRecord(
+        "mx1.example.com", QueryType::AAAA,
+        Record::AAAA { .ip_address = {0x2001, 0xdb8, 0, 0, 0, 0, 0, 1} }));
+  packet.additional.push_back(MakeRecord(
+        "mx2.example.com", QueryType::AAAA,
+        Record::AAAA { .ip_address = {0x2001, 0xdb8, 0, 0, 0, 0, 0, 2} }));
+  packet.additional.push_back(MakeRecord(
+        "mx1.example.com", QueryType::A, Record::A { .ip_address = {10, 0, 0, 1} }));
+  return packet;
+}
+
+// NOTE: as many distinct-ish answers as fit in 512 bytes.
+DnsPacket ResponseFull() {
+  DnsPacket packet = MakeResponse("svc.internal.example", QueryType::AAAA);
+  for (uint16_t i = 0; i < 16; i++) {
+    packet.answers.push_back(MakeRecord(
+          "svc.internal.example", QueryType::AAAA,
+          Record::AAAA { .ip_address = {0xfd00, 0, 0, 0, 0, 0, 0, i} }));
+  }
+  return packet;
+}
+
+std::array<uint8_t, 512> Encode(const DnsPacket& packet, size_t* size = nullptr) {
+  std::array<uint8_t, 512> bytes = {};
+  const absl::StatusOr<std::span<const uint8_t>> encoded = packet.ToBytes(bytes);
+  CHECK_OK(encoded.status());
+  if (size != nullptr) { *size = encoded->size(); }
+  return bytes;
+}
+
+void BM_FromBytes(benchmark::State& state, DnsPacket (*corpus)()) {
+  size_t size = 0;
+  const std::array<uint8_t, 512> bytes = Encode(corpus(), &size);
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(DnsPacket::FromBytes(bytes));
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK_CAPTURE(BM_FromBytes, query_short, &QueryShort);
+BENCHMARK_CAPTURE(BM_FromBytes, query_long, &QueryLong);
+BENCHMARK_CAPTURE(BM_FromBytes, response_compressed_a, &ResponseCompressedA);
+BENCHMARK_CAPTURE(BM_FromBytes, response_cname_chain, &ResponseCnameChain);
+BENCHMARK_CAPTURE(BM_FromBytes, response_mx_uri_aaaa, &ResponseMixed);
+BENCHMARK_CAPTURE(BM_FromBytes, response_full, &ResponseFull);
+
+void BM_ToBytes(benchmark::State& state, DnsPacket (*corpus)()) {
+  const DnsPacket packet = corpus();
+  size_t size = 0;
+  std::array<uint8_t, 512> bytes = Encode(packet, &size);
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(packet.ToBytes(bytes));
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK_CAPTURE(BM_ToBytes, query_short, &QueryShort);
+BENCHMARK_CAPTURE(BM_ToBytes, query_long, &QueryLong);
+BENCHMARK_CAPTURE(BM_ToBytes, response_compressed_a, &ResponseCompressedA);
+BENCHMARK_CAPTURE(BM_ToBytes, response_cname_chain, &ResponseCnameChain);
+BENCHMARK_CAPTURE(BM_ToBytes, response_mx_uri_aaaa, &ResponseMixed);
+BENCHMARK_CAPTURE(BM_ToBytes, response_full, &ResponseFull);
+
+// NOTE: the same packets, but decoded into a reused arena, as the server does.
+void BM_FromBytesArena(benchmark::State& state, DnsPacket (*corpus)()) {
+  size_t size = 0;
+  const std::array<uint8_t, 512> bytes = Encode(corpus(), &size);
+  std::array<std::byte, 16 * 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(DnsPacket::FromBytes(bytes, &arena));
+    arena.release();
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK_CAPTURE(BM_FromBytesArena, query_long, &QueryLong);
+BENCHMARK_CAPTURE(BM_FromBytesArena, response_mx_uri_aaaa, &ResponseMixed);
+BENCHMARK_CAPTURE(BM_FromBytesArena, response_full, &ResponseFull);
+
+// NOTE: a name and the offset it starts at.
+struct NameCorpus {
+  std::array<uint8_t, 512> bytes;
+  size_t offset;
+  size_t size;
+};
+
+NameCorpus NamePlain() {
+  NameCorpus corpus = { .bytes = {}, .offset = 0, .size = 0 };
+  BufferWriter writer(corpus.bytes);
+  CHECK_OK(writer.WriteQName("alt1.smtp.google.com").status());
+  corpus.size = writer.Position();
+  return corpus;
+}
+
+// NOTE: 127 single character labels, the longest name there is.
+std::string MaxLengthName() {
+  std::string name = "a";
+  for (size_t i = 1; i < 127; i++) { name += ".a"; }
+  return name;
+}
+
+NameCorpus NameMaxLength() {
+  NameCorpus corpus = { .bytes = {}, .offset = 0, .size = 0 };
+  BufferWriter writer(corpus.bytes);
+  CHECK_OK(writer.WriteQName(MaxLengthName()).status());
+  corpus.size = writer.Position();
+  return corpus;
+}
+
+// NOTE: each name is one label followed by a pointer to the previous one,
+// read from the last, so every label costs a jump. depth == 5 is the most
+// the reader allows, 6 is rejected.
+NameCorpus NamePointerChain(size_t depth) {
+  NameCorpus corpus = { .bytes = {}, .offset = 0, .size = 0 };
+  size_t pos = 0;
+  corpus.bytes[pos++] = 3;
+  memcpy(corpus.bytes.data() + pos, "com", 3);
+  pos += 3;
+  corpus.bytes[pos++] = 0;
+  size_t previous = 0;
+  for (size_t i = 0; i < depth; i++) {
+    const size_t start = pos;
+    corpus.bytes[pos++] = 4;
+    memcpy(corpus.bytes.data() + pos, "hop0", 4);
+    corpus.bytes[pos + 3] += i;
+    pos += 4;
+    corpus.bytes[pos++] = 0xc0 | (previous >> 8);
+    corpus.bytes[pos++] = previous;
+    previous = start;
+  }
+  corpus.offset = previous;
+  corpus.size = pos - previous;
+  return corpus;
+}
+NameCorpus NamePointerChainMax() { return NamePointerChain(5); }
+NameCorpus NamePointerChainTooDeep() { return NamePointerChain(6); }
+
+void BM_ReadQName(benchmark::State& state, NameCorpus (*corpus)()) {
+  const NameCorpus name = corpus();
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    BufferReader reader(name.bytes, name.offset);
+    benchmark::DoNotOptimize(reader.ReadQName());
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * name.size);
+}
+BENCHMARK_CAPTURE(BM_ReadQName, plain, &NamePlain);
+BENCHMARK_CAPTURE(BM_ReadQName, max_length, &NameMaxLength);
+BENCHMARK_CAPTURE(BM_ReadQName, pointer_chain_max, &NamePointerChainMax);
+BENCHMARK_CAPTURE(BM_ReadQName, pointer_chain_too_deep, &NamePointerChainTooDeep);
+
+// NOTE: names as they'd appear in a typical MX / CNAME heavy response.
+const std::vector<std::string>& ResponseNames() {
+  static const std::vector<std::string> names = {
+    "google.com", "google.com", "smtp.google.com", "alt1.smtp.google.com",
+    "alt2.smtp.google.com", "www.google.com", "mail.google.com",
+    "alt3.smtp.google.com",
+  };
+  return names;
+}
+
+const std::vector<std::string>& MaxLengthNames() {
+  static const std::vector<std::string> names = { MaxLengthName() };
+  return names;
+}
+
+void BM_WriteQName(benchmark::State& state, const std::vector<std::string>& (*names)()) {
+  std::array<uint8_t, 512> bytes = {};
+  size_t size = 0;
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    BufferWriter writer(bytes, 12);
+    for (const std::string& name : names()) {
+      benchmark::DoNotOptimize(writer.WriteQName(name));
+    }
+    size = writer.Position() - 12;
+    benchmark::DoNotOptimize(bytes);
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * names().size());
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK_CAPTURE(BM_WriteQName, response_names, &ResponseNames);
+BENCHMARK_CAPTURE(BM_WriteQName, max_length, &MaxLengthNames);
+
+// NOTE: the string-keyed compression map BufferWriter used to use, kept here
+// as a baseline to compare against.
+void LegacyWriteQName(
+    std::array<uint8_t, 512>& bytes, size_t& pos,
+    absl::btree_map<std::string, uint16_t>& label_map, const std::string& qname) {
+  std::vector<std::string> labels = absl::StrSplit(qname, ".");
+  for (size_t i = 0; i < labels.size(); i++) {
+    std::string merged_label = absl::StrJoin(labels.begin() + i, labels.end(), ".");
+    if (auto it = label_map.find(merged_label); it != label_map.end()) {
+      const uint16_t jump = 0xc000 | it->second;
+      bytes[pos++] = jump >> 8;
+      bytes[pos++] = jump;
+      return;
+    }
+    label_map[merged_label] = (uint16_t) pos;
+    bytes[pos++] = labels[i].size();
+    memcpy(bytes.data() + pos, labels[i].data(), labels[i].size());
+    pos += labels[i].size();
+  }
+  bytes[pos++] = 0;
+}
+
+void BM_WriteQNameLegacy(benchmark::State& state) {
+  std::array<uint8_t, 512> bytes = {};
+  size_t size = 0;
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    size_t pos = 12;
+    absl::btree_map<std::string, uint16_t> label_map;
+    for (const std::string& name : ResponseNames()) {
+      LegacyWriteQName(bytes, pos, label_map, name);
+    }
+    size = pos - 12;
+    benchmark::DoNotOptimize(bytes);
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * ResponseNames().size());
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_WriteQNameLegacy);
+
+// NOTE: one record of each type both record codecs understand.
+std::vector<Record> MixedRecords() {
+  std::vector<Record> records;
+  records.push_back(MakeRecord(
+        "svc.internal.example", QueryType::A, Record::A { .ip_address = {10, 0, 0, 1} }));
+  records.push_back(MakeRecord(
+        "svc.internal.example", QueryType::NS, Record::NS { .host = "ns1.internal.example" }));
+  records.push_back(MakeRecord(
+        "svc.internal.example", QueryType::CNAME,
+        Record::CNAME { .host = "alias.internal.example" }));
+  records.push_back(MakeRecord(
+        "svc.internal.example", QueryType::MX,
+        Record::MX { .priority = 10, .host = "mail.internal.example" }));
+  records.push_back(MakeRecord(
+        "svc.internal.example", QueryType::AAAA,
+        Record::AAAA { .ip_address = {0x2001, 0xdb8, 0, 0, 0, 0, 0, 1} }));
+  records.push_back(MakeRecord(
+        "svc.internal.example", QueryType::URI,
+        Record::URI { .priority = 1, .weight = 1, .target = "ipv4:10.0.0.1:4000" }));
+  records.push_back(MakeRecord(
+        "svc.internal.example", QueryTypeFromShort(4000),
+        Record::UNKNOWN { .bytes = {1, 2, 3, 4, 5, 6, 7, 8} }));
+  return records;
+}
+
+std::array<uint8_t, 512> EncodeRecords(const std::vector<Record>& records) {
+  std::array<uint8_t, 512> bytes = {};
+  BufferWriter writer(bytes);
+  for (const Record& record : records) { CHECK_OK(record.ToBytes(writer)); }
+  return bytes;
+}
+
+void BM_EncodeRecordsLegacy(benchmark::State& state) {
+  const std::vector<Record> records = MixedRecords();
+  std::array<uint8_t, 512> bytes = {};
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    BufferWriter writer(bytes);
+    for (const Record& record : records) {
+      benchmark::DoNotOptimize(LegacyRecordToBytes(record, writer));
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_EncodeRecordsLegacy);
+
+void BM_EncodeRecords(benchmark::State& state) {
+  const std::vector<Record> records = MixedRecords();
+  std::array<uint8_t, 512> bytes = {};
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    BufferWriter writer(bytes);
+    for (const Record& record : records) {
+      benchmark::DoNotOptimize(record.ToBytes(writer));
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_EncodeRecords);
+
+void BM_DecodeRecordsLegacy(benchmark::State& state) {
+  const std::vector<Record> records = MixedRecords();
+  const std::array<uint8_t, 512> bytes = EncodeRecords(records);
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    BufferReader reader(bytes);
+    for (size_t i = 0; i < records.size(); i++) {
+      benchmark::DoNotOptimize(LegacyRecordFromBytes(reader));
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_DecodeRecordsLegacy);
+
+void BM_DecodeRecords(benchmark::State& state) {
+  const std::vector<Record> records = MixedRecords();
+  const std::array<uint8_t, 512> bytes = EncodeRecords(records);
+  const AllocationCounter allocations;
+  for (auto _ : state) {
+    BufferReader reader(bytes);
+    for (size_t i = 0; i < records.size(); i++) {
+      benchmark::DoNotOptimize(Record::FromBytes(reader));
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_DecodeRecords);
+
+} // namespace
+} // tiny_dns
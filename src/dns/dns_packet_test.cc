@@ -2,7 +2,10 @@
 
 #include <array>
 #include <cstdint>
+#include <memory_resource>
+#include <span>
 #include <utility>
+#include <vector>
 
 #include "absl/status/status_matchers.h"
 #include "gtest/gtest.h"
@@ -22,7 +25,7 @@ TEST(PacketReaderTest, ReadQNameNoJumpSuccess) {
     5, 'w', 'o', 'r', 'l', 'd',
     0 };
   BufferReader reader(bytes);
-  absl::StatusOr<std::string> qname = reader.ReadQName();
+  absl::StatusOr<std::pmr::string> qname = reader.ReadQName();
   EXPECT_THAT(qname, IsOkAndHolds(Eq("hello.world")));
 }
 
@@ -32,17 +35,43 @@ TEST(PacketReaderTest, ReadQNameJumpSuccess) {
     5, 'h', 'e', 'l', 'l', 'o',
     0xc0, 0x00 };
   BufferReader reader(bytes, 6);
-  absl::StatusOr<std::string> qname = reader.ReadQName();
+  absl::StatusOr<std::pmr::string> qname = reader.ReadQName();
   EXPECT_THAT(qname, IsOkAndHolds(Eq("hello.jump")));
 }
 
 TEST(PacketReaderTest, ReadQNameJumpLoopReturnsError) {
   std::array<uint8_t, 512> bytes = {0xc0, 0x00 };
   BufferReader reader(bytes);
-  absl::StatusOr<std::string> qname = reader.ReadQName();
+  absl::StatusOr<std::pmr::string> qname = reader.ReadQName();
   EXPECT_THAT(qname, StatusIs(absl::StatusCode::kInvalidArgument));
 }
 
+TEST(PacketWriterTest, WriteQNameCompressesSharedSuffix) {
+  std::array<uint8_t, 512> bytes = {};
+  BufferWriter writer(bytes);
+  EXPECT_THAT(writer.WriteQName("hello.world"), IsOkAndHolds(Eq(13)));
+  EXPECT_THAT(writer.WriteQName("bye.world"), IsOkAndHolds(Eq(6)));
+  EXPECT_THAT(writer.WriteQName("bye.world"), IsOkAndHolds(Eq(2)));
+  std::vector<uint8_t> expected_bytes = {
+    5, 'h', 'e', 'l', 'l', 'o',
+    5, 'w', 'o', 'r', 'l', 'd',
+    0,
+    3, 'b', 'y', 'e', 0xc0, 0x06,
+    0xc0, 0x0d };
+  EXPECT_THAT(std::vector<uint8_t>(writer.Written().begin(), writer.Written().end()),
+              ContainerEq(expected_bytes));
+
+  BufferReader reader(bytes, 13);
+  EXPECT_THAT(reader.ReadQName(), IsOkAndHolds(Eq("bye.world")));
+  EXPECT_THAT(reader.ReadQName(), IsOkAndHolds(Eq("bye.world")));
+}
+
+TEST(PacketWriterTest, WriteQNameRejectsEmptyLabel) {
+  std::array<uint8_t, 512> bytes = {};
+  BufferWriter writer(bytes);
+  EXPECT_THAT(writer.WriteQName("hello..world"), StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
 TEST(DnsPacketTest, FromBytesSuccess) {
   std::array<uint8_t, 512> bytes = {
     // Header
@@ -130,8 +159,9 @@ TEST(DnsPacketTest, ToBytesSuccess) {
     packet.answers.push_back(std::move(answer));
   }
 
-  absl::StatusOr<std::array<uint8_t, 512>> actual_bytes = packet.ToBytes();
-  std::array<uint8_t, 512> expected_bytes = {
+  std::array<uint8_t, 512> buffer = {};
+  absl::StatusOr<std::span<const uint8_t>> actual_bytes = packet.ToBytes(buffer);
+  std::vector<uint8_t> expected_bytes = {
     // Header
     0x86, 0x2a, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
     // Question
@@ -140,15 +170,20 @@ TEST(DnsPacketTest, ToBytesSuccess) {
     // Answer
     0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x25, 0x00, 0x04, 0xd8, 0x3a, 0xd3, 0x8e,
   };
-  /*
-  for (size_t i = 0; i < 512; i++) {
-    std::cerr << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint32_t>((*actual_bytes)[i]);
-    std::cerr << " : ";
-    std::cerr << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint32_t>(expected_bytes[i]);
-    std::cerr << std::endl;
-  }
-  */
-  EXPECT_THAT(actual_bytes, IsOkAndHolds(ContainerEq(expected_bytes)));
+  ASSERT_TRUE(actual_bytes.ok());
+  EXPECT_THAT(std::vector<uint8_t>(actual_bytes->begin(), actual_bytes->end()),
+              ContainerEq(expected_bytes));
+}
+
+TEST(DnsPacketTest, ToBytesOnlyReturnsEncodedLength) {
+  DnsPacket packet = {};
+  packet.header.id = 0x1234;
+  packet.header.response_code = ResponseCode::NO_ERROR;
+  std::array<uint8_t, 512> buffer = {};
+  absl::StatusOr<std::span<const uint8_t>> bytes = packet.ToBytes(buffer);
+  ASSERT_TRUE(bytes.ok());
+  EXPECT_EQ(bytes->size(), 12);
+  EXPECT_EQ(bytes->data(), buffer.data());
 }
 
 } // namespace
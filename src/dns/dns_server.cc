@@ -1,41 +1,105 @@
 #include "src/dns/dns_server.h"
 
 #include <array>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <string>
 #include <thread>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <utility>
 
+#include "absl/cleanup/cleanup.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/strings/str_cat.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "src/common/cpu_affinity.h"
 #include "src/common/status_macros.h"
-#include "src/dns/client.h"
 #include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+#include "src/dns/hot_name_cache.h"
+#include "src/dns/query_log.h"
+#include "src/dns/query_trace.h"
+#include "src/dns/rate_limiter.h"
+#include "src/dns/request_arena.h"
+#include "src/dns/resolver.h"
+#include "src/dns/server_metrics.h"
 
 namespace tiny_dns {
 
-void ServeRequest(DnsServer* server, std::array<uint8_t, 512> request_raw, struct sockaddr_in client_addr) {
-  LOG(INFO) << "Serving request for: " << inet_ntoa(client_addr.sin_addr);
-  const absl::StatusOr<std::array<uint8_t, 512>> response_raw = server->HandleRequest(request_raw);
-  if (!response_raw.ok()) {
-    LOG(ERROR) << "Error serving request: " << response_raw.status();
+namespace {
+
+// NOTE: inet_ntoa() returns a shared static buffer, this is safe to call
+// from any number of serving threads.
+std::string FormatAddress(const struct sockaddr_in& addr) {
+  char buffer[INET_ADDRSTRLEN] = {};
+  inet_ntop(AF_INET, &addr.sin_addr, buffer, sizeof(buffer));
+  return absl::StrCat(buffer, ":", ntohs(addr.sin_port));
+}
+
+// NOTE: an empty response to the request with TC set, built from the raw
+// request so it costs next to nothing.
+std::span<const uint8_t> TruncatedResponse(
+    const std::array<uint8_t, 512>& request_raw, std::array<uint8_t, 512>& response_raw) {
+  constexpr size_t kHeaderSize = 12;
+  const absl::StatusOr<std::span<const uint8_t>> question = RawQuestion(request_raw);
+  memcpy(response_raw.data(), request_raw.data(), 2);
+  // NOTE: QR and TC set, the opcode and RD kept, everything else cleared.
+  response_raw[2] = (request_raw[2] & 0x79) | 0x82;
+  response_raw[3] = 0;
+  memset(response_raw.data() + 4, 0, kHeaderSize - 4);
+  if (!question.ok()) { return std::span<const uint8_t>(response_raw.data(), kHeaderSize); }
+  response_raw[5] = 1;
+  memcpy(response_raw.data() + kHeaderSize, question->data(), question->size());
+  return std::span<const uint8_t>(response_raw.data(), kHeaderSize + question->size());
+}
+
+} // namespace
+
+void ServeRequest(
+    DnsServer* server, std::array<uint8_t, 512> request_raw, struct sockaddr_in client_addr,
+    int64_t received_ns, int64_t deadline_ns, HotNameCache* hot_names) {
+  absl::Cleanup done = [server] {
+    server->inflight_requests_.fetch_sub(1, std::memory_order_relaxed);
+  };
+  // NOTE: per query logging is verbose only, and rate limited otherwise. The
+  // streamed values are only evaluated when the line is actually logged.
+  VLOG(1) << "Serving request for: " << FormatAddress(client_addr);
+  const int64_t start_ns = MonotonicNanos();
+  ServerMetrics& metrics = *server->metrics_;
+  if (deadline_ns != 0 && start_ns > deadline_ns) {
+    metrics.queries.Increment();
+    metrics.shed_deadlines.Increment();
     return;
   }
-  if (sendto(server->socket_fd_, response_raw->data(), sizeof(*response_raw), 0,
-        (const struct sockaddr*) &client_addr, sizeof(client_addr)) < 0) {
-    LOG(ERROR) << "Unable to send response back to the client.";
+  const bool time_stages = received_ns != 0;
+  if (time_stages) { metrics.receive_ns.Record(start_ns - received_ns); }
+  RequestArena arena;
+  std::array<uint8_t, 512> response_buffer = {};
+  RequestOutcome outcome;
+  const absl::StatusOr<std::span<const uint8_t>> response_raw =
+    server->HandleRequest(
+        request_raw, response_buffer, arena, time_stages, &outcome, deadline_ns, hot_names);
+  if (!response_raw.ok()) {
+    LOG_EVERY_N_SEC(ERROR, 1) << "Error serving request: " << response_raw.status();
     return;
   }
+  server->SendResponse(request_raw, client_addr, *response_raw, outcome, start_ns, received_ns);
+  arena.Reset();
 }
 
 absl::StatusOr<std::shared_ptr<DnsServer>>
 DnsServer::Create(std::string server_addr, int32_t server_port,
-                  std::shared_ptr<Client> fallback_dns,
+                  std::shared_ptr<Forwarder> forwarder,
                   std::shared_ptr<RecordStore> record_store) {
   int32_t socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
   if (socket_fd < 0) {
@@ -55,87 +119,439 @@ DnsServer::Create(std::string server_addr, int32_t server_port,
         absl::StrCat("Unable to bind to localhost."));
   }
   return std::make_shared<DnsServer>(
-      socket_fd, std::move(fallback_dns), std::move(record_store));
+      socket_fd, std::move(forwarder), std::move(record_store));
+}
+
+absl::Status DnsServer::EnableAsyncForwarding() {
+  if (forwarder_ == nullptr) {
+    return absl::FailedPreconditionError("Async forwarding needs a forwarder.");
+  }
+  async_forwarding_ = true;
+  return absl::OkStatus();
 }
 
 void DnsServer::Wait() {
-  while (true) {
+  if (absl::Status status = PinCurrentThread(io_cpus_); !status.ok()) { LOG(ERROR) << status; }
+  uint64_t received = 0;
+  const int64_t max_queue_time_ns =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(admission_.max_queue_time).count();
+  // NOTE: for requests served inline, reset after each.
+  RequestArena arena;
+  std::unique_ptr<HotNameCache> hot_names;
+  if (async_forwarding_ && hot_name_entries_ > 0) {
+    hot_names = std::make_unique<HotNameCache>(hot_name_entries_);
+  }
+  if (!async_forwarding_ && worker_threads_ > 0) {
+    for (size_t i = 0; i < worker_threads_; i++) { workers_.emplace_back([this] { ServeWork(); }); }
+  }
+  const size_t max_queued_requests = kMaxQueuedRequestsPerWorker * workers_.size();
+  while (!stop_requested_.load(std::memory_order_acquire)) {
     struct sockaddr_in client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
     std::array<uint8_t, 512> request_raw = {};
-    if (recvfrom(socket_fd_, request_raw.data(), sizeof(request_raw), MSG_WAITALL,
-          (struct sockaddr*) &client_addr, &client_addr_len) < 0) {
-      LOG(ERROR) << "Error receiving request.";
+    const ssize_t received_size = recvfrom(
+        socket_fd_, request_raw.data(), sizeof(request_raw), MSG_WAITALL,
+        (struct sockaddr*) &client_addr, &client_addr_len);
+    if (stop_requested_.load(std::memory_order_acquire)) { break; }
+    if (received_size < 0) {
+      LOG_EVERY_N_SEC(ERROR, 1) << "Error receiving request.";
       continue;
     }
-    auto serve_thread = std::thread(ServeRequest, this, request_raw, client_addr);
+    if (rate_limiter_ != nullptr) {
+      const RateLimitAction action = rate_limiter_->CheckQuery(client_addr, MonotonicNanos());
+      if (action != RateLimitAction::kSend) {
+        metrics_->queries.Increment();
+        SendRateLimited(action, request_raw, client_addr);
+        continue;
+      }
+    }
+    const int64_t received_ns = (++received % kTimingSampleRate == 0) ? MonotonicNanos() : 0;
+    const int64_t deadline_ns = max_queue_time_ns > 0 ? MonotonicNanos() + max_queue_time_ns : 0;
+    if (async_forwarding_) {
+      ServeInline(request_raw, client_addr, received_ns, deadline_ns, arena, hot_names.get());
+      arena.Reset();
+      continue;
+    }
+    if (admission_.max_inflight_requests != 0 &&
+        inflight_requests_.load(std::memory_order_relaxed) >= admission_.max_inflight_requests) {
+      ServeOverloaded(request_raw, client_addr, received_ns, arena);
+      arena.Reset();
+      continue;
+    }
+    if (!workers_.empty()) {
+      std::unique_lock lock(work_mutex_);
+      if (work_.size() >= max_queued_requests) {
+        lock.unlock();
+        ServeOverloaded(request_raw, client_addr, received_ns, arena);
+        arena.Reset();
+        continue;
+      }
+      inflight_requests_.fetch_add(1, std::memory_order_relaxed);
+      work_.push_back(Work{
+          .request_raw = request_raw, .client_addr = client_addr,
+          .received_ns = received_ns, .deadline_ns = deadline_ns });
+      lock.unlock();
+      work_cv_.notify_one();
+      continue;
+    }
+    inflight_requests_.fetch_add(1, std::memory_order_relaxed);
+    auto serve_thread = std::thread(
+        ServeRequest, this, request_raw, client_addr, received_ns, deadline_ns, nullptr);
     serve_thread.detach();
   }
+  {
+    std::scoped_lock lock(work_mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& worker : workers_) { worker.join(); }
+  workers_.clear();
+}
+
+void DnsServer::Stop() {
+  stop_requested_.store(true, std::memory_order_release);
+  // NOTE: wakes Wait() from recvfrom(). The socket isn't connected, so this
+  // fails with ENOTCONN, but Linux shuts down reads all the same.
+  shutdown(socket_fd_, SHUT_RD);
+}
+
+int32_t DnsServer::port() const {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  if (getsockname(socket_fd_, (struct sockaddr*) &addr, &addr_len) < 0) { return -1; }
+  return ntohs(addr.sin_port);
+}
+
+void DnsServer::ServeWork() {
+  if (absl::Status status = PinCurrentThread(worker_cpus_); !status.ok()) { LOG(ERROR) << status; }
+  std::unique_ptr<HotNameCache> hot_names;
+  if (hot_name_entries_ > 0) { hot_names = std::make_unique<HotNameCache>(hot_name_entries_); }
+  while (true) {
+    std::unique_lock lock(work_mutex_);
+    work_cv_.wait(lock, [this] { return stopping_ || !work_.empty(); });
+    if (stopping_) { return; }
+    const Work work = std::move(work_.front());
+    work_.pop_front();
+    lock.unlock();
+    ServeRequest(
+        this, work.request_raw, work.client_addr, work.received_ns, work.deadline_ns,
+        hot_names.get());
+  }
+}
+
+absl::StatusOr<std::span<const uint8_t>> DnsServer::HandleRequest(
+    std::array<uint8_t, 512>& request_raw,
+    std::array<uint8_t, 512>& response_raw,
+    RequestArena& arena,
+    bool time_stages,
+    RequestOutcome* outcome,
+    int64_t deadline_ns,
+    HotNameCache* hot_names) {
+  metrics_->queries.Increment();
+  StageTimer timer(time_stages);
+  HotNameLookup hot_name;
+  if (std::span<const uint8_t> cached;
+      LookupHotName(hot_names, request_raw, timer, response_raw, cached, hot_name)) {
+    if (outcome != nullptr) { outcome->cache_hit = true; }
+    return cached;
+  }
+  std::pmr::memory_resource* resource = arena.resource();
+  const absl::StatusOr<DnsPacket> request = DnsPacket::FromBytes(request_raw, resource);
+  timer.Lap(metrics_->parse_ns);
+  if (!request.ok()) { return EncodeFormError(request_raw, response_raw, resource); }
+
+  ReadHotNameGeneration(hot_names, *request, hot_name);
+  RequestOutcome resolved;
+  const DnsPacket response = resolver_->Resolve(*request, resource, timer, &resolved, deadline_ns);
+  if (outcome != nullptr) { *outcome = resolved; }
+  absl::StatusOr<std::span<const uint8_t>> response_encoded =
+    EncodeResponse(response, response_raw, timer);
+  if (resolved.cache_hit && !resolved.forwarded && response_encoded.ok()) {
+    StoreHotName(hot_names, hot_name, request_raw, response, *response_encoded);
+  }
+  return response_encoded;
+}
+
+bool DnsServer::LookupHotName(
+    HotNameCache* hot_names, const std::array<uint8_t, 512>& request_raw, StageTimer& timer,
+    std::array<uint8_t, 512>& response_raw, std::span<const uint8_t>& response,
+    HotNameLookup& lookup) {
+  if (hot_names == nullptr) { return false; }
+  lookup.now = time(nullptr);
+  const RecordStore& record_store = *record_store_;
+  switch (hot_names->Lookup(
+        request_raw, [&](size_t shard) { return record_store.Generation(shard); }, lookup.now,
+        response_raw, response)) {
+    case HotNameCache::Result::kHit:
+      timer.Lap(metrics_->lookup_ns);
+      metrics_->hot_name_hits.Increment();
+      metrics_->cache_hits.Increment();
+      return true;
+    case HotNameCache::Result::kInvalidated:
+      metrics_->hot_name_invalidations.Increment();
+      [[fallthrough]];
+    case HotNameCache::Result::kMiss:
+      metrics_->hot_name_misses.Increment();
+      return false;
+  }
+  return false;
+}
+
+void DnsServer::ReadHotNameGeneration(
+    HotNameCache* hot_names, const DnsPacket& request, HotNameLookup& lookup) {
+  if (hot_names == nullptr || request.questions.size() != 1) { return; }
+  // NOTE: read before the store is, see HotNameCache::Store().
+  lookup.shard = record_store_->ShardIndex(request.questions[0].qname);
+  lookup.generation = record_store_->Generation(lookup.shard);
+}
+
+void DnsServer::StoreHotName(
+    HotNameCache* hot_names, const HotNameLookup& lookup,
+    const std::array<uint8_t, 512>& request_raw, const DnsPacket& response,
+    std::span<const uint8_t> response_raw) {
+  if (hot_names == nullptr || response.questions.size() != 1) { return; }
+  // NOTE: answers for another name, e.g. a CNAME's target, or a CNAME that
+  // would be chased once its target is, were read from other shards too.
+  const Question& question = response.questions[0];
+  for (const Record& answer : response.answers) {
+    if (answer.qname != question.qname || answer.qtype != question.qtype) { return; }
+  }
+  hot_names->Store(request_raw, response_raw, lookup.shard, lookup.generation, lookup.now);
 }
 
-absl::StatusOr<std::array<uint8_t, 512>> DnsServer::HandleRequest(
-    std::array<uint8_t, 512>& request_raw) {
-  const absl::StatusOr<DnsPacket> request = DnsPacket::FromBytes(request_raw);
+void DnsServer::ServeInline(
+    const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+    int64_t received_ns, int64_t deadline_ns, RequestArena& arena, HotNameCache* hot_names) {
+  const int64_t start_ns = MonotonicNanos();
+  const bool time_stages = received_ns != 0;
+  if (time_stages) { metrics_->receive_ns.Record(start_ns - received_ns); }
+  metrics_->queries.Increment();
+  StageTimer timer(time_stages);
+  std::array<uint8_t, 512> response_buffer = {};
+  RequestOutcome outcome;
+  HotNameLookup hot_name;
+  if (std::span<const uint8_t> cached;
+      LookupHotName(hot_names, request_raw, timer, response_buffer, cached, hot_name)) {
+    outcome.cache_hit = true;
+    SendResponse(request_raw, client_addr, cached, outcome, start_ns, received_ns);
+    return;
+  }
+  std::pmr::memory_resource* resource = arena.resource();
+  absl::StatusOr<std::span<const uint8_t>> response_raw;
+  const absl::StatusOr<DnsPacket> request = DnsPacket::FromBytes(request_raw, resource);
+  timer.Lap(metrics_->parse_ns);
+  if (request.ok()) { ReadHotNameGeneration(hot_names, *request, hot_name); }
   if (!request.ok()) {
-    ASSIGN_OR_RETURN(uint16_t id, DnsPacket::FromBytesIdOnly(request_raw));
-    return CreateResponseTemplate(id, ResponseCode::FORM_ERROR).ToBytes();
+    response_raw = EncodeFormError(request_raw, response_buffer, resource);
+  } else if (const absl::StatusOr<DnsPacket> response =
+      resolver_->ResolveLocally(*request, resource, timer, &outcome); response.ok()) {
+    response_raw = EncodeResponse(*response, response_buffer, timer);
+    if (outcome.cache_hit && response_raw.ok()) {
+      StoreHotName(hot_names, hot_name, request_raw, *response, *response_raw);
+    }
+  } else {
+    // NOTE: a miss, handed to the forwarder unless its queue is full.
+    ForwardRequest forward;
+    forward.client_addr = client_addr;
+    forward.received_ns = received_ns;
+    forward.deadline_ns = deadline_ns;
+    const absl::StatusOr<std::span<const uint8_t>> query = request->ToBytes(forward.query);
+    if (query.ok()) {
+      forward.query_size = query->size();
+      pipeline_forwards_.fetch_add(1, std::memory_order_relaxed);
+      if (forwarder_->Submit(std::move(forward), [this](
+              const ForwardRequest& submitted,
+              const absl::StatusOr<std::array<uint8_t, 512>>& upstream_raw) {
+            CompleteForward(submitted, upstream_raw);
+          })) {
+        metrics_->forwards.Increment();
+        return;
+      }
+      pipeline_forwards_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    metrics_->shed_forwards.Increment();
+    response_raw = EncodeResponse(
+        resolver_->CreateResponseTemplate(
+          request->header.id, admission_.shed_response_code, resource),
+        response_buffer, timer);
   }
+  if (!response_raw.ok()) {
+    LOG_EVERY_N_SEC(ERROR, 1) << "Error serving request: " << response_raw.status();
+    return;
+  }
+  SendResponse(request_raw, client_addr, *response_raw, outcome, start_ns, received_ns);
+}
 
-  absl::StatusOr<DnsPacket> response;
-  response = Lookup(*request);
-  if (!response.ok() && request->header.recursion_desired) {
-    LOG(ERROR) << "Error retrieving results locally: " << response.status();
-    response = Forward(*request);
+void DnsServer::ServeOverloaded(
+    const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+    int64_t received_ns, RequestArena& arena) {
+  const int64_t start_ns = MonotonicNanos();
+  metrics_->queries.Increment();
+  StageTimer timer(received_ns != 0);
+  std::array<uint8_t, 512> response_buffer = {};
+  RequestOutcome outcome;
+  std::pmr::memory_resource* resource = arena.resource();
+  absl::StatusOr<std::span<const uint8_t>> response_raw;
+  const absl::StatusOr<DnsPacket> request = DnsPacket::FromBytes(request_raw, resource);
+  timer.Lap(metrics_->parse_ns);
+  if (!request.ok()) {
+    response_raw = EncodeFormError(request_raw, response_buffer, resource);
+  } else if (const absl::StatusOr<DnsPacket> response =
+      resolver_->ResolveLocally(*request, resource, timer, &outcome); response.ok()) {
+    response_raw = EncodeResponse(*response, response_buffer, timer);
+  } else {
+    metrics_->shed_overload.Increment();
+    response_raw = EncodeResponse(
+        resolver_->CreateResponseTemplate(
+          request->header.id, admission_.shed_response_code, resource),
+        response_buffer, timer);
   }
-  if (!response.ok()) {
-    LOG(ERROR) << "Returning SERV_FAIL response.";
-    return CreateResponseTemplate(request->header.id, ResponseCode::SERV_FAIL).ToBytes();
+  if (!response_raw.ok()) {
+    LOG_EVERY_N_SEC(ERROR, 1) << "Error serving request: " << response_raw.status();
+    return;
   }
-  return response->ToBytes();
+  SendResponse(request_raw, client_addr, *response_raw, outcome, start_ns, received_ns);
 }
 
-absl::StatusOr<DnsPacket> DnsServer::Lookup(const DnsPacket& request) {
-  if (request.questions.size() != 1) {
-    LOG(ERROR) << "Malformatted request detected.";
-    return CreateResponseTemplate(request.header.id, ResponseCode::FORM_ERROR);
+void DnsServer::CompleteForward(
+    const ForwardRequest& forward, const absl::StatusOr<std::array<uint8_t, 512>>& upstream_raw) {
+  absl::Cleanup done = [this] {
+    pipeline_forwards_.fetch_sub(1, std::memory_order_release);
+  };
+  if (absl::IsDeadlineExceeded(upstream_raw.status())) {
+    metrics_->shed_deadlines.Increment();
+    return;
   }
+  const int64_t now_ns = MonotonicNanos();
+  if (forward.received_ns != 0) { metrics_->forward_ns.Record(now_ns - forward.submitted_ns); }
+  RequestOutcome outcome;
+  outcome.forwarded = true;
+  outcome.upstream_rtt_ns = now_ns - forward.submitted_ns;
+  RequestArena arena;
+  std::pmr::memory_resource* resource = arena.resource();
+  absl::StatusOr<DnsPacket> response = upstream_raw.ok()
+    ? DnsPacket::FromBytes(*upstream_raw, resource)
+    : absl::StatusOr<DnsPacket>(upstream_raw.status());
+  if (response.ok()) {
+    resolver_->CompleteForward(*response, resource);
+  } else {
+    metrics_->forward_errors.Increment();
+    LOG_EVERY_N_SEC(WARNING, 1) << "Returning SERV_FAIL response: " << response.status();
+    // NOTE: the client's ID, as the forwarded request was encoded with it.
+    const uint16_t id = (forward.query[0] << 8) | forward.query[1];
+    response = resolver_->CreateResponseTemplate(id, ResponseCode::SERV_FAIL, resource);
+  }
+  StageTimer timer(forward.received_ns != 0);
+  std::array<uint8_t, 512> response_buffer = {};
+  const absl::StatusOr<std::span<const uint8_t>> response_raw =
+    EncodeResponse(*response, response_buffer, timer);
+  if (!response_raw.ok()) {
+    LOG_EVERY_N_SEC(ERROR, 1) << "Error serving request: " << response_raw.status();
+    return;
+  }
+  SendResponse(
+      forward.query, forward.client_addr, *response_raw, outcome,
+      forward.submitted_ns, forward.received_ns);
+  arena.Reset();
+}
 
-  const Question& question = request.questions[0];
-  const std::vector<Record> answers = record_store_->Query(question);
-  if (answers.size() == 0) {
-    return absl::NotFoundError(
-        absl::StrCat("No records found for qname: ", question.qname));
+absl::StatusOr<std::span<const uint8_t>> DnsServer::EncodeResponse(
+    const DnsPacket& response, std::array<uint8_t, 512>& response_raw, StageTimer& timer) {
+  // NOTE: also counts errors passed through from the fallback DNS server.
+  if (response.header.response_code == ResponseCode::SERV_FAIL) {
+    metrics_->serv_fail.Increment();
+  } else if (response.header.response_code == ResponseCode::FORM_ERROR) {
+    metrics_->form_error.Increment();
   }
+  absl::StatusOr<std::span<const uint8_t>> encoded = response.ToBytes(response_raw);
+  timer.Lap(metrics_->encode_ns);
+  return encoded;
+}
+
+absl::StatusOr<std::span<const uint8_t>> DnsServer::EncodeFormError(
+    const std::array<uint8_t, 512>& request_raw, std::array<uint8_t, 512>& response_raw,
+    std::pmr::memory_resource* resource) {
+  ASSIGN_OR_RETURN(uint16_t id, DnsPacket::FromBytesIdOnly(request_raw));
+  metrics_->form_error.Increment();
+  return resolver_->CreateResponseTemplate(id, ResponseCode::FORM_ERROR, resource)
+    .ToBytes(response_raw);
+}
 
-  DnsPacket response = CreateResponseTemplate(request.header.id, ResponseCode::NO_ERROR);
-  response.questions = request.questions;
-  response.answers = std::move(answers);
-  LOG(INFO) << "Returning response: " << response.DebugString();
-  return response;
+void DnsServer::SendResponse(
+    const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+    std::span<const uint8_t> response_raw, const RequestOutcome& outcome,
+    int64_t start_ns, int64_t received_ns) {
+  if (rate_limiter_ != nullptr) {
+    const absl::StatusOr<std::span<const uint8_t>> question = RawQuestion(request_raw);
+    const RateLimitAction action = rate_limiter_->CheckResponse(
+        client_addr, question.ok() ? *question : std::span<const uint8_t>(),
+        ResponseCodeFromByte(response_raw[3] & 0x0f), MonotonicNanos());
+    if (action != RateLimitAction::kSend) {
+      SendRateLimited(action, request_raw, client_addr);
+      return;
+    }
+  }
+  StageTimer timer(received_ns != 0);
+  if (sendto(socket_fd_, response_raw.data(), response_raw.size(), 0,
+        (const struct sockaddr*) &client_addr, sizeof(client_addr)) < 0) {
+    LOG_EVERY_N_SEC(ERROR, 1) << "Unable to send response back to the client: "
+      << FormatAddress(client_addr);
+    metrics_->send_errors.Increment();
+  }
+  timer.Lap(metrics_->send_ns);
+  if (received_ns != 0) { metrics_->total_ns.Record(MonotonicNanos() - received_ns); }
+  if (trace_writer_ != nullptr || (query_log_ != nullptr && query_log_->HasSubscribers())) {
+    const int64_t service_time_ns = MonotonicNanos() - start_ns;
+    RecordRequest(
+        request_raw, client_addr, response_raw, outcome,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count() - service_time_ns,
+        service_time_ns);
+  }
 }
 
-absl::StatusOr<DnsPacket> DnsServer::Forward(const DnsPacket& request) {
-  if (fallback_dns_ == nullptr) {
-    return absl::UnavailableError("Fallback DNS is not configured.");
+void DnsServer::SendRateLimited(
+    RateLimitAction action, const std::array<uint8_t, 512>& request_raw,
+    const struct sockaddr_in& client_addr) {
+  if (action == RateLimitAction::kDrop) {
+    metrics_->rate_limit_drops.Increment();
+    return;
   }
-  LOG(INFO) << "Forwarding request to fallback DNS server.";
-  ASSIGN_OR_RETURN(auto request_raw, request.ToBytes());
-  std::array<uint8_t, 512> response_raw = {};
-  RETURN_IF_ERROR(fallback_dns_->Call(request_raw, response_raw));
-  ASSIGN_OR_RETURN(const DnsPacket response, DnsPacket::FromBytes(response_raw));
-  for (const Record& record : response.answers) {
-    record_store_->InsertOrUpdate(record);
+  metrics_->rate_limit_slips.Increment();
+  std::array<uint8_t, 512> response_buffer;
+  const std::span<const uint8_t> response_raw = TruncatedResponse(request_raw, response_buffer);
+  if (sendto(socket_fd_, response_raw.data(), response_raw.size(), 0,
+        (const struct sockaddr*) &client_addr, sizeof(client_addr)) < 0) {
+    metrics_->send_errors.Increment();
   }
-  return response;
 }
 
-DnsPacket DnsServer::CreateResponseTemplate(uint16_t id, ResponseCode response_code) {
-  DnsPacket response = {};
-  response.header.id = id;
-  response.header.response_code = response_code;
-  response.header.query_response = true;
-  response.header.recursion_available = (fallback_dns_ != nullptr);
-  return response;
+void DnsServer::RecordRequest(
+    const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+    std::span<const uint8_t> response_raw, const RequestOutcome& outcome,
+    int64_t timestamp_ns, uint32_t service_time_ns) {
+  const absl::StatusOr<std::span<const uint8_t>> question = RawQuestion(request_raw);
+  if (!question.ok()) {
+    VLOG(1) << "Not recording request: " << question.status();
+    return;
+  }
+  QueryLogEntry log_entry;
+  TraceEntry& entry = log_entry.query;
+  entry.timestamp_ns = timestamp_ns;
+  memcpy(entry.client_addr.data(), &client_addr.sin_addr.s_addr, entry.client_addr.size());
+  entry.client_port = ntohs(client_addr.sin_port);
+  entry.recursion_desired = (request_raw[2] & 0x01) != 0;
+  entry.response_code = ResponseCodeFromByte(response_raw[3] & 0x0f);
+  entry.service_time_ns = service_time_ns;
+  entry.question_size = question->size();
+  memcpy(entry.question.data(), question->data(), question->size());
+  if (trace_writer_ != nullptr) { trace_writer_->Record(entry); }
+  if (query_log_ != nullptr && query_log_->HasSubscribers()) {
+    log_entry.cache_hit = outcome.cache_hit;
+    log_entry.forwarded = outcome.forwarded;
+    log_entry.upstream_rtt_ns = outcome.upstream_rtt_ns;
+    query_log_->Record(log_entry);
+  }
 }
 
 } // tiny_dns
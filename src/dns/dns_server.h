@@ -1,49 +1,291 @@
 #ifndef SRC_DNS_SERVER_H_
 #define SRC_DNS_SERVER_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <ctime>
+#include <deque>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
-#include "src/dns/client.h"
 #include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+#include "src/dns/hot_name_cache.h"
+#include "src/dns/query_log.h"
+#include "src/dns/query_trace.h"
+#include "src/dns/rate_limiter.h"
 #include "src/dns/record_store.h"
+#include "src/dns/request_arena.h"
+#include "src/dns/resolver.h"
+#include "src/dns/server_metrics.h"
 
 namespace tiny_dns {
 
-// Triages and serves incoming UDP requests.
+// NOTE: every limit is off at 0. Under overload the server sheds the work
+// that costs the most and helps the least: cache hits are answered
+// throughout, misses and stale requests give way.
+struct AdmissionOptions {
+  // NOTE: see Resolver::LimitForwards.
+  size_t max_inflight_forwards = 0;
+  ResponseCode shed_response_code = ResponseCode::SERV_FAIL;
+  // NOTE: requests still waiting this long after being received, to be
+  // picked up or for the forwarder, are dropped: by then the client has
+  // given up or retried, and answering only delays the requests behind.
+  std::chrono::milliseconds max_queue_time{0};
+  // NOTE: requests received with this many already being served get no
+  // thread of their own: the receiving thread answers them if it can from
+  // the record store, and with shed_response_code if they'd be forwarded.
+  size_t max_inflight_requests = 0;
+};
+
+// NOTE: serving threads wait on forwards, so there are several to a CPU.
+inline constexpr size_t kDefaultWorkerThreadsPerCpu = 8;
+// NOTE: requests waiting on the worker pool beyond this many per thread are
+// served as over max_inflight_requests, which may be unset or larger.
+inline constexpr size_t kMaxQueuedRequestsPerWorker = 64;
+
+// Triages and serves incoming UDP requests. By default each request gets a
+// thread of its own, or one of a pool of worker threads, pinned to worker
+// CPUs if any. With async forwarding enabled the server is a pipeline
+// instead: the receiving thread answers cache hits itself, with no hand-off,
+// and passes misses to the forwarder, which answers them when upstream does.
+// Long lived serving threads, the pool's or the receiving thread, each keep
+// a HotNameCache if enabled.
+// Either way every forward goes through the one forwarder, null without a
+// fallback DNS server, which the resolver shares.
 class DnsServer {
  public:
   DnsServer(
-      int32_t socket_fd, std::shared_ptr<Client> fallback_dns,
+      int32_t socket_fd, std::shared_ptr<Forwarder> forwarder,
       std::shared_ptr<RecordStore> record_store) :
-    socket_fd_(socket_fd), fallback_dns_(std::move(fallback_dns)),
-    record_store_(record_store) {};
-  ~DnsServer() { close(socket_fd_); }
+    socket_fd_(socket_fd), metrics_(std::make_shared<ServerMetrics>()),
+    record_store_(record_store),
+    resolver_(std::make_shared<Resolver>(
+          std::move(record_store), std::move(forwarder), metrics_)),
+    forwarder_(resolver_->forwarder()) {};
+  ~DnsServer() {
+    {
+      std::scoped_lock lock(work_mutex_);
+      stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread& worker : workers_) { worker.join(); }
+    // NOTE: the forwarder is shared, so may outlive the server: wait out the
+    // pipeline's completions, which send on the socket, before it goes.
+    // Shutting the forwarder down completes those still waiting on upstream
+    // straight away, rather than within its timeout, which may be never.
+    // Forwards the resolver makes after, e.g. for the admin service, fail.
+    if (async_forwarding_) { forwarder_->Shutdown(); }
+    while (pipeline_forwards_.load(std::memory_order_acquire) > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    close(socket_fd_);
+  }
   static absl::StatusOr<std::shared_ptr<DnsServer>> Create(
       std::string server_addr, int32_t server_port,
-      std::shared_ptr<Client> fallback_dns,
+      std::shared_ptr<Forwarder> forwarder,
       std::shared_ptr<RecordStore> record_store);
 
+  // NOTE: must be called before Wait(). Every request served from then on is
+  // recorded to the trace.
+  void EnableTracing(std::shared_ptr<TraceWriter> trace_writer) {
+    trace_writer_ = std::move(trace_writer);
+  }
+
+  // NOTE: must be called before Wait(). Requests are only recorded to the
+  // query log while it has subscribers.
+  void EnableQueryLog(std::shared_ptr<QueryLog> query_log) {
+    query_log_ = std::move(query_log);
+  }
+
+  // NOTE: must be called before Wait(). Queries and responses over the
+  // limiter's limits are dropped or answered truncated.
+  void EnableRateLimiting(std::shared_ptr<RateLimiter> rate_limiter) {
+    rate_limiter_ = std::move(rate_limiter);
+  }
+
+  // NOTE: must be called before Wait().
+  void EnableAdmissionControl(AdmissionOptions options) {
+    admission_ = options;
+    resolver_->LimitForwards(options.max_inflight_forwards, options.shed_response_code);
+  }
+
+  // NOTE: must be called before Wait(), and needs a forwarder. Misses are
+  // submitted to it rather than waited on, and those over its queue are
+  // answered as admission control sheds them.
+  absl::Status EnableAsyncForwarding();
+
+  // NOTE: must be called before Wait(). Each pool thread, or with async
+  // forwarding the receiving thread, answers repeat queries from a
+  // HotNameCache of its own of this many entries before trying the record
+  // store. A thread per request has nothing to reuse a cache for, so without
+  // either there is none.
+  void EnableHotNameCache(size_t entries = kDefaultHotNameCacheEntries) {
+    hot_name_entries_ = entries;
+  }
+
+  // NOTE: must be called before Wait(). Wait() pins itself to io_cpus, if
+  // any. With worker_threads, or worker_cpus, requests are served by a pool
+  // of worker_threads threads (0 for kDefaultWorkerThreadsPerCpu per worker
+  // CPU) rather than a thread each. Each is pinned to worker_cpus, if any,
+  // once: pinning per request would cost a syscall per query.
+  void PinThreads(
+      std::vector<int> io_cpus, std::vector<int> worker_cpus, size_t worker_threads = 0) {
+    io_cpus_ = std::move(io_cpus);
+    worker_cpus_ = std::move(worker_cpus);
+    worker_threads_ = worker_threads != 0
+      ? worker_threads : kDefaultWorkerThreadsPerCpu * worker_cpus_.size();
+  }
+
+  // NOTE: serves requests until Stop() is called.
   void Wait();
+  // NOTE: from any thread. Wait() returns once it has stopped the worker
+  // pool, if any; forwards still in flight complete as usual.
+  void Stop();
 
- private:
-  absl::StatusOr<std::array<uint8_t, 512>> HandleRequest(
-      std::array<uint8_t, 512>& request_raw);
-  absl::StatusOr<DnsPacket> Lookup(const DnsPacket& request);
-  absl::StatusOr<DnsPacket> Forward(const DnsPacket& request);
+  // NOTE: encodes the response into response_raw, returns the encoded prefix.
+  // All intermediate allocations come from the arena, which the caller should
+  // Reset() once the response has been sent. With time_stages the parse,
+  // lookup, forward and encode latencies are recorded to metrics(). If given,
+  // outcome is filled in. See Resolver::Resolve for deadline_ns. With
+  // hot_names, owned by the calling thread, repeat queries are answered from
+  // it.
+  absl::StatusOr<std::span<const uint8_t>> HandleRequest(
+      std::array<uint8_t, 512>& request_raw,
+      std::array<uint8_t, 512>& response_raw,
+      RequestArena& arena,
+      bool time_stages = false,
+      RequestOutcome* outcome = nullptr,
+      int64_t deadline_ns = 0,
+      HotNameCache* hot_names = nullptr);
+
+  // NOTE: the port requests are received on, e.g. the one picked for a
+  // server_port of 0.
+  int32_t port() const;
+  // NOTE: misses the pipeline submitted to the forwarder and hasn't answered
+  // yet.
+  size_t pipeline_forwards() const {
+    return pipeline_forwards_.load(std::memory_order_acquire);
+  }
+  std::shared_ptr<const ServerMetrics> metrics() const { return metrics_; }
+  // NOTE: for answering requests in-process, e.g. from the admin service.
+  std::shared_ptr<Resolver> resolver() const { return resolver_; }
 
-  DnsPacket CreateResponseTemplate(uint16_t id, ResponseCode response_code);
+ private:
+  // NOTE: feeds the trace and the query log, whichever are enabled.
+  void RecordRequest(
+      const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+      std::span<const uint8_t> response_raw, const RequestOutcome& outcome,
+      int64_t timestamp_ns, uint32_t service_time_ns);
+  // NOTE: the receiving thread's side of the pipeline. Allocations come from
+  // arena, which the caller should Reset() afterwards. hot_names may be null.
+  void ServeInline(
+      const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+      int64_t received_ns, int64_t deadline_ns, RequestArena& arena, HotNameCache* hot_names);
+  // NOTE: what a response served after a hot name miss is stored under.
+  struct HotNameLookup {
+    size_t shard = 0;
+    uint64_t generation = 0;
+    time_t now = 0;
+  };
+  // NOTE: false without hot_names. Counts the lookup; true on a hit, with
+  // response set to it and the lookup stage lapped. Sets lookup's time.
+  bool LookupHotName(
+      HotNameCache* hot_names, const std::array<uint8_t, 512>& request_raw, StageTimer& timer,
+      std::array<uint8_t, 512>& response_raw, std::span<const uint8_t>& response,
+      HotNameLookup& lookup);
+  // NOTE: after a miss, sets lookup's shard and generation for the parsed
+  // request. Must be called before the store is queried for it.
+  void ReadHotNameGeneration(
+      HotNameCache* hot_names, const DnsPacket& request, HotNameLookup& lookup);
+  // NOTE: for a response answered from the record store. Does nothing
+  // without hot_names, or if the response wasn't read from the request's
+  // shard alone, e.g. a chased CNAME.
+  void StoreHotName(
+      HotNameCache* hot_names, const HotNameLookup& lookup,
+      const std::array<uint8_t, 512>& request_raw, const DnsPacket& response,
+      std::span<const uint8_t> response_raw);
+  // NOTE: for a request over AdmissionOptions::max_inflight_requests, or the
+  // worker pool's queue, on the receiving thread. Allocations come from arena, as for ServeInline.
+  void ServeOverloaded(
+      const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+      int64_t received_ns, RequestArena& arena);
+  // NOTE: a request received, for a serving thread.
+  struct Work {
+    std::array<uint8_t, 512> request_raw;
+    struct sockaddr_in client_addr;
+    int64_t received_ns;
+    int64_t deadline_ns;
+  };
+  // NOTE: a pool thread, serving requests from work_ until the server goes.
+  void ServeWork();
+  // NOTE: the forwarder's side, see Forwarder::Completion.
+  void CompleteForward(
+      const ForwardRequest& forward, const absl::StatusOr<std::array<uint8_t, 512>>& upstream_raw);
+  // NOTE: counts SERV_FAIL and FORM_ERROR responses, and laps encoding.
+  absl::StatusOr<std::span<const uint8_t>> EncodeResponse(
+      const DnsPacket& response, std::array<uint8_t, 512>& response_raw, StageTimer& timer);
+  absl::StatusOr<std::span<const uint8_t>> EncodeFormError(
+      const std::array<uint8_t, 512>& request_raw, std::array<uint8_t, 512>& response_raw,
+      std::pmr::memory_resource* resource);
+  // NOTE: checks the response rate limit, sends, and records the request.
+  // start_ns is when serving it began, received_ns as for ServeRequest.
+  void SendResponse(
+      const std::array<uint8_t, 512>& request_raw, const struct sockaddr_in& client_addr,
+      std::span<const uint8_t> response_raw, const RequestOutcome& outcome,
+      int64_t start_ns, int64_t received_ns);
+  // NOTE: for a query or response the rate limiter didn't let through: sends
+  // a truncated response if it's to slip, and counts it.
+  void SendRateLimited(
+      RateLimitAction action, const std::array<uint8_t, 512>& request_raw,
+      const struct sockaddr_in& client_addr);
 
   int32_t socket_fd_;
-  std::shared_ptr<Client> fallback_dns_;
+  std::shared_ptr<ServerMetrics> metrics_;
   std::shared_ptr<RecordStore> record_store_;
+  std::shared_ptr<Resolver> resolver_;
+  std::shared_ptr<TraceWriter> trace_writer_;
+  std::shared_ptr<QueryLog> query_log_;
+  std::shared_ptr<RateLimiter> rate_limiter_;
+  AdmissionOptions admission_;
+  // NOTE: requests handed to a serving thread and not yet done with.
+  std::atomic<size_t> inflight_requests_ = 0;
+  // NOTE: the resolver's.
+  std::shared_ptr<Forwarder> forwarder_;
+  bool async_forwarding_ = false;
+  // NOTE: misses submitted to the forwarder and not yet completed.
+  std::atomic<size_t> pipeline_forwards_ = 0;
+  size_t hot_name_entries_ = 0;
+  std::vector<int> io_cpus_;
+  std::vector<int> worker_cpus_;
+  size_t worker_threads_ = 0;
+  // NOTE: with worker threads, the pool and the requests waiting for it.
+  std::vector<std::thread> workers_;
+  std::mutex work_mutex_;
+  std::condition_variable work_cv_;
+  std::deque<Work> work_;
+  bool stopping_ = false;
+  std::atomic<bool> stop_requested_ = false;
 
-  friend void ServeRequest(DnsServer*, std::array<uint8_t, 512>, struct sockaddr_in);
+  // NOTE: received_ns is 0 unless the request was sampled for stage timings,
+  // deadline_ns 0 unless there's a max_queue_time. hot_names is the calling
+  // thread's, if it keeps one.
+  friend void ServeRequest(
+      DnsServer*, std::array<uint8_t, 512>, struct sockaddr_in, int64_t received_ns,
+      int64_t deadline_ns, HotNameCache* hot_names);
 };
 
 } // tiny_dns
@@ -0,0 +1,211 @@
+#include "src/dns/dns_server.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "src/common/zipfian.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+#include "src/dns/hot_name_cache.h"
+#include "src/dns/mock_upstream.h"
+#include "src/dns/record_store.h"
+#include "src/dns/request_arena.h"
+#include "src/dns/test_util.h"
+
+// Benchmarks DnsServer::HandleRequest end to end: answering from the record
+// store, and forwarding misses to a MockUpstream on localhost. Needs no
+// network access beyond the loopback interface.
+//
+// BM_Overload has many threads share one server behind a slow upstream, with
+// and without a forward budget, and counts goodput: responses with answers.
+//
+// BM_HotNames serves Zipfian popular names with and without a HotNameCache,
+// while the store takes writes, and reports the cache's hit rate.
+
+namespace tiny_dns {
+namespace {
+
+struct Fixture {
+  std::unique_ptr<MockUpstream> upstream;
+  std::shared_ptr<RecordStore> record_store;
+  std::shared_ptr<DnsServer> server;
+};
+
+Fixture CreateFixture(MockUpstreamOptions options) {
+  Fixture fixture;
+  absl::StatusOr<std::unique_ptr<MockUpstream>> upstream =
+    MockUpstream::Create(std::move(options));
+  CHECK_OK(upstream.status());
+  fixture.upstream = std::move(*upstream);
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", fixture.upstream->port(),
+      { .timeout = std::chrono::milliseconds(1000) });
+  CHECK_OK(forwarder.status());
+  fixture.record_store = std::make_shared<RecordStore>();
+  absl::StatusOr<std::shared_ptr<DnsServer>> server =
+    DnsServer::Create("127.0.0.1", 0, std::move(*forwarder), fixture.record_store);
+  CHECK_OK(server.status());
+  fixture.server = std::move(*server);
+  return fixture;
+}
+
+void BM_CacheHit(benchmark::State& state) {
+  Fixture fixture = CreateFixture({ .synthesize_answers = true });
+  std::array<uint8_t, 512> request =
+    CreateRequest("cached.example", QueryType::A, /*recursion_desired=*/true);
+  std::array<uint8_t, 512> response = {};
+  RequestArena arena;
+  // NOTE: the first request is forwarded, and caches the answer.
+  CHECK_OK(fixture.server->HandleRequest(request, response, arena).status());
+  arena.Reset();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(fixture.server->HandleRequest(request, response, arena));
+    arena.Reset();
+  }
+  CHECK_EQ(fixture.upstream->stats().queries, 1);
+}
+BENCHMARK(BM_CacheHit);
+
+// NOTE: every iteration asks for a new name, so every one is a miss that is
+// forwarded upstream (and then cached). Argument is the upstream delay in us.
+void BM_ForwardMiss(benchmark::State& state) {
+  Fixture fixture = CreateFixture({
+      .synthesize_answers = true,
+      .delay = std::chrono::microseconds(state.range(0)) });
+  std::array<uint8_t, 512> response = {};
+  RequestArena arena;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::array<uint8_t, 512> request = CreateRequest(
+        absl::StrCat("miss-", i++, ".example"), QueryType::A, /*recursion_desired=*/true);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(fixture.server->HandleRequest(request, response, arena));
+    arena.Reset();
+  }
+  state.counters["upstream_queries"] = fixture.upstream->stats().queries;
+}
+BENCHMARK(BM_ForwardMiss)->Arg(0)->Arg(100)->Arg(1000)->UseRealTime();
+
+// NOTE: argument is the upstream answer count, to see the cost of decoding
+// and caching larger responses.
+void BM_ForwardMissAnswers(benchmark::State& state) {
+  Fixture fixture = CreateFixture({
+      .synthesize_answers = true,
+      .synthesized_answers_per_query = static_cast<size_t>(state.range(0)) });
+  std::array<uint8_t, 512> response = {};
+  RequestArena arena;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::array<uint8_t, 512> request = CreateRequest(
+        absl::StrCat("miss-", i++, ".example"), QueryType::A, /*recursion_desired=*/true);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(fixture.server->HandleRequest(request, response, arena));
+    arena.Reset();
+  }
+}
+BENCHMARK(BM_ForwardMissAnswers)->Arg(1)->Arg(8)->Arg(24)->UseRealTime();
+
+// NOTE: 1 in 10 requests is a miss, forwarded to an upstream that takes 2ms.
+// Without a budget, every thread can end up waiting on a miss, so hits are
+// served only as fast as the upstream answers. With one, misses over it are
+// shed, and the threads keep serving hits. Argument
+// is the forward budget, 0 for none.
+void BM_Overload(benchmark::State& state) {
+  static Fixture* fixtures = [] {
+    const Record record = CreateARecord("cached.example", 1, 3600);
+    Fixture* fixtures = new Fixture[2];
+    for (int i = 0; i < 2; i++) {
+      fixtures[i] = CreateFixture({
+          .synthesize_answers = true, .delay = std::chrono::milliseconds(2) });
+      fixtures[i].record_store->InsertOrUpdate(record);
+    }
+    fixtures[1].server->EnableAdmissionControl({ .max_inflight_forwards = 2 });
+    return fixtures;
+  }();
+  DnsServer& server = *fixtures[state.range(0) == 0 ? 0 : 1].server;
+  const std::array<uint8_t, 512> hit =
+    CreateRequest("cached.example", QueryType::A, /*recursion_desired=*/true);
+  std::array<uint8_t, 512> request = {};
+  std::array<uint8_t, 512> response = {};
+  RequestArena arena;
+  uint64_t i = 0;
+  uint64_t answered = 0;
+  for (auto _ : state) {
+    if (++i % 10 == 0) {
+      state.PauseTiming();
+      request = CreateRequest(
+          absl::StrCat("miss-", state.thread_index(), "-", i, ".example"), QueryType::A,
+          /*recursion_desired=*/true);
+      state.ResumeTiming();
+    } else {
+      request = hit;
+    }
+    const absl::StatusOr<std::span<const uint8_t>> encoded =
+      server.HandleRequest(request, response, arena);
+    if (encoded.ok() && (response[3] & 0x0f) == 0) { answered++; }
+    arena.Reset();
+  }
+  state.counters["goodput"] = benchmark::Counter(answered, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Overload)->ArgName("forward_budget")->Arg(0)->Arg(2)->Threads(16)->UseRealTime();
+
+// NOTE: 10k names, queried with Zipfian popularity. Arguments are the hot
+// name cache's entries (0 for none), and the store writes per 10k queries:
+// each invalidates every hot name cache, which is what it costs to keep them
+// coherent. The writes themselves are timed too.
+void BM_HotNames(benchmark::State& state) {
+  constexpr size_t kNames = 10000;
+  constexpr size_t kSamples = 1 << 16;
+  Fixture fixture = CreateFixture({});
+  std::vector<std::array<uint8_t, 512>> requests;
+  for (size_t i = 0; i < kNames; i++) {
+    const std::string qname = absl::StrCat("host-", i, ".example");
+    fixture.record_store->InsertOrUpdate(CreateARecord(qname, 1, 3600));
+    requests.push_back(CreateRequest(qname, QueryType::A, /*recursion_desired=*/true));
+  }
+  std::vector<uint32_t> samples(kSamples);
+  const ZipfianGenerator zipf(kNames, 0.99);
+  std::mt19937_64 rng(42);
+  for (uint32_t& sample : samples) { sample = zipf(rng); }
+  const Record written = CreateARecord("written.example", 2, 3600);
+
+  std::unique_ptr<HotNameCache> hot_names;
+  if (state.range(0) > 0) { hot_names = std::make_unique<HotNameCache>(state.range(0)); }
+  const uint64_t write_every = state.range(1) > 0 ? 10000 / state.range(1) : 0;
+  const ServerMetrics& metrics = *fixture.server->metrics();
+  std::array<uint8_t, 512> response = {};
+  RequestArena arena;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    if (write_every != 0 && i % write_every == 0) {
+      fixture.record_store->InsertOrUpdate(written);
+    }
+    benchmark::DoNotOptimize(fixture.server->HandleRequest(
+          requests[samples[i++ % kSamples]], response, arena, false, nullptr, 0,
+          hot_names.get()));
+    arena.Reset();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hit_rate"] = static_cast<double>(metrics.hot_name_hits.Value()) / i;
+  state.counters["invalidations"] = metrics.hot_name_invalidations.Value();
+}
+BENCHMARK(BM_HotNames)
+  ->ArgNames({"entries", "writes_per_10k"})
+  ->Args({0, 0})->Args({256, 0})->Args({256, 1})->Args({256, 10})->Args({256, 100})
+  ->Args({1024, 0});
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,612 @@
+#include "src/dns/dns_server.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "absl/status/status_matchers.h"
+#include "absl/status/statusor.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/client.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+#include "src/dns/hot_name_cache.h"
+#include "src/dns/mock_upstream.h"
+#include "src/dns/rate_limiter.h"
+#include "src/dns/record_store.h"
+#include "src/dns/request_arena.h"
+#include "src/dns/server_metrics.h"
+#include "src/dns/test_util.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Gt;
+using ::testing::HasSubstr;
+
+class DnsServerTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    record_store_ = std::make_shared<RecordStore>();
+    absl::StatusOr<std::shared_ptr<DnsServer>> server =
+      DnsServer::Create("127.0.0.1", 0, nullptr, record_store_);
+    ASSERT_TRUE(server.ok());
+    server_ = std::move(*server);
+  }
+
+  std::shared_ptr<RecordStore> record_store_;
+  std::shared_ptr<DnsServer> server_;
+};
+
+TEST_F(DnsServerTest, CacheHitReturnsStoredRecord) {
+  Record record = {};
+  record.qname = "service.internal.example";
+  record.qtype = QueryType::A;
+  record.ttl = 300;
+  record.data = Record::A { .ip_address = {10, 0, 0, 1} };
+  record_store_->InsertOrUpdate(record);
+
+  std::array<uint8_t, 512> request = CreateRequest(record.qname, QueryType::A);
+  std::array<uint8_t, 512> response_raw = {};
+  RequestArena arena;
+  absl::StatusOr<std::span<const uint8_t>> response_bytes =
+    server_->HandleRequest(request, response_raw, arena);
+  ASSERT_TRUE(response_bytes.ok());
+
+  absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(response_raw);
+  ASSERT_TRUE(response.ok());
+  EXPECT_EQ(response->header.id, 0x1234);
+  EXPECT_EQ(response->header.response_code, ResponseCode::NO_ERROR);
+  ASSERT_EQ(response->answers.size(), 1);
+  EXPECT_EQ(response->answers[0].qname, record.qname);
+  EXPECT_EQ(std::get<Record::A>(response->answers[0].data), std::get<Record::A>(record.data));
+}
+
+TEST_F(DnsServerTest, SteadyStateCacheHitDoesNotAllocate) {
+  // NOTE: names longer than the small string buffer, so that any string
+  // copied outside of the arena would show up.
+  for (uint8_t i = 0; i < 4; i++) {
+    Record record = {};
+    record.qname = "a-fairly-long-service-name.internal.example";
+    record.qtype = QueryType::A;
+    record.ttl = 300;
+    record.data = Record::A { .ip_address = {10, 0, 0, i} };
+    record_store_->InsertOrUpdate(record);
+  }
+
+  std::array<uint8_t, 512> request = CreateRequest(
+      "a-fairly-long-service-name.internal.example", QueryType::A);
+  std::array<uint8_t, 512> response_raw = {};
+  RequestArena arena;
+  // NOTE: warm up, e.g. any lazily initialized statics.
+  ASSERT_TRUE(server_->HandleRequest(request, response_raw, arena).ok());
+  arena.Reset();
+
+  const AllocationCounter allocations;
+  for (size_t i = 0; i < 16; i++) {
+    const absl::StatusOr<std::span<const uint8_t>> response =
+      server_->HandleRequest(request, response_raw, arena);
+    arena.Reset();
+    if (!response.ok()) { break; }
+  }
+  const size_t allocated = allocations.Count();
+  EXPECT_THAT(allocated, Eq(0));
+
+  absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(response_raw);
+  ASSERT_TRUE(response.ok());
+  EXPECT_EQ(response->answers.size(), 4);
+}
+
+TEST_F(DnsServerTest, HotNamesAreAnsweredFromTheCacheUntilTheStoreChanges) {
+  record_store_->InsertOrUpdate(CreateARecord("hot.example", 1));
+  std::array<uint8_t, 512> request = CreateRequest("hot.example", QueryType::A);
+  std::array<uint8_t, 512> response_raw = {};
+  RequestArena arena;
+  HotNameCache hot_names;
+  RequestOutcome outcome;
+  ASSERT_TRUE(server_->HandleRequest(
+        request, response_raw, arena, false, &outcome, 0, &hot_names).ok());
+  arena.Reset();
+
+  absl::StatusOr<std::span<const uint8_t>> cached;
+  size_t allocated = 0;
+  {
+    const AllocationCounter allocations;
+    cached = server_->HandleRequest(request, response_raw, arena, false, &outcome, 0, &hot_names);
+    allocated = allocations.Count();
+  }
+  EXPECT_THAT(allocated, Eq(0));
+  ASSERT_TRUE(cached.ok());
+  EXPECT_TRUE(outcome.cache_hit);
+  absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(response_raw);
+  ASSERT_TRUE(response.ok());
+  EXPECT_EQ(response->header.id, 0x1234);
+  ASSERT_EQ(response->answers.size(), 1);
+
+  // NOTE: writes to other shards, e.g. caching forwarded answers, don't
+  // make the entry stale.
+  std::string other = "other.example";
+  for (int i = 0; record_store_->ShardIndex(other) == record_store_->ShardIndex("hot.example");
+      i++) {
+    other = "other-" + std::to_string(i) + ".example";
+  }
+  record_store_->InsertOrUpdate(CreateARecord(other, 1));
+  ASSERT_TRUE(server_->HandleRequest(
+        request, response_raw, arena, false, &outcome, 0, &hot_names).ok());
+  arena.Reset();
+  // NOTE: writes to the name's shard, not just to the name, do.
+  record_store_->InsertOrUpdate(CreateARecord("hot.example", 2));
+  ASSERT_TRUE(server_->HandleRequest(
+        request, response_raw, arena, false, &outcome, 0, &hot_names).ok());
+  arena.Reset();
+  response = DnsPacket::FromBytes(response_raw);
+  ASSERT_TRUE(response.ok());
+  EXPECT_EQ(response->answers.size(), 2);
+
+  const ServerMetrics& metrics = *server_->metrics();
+  EXPECT_THAT(metrics.hot_name_hits.Value(), Eq(2));
+  EXPECT_THAT(metrics.hot_name_misses.Value(), Eq(2));
+  EXPECT_THAT(metrics.hot_name_invalidations.Value(), Eq(1));
+  EXPECT_THAT(metrics.cache_hits.Value(), Eq(4));
+}
+
+TEST_F(DnsServerTest, ChasedCnamesAreNotHotNames) {
+  Record alias = {};
+  alias.qname = "alias.example";
+  alias.qtype = QueryType::CNAME;
+  alias.ttl = 300;
+  alias.data = Record::CNAME { .host = "hot.example" };
+  record_store_->InsertOrUpdate(alias);
+  record_store_->InsertOrUpdate(CreateARecord("hot.example", 1));
+  std::array<uint8_t, 512> request = CreateRequest("alias.example", QueryType::A);
+  std::array<uint8_t, 512> response_raw = {};
+  RequestArena arena;
+  HotNameCache hot_names;
+  RequestOutcome outcome;
+  // NOTE: the answer is read from the target's shard too, which the entry
+  // wouldn't be invalidated by.
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(server_->HandleRequest(
+          request, response_raw, arena, false, &outcome, 0, &hot_names).ok());
+    arena.Reset();
+    EXPECT_TRUE(outcome.cache_hit);
+  }
+  EXPECT_THAT(server_->metrics()->hot_name_hits.Value(), Eq(0));
+  absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(response_raw);
+  ASSERT_TRUE(response.ok());
+  EXPECT_EQ(response->answers.size(), 2);
+}
+
+TEST_F(DnsServerTest, CountsQueriesByOutcome) {
+  record_store_->InsertOrUpdate(CreateARecord("hit.example", 1));
+  std::array<uint8_t, 512> response_raw = {};
+  RequestArena arena;
+  std::array<uint8_t, 512> hit = CreateRequest("hit.example", QueryType::A);
+  ASSERT_TRUE(server_->HandleRequest(hit, response_raw, arena, /*time_stages=*/true).ok());
+  std::array<uint8_t, 512> miss = CreateRequest("miss.example", QueryType::A);
+  ASSERT_TRUE(server_->HandleRequest(miss, response_raw, arena).ok());
+  // NOTE: the question name is a compression pointer to itself.
+  std::array<uint8_t, 512> malformed = {
+    0x12, 0x34, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0x0c};
+  ASSERT_TRUE(server_->HandleRequest(malformed, response_raw, arena).ok());
+
+  const ServerMetrics& metrics = *server_->metrics();
+  EXPECT_THAT(metrics.queries.Value(), Eq(3));
+  EXPECT_THAT(metrics.cache_hits.Value(), Eq(1));
+  EXPECT_THAT(metrics.cache_misses.Value(), Eq(1));
+  EXPECT_THAT(metrics.forwards.Value(), Eq(0));
+  EXPECT_THAT(metrics.serv_fail.Value(), Eq(1));
+  EXPECT_THAT(metrics.form_error.Value(), Eq(1));
+  // NOTE: only the first request had its stages timed.
+  EXPECT_THAT(metrics.parse_ns.Snapshot().Count(), Eq(1));
+  EXPECT_THAT(metrics.lookup_ns.Snapshot().Count(), Eq(1));
+  EXPECT_THAT(metrics.encode_ns.Snapshot().Count(), Eq(1));
+  EXPECT_THAT(metrics.forward_ns.Snapshot().Count(), Eq(0));
+
+  const std::string text = PrometheusText(metrics, record_store_->GetStats());
+  EXPECT_THAT(text, HasSubstr("\ntiny_dns_queries_total 3\n"));
+  EXPECT_THAT(text, HasSubstr("\ntiny_dns_record_store_size 1\n"));
+  EXPECT_THAT(text, HasSubstr("\ntiny_dns_record_store_pending_expirations 1\n"));
+  EXPECT_THAT(text, HasSubstr("tiny_dns_stage_latency_seconds_count{stage=\"lookup\"} 1\n"));
+}
+
+class DnsServerForwardingTest : public testing::Test {
+ protected:
+  void StartUpstream(MockUpstreamOptions options) {
+    absl::StatusOr<std::unique_ptr<MockUpstream>> upstream =
+      MockUpstream::Create(std::move(options));
+    ASSERT_TRUE(upstream.ok());
+    upstream_ = std::move(*upstream);
+    absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+        "127.0.0.1", "127.0.0.1", upstream_->port(),
+        { .timeout = std::chrono::milliseconds(200) });
+    ASSERT_TRUE(forwarder.ok());
+    record_store_ = std::make_shared<RecordStore>();
+    absl::StatusOr<std::shared_ptr<DnsServer>> server =
+      DnsServer::Create("127.0.0.1", 0, std::move(*forwarder), record_store_);
+    ASSERT_TRUE(server.ok());
+    server_ = std::move(*server);
+  }
+
+  DnsPacket Resolve(std::string_view qname, bool recursion_desired = true) {
+    std::array<uint8_t, 512> request = CreateRequest(qname, QueryType::A, recursion_desired);
+    std::array<uint8_t, 512> response_raw = {};
+    RequestArena arena;
+    EXPECT_TRUE(server_->HandleRequest(request, response_raw, arena).ok());
+    absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(response_raw);
+    EXPECT_TRUE(response.ok());
+    return response.ok() ? *std::move(response) : DnsPacket();
+  }
+
+  std::unique_ptr<MockUpstream> upstream_;
+  std::shared_ptr<RecordStore> record_store_;
+  std::shared_ptr<DnsServer> server_;
+};
+
+TEST_F(DnsServerForwardingTest, ForwardsMissAndCachesAnswer) {
+  StartUpstream({ .records = { CreateARecord("upstream.example", 7) } });
+
+  DnsPacket response = Resolve("upstream.example");
+  EXPECT_EQ(response.header.response_code, ResponseCode::NO_ERROR);
+  ASSERT_EQ(response.answers.size(), 1);
+  EXPECT_EQ(response.answers[0].data, CreateARecord("upstream.example", 7).data);
+  EXPECT_EQ(upstream_->stats().queries, 1);
+
+  response = Resolve("upstream.example");
+  ASSERT_EQ(response.answers.size(), 1);
+  EXPECT_EQ(upstream_->stats().queries, 1);
+}
+
+TEST_F(DnsServerForwardingTest, ReportsRequestOutcome) {
+  StartUpstream({ .records = { CreateARecord("upstream.example", 7) } });
+  std::array<uint8_t, 512> request = CreateRequest("upstream.example", QueryType::A, true);
+  std::array<uint8_t, 512> response_raw = {};
+  RequestArena arena;
+
+  RequestOutcome outcome;
+  ASSERT_TRUE(server_->HandleRequest(request, response_raw, arena, false, &outcome).ok());
+  EXPECT_FALSE(outcome.cache_hit);
+  EXPECT_TRUE(outcome.forwarded);
+  EXPECT_THAT(outcome.upstream_rtt_ns, Gt(0));
+
+  outcome = {};
+  ASSERT_TRUE(server_->HandleRequest(request, response_raw, arena, false, &outcome).ok());
+  EXPECT_TRUE(outcome.cache_hit);
+  EXPECT_FALSE(outcome.forwarded);
+  EXPECT_THAT(outcome.upstream_rtt_ns, Eq(0));
+}
+
+TEST_F(DnsServerForwardingTest, DoesNotForwardWithoutRecursionDesired) {
+  StartUpstream({ .synthesize_answers = true });
+
+  DnsPacket response = Resolve("upstream.example", /*recursion_desired=*/false);
+  EXPECT_EQ(response.header.response_code, ResponseCode::SERV_FAIL);
+  EXPECT_EQ(upstream_->stats().queries, 0);
+}
+
+TEST_F(DnsServerForwardingTest, PassesThroughUpstreamErrors) {
+  StartUpstream({ .synthesize_answers = true, .serv_fail_rate = 1 });
+  EXPECT_EQ(Resolve("a.example").header.response_code, ResponseCode::SERV_FAIL);
+
+  StartUpstream({});
+  EXPECT_EQ(Resolve("missing.example").header.response_code, ResponseCode::NX_DOMAIN);
+}
+
+TEST_F(DnsServerForwardingTest, LostUpstreamResponseTimesOut) {
+  StartUpstream({ .synthesize_answers = true, .loss_rate = 1 });
+
+  const auto start = std::chrono::steady_clock::now();
+  DnsPacket response = Resolve("lost.example");
+  EXPECT_EQ(response.header.response_code, ResponseCode::SERV_FAIL);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+  EXPECT_EQ(upstream_->stats().dropped, 1);
+}
+
+TEST_F(DnsServerForwardingTest, LateResponseIsNotMistakenForTheNextOne) {
+  StartUpstream({ .synthesize_answers = true, .delay = std::chrono::milliseconds(300) });
+  EXPECT_EQ(Resolve("slow.example").header.response_code, ResponseCode::SERV_FAIL);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  // NOTE: the late response to the first query is waiting in the client's
+  // socket by now, with the same ID; it must not be returned for this one.
+  DnsPacket response = Resolve("slow.example");
+  EXPECT_EQ(response.header.response_code, ResponseCode::SERV_FAIL);
+  EXPECT_TRUE(response.answers.empty());
+}
+
+// NOTE: serves over UDP from Wait(), as the pipeline and the worker pool
+// answer on the socket.
+class DnsServerUdpTest : public testing::Test {
+ protected:
+  void TearDown() override { StopServer(); }
+
+  // NOTE: configure server_ between this and Serve().
+  void CreateServer(
+      MockUpstreamOptions upstream_options,
+      ForwarderOptions forwarder_options = { .timeout = std::chrono::milliseconds(200) },
+      AdmissionOptions admission_options = {}) {
+    absl::StatusOr<std::unique_ptr<MockUpstream>> upstream =
+      MockUpstream::Create(std::move(upstream_options));
+    ASSERT_TRUE(upstream.ok());
+    upstream_ = std::move(*upstream);
+    absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+        "127.0.0.1", "127.0.0.1", upstream_->port(), forwarder_options);
+    ASSERT_TRUE(forwarder.ok());
+    record_store_ = std::make_shared<RecordStore>();
+    absl::StatusOr<std::shared_ptr<DnsServer>> server =
+      DnsServer::Create("127.0.0.1", 0, std::move(*forwarder), record_store_);
+    ASSERT_TRUE(server.ok());
+    server_ = std::move(*server);
+    server_->EnableAdmissionControl(admission_options);
+  }
+
+  void Serve() {
+    wait_thread_ = std::thread([this] { server_->Wait(); });
+    absl::StatusOr<std::shared_ptr<Client>> client = Client::Create(
+        "127.0.0.1", "127.0.0.1", server_->port(), std::chrono::milliseconds(2000));
+    ASSERT_TRUE(client.ok());
+    client_ = std::move(*client);
+  }
+
+  void StartServer(
+      MockUpstreamOptions upstream_options,
+      ForwarderOptions forwarder_options = { .timeout = std::chrono::milliseconds(200) },
+      AdmissionOptions admission_options = {}) {
+    ASSERT_NO_FATAL_FAILURE(CreateServer(
+          std::move(upstream_options), forwarder_options, admission_options));
+    ASSERT_TRUE(server_->EnableAsyncForwarding().ok());
+    ASSERT_NO_FATAL_FAILURE(Serve());
+  }
+
+  void StopServer() {
+    if (server_ == nullptr) { return; }
+    server_->Stop();
+    wait_thread_.join();
+    server_.reset();
+  }
+
+  void Send(std::string_view qname, uint16_t id) {
+    std::array<uint8_t, 512> request_raw = {};
+    const absl::StatusOr<std::span<const uint8_t>> encoded =
+      CreateRequestPacket(qname, QueryType::A, /*recursion_desired=*/true, id)
+      .ToBytes(request_raw);
+    ASSERT_TRUE(encoded.ok());
+    ASSERT_TRUE(client_->Send(*encoded).ok());
+  }
+
+  absl::StatusOr<DnsPacket> Receive() {
+    std::array<uint8_t, 512> response_raw = {};
+    if (absl::StatusOr<size_t> size = client_->Receive(response_raw); !size.ok()) {
+      return size.status();
+    }
+    return DnsPacket::FromBytes(response_raw);
+  }
+
+  absl::StatusOr<DnsPacket> Query(std::string_view qname, uint16_t id = 0x1234) {
+    Send(qname, id);
+    return Receive();
+  }
+
+  // NOTE: completions only finish once they've sent their response.
+  void ExpectPipelineDrains() {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (server_->pipeline_forwards() > 0 && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_THAT(server_->pipeline_forwards(), Eq(0));
+  }
+
+  std::unique_ptr<MockUpstream> upstream_;
+  std::shared_ptr<RecordStore> record_store_;
+  std::shared_ptr<DnsServer> server_;
+  std::thread wait_thread_;
+  std::shared_ptr<Client> client_;
+};
+
+using DnsServerPipelineTest = DnsServerUdpTest;
+
+TEST_F(DnsServerPipelineTest, ServesHitsInline) {
+  ASSERT_NO_FATAL_FAILURE(StartServer({ .synthesize_answers = true }));
+  record_store_->InsertOrUpdate(CreateARecord("hit.example", 1));
+
+  const absl::StatusOr<DnsPacket> response = Query("hit.example", 0xbeef);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_THAT(response->header.id, Eq(0xbeef));
+  EXPECT_THAT(response->header.response_code, Eq(ResponseCode::NO_ERROR));
+  ASSERT_THAT(response->answers.size(), Eq(1));
+  EXPECT_EQ(response->answers[0].data, CreateARecord("hit.example", 1).data);
+  const ServerMetrics& metrics = *server_->metrics();
+  EXPECT_THAT(metrics.cache_hits.Value(), Eq(1));
+  EXPECT_THAT(metrics.forwards.Value(), Eq(0));
+  EXPECT_THAT(upstream_->stats().queries, Eq(0));
+  EXPECT_THAT(server_->pipeline_forwards(), Eq(0));
+}
+
+TEST_F(DnsServerPipelineTest, AnswersMissesOnCompletionWithTheClientsId) {
+  ASSERT_NO_FATAL_FAILURE(StartServer({ .records = { CreateARecord("miss.example", 7) } }));
+
+  absl::StatusOr<DnsPacket> response = Query("miss.example", 0xbeef);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_THAT(response->header.id, Eq(0xbeef));
+  EXPECT_THAT(response->header.response_code, Eq(ResponseCode::NO_ERROR));
+  ASSERT_THAT(response->answers.size(), Eq(1));
+  EXPECT_EQ(response->answers[0].data, CreateARecord("miss.example", 7).data);
+  EXPECT_THAT(server_->metrics()->forwards.Value(), Eq(1));
+  ExpectPipelineDrains();
+
+  // NOTE: the answer was cached on completion, so is now a hit.
+  response = Query("miss.example", 0xcafe);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_THAT(response->header.id, Eq(0xcafe));
+  EXPECT_THAT(response->answers.size(), Eq(1));
+  EXPECT_THAT(upstream_->stats().queries, Eq(1));
+  EXPECT_THAT(server_->metrics()->cache_hits.Value(), Eq(1));
+}
+
+TEST_F(DnsServerPipelineTest, UpstreamErrorsAreServFail) {
+  ASSERT_NO_FATAL_FAILURE(StartServer(
+        { .synthesize_answers = true, .loss_rate = 1 },
+        { .timeout = std::chrono::milliseconds(100) }));
+
+  const absl::StatusOr<DnsPacket> response = Query("lost.example", 0xbeef);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_THAT(response->header.id, Eq(0xbeef));
+  EXPECT_THAT(response->header.response_code, Eq(ResponseCode::SERV_FAIL));
+  EXPECT_THAT(response->answers.size(), Eq(0));
+  EXPECT_THAT(server_->metrics()->forward_errors.Value(), Eq(1));
+  EXPECT_THAT(server_->metrics()->serv_fail.Value(), Eq(1));
+  ExpectPipelineDrains();
+}
+
+TEST_F(DnsServerPipelineTest, ShedsMissesOverTheForwarderQueue) {
+  // NOTE: a queue of 0 is always full.
+  ASSERT_NO_FATAL_FAILURE(StartServer(
+        { .synthesize_answers = true },
+        { .max_queued = 0 },
+        { .shed_response_code = ResponseCode::REFUSED }));
+
+  const absl::StatusOr<DnsPacket> response = Query("shed.example", 0xbeef);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_THAT(response->header.id, Eq(0xbeef));
+  EXPECT_THAT(response->header.response_code, Eq(ResponseCode::REFUSED));
+  EXPECT_THAT(server_->metrics()->shed_forwards.Value(), Eq(1));
+  EXPECT_THAT(server_->metrics()->forwards.Value(), Eq(0));
+  EXPECT_THAT(upstream_->stats().queries, Eq(0));
+  EXPECT_THAT(server_->pipeline_forwards(), Eq(0));
+}
+
+TEST_F(DnsServerPipelineTest, ShutdownDoesNotWaitOnUpstream) {
+  // NOTE: no timeout, so the forward would otherwise never complete.
+  ASSERT_NO_FATAL_FAILURE(StartServer(
+        { .synthesize_answers = true, .loss_rate = 1 },
+        { .timeout = std::chrono::milliseconds(0) }));
+  ASSERT_NO_FATAL_FAILURE(Send("lost.example", 0xbeef));
+  while (upstream_->stats().dropped == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_THAT(server_->pipeline_forwards(), Eq(1));
+
+  const auto start = std::chrono::steady_clock::now();
+  StopServer();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+  // NOTE: the client is still answered.
+  const absl::StatusOr<DnsPacket> response = Receive();
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_THAT(response->header.id, Eq(0xbeef));
+  EXPECT_THAT(response->header.response_code, Eq(ResponseCode::SERV_FAIL));
+}
+
+using DnsServerPoolTest = DnsServerUdpTest;
+
+TEST_F(DnsServerPoolTest, EachWorkerAnswersRepeatQueriesFromItsHotNameCache) {
+  ASSERT_NO_FATAL_FAILURE(CreateServer({ .synthesize_answers = true }));
+  server_->PinThreads({}, {}, /*worker_threads=*/1);
+  server_->EnableHotNameCache();
+  ASSERT_NO_FATAL_FAILURE(Serve());
+  record_store_->InsertOrUpdate(CreateARecord("hot.example", 1));
+
+  for (uint16_t id = 1; id <= 3; id++) {
+    const absl::StatusOr<DnsPacket> response = Query("hot.example", id);
+    ASSERT_TRUE(response.ok()) << response.status();
+    EXPECT_THAT(response->header.id, Eq(id));
+    EXPECT_THAT(response->answers.size(), Eq(1));
+  }
+  const ServerMetrics& metrics = *server_->metrics();
+  EXPECT_THAT(metrics.cache_hits.Value(), Eq(3));
+  EXPECT_THAT(metrics.hot_name_misses.Value(), Eq(1));
+  EXPECT_THAT(metrics.hot_name_hits.Value(), Eq(2));
+}
+
+TEST_F(DnsServerPoolTest, ShedsMissesOverTheWorkQueue) {
+  // NOTE: the one worker is held up by each miss for the whole upstream
+  // delay, so the burst queues behind it.
+  ASSERT_NO_FATAL_FAILURE(CreateServer(
+        { .synthesize_answers = true, .delay = std::chrono::milliseconds(100) },
+        { .timeout = std::chrono::milliseconds(500) },
+        { .shed_response_code = ResponseCode::REFUSED }));
+  server_->PinThreads({}, {}, /*worker_threads=*/1);
+  ASSERT_NO_FATAL_FAILURE(Serve());
+
+  constexpr size_t kBurst = kMaxQueuedRequestsPerWorker + 16;
+  for (uint16_t id = 1; id <= kBurst; id++) {
+    ASSERT_NO_FATAL_FAILURE(Send("miss-" + std::to_string(id) + ".example", id));
+  }
+  // NOTE: at most the queue's worth, plus the one being served, get in.
+  size_t refused = 0;
+  while (refused < kBurst - kMaxQueuedRequestsPerWorker - 1) {
+    const absl::StatusOr<DnsPacket> response = Receive();
+    ASSERT_TRUE(response.ok()) << response.status();
+    if (response->header.response_code == ResponseCode::REFUSED) { refused++; }
+  }
+  EXPECT_GE(server_->metrics()->shed_overload.Value(), refused);
+}
+
+class DnsServerRateLimitTest : public DnsServerUdpTest {
+ protected:
+  void StartServer(RateLimiterOptions options) {
+    ASSERT_NO_FATAL_FAILURE(CreateServer({}));
+    server_->EnableRateLimiting(std::make_shared<RateLimiter>(options));
+    ASSERT_TRUE(server_->EnableAsyncForwarding().ok());
+    ASSERT_NO_FATAL_FAILURE(Serve());
+    record_store_->InsertOrUpdate(CreateARecord("limited.example", 1));
+  }
+
+  // NOTE: sends kQueries for the one name, then expects the burst of 2 to be
+  // answered and, of those limited after, every other one to be sent
+  // truncated and the rest dropped. Drops are only seen as the IDs skipped.
+  void ExpectSlipCadence() {
+    constexpr uint16_t kQueries = 8;
+    for (uint16_t id = 1; id <= kQueries; id++) {
+      ASSERT_NO_FATAL_FAILURE(Send("limited.example", id));
+    }
+    for (uint16_t id : { 1, 2 }) {
+      const absl::StatusOr<DnsPacket> response = Receive();
+      ASSERT_TRUE(response.ok()) << response.status();
+      EXPECT_THAT(response->header.id, Eq(id));
+      EXPECT_FALSE(response->header.truncated_message);
+      EXPECT_THAT(response->answers.size(), Eq(1));
+    }
+    for (uint16_t id : { 4, 6, 8 }) {
+      const absl::StatusOr<DnsPacket> response = Receive();
+      ASSERT_TRUE(response.ok()) << response.status();
+      EXPECT_THAT(response->header.id, Eq(id));
+      EXPECT_TRUE(response->header.truncated_message);
+      EXPECT_TRUE(response->header.query_response);
+      ASSERT_THAT(response->questions.size(), Eq(1));
+      EXPECT_THAT(response->questions[0].qname, Eq("limited.example"));
+      EXPECT_THAT(response->answers.size(), Eq(0));
+    }
+    const ServerMetrics& metrics = *server_->metrics();
+    EXPECT_THAT(metrics.queries.Value(), Eq(kQueries));
+    EXPECT_THAT(metrics.rate_limit_slips.Value(), Eq(3));
+    EXPECT_THAT(metrics.rate_limit_drops.Value(), Eq(3));
+  }
+};
+
+// NOTE: rates low enough that no token is refilled during the test.
+TEST_F(DnsServerRateLimitTest, SlipsOrDropsQueriesOverTheLimit) {
+  ASSERT_NO_FATAL_FAILURE(StartServer(
+        { .queries_per_second = 0.1, .window_seconds = 20, .slip = 2 }));
+  ExpectSlipCadence();
+  EXPECT_THAT(server_->metrics()->cache_hits.Value(), Eq(2));
+}
+
+TEST_F(DnsServerRateLimitTest, SlipsOrDropsResponsesOverTheLimit) {
+  ASSERT_NO_FATAL_FAILURE(StartServer(
+        { .responses_per_second = 0.1, .window_seconds = 20, .slip = 2 }));
+  ExpectSlipCadence();
+  // NOTE: limited responses are still looked up, unlike limited queries.
+  EXPECT_THAT(server_->metrics()->cache_hits.Value(), Eq(8));
+}
+
+} // namespace
+} // tiny_dns
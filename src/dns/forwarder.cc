@@ -0,0 +1,248 @@
+#include "src/dns/forwarder.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/random/distributions.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "src/common/cpu_affinity.h"
+#include "src/common/status_macros.h"
+#include "src/dns/client.h"
+#include "src/dns/query_trace.h"
+#include "src/dns/server_metrics.h"
+
+namespace tiny_dns {
+namespace {
+
+// NOTE: how late a timed out forward, or a request to stop, can be noticed.
+constexpr std::chrono::milliseconds kPollInterval(50);
+constexpr size_t kHeaderSize = 12;
+constexpr size_t kMaxInflight = 1 << 15;
+constexpr uint32_t kNoSlot = UINT32_MAX;
+
+void SetId(std::array<uint8_t, 512>& packet, uint16_t id) {
+  packet[0] = id >> 8;
+  packet[1] = id & 0xff;
+}
+
+} // namespace
+
+absl::StatusOr<std::unique_ptr<Forwarder>> Forwarder::Create(
+    std::string local_address, std::string upstream_address, int32_t upstream_port,
+    ForwarderOptions options) {
+  ASSIGN_OR_RETURN(std::shared_ptr<Client> upstream, Client::Create(
+        std::move(local_address), std::move(upstream_address), upstream_port, kPollInterval));
+  return std::make_unique<Forwarder>(std::move(upstream), options);
+}
+
+Forwarder::Forwarder(std::shared_ptr<Client> upstream, ForwarderOptions options) :
+  upstream_(std::move(upstream)), options_(options),
+  slots_(std::clamp<size_t>(options.max_inflight, 1, kMaxInflight)),
+  slot_by_id_(1 << 16, kNoSlot), stopping_(false) {
+  free_slots_.reserve(slots_.size());
+  for (size_t i = slots_.size(); i > 0; i--) { free_slots_.push_back(i - 1); }
+  send_thread_ = std::thread([this] { Send(); });
+  receive_thread_ = std::thread([this] { Receive(); });
+}
+
+Forwarder::~Forwarder() {
+  {
+    std::scoped_lock lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  send_thread_.join();
+  receive_thread_.join();
+  Shutdown();
+}
+
+bool Forwarder::Submit(ForwardRequest request, Completion completion) {
+  request.submitted_ns = MonotonicNanos();
+  {
+    std::scoped_lock lock(mutex_);
+    if (shut_down_ || queue_.size() >= options_.max_queued) { return false; }
+    queue_.push_back(Pending{ .request = std::move(request), .completion = std::move(completion) });
+  }
+  cv_.notify_one();
+  return true;
+}
+
+std::future<absl::StatusOr<std::array<uint8_t, 512>>> Forwarder::Forward(
+    std::span<const uint8_t> query, int64_t deadline_ns) {
+  // NOTE: shared, as a Completion must be copyable.
+  auto response = std::make_shared<std::promise<absl::StatusOr<std::array<uint8_t, 512>>>>();
+  std::future<absl::StatusOr<std::array<uint8_t, 512>>> future = response->get_future();
+  ForwardRequest request;
+  if (query.size() > request.query.size()) {
+    response->set_value(absl::InvalidArgumentError("Query too large to forward."));
+    return future;
+  }
+  memcpy(request.query.data(), query.data(), query.size());
+  request.query_size = query.size();
+  request.deadline_ns = deadline_ns;
+  if (!Submit(std::move(request), [response](
+          const ForwardRequest&, const absl::StatusOr<std::array<uint8_t, 512>>& upstream_raw) {
+        response->set_value(upstream_raw);
+      })) {
+    response->set_value(absl::ResourceExhaustedError("Forward queue is full or shut down."));
+  }
+  return future;
+}
+
+void Forwarder::Shutdown() {
+  std::vector<Pending> cancelled;
+  {
+    std::scoped_lock lock(mutex_);
+    shut_down_ = true;
+    for (Pending& pending : queue_) { cancelled.push_back(std::move(pending)); }
+    queue_.clear();
+    for (uint32_t index = 0; index < slots_.size(); index++) {
+      if (!slots_[index].in_use) { continue; }
+      FreeSlotLocked(index);
+      cancelled.push_back(std::move(slots_[index].pending));
+    }
+  }
+  for (const Pending& pending : cancelled) {
+    pending.completion(pending.request, absl::CancelledError("Forwarder shut down."));
+  }
+}
+
+size_t Forwarder::queued() const {
+  std::scoped_lock lock(mutex_);
+  return queue_.size();
+}
+
+size_t Forwarder::inflight() const {
+  std::scoped_lock lock(mutex_);
+  return slots_.size() - free_slots_.size();
+}
+
+void Forwarder::Send() {
+  if (absl::Status status = PinCurrentThread(options_.cpus); !status.ok()) { LOG(ERROR) << status; }
+  std::array<uint8_t, 512> buffer = {};
+  while (true) {
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [this] { return stopping_ || (!queue_.empty() && !free_slots_.empty()); });
+    if (stopping_) { return; }
+    Pending pending = std::move(queue_.front());
+    queue_.pop_front();
+    const int64_t now_ns = MonotonicNanos();
+    if (pending.request.deadline_ns != 0 && now_ns > pending.request.deadline_ns) {
+      lock.unlock();
+      pending.completion(
+          pending.request, absl::DeadlineExceededError("Queued past the request's deadline."));
+      continue;
+    }
+    const uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    const uint16_t id = PickIdLocked();
+    slot_by_id_[id] = slot;
+    const size_t size = std::min(pending.request.query_size, buffer.size());
+    memcpy(buffer.data(), pending.request.query.data(), size);
+    slots_[slot] =
+      Slot{ .in_use = true, .id = id, .sent_ns = now_ns, .pending = std::move(pending) };
+    lock.unlock();
+
+    SetId(buffer, id);
+    const absl::Status status = upstream_->Send(std::span<const uint8_t>(buffer.data(), size));
+    if (status.ok()) { continue; }
+    lock.lock();
+    // NOTE: unless it timed out in the meantime.
+    if (slot_by_id_[id] != slot) { continue; }
+    FreeSlotLocked(slot);
+    pending = std::move(slots_[slot].pending);
+    lock.unlock();
+    pending.completion(pending.request, status);
+  }
+}
+
+void Forwarder::Receive() {
+  if (absl::Status status = PinCurrentThread(options_.cpus); !status.ok()) { LOG(ERROR) << status; }
+  std::array<uint8_t, 512> buffer = {};
+  int64_t next_sweep_ns = 0;
+  while (!stopping_) {
+    // NOTE: fails with DeadlineExceeded every kPollInterval without a response.
+    const absl::StatusOr<size_t> received = upstream_->Receive(buffer);
+    if (received.ok() && *received >= kHeaderSize) {
+      const uint16_t id = (buffer[0] << 8) | buffer[1];
+      Pending pending;
+      if (TakeSlot(id, buffer, pending)) {
+        cv_.notify_one();
+        SetId(buffer, (pending.request.query[0] << 8) | pending.request.query[1]);
+        pending.completion(pending.request, buffer);
+      }
+    } else if (!received.ok() && !absl::IsDeadlineExceeded(received.status())) {
+      LOG_EVERY_N_SEC(WARNING, 1) << "Error receiving from upstream: " << received.status();
+    }
+
+    const int64_t now_ns = MonotonicNanos();
+    if (now_ns < next_sweep_ns) { continue; }
+    next_sweep_ns = now_ns + std::chrono::nanoseconds(kPollInterval).count();
+    const std::vector<Pending> expired = TakeExpired(now_ns);
+    if (expired.empty()) { continue; }
+    cv_.notify_one();
+    for (const Pending& pending : expired) {
+      pending.completion(
+          pending.request, absl::UnavailableError("Timed out waiting for upstream."));
+    }
+  }
+}
+
+bool Forwarder::TakeSlot(
+    uint16_t id, const std::array<uint8_t, 512>& response, Pending& pending) {
+  std::scoped_lock lock(mutex_);
+  // NOTE: e.g. a late response to a forward that already timed out.
+  const uint32_t index = slot_by_id_[id];
+  if (index == kNoSlot) { return false; }
+  Slot& slot = slots_[index];
+  const absl::StatusOr<std::span<const uint8_t>> question = RawQuestion(response);
+  const absl::StatusOr<std::span<const uint8_t>> asked =
+    RawQuestion(slot.pending.request.query);
+  if (!question.ok() || !asked.ok() || !std::ranges::equal(*question, *asked)) { return false; }
+  FreeSlotLocked(index);
+  pending = std::move(slot.pending);
+  return true;
+}
+
+uint16_t Forwarder::PickIdLocked() {
+  // NOTE: at most half the IDs are in use, so this takes two tries on average.
+  uint16_t id;
+  do {
+    id = absl::Uniform<uint16_t>(bitgen_);
+  } while (slot_by_id_[id] != kNoSlot);
+  return id;
+}
+
+void Forwarder::FreeSlotLocked(uint32_t slot) {
+  slots_[slot].in_use = false;
+  slot_by_id_[slots_[slot].id] = kNoSlot;
+  free_slots_.push_back(slot);
+}
+
+std::vector<Forwarder::Pending> Forwarder::TakeExpired(int64_t now_ns) {
+  const int64_t timeout_ns = std::chrono::nanoseconds(options_.timeout).count();
+  std::vector<Pending> expired;
+  if (timeout_ns == 0) { return expired; }
+  std::scoped_lock lock(mutex_);
+  for (uint32_t index = 0; index < slots_.size(); index++) {
+    Slot& slot = slots_[index];
+    if (!slot.in_use || now_ns - slot.sent_ns < timeout_ns) { continue; }
+    FreeSlotLocked(index);
+    expired.push_back(std::move(slot.pending));
+  }
+  return expired;
+}
+
+} // tiny_dns
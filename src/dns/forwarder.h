@@ -0,0 +1,151 @@
+#ifndef SRC_DNS_FORWARDER_H_
+#define SRC_DNS_FORWARDER_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "src/dns/client.h"
+
+// Forwards requests to an upstream DNS server asynchronously: Submit() only
+// queues the request, and its completion is called once upstream answers (or
+// doesn't). Many forwards are in flight at once over one socket, told apart
+// by DNS ID, so a slow upstream costs a slot per forward rather than a thread.
+// The IDs sent upstream are picked at random, so they can't be guessed to
+// spoof a response (RFC 5452), and the Client only takes responses from
+// upstream's address.
+// Every forward to upstream goes through one: the pipeline's misses, and the
+// ones the resolver waits on for serving threads and the admin service.
+//
+// Two threads: one sends queued requests as slots come free, the other
+// receives responses, matches them to their slots and runs the completion.
+// Forwards that get no response within the timeout complete with an error.
+
+namespace tiny_dns {
+
+struct ForwarderOptions {
+  // NOTE: forwards awaiting an upstream response at once, at most 32768, so
+  // at least half the DNS IDs are free to pick from at random. More wait in
+  // the queue.
+  size_t max_inflight = 1024;
+  // NOTE: requests waiting for a slot, Submit() fails beyond this many.
+  size_t max_queued = 4096;
+  // NOTE: 0 waits for a response forever.
+  std::chrono::milliseconds timeout = std::chrono::seconds(2);
+  // NOTE: both threads are pinned to these, if any.
+  std::vector<int> cpus = {};
+};
+
+// NOTE: a request to forward, and what's needed to answer the client for it.
+struct ForwardRequest {
+  // NOTE: the encoded request, with the client's ID. The ID is swapped for
+  // one of the forwarder's on the way upstream, and back on the way down.
+  std::array<uint8_t, 512> query = {};
+  size_t query_size = 0;
+  struct sockaddr_in client_addr = {};
+  // NOTE: both on the steady clock. received_ns is 0 unless the request was
+  // sampled for stage timings, deadline_ns 0 for no deadline.
+  int64_t received_ns = 0;
+  int64_t deadline_ns = 0;
+  // NOTE: set by Submit().
+  int64_t submitted_ns = 0;
+};
+
+class Forwarder {
+ public:
+  // NOTE: called on either of the forwarder's threads, with the upstream
+  // response (its ID restored to the client's) or why there is none:
+  // DeadlineExceeded for a request still queued at its deadline, which was
+  // never sent, Unavailable for one upstream didn't answer in time.
+  using Completion = std::function<void(
+      const ForwardRequest& request, const absl::StatusOr<std::array<uint8_t, 512>>& response)>;
+
+  static absl::StatusOr<std::unique_ptr<Forwarder>> Create(
+      std::string local_address, std::string upstream_address, int32_t upstream_port,
+      ForwarderOptions options);
+  // NOTE: upstream must have a receive timeout: it's how often the receiving
+  // thread looks for timed out forwards, and checks whether to stop.
+  Forwarder(std::shared_ptr<Client> upstream, ForwarderOptions options);
+  // NOTE: Shutdown()s first.
+  ~Forwarder();
+
+  Forwarder(const Forwarder&) = delete;
+  Forwarder& operator=(const Forwarder&) = delete;
+
+  // NOTE: never waits on upstream. False, and the request is dropped without
+  // completing, if the queue is full or the forwarder shut down.
+  bool Submit(ForwardRequest request, Completion completion);
+  // NOTE: Submit() for a caller that waits on the response itself. Never
+  // waits on upstream either: the future is ready with ResourceExhausted
+  // straight away if the queue is full or the forwarder shut down.
+  std::future<absl::StatusOr<std::array<uint8_t, 512>>> Forward(
+      std::span<const uint8_t> query, int64_t deadline_ns = 0);
+
+  // NOTE: completes every request still queued or in flight with Cancelled,
+  // on the calling thread, and refuses any submitted after. So once it
+  // returns, no completion is left waiting on upstream, however long the
+  // timeout.
+  void Shutdown();
+
+  size_t queued() const;
+  size_t inflight() const;
+
+ private:
+  struct Pending {
+    ForwardRequest request;
+    Completion completion;
+  };
+  struct Slot {
+    bool in_use = false;
+    // NOTE: the DNS ID sent upstream.
+    uint16_t id = 0;
+    int64_t sent_ns = 0;
+    Pending pending;
+  };
+
+  void Send();
+  void Receive();
+  // NOTE: all take mutex_.
+  bool TakeSlot(uint16_t id, const std::array<uint8_t, 512>& response, Pending& pending);
+  std::vector<Pending> TakeExpired(int64_t now_ns);
+  // NOTE: a DNS ID no slot in use has.
+  uint16_t PickIdLocked();
+  void FreeSlotLocked(uint32_t slot);
+
+  // NOTE: sending and receiving on the socket from different threads is
+  // safe, they don't share any of the Client's state.
+  const std::shared_ptr<Client> upstream_;
+  const ForwarderOptions options_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Pending> queue_;
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  // NOTE: indexed by DNS ID, the slot in use with it or kNoSlot.
+  std::vector<uint32_t> slot_by_id_;
+  absl::BitGen bitgen_;
+  bool shut_down_ = false;
+  std::atomic<bool> stopping_;
+  std::thread send_thread_;
+  std::thread receive_thread_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_FORWARDER_H_
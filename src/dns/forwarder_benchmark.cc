@@ -0,0 +1,71 @@
+#include "src/dns/forwarder.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/mock_upstream.h"
+#include "src/dns/test_util.h"
+
+// Benchmarks the forwarding stage of the pipelined server on its own:
+// requests submitted to a Forwarder, answered by a MockUpstream on localhost.
+// The other stage, answering hits on the receiving thread, is the work
+// measured by BM_CacheHit in dns_server_benchmark.
+//
+// Arguments: the upstream delay in us, and how many forwards are kept
+// outstanding. With a delay, throughput should grow with the window rather
+// than being capped at one forward per round trip.
+
+namespace tiny_dns {
+namespace {
+
+void BM_Forward(benchmark::State& state) {
+  absl::StatusOr<std::unique_ptr<MockUpstream>> upstream = MockUpstream::Create({
+      .synthesize_answers = true,
+      .delay = std::chrono::microseconds(state.range(0)) });
+  CHECK_OK(upstream.status());
+  std::atomic<uint64_t> completed = 0;
+  std::atomic<uint64_t> failed = 0;
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", (*upstream)->port(), {});
+  CHECK_OK(forwarder.status());
+  const Forwarder::Completion completion =
+    [&](const ForwardRequest&, const absl::StatusOr<std::array<uint8_t, 512>>& response) {
+      if (!response.ok()) { failed.fetch_add(1, std::memory_order_relaxed); }
+      completed.fetch_add(1, std::memory_order_release);
+    };
+  const uint64_t window = state.range(1);
+  uint64_t submitted = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    ForwardRequest request = CreateForwardRequest(absl::StrCat("miss-", submitted, ".example"));
+    state.ResumeTiming();
+    while (submitted - completed.load(std::memory_order_acquire) >= window) {
+      std::this_thread::yield();
+    }
+    CHECK((*forwarder)->Submit(std::move(request), completion));
+    submitted++;
+  }
+  while (completed.load(std::memory_order_acquire) < submitted) { std::this_thread::yield(); }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["failed"] = failed.load();
+}
+BENCHMARK(BM_Forward)
+  ->ArgNames({"delay_us", "window"})
+  ->Args({0, 1})->Args({0, 64})
+  ->Args({1000, 1})->Args({1000, 64})
+  ->UseRealTime();
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,207 @@
+#include "src/dns/forwarder.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/mock_upstream.h"
+#include "src/dns/server_metrics.h"
+#include "src/dns/test_util.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Lt;
+using ::testing::SizeIs;
+
+// NOTE: collects what the forwarder completes with.
+class Completions {
+ public:
+  Forwarder::Completion Callback() {
+    return [this](const ForwardRequest& request,
+                  const absl::StatusOr<std::array<uint8_t, 512>>& response) {
+      std::scoped_lock lock(mutex_);
+      if (response.ok()) {
+        responses_.push_back(DnsPacket::FromBytes(*response));
+      } else {
+        responses_.push_back(response.status());
+      }
+      cv_.notify_all();
+    };
+  }
+
+  std::vector<absl::StatusOr<DnsPacket>> WaitFor(size_t count) {
+    std::unique_lock lock(mutex_);
+    cv_.wait_for(lock, std::chrono::seconds(10), [&] { return responses_.size() >= count; });
+    return responses_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<absl::StatusOr<DnsPacket>> responses_;
+};
+
+std::unique_ptr<MockUpstream> CreateUpstream(MockUpstreamOptions options) {
+  options.synthesize_answers = true;
+  absl::StatusOr<std::unique_ptr<MockUpstream>> upstream =
+    MockUpstream::Create(std::move(options));
+  EXPECT_TRUE(upstream.ok());
+  return std::move(*upstream);
+}
+
+TEST(ForwarderTest, AnswersWithTheClientsId) {
+  std::unique_ptr<MockUpstream> upstream = CreateUpstream({});
+  Completions completions;
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", upstream->port(), {});
+  ASSERT_TRUE(forwarder.ok());
+
+  EXPECT_TRUE((*forwarder)->Submit(
+        CreateForwardRequest("a.example", 0x4242), completions.Callback()));
+  const std::vector<absl::StatusOr<DnsPacket>> responses = completions.WaitFor(1);
+  ASSERT_THAT(responses, SizeIs(1));
+  ASSERT_TRUE(responses[0].ok()) << responses[0].status();
+  EXPECT_THAT(responses[0]->header.id, Eq(0x4242));
+  ASSERT_THAT(responses[0]->answers, SizeIs(1));
+  EXPECT_THAT(responses[0]->answers[0].qname, Eq("a.example"));
+  EXPECT_THAT((*forwarder)->inflight(), Eq(0));
+}
+
+TEST(ForwarderTest, OverlapsSlowForwards) {
+  std::unique_ptr<MockUpstream> upstream = CreateUpstream({
+      .delay = std::chrono::milliseconds(200) });
+  Completions completions;
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", upstream->port(), {});
+  ASSERT_TRUE(forwarder.ok());
+
+  const int64_t start_ns = MonotonicNanos();
+  for (uint16_t i = 0; i < 10; i++) {
+    EXPECT_TRUE((*forwarder)->Submit(
+          CreateForwardRequest("n" + std::to_string(i) + ".example", i), completions.Callback()));
+  }
+  const std::vector<absl::StatusOr<DnsPacket>> responses = completions.WaitFor(10);
+  ASSERT_THAT(responses, SizeIs(10));
+  for (const absl::StatusOr<DnsPacket>& response : responses) {
+    EXPECT_TRUE(response.ok()) << response.status();
+  }
+  // NOTE: one after the other would take 2s.
+  EXPECT_THAT(MonotonicNanos() - start_ns, Lt(1'000'000'000));
+}
+
+TEST(ForwarderTest, RejectsRequestsOverTheQueue) {
+  std::unique_ptr<MockUpstream> upstream = CreateUpstream({
+      .delay = std::chrono::milliseconds(300) });
+  Completions completions;
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", upstream->port(),
+      { .max_inflight = 1, .max_queued = 1 });
+  ASSERT_TRUE(forwarder.ok());
+
+  EXPECT_TRUE((*forwarder)->Submit(CreateForwardRequest("a.example", 1), completions.Callback()));
+  while ((*forwarder)->inflight() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE((*forwarder)->Submit(CreateForwardRequest("b.example", 2), completions.Callback()));
+  EXPECT_FALSE((*forwarder)->Submit(CreateForwardRequest("c.example", 3), completions.Callback()));
+  EXPECT_THAT((*forwarder)->queued(), Eq(1));
+
+  const std::vector<absl::StatusOr<DnsPacket>> responses = completions.WaitFor(2);
+  ASSERT_THAT(responses, SizeIs(2));
+  EXPECT_TRUE(responses[0].ok());
+  EXPECT_TRUE(responses[1].ok());
+}
+
+TEST(ForwarderTest, TimesOutUnansweredForwards) {
+  std::unique_ptr<MockUpstream> upstream = CreateUpstream({ .loss_rate = 1 });
+  Completions completions;
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", upstream->port(),
+      { .timeout = std::chrono::milliseconds(100) });
+  ASSERT_TRUE(forwarder.ok());
+
+  EXPECT_TRUE((*forwarder)->Submit(
+        CreateForwardRequest("lost.example", 1), completions.Callback()));
+  const std::vector<absl::StatusOr<DnsPacket>> responses = completions.WaitFor(1);
+  ASSERT_THAT(responses, SizeIs(1));
+  EXPECT_TRUE(absl::IsUnavailable(responses[0].status())) << responses[0].status();
+  EXPECT_THAT((*forwarder)->inflight(), Eq(0));
+}
+
+TEST(ForwarderTest, ShutdownCompletesOutstandingForwards) {
+  std::unique_ptr<MockUpstream> upstream = CreateUpstream({ .loss_rate = 1 });
+  Completions completions;
+  // NOTE: without a timeout, only Shutdown() completes a lost forward.
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", upstream->port(),
+      { .max_inflight = 1, .timeout = std::chrono::milliseconds(0) });
+  ASSERT_TRUE(forwarder.ok());
+
+  EXPECT_TRUE((*forwarder)->Submit(
+        CreateForwardRequest("lost.example", 1), completions.Callback()));
+  while ((*forwarder)->inflight() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE((*forwarder)->Submit(
+        CreateForwardRequest("queued.example", 2), completions.Callback()));
+  (*forwarder)->Shutdown();
+  const std::vector<absl::StatusOr<DnsPacket>> responses = completions.WaitFor(2);
+  ASSERT_THAT(responses, SizeIs(2));
+  EXPECT_TRUE(absl::IsCancelled(responses[0].status())) << responses[0].status();
+  EXPECT_TRUE(absl::IsCancelled(responses[1].status())) << responses[1].status();
+  EXPECT_THAT((*forwarder)->inflight(), Eq(0));
+  EXPECT_THAT((*forwarder)->queued(), Eq(0));
+  EXPECT_FALSE((*forwarder)->Submit(
+        CreateForwardRequest("late.example", 3), completions.Callback()));
+}
+
+TEST(ForwarderTest, DropsRequestsQueuedPastDeadline) {
+  std::unique_ptr<MockUpstream> upstream = CreateUpstream({});
+  Completions completions;
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", upstream->port(), {});
+  ASSERT_TRUE(forwarder.ok());
+
+  ForwardRequest request = CreateForwardRequest("late.example", 1);
+  request.deadline_ns = MonotonicNanos() - 1;
+  EXPECT_TRUE((*forwarder)->Submit(std::move(request), completions.Callback()));
+  const std::vector<absl::StatusOr<DnsPacket>> responses = completions.WaitFor(1);
+  ASSERT_THAT(responses, SizeIs(1));
+  EXPECT_TRUE(absl::IsDeadlineExceeded(responses[0].status())) << responses[0].status();
+  EXPECT_THAT(upstream->stats().queries, Eq(0));
+}
+
+TEST(ForwarderTest, ForwardsForCallersThatWait) {
+  std::unique_ptr<MockUpstream> upstream = CreateUpstream({});
+  absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+      "127.0.0.1", "127.0.0.1", upstream->port(), {});
+  ASSERT_TRUE(forwarder.ok());
+
+  const ForwardRequest request = CreateForwardRequest("a.example", 0x4242);
+  const absl::StatusOr<std::array<uint8_t, 512>> response_raw = (*forwarder)->Forward(
+      std::span<const uint8_t>(request.query.data(), request.query_size)).get();
+  ASSERT_TRUE(response_raw.ok()) << response_raw.status();
+  const absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(*response_raw);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_THAT(response->header.id, Eq(0x4242));
+  ASSERT_THAT(response->answers, SizeIs(1));
+  EXPECT_THAT(response->answers[0].qname, Eq("a.example"));
+}
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,82 @@
+#include "src/dns/hot_name_cache.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <span>
+#include <string_view>
+
+#include "absl/functional/function_ref.h"
+#include "absl/hash/hash.h"
+#include "absl/status/statusor.h"
+#include "src/dns/query_trace.h"
+
+namespace tiny_dns {
+namespace {
+
+constexpr size_t kHeaderSize = 12;
+// NOTE: QDCOUNT 1, ANCOUNT, NSCOUNT and ARCOUNT 0. Anything else, e.g. an
+// EDNS OPT record, goes the long way.
+constexpr std::array<uint8_t, 8> kCacheableCounts = {0, 1, 0, 0, 0, 0, 0, 0};
+
+} // namespace
+
+HotNameCache::HotNameCache(size_t entries) :
+  entries_(std::bit_ceil(std::max<size_t>(entries, 1))), mask_(entries_.size() - 1) {}
+
+HotNameCache::Entry* HotNameCache::Find(
+    const std::array<uint8_t, 512>& request_raw, std::span<const uint8_t>& question) {
+  if (memcmp(request_raw.data() + 4, kCacheableCounts.data(), kCacheableCounts.size()) != 0) {
+    return nullptr;
+  }
+  const absl::StatusOr<std::span<const uint8_t>> raw_question = RawQuestion(request_raw);
+  if (!raw_question.ok()) { return nullptr; }
+  question = *raw_question;
+  const uint16_t flags = (request_raw[2] << 8) | request_raw[3];
+  const uint64_t hash = absl::HashOf(flags, std::string_view(
+        reinterpret_cast<const char*>(question.data()), question.size()));
+  return &entries_[hash & mask_];
+}
+
+HotNameCache::Result HotNameCache::Lookup(
+    const std::array<uint8_t, 512>& request_raw,
+    absl::FunctionRef<uint64_t(size_t shard)> generation, time_t now,
+    std::array<uint8_t, 512>& response_raw, std::span<const uint8_t>& response) {
+  std::span<const uint8_t> question;
+  const Entry* entry = Find(request_raw, question);
+  if (entry == nullptr || now >= entry->expires_at) { return Result::kMiss; }
+  if (entry->flags != ((request_raw[2] << 8) | request_raw[3])
+      || entry->question_size != question.size()
+      || memcmp(entry->response.data() + kHeaderSize, question.data(), question.size()) != 0) {
+    return Result::kMiss;
+  }
+  if (entry->generation != generation(entry->shard)) { return Result::kInvalidated; }
+  memcpy(response_raw.data(), entry->response.data(), entry->response_size);
+  memcpy(response_raw.data(), request_raw.data(), 2);
+  response = std::span<const uint8_t>(response_raw.data(), entry->response_size);
+  return Result::kHit;
+}
+
+void HotNameCache::Store(
+    const std::array<uint8_t, 512>& request_raw, std::span<const uint8_t> response_raw,
+    size_t shard, uint64_t generation, time_t now) {
+  std::span<const uint8_t> question;
+  Entry* entry = Find(request_raw, question);
+  // NOTE: the response must echo the question for Lookup() to match it.
+  if (entry == nullptr || response_raw.size() < kHeaderSize + question.size()
+      || memcmp(response_raw.data() + kHeaderSize, question.data(), question.size()) != 0) {
+    return;
+  }
+  entry->generation = generation;
+  entry->shard = shard;
+  entry->expires_at = now + 1;
+  entry->flags = (request_raw[2] << 8) | request_raw[3];
+  entry->question_size = question.size();
+  entry->response_size = response_raw.size();
+  memcpy(entry->response.data(), response_raw.data(), response_raw.size());
+}
+
+} // tiny_dns
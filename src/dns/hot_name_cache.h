@@ -0,0 +1,88 @@
+#ifndef SRC_DNS_HOT_NAME_CACHE_H_
+#define SRC_DNS_HOT_NAME_CACHE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <span>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+
+// A small per-thread cache of encoded responses, in front of the shared
+// RecordStore. A handful of names make up most queries; for those a hit skips
+// parsing, the store's shard lock, copying the records out and encoding, and
+// reads nothing another thread writes but a store shard's generation.
+//
+// Direct mapped, keyed on the request as received: its flags and raw
+// question. Names differing only in case are different keys, so either is
+// answered with the question as it was asked. Entries are:
+// * invalidated by any write to the shard they were read from, through
+//   RecordStore::Generation(). Only responses read from one shard are
+//   stored, so writes to the others, e.g. caching forwarded answers for
+//   other names, leave them be.
+// * expired at the end of the second they were stored in, as the store counts
+//   TTLs down a second at a time; the TTLs served are the ones it would.
+//
+// Not thread safe: each thread serving requests owns its own.
+
+namespace tiny_dns {
+
+inline constexpr size_t kDefaultHotNameCacheEntries = 256;
+
+class HotNameCache {
+ public:
+  // NOTE: rounded up to a power of two.
+  explicit HotNameCache(size_t entries = kDefaultHotNameCacheEntries);
+
+  HotNameCache(const HotNameCache&) = delete;
+  HotNameCache& operator=(const HotNameCache&) = delete;
+
+  enum class Result {
+    kHit,
+    kMiss,
+    // NOTE: a miss on an entry for the request the store has since changed.
+    kInvalidated,
+  };
+
+  // NOTE: on a hit, copies the response into response_raw with the request's
+  // ID and sets response to it. generation returns the store's generation of
+  // a shard, now is the time.
+  Result Lookup(
+      const std::array<uint8_t, 512>& request_raw,
+      absl::FunctionRef<uint64_t(size_t shard)> generation, time_t now,
+      std::array<uint8_t, 512>& response_raw, std::span<const uint8_t>& response);
+  // NOTE: for a response read from shard, at generation. The generation must
+  // have been read before the store was queried for the response, so a
+  // write racing the query leaves the entry stale.
+  void Store(
+      const std::array<uint8_t, 512>& request_raw, std::span<const uint8_t> response_raw,
+      size_t shard, uint64_t generation, time_t now);
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    uint64_t generation = 0;
+    // NOTE: 0 for an empty entry.
+    time_t expires_at = 0;
+    uint32_t shard = 0;
+    uint16_t flags = 0;
+    uint16_t question_size = 0;
+    uint16_t response_size = 0;
+    // NOTE: the question is at the same offset as in the request.
+    std::array<uint8_t, 512> response;
+  };
+
+  // NOTE: the entry for the request, whatever it holds; sets question to the
+  // request's. nullptr if the request can't be cached.
+  Entry* Find(const std::array<uint8_t, 512>& request_raw, std::span<const uint8_t>& question);
+
+  std::vector<Entry> entries_;
+  size_t mask_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_HOT_NAME_CACHE_H_
@@ -0,0 +1,149 @@
+#include "src/dns/hot_name_cache.h"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "absl/status/statusor.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/test_util.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::ElementsAreArray;
+using ::testing::Eq;
+
+constexpr time_t kNow = 1'700'000'000;
+
+// NOTE: a store with every shard at generation.
+auto AtGeneration(uint64_t generation) {
+  return [generation](size_t) { return generation; };
+}
+
+std::span<const uint8_t> CreateResponse(
+    const std::array<uint8_t, 512>& request_raw, uint8_t last_octet,
+    std::array<uint8_t, 512>& response_raw) {
+  absl::StatusOr<DnsPacket> response = DnsPacket::FromBytes(request_raw);
+  EXPECT_TRUE(response.ok());
+  response->header.query_response = true;
+  response->answers.push_back(CreateARecord(response->questions[0].qname, last_octet));
+  absl::StatusOr<std::span<const uint8_t>> encoded = response->ToBytes(response_raw);
+  EXPECT_TRUE(encoded.ok());
+  return *encoded;
+}
+
+TEST(HotNameCacheTest, HitsAnswerWithTheRequestsId) {
+  HotNameCache cache;
+  std::array<uint8_t, 512> stored_raw = {};
+  const std::span<const uint8_t> stored =
+    CreateResponse(CreateRequest("a.example"), 1, stored_raw);
+  cache.Store(CreateRequest("a.example"), stored, 0, 7, kNow);
+
+  std::array<uint8_t, 512> response_raw = {};
+  std::span<const uint8_t> response;
+  ASSERT_THAT(cache.Lookup(
+        CreateRequest("a.example", QueryType::A, /*recursion_desired=*/false, 0xbeef),
+        AtGeneration(7), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kHit));
+  ASSERT_THAT(response.size(), Eq(stored.size()));
+  EXPECT_THAT(response[0], Eq(0xbe));
+  EXPECT_THAT(response[1], Eq(0xef));
+  EXPECT_THAT(response.subspan(2), ElementsAreArray(stored.subspan(2)));
+
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("b.example"), AtGeneration(7), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kMiss));
+  // NOTE: a different question is a different key, even just by case.
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("A.example"), AtGeneration(7), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kMiss));
+  // NOTE: as are different flags, which can change the answer.
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("a.example", QueryType::A, /*recursion_desired=*/true),
+        AtGeneration(7), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kMiss));
+}
+
+TEST(HotNameCacheTest, StoreWritesInvalidate) {
+  HotNameCache cache;
+  std::array<uint8_t, 512> stored_raw = {};
+  cache.Store(CreateRequest("a.example"),
+      CreateResponse(CreateRequest("a.example"), 1, stored_raw), 0, 7, kNow);
+
+  std::array<uint8_t, 512> response_raw = {};
+  std::span<const uint8_t> response;
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("a.example"), AtGeneration(8), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kInvalidated));
+  cache.Store(CreateRequest("a.example"),
+      CreateResponse(CreateRequest("a.example"), 2, stored_raw), 0, 8, kNow);
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("a.example"), AtGeneration(8), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kHit));
+  EXPECT_THAT(response.back(), Eq(2));
+}
+
+TEST(HotNameCacheTest, OnlyWritesToTheEntrysShardInvalidate) {
+  HotNameCache cache;
+  std::array<uint8_t, 512> stored_raw = {};
+  cache.Store(CreateRequest("a.example"),
+      CreateResponse(CreateRequest("a.example"), 1, stored_raw), 1, 7, kNow);
+
+  std::array<uint8_t, 512> response_raw = {};
+  std::span<const uint8_t> response;
+  std::array<uint64_t, 2> generations = {7, 7};
+  const auto generation = [&](size_t shard) { return generations[shard]; };
+  generations[0]++;
+  EXPECT_THAT(cache.Lookup(CreateRequest("a.example"), generation, kNow, response_raw, response),
+              Eq(HotNameCache::Result::kHit));
+  generations[1]++;
+  EXPECT_THAT(cache.Lookup(CreateRequest("a.example"), generation, kNow, response_raw, response),
+              Eq(HotNameCache::Result::kInvalidated));
+}
+
+TEST(HotNameCacheTest, EntriesExpireAtTheEndOfTheSecond) {
+  HotNameCache cache;
+  std::array<uint8_t, 512> stored_raw = {};
+  cache.Store(CreateRequest("a.example"),
+      CreateResponse(CreateRequest("a.example"), 1, stored_raw), 0, 7, kNow);
+
+  std::array<uint8_t, 512> response_raw = {};
+  std::span<const uint8_t> response;
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("a.example"), AtGeneration(7), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kHit));
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("a.example"), AtGeneration(7), kNow + 1, response_raw, response),
+      Eq(HotNameCache::Result::kMiss));
+}
+
+TEST(HotNameCacheTest, OnlyPlainQueriesAreCached) {
+  HotNameCache cache(1);
+  EXPECT_THAT(cache.size(), Eq(1));
+  std::array<uint8_t, 512> request = CreateRequest("a.example");
+  // NOTE: ARCOUNT 1, e.g. an EDNS OPT record.
+  request[11] = 1;
+  std::array<uint8_t, 512> stored_raw = {};
+  cache.Store(request, CreateResponse(CreateRequest("a.example"), 1, stored_raw), 0, 7, kNow);
+
+  std::array<uint8_t, 512> response_raw = {};
+  std::span<const uint8_t> response;
+  EXPECT_THAT(cache.Lookup(request, AtGeneration(7), kNow, response_raw, response),
+              Eq(HotNameCache::Result::kMiss));
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("a.example"), AtGeneration(7), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kMiss));
+  // NOTE: nor a response that isn't to the request.
+  cache.Store(CreateRequest("a.example"),
+      CreateResponse(CreateRequest("b.example"), 1, stored_raw), 0, 7, kNow);
+  EXPECT_THAT(cache.Lookup(
+        CreateRequest("a.example"), AtGeneration(7), kNow, response_raw, response),
+      Eq(HotNameCache::Result::kMiss));
+}
+
+} // namespace
+} // tiny_dns
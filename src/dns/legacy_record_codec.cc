@@ -0,0 +1,159 @@
+#include "src/dns/legacy_record_codec.h"
+
+#include <memory_resource>
+#include <utility>
+#include <variant>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "src/common/status_macros.h"
+#include "src/dns/dns_packet.h"
+
+namespace tiny_dns {
+
+absl::StatusOr<Record> LegacyRecordFromBytes(
+    BufferReader& reader, std::pmr::memory_resource* resource) {
+  Record answer(resource);
+  uint16_t length = 0;
+  {
+    ASSIGN_OR_RETURN(answer.qname, reader.ReadQName(resource));
+    ASSIGN_OR_RETURN(const uint16_t qtype_raw, reader.ReadU16());
+    answer.qtype = QueryTypeFromShort(qtype_raw);
+    ASSIGN_OR_RETURN(answer.dns_class, reader.ReadU16());
+    ASSIGN_OR_RETURN(answer.ttl, reader.ReadU32());
+    ASSIGN_OR_RETURN(length, reader.ReadU16());
+  }
+  switch (answer.qtype) {
+    case QueryType::A: {
+      if (length != 4) {
+        LOG(WARNING) << "Unexpected length for type A. Expected 4, got: " << length;
+      }
+      Record::A a = {};
+      RETURN_IF_ERROR(reader.ReadBytes(a.ip_address.data(), a.ip_address.size()));
+      answer.data = std::move(a);
+    } break;
+    case QueryType::NS: {
+      Record::NS ns = { .host = std::pmr::string(resource) };
+      ASSIGN_OR_RETURN(ns.host, reader.ReadQName(resource));
+      answer.data = std::move(ns);
+    } break;
+    case QueryType::CNAME: {
+      Record::CNAME cname = { .host = std::pmr::string(resource) };
+      ASSIGN_OR_RETURN(cname.host, reader.ReadQName(resource));
+      answer.data = std::move(cname);
+    } break;
+    case QueryType::MX: {
+      Record::MX mx = { .host = std::pmr::string(resource) };
+      ASSIGN_OR_RETURN(mx.priority, reader.ReadU16());
+      ASSIGN_OR_RETURN(mx.host, reader.ReadQName(resource));
+      answer.data = std::move(mx);
+    } break;
+    case QueryType::AAAA: {
+      if (length != 16) {
+        LOG(WARNING) << "Unexpected length for type AAAA. Expected 16, got: " << length;
+      }
+      Record::AAAA aaaa = {};
+      ASSIGN_OR_RETURN(aaaa.ip_address[0], reader.ReadU16());
+      ASSIGN_OR_RETURN(aaaa.ip_address[1], reader.ReadU16());
+      ASSIGN_OR_RETURN(aaaa.ip_address[2], reader.ReadU16());
+      ASSIGN_OR_RETURN(aaaa.ip_address[3], reader.ReadU16());
+      ASSIGN_OR_RETURN(aaaa.ip_address[4], reader.ReadU16());
+      ASSIGN_OR_RETURN(aaaa.ip_address[5], reader.ReadU16());
+      ASSIGN_OR_RETURN(aaaa.ip_address[6], reader.ReadU16());
+      ASSIGN_OR_RETURN(aaaa.ip_address[7], reader.ReadU16());
+      answer.data = std::move(aaaa);
+    } break;
+    case QueryType::URI: {
+      Record::URI uri = { .target = std::pmr::string(resource) };
+      ASSIGN_OR_RETURN(uri.priority, reader.ReadU16());
+      ASSIGN_OR_RETURN(uri.weight, reader.ReadU16());
+      ASSIGN_OR_RETURN(uri.target, reader.ReadQName(resource));
+      answer.data = std::move(uri);
+    } break;
+    case QueryType::UNKNOWN:
+    default: {
+      Record::UNKNOWN unknown = { .bytes = std::pmr::vector<uint8_t>(length, resource) };
+      RETURN_IF_ERROR(reader.ReadBytes(unknown.bytes.data(), length));
+      answer.data = std::move(unknown);
+    } break;
+  }
+  return answer;
+}
+
+
+absl::Status LegacyRecordToBytes(const Record& record, BufferWriter& writer) {
+  {
+    RETURN_IF_ERROR(writer.WriteQName(record.qname).status());
+    RETURN_IF_ERROR(writer.WriteU16(QueryTypeToShort(record.qtype)));
+    RETURN_IF_ERROR(writer.WriteU16(record.dns_class));
+    RETURN_IF_ERROR(writer.WriteU32(record.ttl));
+  }
+  switch (record.qtype) {
+    case QueryType::A: {
+      CHECK(std::holds_alternative<Record::A>(record.data));
+      const Record::A& a = std::get<Record::A>(record.data);
+      RETURN_IF_ERROR(writer.WriteU16(4));
+      RETURN_IF_ERROR(writer.WriteBytes(a.ip_address.data(), a.ip_address.size()));
+    } break;
+    case QueryType::NS: {
+      CHECK(std::holds_alternative<Record::NS>(record.data));
+      const Record::NS& ns = std::get<Record::NS>(record.data);
+      BufferWriter len_ptr = writer;
+      RETURN_IF_ERROR(writer.WriteU16(0)); // NOTE: write length after label block size is known.
+      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(ns.host));
+      RETURN_IF_ERROR(len_ptr.WriteU16(len));
+    } break;
+    case QueryType::CNAME: {
+      CHECK(std::holds_alternative<Record::CNAME>(record.data));
+      const Record::CNAME& cname = std::get<Record::CNAME>(record.data);
+      BufferWriter len_ptr = writer;
+      RETURN_IF_ERROR(writer.WriteU16(0));
+      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(cname.host));
+      RETURN_IF_ERROR(len_ptr.WriteU16(len));
+    } break;
+    case QueryType::MX: {
+      CHECK(std::holds_alternative<Record::MX>(record.data));
+      const Record::MX& mx = std::get<Record::MX>(record.data);
+      BufferWriter len_ptr = writer;
+      RETURN_IF_ERROR(writer.WriteU16(0));
+      RETURN_IF_ERROR(writer.WriteU16(mx.priority));
+      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(mx.host));
+      RETURN_IF_ERROR(len_ptr.WriteU16(2 + len));
+    } break;
+    case QueryType::AAAA: {
+      CHECK(std::holds_alternative<Record::AAAA>(record.data));
+      const Record::AAAA& aaaa = std::get<Record::AAAA>(record.data);
+      RETURN_IF_ERROR(writer.WriteU16(16));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[0]));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[1]));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[2]));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[3]));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[4]));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[5]));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[6]));
+      RETURN_IF_ERROR(writer.WriteU16(aaaa.ip_address[7]));
+    } break;
+    case QueryType::URI: {
+      CHECK(std::holds_alternative<Record::URI>(record.data));
+      const Record::URI& uri = std::get<Record::URI>(record.data);
+      BufferWriter len_ptr = writer;
+      RETURN_IF_ERROR(writer.WriteU16(0));
+      RETURN_IF_ERROR(writer.WriteU16(uri.priority));
+      RETURN_IF_ERROR(writer.WriteU16(uri.weight));
+      ASSIGN_OR_RETURN(uint16_t len, writer.WriteQName(uri.target));
+      RETURN_IF_ERROR(len_ptr.WriteU16(4 + len));
+    } break;
+    case QueryType::UNKNOWN:
+    default: {
+      CHECK(std::holds_alternative<Record::UNKNOWN>(record.data));
+      const Record::UNKNOWN& unknown = std::get<Record::UNKNOWN>(record.data);
+      RETURN_IF_ERROR(writer.WriteU16(unknown.bytes.size()));
+      RETURN_IF_ERROR(writer.WriteBytes(unknown.bytes.data(), unknown.bytes.size()));
+    } break;
+  }
+  return absl::OkStatus();
+}
+
+} // tiny_dns
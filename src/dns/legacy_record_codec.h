@@ -0,0 +1,24 @@
+#ifndef SRC_DNS_LEGACY_RECORD_CODEC_H_
+#define SRC_DNS_LEGACY_RECORD_CODEC_H_
+
+#include <memory_resource>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "src/dns/dns_packet.h"
+
+// The hand-written, per-QueryType switch record codec that predates
+// rdata_codec.h. Only kept around as a reference implementation for tests and
+// benchmarks of the table-driven codec. Only understands UNKNOWN, A, NS, CNAME,
+// MX, AAAA and URI.
+
+namespace tiny_dns {
+
+absl::StatusOr<Record> LegacyRecordFromBytes(
+    BufferReader& reader,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+absl::Status LegacyRecordToBytes(const Record& record, BufferWriter& writer);
+
+} // tiny_dns
+
+#endif // SRC_DNS_LEGACY_RECORD_CODEC_H_
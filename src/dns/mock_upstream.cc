@@ -0,0 +1,233 @@
+#include "src/dns/mock_upstream.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "src/dns/dns_packet.h"
+
+namespace tiny_dns {
+
+namespace {
+
+// NOTE: how often the receive thread checks whether it should stop.
+constexpr int32_t kPollIntervalMs = 50;
+
+// NOTE: FNV-1a, so synthesized answers are stable across runs.
+uint64_t HashName(std::string_view qname) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const char c : qname) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+} // namespace
+
+absl::StatusOr<std::unique_ptr<MockUpstream>> MockUpstream::Create(MockUpstreamOptions options) {
+  int32_t socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socket_fd < 0) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Unable to open socket: ", socket_fd));
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  if (inet_pton(AF_INET, options.addr.c_str(), &addr.sin_addr) <= 0) {
+    close(socket_fd);
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unable to translate address: ", options.addr));
+  }
+  socklen_t addr_len = sizeof(addr);
+  if (bind(socket_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      getsockname(socket_fd, (struct sockaddr*) &addr, &addr_len) < 0) {
+    close(socket_fd);
+    return absl::FailedPreconditionError(
+        absl::StrCat("Unable to bind to: ", options.addr, ":", options.port));
+  }
+  return std::make_unique<MockUpstream>(socket_fd, ntohs(addr.sin_port), std::move(options));
+}
+
+MockUpstream::MockUpstream(int32_t socket_fd, int32_t port, MockUpstreamOptions options)
+  : socket_fd_(socket_fd), port_(port), options_(std::move(options)), records_by_name_(),
+    rng_(options_.seed), stopping_(false), queries_(0), dropped_(0), truncated_(0),
+    serv_failed_(0), mutex_(), cv_(), pending_() {
+  for (const Record& record : options_.records) {
+    records_by_name_[std::string(record.qname)].push_back(record);
+  }
+  receive_thread_ = std::thread(&MockUpstream::Receive, this);
+  send_thread_ = std::thread(&MockUpstream::Send, this);
+}
+
+MockUpstream::~MockUpstream() {
+  {
+    std::scoped_lock lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  receive_thread_.join();
+  send_thread_.join();
+  close(socket_fd_);
+}
+
+MockUpstream::Stats MockUpstream::stats() const {
+  return Stats {
+    .queries = queries_.load(),
+    .dropped = dropped_.load(),
+    .truncated = truncated_.load(),
+    .serv_failed = serv_failed_.load(),
+  };
+}
+
+void MockUpstream::Receive() {
+  std::exponential_distribution<double> jitter(
+      options_.delay_jitter_mean.count() > 0 ? 1.0 / options_.delay_jitter_mean.count() : 1.0);
+  struct pollfd poll_fd = { .fd = socket_fd_, .events = POLLIN, .revents = 0 };
+  while (!stopping_) {
+    if (poll(&poll_fd, 1, kPollIntervalMs) <= 0) { continue; }
+    std::array<uint8_t, 512> request_raw = {};
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+    if (recvfrom(socket_fd_, request_raw.data(), request_raw.size(), MSG_DONTWAIT,
+          (struct sockaddr*) &client_addr, &client_addr_len) < 0) {
+      continue;
+    }
+    queries_++;
+    const std::optional<DnsPacket> response = Respond(request_raw);
+    if (!response.has_value()) { continue; }
+
+    PendingResponse pending = {
+      .due = std::chrono::steady_clock::now() + options_.delay,
+      .bytes = {},
+      .size = 0,
+      .client_addr = client_addr,
+    };
+    if (options_.delay_jitter_mean.count() > 0) {
+      pending.due += std::chrono::microseconds(static_cast<int64_t>(jitter(rng_)));
+    }
+    const absl::StatusOr<std::span<const uint8_t>> response_raw =
+      response->ToBytes(pending.bytes);
+    if (!response_raw.ok()) {
+      LOG(ERROR) << "Unable to encode mock response: " << response_raw.status();
+      continue;
+    }
+    pending.size = response_raw->size();
+    {
+      std::scoped_lock lock(mutex_);
+      pending_.push(std::move(pending));
+    }
+    cv_.notify_one();
+  }
+}
+
+void MockUpstream::Send() {
+  std::unique_lock lock(mutex_);
+  while (!stopping_) {
+    if (pending_.empty()) {
+      cv_.wait(lock);
+      continue;
+    }
+    if (cv_.wait_until(lock, pending_.top().due) == std::cv_status::no_timeout) { continue; }
+    if (pending_.empty() || pending_.top().due > std::chrono::steady_clock::now()) { continue; }
+    const PendingResponse pending = pending_.top();
+    pending_.pop();
+    lock.unlock();
+    if (sendto(socket_fd_, pending.bytes.data(), pending.size, 0,
+          (const struct sockaddr*) &pending.client_addr, sizeof(pending.client_addr)) < 0) {
+      LOG(ERROR) << "Unable to send mock response.";
+    }
+    lock.lock();
+  }
+}
+
+std::optional<DnsPacket> MockUpstream::Respond(const std::array<uint8_t, 512>& request_raw) {
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  if (chance(rng_) < options_.loss_rate) {
+    dropped_++;
+    return std::nullopt;
+  }
+
+  DnsPacket response = {};
+  response.header.query_response = true;
+  response.header.authoritative_answer = true;
+  const absl::StatusOr<DnsPacket> request = DnsPacket::FromBytes(request_raw);
+  if (!request.ok()) {
+    const absl::StatusOr<uint16_t> id = DnsPacket::FromBytesIdOnly(request_raw);
+    response.header.id = id.ok() ? *id : 0;
+    response.header.response_code = ResponseCode::FORM_ERROR;
+    return response;
+  }
+  response.header.id = request->header.id;
+  response.header.recursion_desired = request->header.recursion_desired;
+  response.questions = request->questions;
+
+  if (chance(rng_) < options_.serv_fail_rate) {
+    serv_failed_++;
+    response.header.response_code = ResponseCode::SERV_FAIL;
+    return response;
+  }
+  for (const Question& question : request->questions) { Answer(question, response); }
+  response.header.response_code =
+    response.answers.empty() ? ResponseCode::NX_DOMAIN : ResponseCode::NO_ERROR;
+  if (chance(rng_) < options_.truncation_rate) {
+    truncated_++;
+    response.header.truncated_message = true;
+    response.answers.clear();
+  }
+  return response;
+}
+
+void MockUpstream::Answer(const Question& question, DnsPacket& response) const {
+  if (auto it = records_by_name_.find(std::string(question.qname));
+      it != records_by_name_.end()) {
+    for (const Record& record : it->second) {
+      if (record.qtype != question.qtype && record.qtype != QueryType::CNAME) { continue; }
+      response.answers.push_back(record);
+    }
+    return;
+  }
+  if (!options_.synthesize_answers) { return; }
+  if (question.qtype != QueryType::A && question.qtype != QueryType::AAAA) { return; }
+
+  const uint64_t hash = HashName(question.qname);
+  for (size_t i = 0; i < options_.synthesized_answers_per_query; i++) {
+    Record record = {};
+    record.qname = question.qname;
+    record.qtype = question.qtype;
+    record.ttl = options_.synthesized_ttl;
+    if (question.qtype == QueryType::A) {
+      record.data = Record::A { .ip_address = {
+        10, static_cast<uint8_t>(hash >> 8), static_cast<uint8_t>(hash),
+        static_cast<uint8_t>(i) } };
+    } else {
+      record.data = Record::AAAA { .ip_address = {
+        0xfd00, 0, 0, 0, static_cast<uint16_t>(hash >> 32),
+        static_cast<uint16_t>(hash >> 16), static_cast<uint16_t>(hash),
+        static_cast<uint16_t>(i) } };
+    }
+    response.answers.push_back(std::move(record));
+  }
+}
+
+} // tiny_dns
@@ -0,0 +1,113 @@
+#ifndef SRC_DNS_MOCK_UPSTREAM_H_
+#define SRC_DNS_MOCK_UPSTREAM_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "src/dns/dns_packet.h"
+
+// A local stand-in for an upstream / authoritative DNS server, so forwarding,
+// caching and timeouts can be tested and benchmarked without network access.
+// Answers come from a fixed set of records, or are synthesized for any A/AAAA
+// question. Faults are injected per query: responses can be delayed, dropped,
+// truncated (TC set, answers stripped) or replaced with SERV_FAIL.
+//
+// Requests are received on one thread and responses sent from another, so a
+// delayed response doesn't hold up the ones behind it.
+
+namespace tiny_dns {
+
+struct MockUpstreamOptions {
+  std::string addr = "127.0.0.1";
+  int32_t port = 0; // NOTE: 0 picks a free port, see MockUpstream::port().
+
+  // NOTE: questions without a matching record get NX_DOMAIN, unless
+  // synthesize_answers is set.
+  std::vector<Record> records = {};
+  bool synthesize_answers = false;
+  size_t synthesized_answers_per_query = 1;
+  uint32_t synthesized_ttl = 300;
+
+  // NOTE: each response is delayed by delay plus an exponentially distributed
+  // jitter with the given mean.
+  std::chrono::microseconds delay = std::chrono::microseconds(0);
+  std::chrono::microseconds delay_jitter_mean = std::chrono::microseconds(0);
+  double loss_rate = 0;
+  double truncation_rate = 0;
+  double serv_fail_rate = 0;
+  uint64_t seed = 1;
+};
+
+class MockUpstream {
+ public:
+  struct Stats {
+    uint64_t queries;
+    uint64_t dropped;
+    uint64_t truncated;
+    uint64_t serv_failed;
+  };
+
+  static absl::StatusOr<std::unique_ptr<MockUpstream>> Create(MockUpstreamOptions options);
+  MockUpstream(int32_t socket_fd, int32_t port, MockUpstreamOptions options);
+  ~MockUpstream();
+
+  MockUpstream(const MockUpstream&) = delete;
+  MockUpstream& operator=(const MockUpstream&) = delete;
+
+  int32_t port() const { return port_; }
+  Stats stats() const;
+
+ private:
+  struct PendingResponse {
+    std::chrono::steady_clock::time_point due;
+    std::array<uint8_t, 512> bytes;
+    size_t size;
+    struct sockaddr_in client_addr;
+
+    bool operator>(const PendingResponse& other) const { return due > other.due; }
+  };
+
+  void Receive();
+  void Send();
+  // NOTE: nullopt means the query is dropped.
+  std::optional<DnsPacket> Respond(const std::array<uint8_t, 512>& request_raw);
+  void Answer(const Question& question, DnsPacket& response) const;
+
+  const int32_t socket_fd_;
+  const int32_t port_;
+  const MockUpstreamOptions options_;
+  absl::flat_hash_map<std::string, std::vector<Record>> records_by_name_;
+  std::mt19937_64 rng_; // NOTE: only used on the receive thread.
+
+  std::atomic<bool> stopping_;
+  std::atomic<uint64_t> queries_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> truncated_;
+  std::atomic<uint64_t> serv_failed_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::priority_queue<PendingResponse, std::vector<PendingResponse>, std::greater<>> pending_;
+
+  std::thread receive_thread_;
+  std::thread send_thread_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_MOCK_UPSTREAM_H_
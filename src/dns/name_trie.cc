@@ -0,0 +1,240 @@
+#include "src/dns/name_trie.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tiny_dns {
+namespace {
+
+constexpr std::string_view kWildcardLabel = "\1*";
+// NOTE: edges are only rewritten once this many bytes are dead, and more
+// than half of them are.
+constexpr size_t kMinDeadEdgeBytes = 4096;
+
+// NOTE: a key of NameTrie::children_ on the stack, so lookups don't allocate.
+class ChildKey {
+ public:
+  ChildKey(uint32_t parent, std::string_view label) : size_(sizeof(parent) + label.size()) {
+    memcpy(bytes_, &parent, sizeof(parent));
+    memcpy(bytes_ + sizeof(parent), label.data(), label.size());
+  }
+  std::string_view view() const { return std::string_view(bytes_, size_); }
+
+ private:
+  // NOTE: a label is at most 64 bytes in wire format.
+  char bytes_[sizeof(uint32_t) + 64];
+  size_t size_;
+};
+
+std::string_view FirstLabel(std::string_view key) {
+  return key.substr(0, 1 + static_cast<uint8_t>(key[0]));
+}
+
+// NOTE: the number of bytes of whole labels key and edge start with.
+size_t MatchLabels(std::string_view key, std::string_view edge) {
+  size_t matched = 0;
+  while (matched < edge.size()) {
+    const size_t label_size = 1 + static_cast<uint8_t>(edge[matched]);
+    if (key.substr(matched, label_size) != edge.substr(matched, label_size)) { break; }
+    matched += label_size;
+  }
+  return matched;
+}
+
+bool IsWildcard(std::string_view name) {
+  return name == "*" || name.starts_with("*.");
+}
+
+} // namespace
+
+NameTrie::NameTrie() : nodes_(1) {}
+
+bool NameTrie::Encode(std::string_view name, Key& key) {
+  if (!name.empty() && name.back() == '.') { name.remove_suffix(1); }
+  key.size = 0;
+  if (name.empty()) { return true; }
+  const size_t total = name.size() + 1;
+  if (total > sizeof(key.bytes)) { return false; }
+  // NOTE: the name's labels are written from the back of the key, so the
+  // last label comes first.
+  for (size_t start = 0; start <= name.size();) {
+    size_t dot = name.find('.', start);
+    if (dot == std::string_view::npos) { dot = name.size(); }
+    const size_t length = dot - start;
+    if (length == 0 || length > 63) { return false; }
+    char* out = key.bytes + total - (dot + 1);
+    out[0] = static_cast<char>(length);
+    memcpy(out + 1, name.data() + start, length);
+    start = dot + 1;
+  }
+  key.size = total;
+  return true;
+}
+
+NameTrie::Position NameTrie::Walk(std::string_view key) const {
+  Position position;
+  while (position.matched < key.size()) {
+    const std::string_view rest = key.substr(position.matched);
+    const int32_t child = FindChild(position.node, FirstLabel(rest));
+    if (child < 0) { break; }
+    const std::string_view edge = Edge(nodes_[child]);
+    const size_t matched = MatchLabels(rest, edge);
+    position.matched += matched;
+    if (matched < edge.size()) {
+      position.in_edge = true;
+      position.child = child;
+      position.edge_matched = matched;
+      break;
+    }
+    position.node = child;
+  }
+  return position;
+}
+
+int32_t NameTrie::FindChild(uint32_t parent, std::string_view label) const {
+  auto it = children_.find(ChildKey(parent, label).view());
+  if (it == children_.end()) { return -1; }
+  return it->second;
+}
+
+void NameTrie::LinkChild(uint32_t parent, uint32_t child) {
+  nodes_[child].parent = parent;
+  nodes_[parent].child_count++;
+  children_.insert_or_assign(
+      std::string(ChildKey(parent, FirstLabel(Edge(nodes_[child]))).view()), child);
+}
+
+void NameTrie::UnlinkChild(uint32_t parent, uint32_t child) {
+  nodes_[parent].child_count--;
+  children_.erase(ChildKey(parent, FirstLabel(Edge(nodes_[child]))).view());
+}
+
+uint32_t NameTrie::NewNode() {
+  if (free_nodes_.empty()) {
+    nodes_.emplace_back();
+    return nodes_.size() - 1;
+  }
+  const uint32_t index = free_nodes_.back();
+  free_nodes_.pop_back();
+  return index;
+}
+
+void NameTrie::FreeNode(uint32_t index) {
+  dead_edge_bytes_ += nodes_[index].edge_size;
+  nodes_[index] = Node();
+  free_nodes_.push_back(index);
+}
+
+void NameTrie::CompactEdges() {
+  std::string edges;
+  edges.reserve(edges_.size() - dead_edge_bytes_);
+  for (Node& node : nodes_) {
+    if (node.edge_size == 0) { continue; }
+    const uint32_t offset = edges.size();
+    edges.append(Edge(node));
+    node.edge_offset = offset;
+  }
+  edges_ = std::move(edges);
+  dead_edge_bytes_ = 0;
+}
+
+bool NameTrie::Insert(std::string_view name) {
+  Key key;
+  if (!Encode(name, key)) { return false; }
+  const std::string_view bytes = key.view();
+  const Position position = Walk(bytes);
+  uint32_t node = position.node;
+  if (position.in_edge) {
+    // NOTE: split the child's edge where the key leaves it. The new node
+    // takes the edge's leading bytes in place, so nothing is copied.
+    const uint32_t child = position.child;
+    UnlinkChild(node, child);
+    const uint32_t middle = NewNode();
+    nodes_[middle].edge_offset = nodes_[child].edge_offset;
+    nodes_[middle].edge_size = position.edge_matched;
+    nodes_[child].edge_offset += position.edge_matched;
+    nodes_[child].edge_size -= position.edge_matched;
+    LinkChild(node, middle);
+    LinkChild(middle, child);
+    node = middle;
+  }
+  if (position.matched == bytes.size()) {
+    if (nodes_[node].terminal) { return false; }
+    nodes_[node].terminal = true;
+  } else {
+    const std::string_view edge = bytes.substr(position.matched);
+    const uint32_t leaf = NewNode();
+    nodes_[leaf].edge_offset = edges_.size();
+    nodes_[leaf].edge_size = edge.size();
+    nodes_[leaf].terminal = true;
+    edges_.append(edge);
+    LinkChild(node, leaf);
+  }
+  size_++;
+  if (IsWildcard(name)) { wildcard_count_++; }
+  return true;
+}
+
+bool NameTrie::Erase(std::string_view name) {
+  Key key;
+  if (!Encode(name, key)) { return false; }
+  const Position position = Walk(key.view());
+  if (position.in_edge || position.matched != key.size) { return false; }
+  uint32_t node = position.node;
+  if (!nodes_[node].terminal) { return false; }
+  nodes_[node].terminal = false;
+  size_--;
+  if (IsWildcard(name)) { wildcard_count_--; }
+  // NOTE: drop the nodes left without names below them. A node left with a
+  // single child isn't merged into it, which costs a lookup per walk through
+  // it but nothing else.
+  while (node != 0 && !nodes_[node].terminal && nodes_[node].child_count == 0) {
+    const uint32_t parent = nodes_[node].parent;
+    UnlinkChild(parent, node);
+    FreeNode(node);
+    node = parent;
+  }
+  if (dead_edge_bytes_ > kMinDeadEdgeBytes && dead_edge_bytes_ > edges_.size() / 2) {
+    CompactEdges();
+  }
+  return true;
+}
+
+bool NameTrie::Contains(std::string_view name) const {
+  Key key;
+  if (!Encode(name, key)) { return false; }
+  const Position position = Walk(key.view());
+  return !position.in_edge && position.matched == key.size && nodes_[position.node].terminal;
+}
+
+NameTrie::Match NameTrie::Lookup(std::string_view name) const {
+  Match match;
+  Key key;
+  if (!Encode(name, key)) { return match; }
+  if (!name.empty() && name.back() == '.') { name.remove_suffix(1); }
+  const Position position = Walk(key.view());
+  // NOTE: every node but the root has a name at or below it, as does every
+  // edge, so wherever the walk ends exists.
+  match.exists = position.matched == key.size;
+  // NOTE: the reverse wire format of a name is one byte longer than it.
+  match.closest_encloser =
+    name.substr(name.size() - (position.matched == 0 ? 0 : position.matched - 1));
+  if (match.exists) { return match; }
+  // NOTE: a closest encloser in the middle of an edge has a single child, so
+  // has a wildcard if the rest of the edge is one.
+  if (position.in_edge) {
+    const Node& child = nodes_[position.child];
+    match.wildcard = Edge(child).substr(position.edge_matched) == kWildcardLabel
+      && child.terminal;
+    return match;
+  }
+  const int32_t wildcard = FindChild(position.node, kWildcardLabel);
+  match.wildcard = wildcard >= 0 && nodes_[wildcard].edge_size == kWildcardLabel.size()
+    && nodes_[wildcard].terminal;
+  return match;
+}
+
+} // tiny_dns
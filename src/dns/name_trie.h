@@ -0,0 +1,112 @@
+#ifndef SRC_DNS_NAME_TRIE_H_
+#define SRC_DNS_NAME_TRIE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+// A set of domain names, as a compressed trie keyed on their labels in
+// reverse wire format ("www.example.com" is "\3com\7example\3www"), so names
+// sharing a suffix share a path. On top of membership this answers what the
+// exact-match RecordStore can't: whether a name exists as an empty
+// non-terminal, its closest encloser, and whether a wildcard covers it
+// (RFC 4592), all in one walk of O(label count) hash lookups.
+//
+// Nodes are 16 bytes in one vector and refer to each other and to their
+// edges by index, the edges' labels live in one string. A node's children
+// are found through a single map keyed on (node index, first label of the
+// edge), so a walk never scans siblings however wide a zone is.
+//
+// Names are compared byte for byte, like the RecordStore's keys. Not thread
+// safe.
+
+namespace tiny_dns {
+
+class NameTrie {
+ public:
+  struct Match {
+    // NOTE: the name exists, either itself or as an empty non-terminal, i.e.
+    // as the ancestor of a name that does.
+    bool exists = false;
+    // NOTE: the longest existing suffix of the name, a view into it, or ""
+    // for the root. The name itself when it exists.
+    std::string_view closest_encloser;
+    // NOTE: the name doesn't exist but "*.<closest_encloser>" does, so
+    // answers for it are synthesized from the wildcard's records.
+    bool wildcard = false;
+  };
+
+  NameTrie();
+
+  // NOTE: true if the name was added, false if it was already present or
+  // isn't a valid name (an empty label, a label over 63 bytes or a name
+  // over 255 bytes in wire format).
+  bool Insert(std::string_view name);
+  // NOTE: true if the name was present.
+  bool Erase(std::string_view name);
+  bool Contains(std::string_view name) const;
+  Match Lookup(std::string_view name) const;
+
+  size_t size() const { return size_; }
+  // NOTE: the number of names whose first label is "*".
+  size_t wildcard_count() const { return wildcard_count_; }
+
+ private:
+  struct Node {
+    uint32_t edge_offset = 0;
+    uint32_t parent = 0;
+    uint32_t child_count = 0;
+    uint8_t edge_size = 0;
+    bool terminal = false;
+  };
+
+  // NOTE: a name in reverse wire format, without the root label.
+  struct Key {
+    char bytes[255];
+    size_t size = 0;
+    std::string_view view() const { return std::string_view(bytes, size); }
+  };
+  static bool Encode(std::string_view name, Key& key);
+
+  // NOTE: where a walk for a key ended: the last node reached and how many
+  // bytes of the key were matched. When that's inside the edge of one of
+  // the node's children, also which child and how far into its edge.
+  struct Position {
+    uint32_t node = 0;
+    size_t matched = 0;
+    bool in_edge = false;
+    uint32_t child = 0;
+    size_t edge_matched = 0;
+  };
+  Position Walk(std::string_view key) const;
+
+  std::string_view Edge(const Node& node) const {
+    return std::string_view(edges_).substr(node.edge_offset, node.edge_size);
+  }
+  int32_t FindChild(uint32_t parent, std::string_view label) const;
+  void LinkChild(uint32_t parent, uint32_t child);
+  void UnlinkChild(uint32_t parent, uint32_t child);
+  // NOTE: links nothing, the caller sets the edge then links it.
+  uint32_t NewNode();
+  void FreeNode(uint32_t index);
+  // NOTE: rewrites edges_ without the bytes of freed nodes.
+  void CompactEdges();
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> free_nodes_;
+  std::string edges_;
+  size_t dead_edge_bytes_ = 0;
+  // NOTE: keyed on the parent's index, as 4 bytes, then the child's first
+  // label in wire format.
+  absl::flat_hash_map<std::string, uint32_t> children_;
+  size_t size_ = 0;
+  size_t wildcard_count_ = 0;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_NAME_TRIE_H_
@@ -0,0 +1,99 @@
+#include "src/dns/name_trie.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+
+// NameTrie lookups against the exact-match lookups RecordStoreShard does on
+// its absl::flat_hash_map, over the same names: size hosts spread over 64
+// services of a zone, e.g. "host-12.svc-3.cluster.internal". Queries pick
+// names uniformly, so both structures are mostly out of cache at the larger
+// sizes.
+//
+// * BM_ExactMatch: flat_hash_map::find of names that exist.
+// * BM_NameTrieExists: NameTrie::Lookup of the same names.
+// * BM_NameTrieWildcard: NameTrie::Lookup of names that don't exist, under
+//   services that have a wildcard, so each finds its closest encloser and
+//   then the wildcard.
+
+namespace tiny_dns {
+namespace {
+
+constexpr int kServices = 64;
+
+std::string HostName(uint64_t host) {
+  return absl::StrCat("host-", host, ".svc-", host % kServices, ".cluster.internal");
+}
+
+std::vector<std::string> Names(size_t size) {
+  std::vector<std::string> names;
+  names.reserve(size);
+  for (uint64_t host = 0; host < size; host++) { names.push_back(HostName(host)); }
+  return names;
+}
+
+void BM_ExactMatch(benchmark::State& state) {
+  const std::vector<std::string> names = Names(state.range(0));
+  absl::flat_hash_map<std::string, int> map;
+  for (const std::string& name : names) { map.emplace(name, 0); }
+  std::mt19937_64 rng(1);
+  std::uniform_int_distribution<size_t> pick(0, names.size() - 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(names[pick(rng)]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ExactMatch)->RangeMultiplier(10)->Range(1'000, 1'000'000);
+
+void BM_NameTrieExists(benchmark::State& state) {
+  const std::vector<std::string> names = Names(state.range(0));
+  NameTrie trie;
+  for (const std::string& name : names) { CHECK(trie.Insert(name)); }
+  std::mt19937_64 rng(1);
+  std::uniform_int_distribution<size_t> pick(0, names.size() - 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(trie.Lookup(names[pick(rng)]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NameTrieExists)->RangeMultiplier(10)->Range(1'000, 1'000'000);
+
+void BM_NameTrieWildcard(benchmark::State& state) {
+  const size_t size = state.range(0);
+  NameTrie trie;
+  for (const std::string& name : Names(size)) { CHECK(trie.Insert(name)); }
+  for (int service = 0; service < kServices; service++) {
+    CHECK(trie.Insert(absl::StrCat("*.svc-", service, ".cluster.internal")));
+  }
+  // NOTE: hosts past the end of the ones inserted.
+  std::vector<std::string> misses = Names(2 * size);
+  misses.erase(misses.begin(), misses.begin() + size);
+  std::mt19937_64 rng(1);
+  std::uniform_int_distribution<size_t> pick(0, misses.size() - 1);
+  for (auto _ : state) {
+    const NameTrie::Match match = trie.Lookup(misses[pick(rng)]);
+    CHECK(match.wildcard);
+    benchmark::DoNotOptimize(match);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NameTrieWildcard)->RangeMultiplier(10)->Range(1'000, 1'000'000);
+
+void BM_NameTrieInsert(benchmark::State& state) {
+  const std::vector<std::string> names = Names(state.range(0));
+  for (auto _ : state) {
+    NameTrie trie;
+    for (const std::string& name : names) { benchmark::DoNotOptimize(trie.Insert(name)); }
+  }
+  state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(BM_NameTrieInsert)->RangeMultiplier(10)->Range(1'000, 100'000);
+
+} // namespace
+} // tiny_dns
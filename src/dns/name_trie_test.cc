@@ -0,0 +1,137 @@
+#include "src/dns/name_trie.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+
+// NOTE: the owner names of the example zone in RFC 4592 section 2.2.1.
+NameTrie Rfc4592Zone() {
+  NameTrie trie;
+  for (std::string_view name : {
+      "example", "*.example", "sub.*.example", "host1.example",
+      "_ssh._tcp.host1.example", "_ssh._tcp.host2.example", "subdel.example"}) {
+    EXPECT_TRUE(trie.Insert(name)) << name;
+  }
+  return trie;
+}
+
+TEST(NameTrieTest, InsertContainsErase) {
+  NameTrie trie;
+  EXPECT_TRUE(trie.Insert("www.example.com"));
+  EXPECT_FALSE(trie.Insert("www.example.com"));
+  EXPECT_TRUE(trie.Insert("example.com"));
+  EXPECT_TRUE(trie.Insert("mail.example.com."));
+  EXPECT_THAT(trie.size(), Eq(3));
+
+  EXPECT_TRUE(trie.Contains("www.example.com"));
+  EXPECT_TRUE(trie.Contains("mail.example.com"));
+  EXPECT_FALSE(trie.Contains("com"));
+  EXPECT_FALSE(trie.Contains("ww.example.com"));
+  EXPECT_FALSE(trie.Contains("a.www.example.com"));
+
+  EXPECT_TRUE(trie.Erase("example.com"));
+  EXPECT_FALSE(trie.Erase("example.com"));
+  EXPECT_TRUE(trie.Contains("www.example.com"));
+  EXPECT_TRUE(trie.Erase("www.example.com"));
+  EXPECT_TRUE(trie.Erase("mail.example.com"));
+  EXPECT_THAT(trie.size(), Eq(0));
+  EXPECT_FALSE(trie.Lookup("example.com").exists);
+}
+
+TEST(NameTrieTest, RejectsInvalidNames) {
+  NameTrie trie;
+  EXPECT_FALSE(trie.Insert("a..example"));
+  EXPECT_FALSE(trie.Insert(absl::StrCat(std::string(64, 'a'), ".example")));
+  std::string long_name;
+  for (int i = 0; i < 52; i++) { absl::StrAppend(&long_name, "abcd."); }
+  EXPECT_FALSE(trie.Insert(long_name + "example"));
+  EXPECT_THAT(trie.size(), Eq(0));
+}
+
+TEST(NameTrieTest, EmptyNonTerminalsExist) {
+  NameTrie trie = Rfc4592Zone();
+  EXPECT_TRUE(trie.Lookup("_tcp.host1.example").exists);
+  EXPECT_TRUE(trie.Lookup("host2.example").exists);
+  EXPECT_FALSE(trie.Contains("host2.example"));
+  EXPECT_FALSE(trie.Lookup("host3.example").exists);
+}
+
+TEST(NameTrieTest, FindsClosestEncloser) {
+  NameTrie trie = Rfc4592Zone();
+  EXPECT_THAT(trie.Lookup("host3.example").closest_encloser, Eq("example"));
+  EXPECT_THAT(trie.Lookup("foo.bar.example").closest_encloser, Eq("example"));
+  EXPECT_THAT(trie.Lookup("_telnet._tcp.host1.example").closest_encloser,
+      Eq("_tcp.host1.example"));
+  EXPECT_THAT(trie.Lookup("a.b.host1.example.").closest_encloser, Eq("host1.example"));
+  EXPECT_THAT(trie.Lookup("ghost.*.example").closest_encloser, Eq("*.example"));
+  EXPECT_THAT(trie.Lookup("other").closest_encloser, Eq(""));
+}
+
+// NOTE: the cases of RFC 4592 section 2.2.1.
+TEST(NameTrieTest, MatchesWildcardsPerRfc4592) {
+  NameTrie trie = Rfc4592Zone();
+  EXPECT_THAT(trie.wildcard_count(), Eq(1));
+  EXPECT_TRUE(trie.Lookup("host3.example").wildcard);
+  EXPECT_TRUE(trie.Lookup("foo.bar.example").wildcard);
+
+  // NOTE: the name exists.
+  EXPECT_FALSE(trie.Lookup("host1.example").wildcard);
+  EXPECT_FALSE(trie.Lookup("sub.*.example").wildcard);
+  EXPECT_FALSE(trie.Lookup("host2.example").wildcard);
+  // NOTE: there's no "*._tcp.host1.example" or "*.*.example".
+  EXPECT_FALSE(trie.Lookup("_telnet._tcp.host1.example").wildcard);
+  EXPECT_FALSE(trie.Lookup("ghost.*.example").wildcard);
+
+  EXPECT_TRUE(trie.Erase("*.example"));
+  EXPECT_THAT(trie.wildcard_count(), Eq(0));
+  EXPECT_FALSE(trie.Lookup("host3.example").wildcard);
+  // NOTE: "*.example" remains as an empty non-terminal.
+  EXPECT_TRUE(trie.Lookup("*.example").exists);
+}
+
+TEST(NameTrieTest, MatchesWildcardsAtTheEndOfAnEdge) {
+  // NOTE: the only name, so a single edge from the root.
+  NameTrie trie;
+  EXPECT_TRUE(trie.Insert("*.svc.internal"));
+  const NameTrie::Match match = trie.Lookup("web.svc.internal");
+  EXPECT_FALSE(match.exists);
+  EXPECT_THAT(match.closest_encloser, Eq("svc.internal"));
+  EXPECT_TRUE(match.wildcard);
+  EXPECT_TRUE(trie.Lookup("a.b.svc.internal").wildcard);
+  // NOTE: the closest encloser is internal, with no wildcard.
+  EXPECT_FALSE(trie.Lookup("web.other.internal").wildcard);
+
+  EXPECT_TRUE(trie.Insert("*.a.svc.internal"));
+  EXPECT_FALSE(trie.Lookup("*.svc.internal").wildcard);
+  EXPECT_TRUE(trie.Erase("*.svc.internal"));
+  EXPECT_FALSE(trie.Lookup("web.svc.internal").wildcard);
+  EXPECT_TRUE(trie.Lookup("web.a.svc.internal").wildcard);
+}
+
+TEST(NameTrieTest, SurvivesChurn) {
+  NameTrie trie;
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_TRUE(trie.Insert(absl::StrCat("host-", i, ".rack-", i % 7, ".example")));
+    }
+    EXPECT_THAT(trie.size(), Eq(1000));
+    EXPECT_TRUE(trie.Lookup("rack-3.example").exists);
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_TRUE(trie.Erase(absl::StrCat("host-", i, ".rack-", i % 7, ".example")));
+    }
+    EXPECT_THAT(trie.size(), Eq(0));
+    EXPECT_FALSE(trie.Lookup("rack-3.example").exists);
+  }
+}
+
+} // namespace
+} // tiny_dns
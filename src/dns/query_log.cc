@@ -0,0 +1,107 @@
+#include "src/dns/query_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "src/common/mpmc_queue.h"
+
+namespace tiny_dns {
+namespace {
+
+constexpr auto kIdleInterval = std::chrono::milliseconds(5);
+// NOTE: entries fanned out per hold of the subscribers lock.
+constexpr size_t kMaxFanOutBatch = 256;
+
+} // namespace
+
+std::vector<QueryLogEntry> QueryLogSubscription::Next(
+    size_t max_entries, std::chrono::milliseconds timeout) {
+  std::vector<QueryLogEntry> entries;
+  std::unique_lock lock(mutex_);
+  if (!cv_.wait_for(lock, timeout, [this] { return !entries_.empty(); })) { return entries; }
+  const size_t count = std::min(max_entries, entries_.size());
+  entries.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    entries.push_back(entries_.front());
+    entries_.pop_front();
+  }
+  return entries;
+}
+
+void QueryLogSubscription::Push(const QueryLogEntry& entry) {
+  {
+    std::scoped_lock lock(mutex_);
+    if (entries_.size() >= capacity_) {
+      AddDropped(1);
+      return;
+    }
+    entries_.push_back(entry);
+  }
+  cv_.notify_one();
+}
+
+QueryLog::QueryLog(size_t capacity)
+  : ring_(capacity), dropped_(0), subscriber_count_(0), stopping_(false) {
+  fan_out_thread_ = std::thread(&QueryLog::FanOut, this);
+}
+
+QueryLog::~QueryLog() {
+  stopping_ = true;
+  fan_out_thread_.join();
+}
+
+void QueryLog::Record(const QueryLogEntry& entry) {
+  if (!ring_.TryPush(entry)) { dropped_.fetch_add(1, std::memory_order_relaxed); }
+}
+
+std::shared_ptr<QueryLogSubscription> QueryLog::Subscribe(size_t capacity) {
+  auto subscription = std::make_shared<QueryLogSubscription>(capacity);
+  std::scoped_lock lock(subscribers_mutex_);
+  subscribers_.push_back(subscription);
+  subscriber_count_ = subscribers_.size();
+  return subscription;
+}
+
+void QueryLog::Unsubscribe(const std::shared_ptr<QueryLogSubscription>& subscription) {
+  std::scoped_lock lock(subscribers_mutex_);
+  std::erase(subscribers_, subscription);
+  subscriber_count_ = subscribers_.size();
+}
+
+void QueryLog::FanOut() {
+  std::vector<QueryLogEntry> batch;
+  batch.reserve(kMaxFanOutBatch);
+  uint64_t dropped_seen = 0;
+  while (!stopping_.load()) {
+    // NOTE: popped before taking the lock, a batch at a time, so Subscribe
+    // and Unsubscribe wait out one batch at most however fast entries come.
+    batch.clear();
+    QueryLogEntry entry;
+    while (batch.size() < kMaxFanOutBatch && ring_.TryPop(entry)) {
+      batch.push_back(std::move(entry));
+    }
+    {
+      std::scoped_lock lock(subscribers_mutex_);
+      // NOTE: entries dropped from the shared ring were lost to everyone.
+      const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+      for (const std::shared_ptr<QueryLogSubscription>& subscriber : subscribers_) {
+        subscriber->AddDropped(dropped - dropped_seen);
+      }
+      dropped_seen = dropped;
+      for (const QueryLogEntry& batched : batch) {
+        for (const std::shared_ptr<QueryLogSubscription>& subscriber : subscribers_) {
+          subscriber->Push(batched);
+        }
+      }
+    }
+    if (batch.empty()) { std::this_thread::sleep_for(kIdleInterval); }
+  }
+}
+
+} // tiny_dns
@@ -0,0 +1,93 @@
+#ifndef SRC_DNS_QUERY_LOG_H_
+#define SRC_DNS_QUERY_LOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "src/common/mpmc_queue.h"
+#include "src/dns/query_trace.h"
+
+// A live feed of every query the server handles, for streaming to analytics
+// consumers (see StreamQueryLog in dns_admin_service.proto).
+//
+// The DNS path only ever does a lock-free push onto a bounded ring, and only
+// while someone is subscribed. A fan-out thread moves entries from the ring
+// into each subscription's own bounded buffer. Whenever either is full the
+// entry is dropped and counted, a slow consumer never stalls the DNS path.
+
+namespace tiny_dns {
+
+struct QueryLogEntry {
+  TraceEntry query;
+  bool cache_hit;
+  bool forwarded;
+  // NOTE: 0 unless forwarded.
+  uint32_t upstream_rtt_ns;
+};
+
+class QueryLogSubscription {
+ public:
+  explicit QueryLogSubscription(size_t capacity) : capacity_(capacity), dropped_(0) {}
+
+  // NOTE: waits up to timeout for the first entry, then takes up to
+  // max_entries without waiting. Empty on timeout.
+  std::vector<QueryLogEntry> Next(size_t max_entries, std::chrono::milliseconds timeout);
+
+  // NOTE: entries lost because this subscription, or the shared ring, was full.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  friend class QueryLog;
+
+  void Push(const QueryLogEntry& entry);
+  void AddDropped(uint64_t count) { dropped_.fetch_add(count, std::memory_order_relaxed); }
+
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<QueryLogEntry> entries_;
+  std::atomic<uint64_t> dropped_;
+};
+
+class QueryLog {
+ public:
+  static constexpr size_t kDefaultCapacity = 16 * 1024;
+
+  explicit QueryLog(size_t capacity = kDefaultCapacity);
+  ~QueryLog();
+
+  QueryLog(const QueryLog&) = delete;
+  QueryLog& operator=(const QueryLog&) = delete;
+
+  // NOTE: lets callers skip building entries nobody will see.
+  bool HasSubscribers() const { return subscriber_count_.load(std::memory_order_relaxed) > 0; }
+  void Record(const QueryLogEntry& entry);
+
+  std::shared_ptr<QueryLogSubscription> Subscribe(size_t capacity);
+  void Unsubscribe(const std::shared_ptr<QueryLogSubscription>& subscription);
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  void FanOut();
+
+  MpmcQueue<QueryLogEntry> ring_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<size_t> subscriber_count_;
+  std::mutex subscribers_mutex_;
+  std::vector<std::shared_ptr<QueryLogSubscription>> subscribers_;
+  std::atomic<bool> stopping_;
+  std::thread fan_out_thread_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_QUERY_LOG_H_
@@ -0,0 +1,101 @@
+#include "src/dns/query_log.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/query_trace.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::SizeIs;
+
+QueryLogEntry CreateEntry(int64_t timestamp_ns) {
+  QueryLogEntry entry = {};
+  entry.query.timestamp_ns = timestamp_ns;
+  entry.cache_hit = true;
+  return entry;
+}
+
+// NOTE: the fan-out thread delivers asynchronously, poll until count arrive.
+std::vector<QueryLogEntry> Collect(QueryLogSubscription& subscription, size_t count) {
+  std::vector<QueryLogEntry> collected;
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (collected.size() < count && std::chrono::steady_clock::now() < deadline) {
+    for (const QueryLogEntry& entry :
+        subscription.Next(count - collected.size(), std::chrono::milliseconds(100))) {
+      collected.push_back(entry);
+    }
+  }
+  return collected;
+}
+
+TEST(QueryLogTest, TracksSubscribers) {
+  QueryLog query_log;
+  EXPECT_FALSE(query_log.HasSubscribers());
+  std::shared_ptr<QueryLogSubscription> subscription = query_log.Subscribe(16);
+  EXPECT_TRUE(query_log.HasSubscribers());
+  query_log.Unsubscribe(subscription);
+  EXPECT_FALSE(query_log.HasSubscribers());
+}
+
+TEST(QueryLogTest, DeliversEntriesToEverySubscriberInOrder) {
+  QueryLog query_log;
+  std::shared_ptr<QueryLogSubscription> first = query_log.Subscribe(16);
+  std::shared_ptr<QueryLogSubscription> second = query_log.Subscribe(16);
+  for (int64_t i = 0; i < 3; i++) { query_log.Record(CreateEntry(i)); }
+
+  for (const std::shared_ptr<QueryLogSubscription>& subscription : {first, second}) {
+    const std::vector<QueryLogEntry> entries = Collect(*subscription, 3);
+    ASSERT_THAT(entries, SizeIs(3));
+    for (int64_t i = 0; i < 3; i++) {
+      EXPECT_THAT(entries[i].query.timestamp_ns, Eq(i));
+      EXPECT_TRUE(entries[i].cache_hit);
+    }
+    EXPECT_THAT(subscription->dropped(), Eq(0));
+  }
+}
+
+TEST(QueryLogTest, DeliversEntriesAcrossBatchesInOrder) {
+  // NOTE: several of the fan-out thread's batches' worth.
+  constexpr int64_t kEntries = 1000;
+  QueryLog query_log;
+  std::shared_ptr<QueryLogSubscription> subscription = query_log.Subscribe(kEntries);
+  for (int64_t i = 0; i < kEntries; i++) { query_log.Record(CreateEntry(i)); }
+
+  const std::vector<QueryLogEntry> entries = Collect(*subscription, kEntries);
+  ASSERT_THAT(entries, SizeIs(kEntries));
+  for (int64_t i = 0; i < kEntries; i++) { EXPECT_THAT(entries[i].query.timestamp_ns, Eq(i)); }
+  EXPECT_THAT(subscription->dropped(), Eq(0));
+}
+
+TEST(QueryLogTest, SlowSubscriberDropsInsteadOfBlocking) {
+  QueryLog query_log;
+  std::shared_ptr<QueryLogSubscription> subscription = query_log.Subscribe(2);
+  for (int64_t i = 0; i < 10; i++) { query_log.Record(CreateEntry(i)); }
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (subscription->dropped() < 8 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_THAT(subscription->dropped(), Eq(8));
+  const std::vector<QueryLogEntry> entries = Collect(*subscription, 2);
+  ASSERT_THAT(entries, SizeIs(2));
+  EXPECT_THAT(entries[0].query.timestamp_ns, Eq(0));
+}
+
+TEST(QueryLogTest, NextTimesOutWhenIdle) {
+  QueryLog query_log;
+  std::shared_ptr<QueryLogSubscription> subscription = query_log.Subscribe(16);
+  EXPECT_THAT(subscription->Next(16, std::chrono::milliseconds(10)), IsEmpty());
+}
+
+} // namespace
+} // tiny_dns
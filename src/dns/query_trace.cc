@@ -0,0 +1,189 @@
+#include "src/dns/query_trace.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "src/dns/dns_packet.h"
+
+namespace tiny_dns {
+
+namespace {
+
+// NOTE: size of everything in an entry before the question bytes.
+constexpr size_t kEntryHeaderSize = 8 + 4 + 2 + 1 + 1 + 4 + 2;
+constexpr size_t kHeaderSize = 12;
+// NOTE: how often the flush thread looks for new entries when idle, and how
+// often buffered writes are flushed to the file.
+constexpr auto kIdleInterval = std::chrono::milliseconds(5);
+constexpr auto kFlushInterval = std::chrono::milliseconds(100);
+
+template <typename T>
+uint8_t* StoreLittleEndian(uint8_t* out, T value) {
+  for (size_t i = 0; i < sizeof(T); i++) { *out++ = static_cast<uint8_t>(value >> (8 * i)); }
+  return out;
+}
+
+template <typename T>
+const uint8_t* LoadLittleEndian(const uint8_t* in, T& value) {
+  value = 0;
+  for (size_t i = 0; i < sizeof(T); i++) { value |= static_cast<T>(*in++) << (8 * i); }
+  return in;
+}
+
+size_t EncodeEntry(const TraceEntry& entry, uint8_t* out) {
+  uint8_t* const start = out;
+  out = StoreLittleEndian<uint64_t>(out, entry.timestamp_ns);
+  memcpy(out, entry.client_addr.data(), entry.client_addr.size());
+  out += entry.client_addr.size();
+  out = StoreLittleEndian<uint16_t>(out, entry.client_port);
+  *out++ = entry.recursion_desired ? 1 : 0;
+  *out++ = ResponseCodeToByte(entry.response_code);
+  out = StoreLittleEndian<uint32_t>(out, entry.service_time_ns);
+  out = StoreLittleEndian<uint16_t>(out, entry.question_size);
+  memcpy(out, entry.question.data(), entry.question_size);
+  out += entry.question_size;
+  return out - start;
+}
+
+} // namespace
+
+absl::StatusOr<std::span<const uint8_t>> RawQuestion(const std::array<uint8_t, 512>& request) {
+  if ((request[4] << 8 | request[5]) == 0) {
+    return absl::InvalidArgumentError("Request has no question.");
+  }
+  size_t pos = kHeaderSize;
+  while (pos < request.size() && request[pos] != 0) {
+    if ((request[pos] & 0xc0) != 0) {
+      return absl::InvalidArgumentError("Compressed or extended label in question.");
+    }
+    pos += request[pos] + 1;
+  }
+  // NOTE: the terminating zero length label, QTYPE and QCLASS.
+  pos += 1 + 4;
+  const size_t size = pos - kHeaderSize;
+  if (pos > request.size() || size > TraceEntry::kMaxQuestionSize) {
+    return absl::InvalidArgumentError(absl::StrCat("Question too long: ", size));
+  }
+  return std::span<const uint8_t>(request.data() + kHeaderSize, size);
+}
+
+absl::StatusOr<Question> ParseRawQuestion(std::span<const uint8_t> raw_question) {
+  std::array<uint8_t, 512> buffer = {};
+  if (raw_question.size() > buffer.size()) {
+    return absl::InvalidArgumentError(absl::StrCat("Question too long: ", raw_question.size()));
+  }
+  memcpy(buffer.data(), raw_question.data(), raw_question.size());
+  BufferReader reader(buffer);
+  return Question::FromBytes(reader);
+}
+
+absl::StatusOr<std::unique_ptr<TraceWriter>> TraceWriter::Create(
+    const std::string& path, size_t capacity) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return absl::FailedPreconditionError(absl::StrCat("Unable to open: ", path));
+  }
+  if (fwrite(kTraceMagic.data(), 1, kTraceMagic.size(), file) != kTraceMagic.size()) {
+    fclose(file);
+    return absl::FailedPreconditionError(absl::StrCat("Unable to write to: ", path));
+  }
+  return std::make_unique<TraceWriter>(file, capacity);
+}
+
+TraceWriter::TraceWriter(FILE* file, size_t capacity)
+  : file_(file), ring_(capacity), written_(0), dropped_(0), stopping_(false) {
+  flush_thread_ = std::thread(&TraceWriter::Flush, this);
+}
+
+TraceWriter::~TraceWriter() {
+  stopping_ = true;
+  flush_thread_.join();
+  fclose(file_);
+  LOG(INFO) << "Trace closed, wrote " << written() << " entries, dropped " << dropped() << ".";
+}
+
+void TraceWriter::Record(const TraceEntry& entry) {
+  if (!ring_.TryPush(entry)) { dropped_.fetch_add(1, std::memory_order_relaxed); }
+}
+
+void TraceWriter::Flush() {
+  TraceEntry entry;
+  std::array<uint8_t, kEntryHeaderSize + TraceEntry::kMaxQuestionSize> buffer;
+  auto last_flush = std::chrono::steady_clock::now();
+  while (true) {
+    // NOTE: read stopping_ first, so entries recorded before it was set are
+    // still written out by the drain below.
+    const bool stopping = stopping_.load();
+    bool wrote = false;
+    while (ring_.TryPop(entry)) {
+      const size_t size = EncodeEntry(entry, buffer.data());
+      if (fwrite(buffer.data(), 1, size, file_) != size) {
+        LOG(ERROR) << "Unable to write trace entry.";
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      written_.fetch_add(1, std::memory_order_relaxed);
+      wrote = true;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (stopping || (wrote && now - last_flush > kFlushInterval)) {
+      fflush(file_);
+      last_flush = now;
+    }
+    if (stopping) { return; }
+    if (!wrote) { std::this_thread::sleep_for(kIdleInterval); }
+  }
+}
+
+absl::StatusOr<std::unique_ptr<TraceReader>> TraceReader::Open(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return absl::NotFoundError(absl::StrCat("Unable to open: ", path));
+  }
+  std::array<char, kTraceMagic.size()> magic;
+  if (fread(magic.data(), 1, magic.size(), file) != magic.size() ||
+      std::string_view(magic.data(), magic.size()) != kTraceMagic) {
+    fclose(file);
+    return absl::InvalidArgumentError(absl::StrCat("Not a trace file: ", path));
+  }
+  return std::make_unique<TraceReader>(file);
+}
+
+absl::StatusOr<bool> TraceReader::Next(TraceEntry& entry) {
+  std::array<uint8_t, kEntryHeaderSize> header;
+  const size_t read = fread(header.data(), 1, header.size(), file_);
+  if (read == 0 && feof(file_)) { return false; }
+  if (read != header.size()) { return absl::DataLossError("Truncated trace entry."); }
+
+  const uint8_t* in = header.data();
+  uint64_t timestamp_ns;
+  in = LoadLittleEndian(in, timestamp_ns);
+  entry.timestamp_ns = timestamp_ns;
+  memcpy(entry.client_addr.data(), in, entry.client_addr.size());
+  in += entry.client_addr.size();
+  in = LoadLittleEndian(in, entry.client_port);
+  entry.recursion_desired = (*in++ & 1) != 0;
+  entry.response_code = ResponseCodeFromByte(*in++);
+  in = LoadLittleEndian(in, entry.service_time_ns);
+  in = LoadLittleEndian(in, entry.question_size);
+  if (entry.question_size > TraceEntry::kMaxQuestionSize) {
+    return absl::DataLossError(absl::StrCat("Bad question size: ", entry.question_size));
+  }
+  if (fread(entry.question.data(), 1, entry.question_size, file_) != entry.question_size) {
+    return absl::DataLossError("Truncated trace entry.");
+  }
+  return true;
+}
+
+} // tiny_dns
@@ -0,0 +1,110 @@
+#ifndef SRC_DNS_QUERY_TRACE_H_
+#define SRC_DNS_QUERY_TRACE_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "src/common/mpmc_queue.h"
+#include "src/dns/dns_packet.h"
+
+// Capture and read back traces of the queries a server handled, so production
+// shaped traffic can be replayed later (see //src/tools:dns_replay).
+//
+// Trace file layout, all integers little-endian:
+//   "TDNSTRC1"                        8 byte magic.
+//   Then per entry:
+//     u64 timestamp_ns                Wall clock (unix epoch) at receipt.
+//     u8[4] client_addr               IPv4 address, network byte order.
+//     u16 client_port
+//     u8 flags                        Bit 0: recursion desired.
+//     u8 response_code
+//     u32 service_time_ns             Time spent producing the response.
+//     u16 question_size
+//     u8[question_size] question      Raw question section: QNAME, QTYPE, QCLASS.
+
+namespace tiny_dns {
+
+inline constexpr std::string_view kTraceMagic = "TDNSTRC1";
+
+struct TraceEntry {
+  // NOTE: the longest name is 255 bytes, followed by QTYPE and QCLASS.
+  static constexpr size_t kMaxQuestionSize = 255 + 4;
+
+  std::span<const uint8_t> Question() const { return {question.data(), question_size}; }
+
+  int64_t timestamp_ns;
+  std::array<uint8_t, 4> client_addr;
+  uint16_t client_port;
+  bool recursion_desired;
+  ResponseCode response_code;
+  uint32_t service_time_ns;
+  uint16_t question_size;
+  std::array<uint8_t, kMaxQuestionSize> question;
+};
+
+// NOTE: finds the first question of a raw request and returns it unparsed.
+// Fails on requests without a question, or with a compressed / overlong QNAME.
+absl::StatusOr<std::span<const uint8_t>> RawQuestion(const std::array<uint8_t, 512>& request);
+// NOTE: the inverse of RawQuestion().
+absl::StatusOr<Question> ParseRawQuestion(std::span<const uint8_t> raw_question);
+
+// Appends entries to a trace file. Record() is lock-free and never blocks: it
+// pushes onto a bounded ring, and a background thread encodes and writes the
+// entries out. When the ring is full, entries are dropped (and counted).
+class TraceWriter {
+ public:
+  static constexpr size_t kDefaultCapacity = 16 * 1024;
+
+  static absl::StatusOr<std::unique_ptr<TraceWriter>> Create(
+      const std::string& path, size_t capacity = kDefaultCapacity);
+  TraceWriter(FILE* file, size_t capacity);
+  // NOTE: writes out anything still in the ring before closing the file.
+  ~TraceWriter();
+
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+
+  void Record(const TraceEntry& entry);
+
+  uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  void Flush();
+
+  FILE* const file_;
+  MpmcQueue<TraceEntry> ring_;
+  std::atomic<uint64_t> written_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<bool> stopping_;
+  std::thread flush_thread_;
+};
+
+class TraceReader {
+ public:
+  static absl::StatusOr<std::unique_ptr<TraceReader>> Open(const std::string& path);
+  explicit TraceReader(FILE* file) : file_(file) {}
+  ~TraceReader() { fclose(file_); }
+
+  TraceReader(const TraceReader&) = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+
+  // NOTE: false once the end of the trace is reached.
+  absl::StatusOr<bool> Next(TraceEntry& entry);
+
+ private:
+  FILE* const file_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_QUERY_TRACE_H_
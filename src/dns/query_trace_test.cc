@@ -0,0 +1,166 @@
+#include "src/dns/query_trace.h"
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+#include "absl/status/status_matchers.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/test_util.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::absl_testing::IsOk;
+using ::absl_testing::StatusIs;
+using ::testing::ElementsAreArray;
+using ::testing::Eq;
+using ::testing::SizeIs;
+
+TraceEntry CreateEntry(std::string_view qname, int64_t timestamp_ns) {
+  const std::array<uint8_t, 512> request = CreateRequest(qname, QueryType::AAAA);
+  const absl::StatusOr<std::span<const uint8_t>> question = RawQuestion(request);
+  EXPECT_TRUE(question.ok());
+  TraceEntry entry = {};
+  entry.timestamp_ns = timestamp_ns;
+  entry.client_addr = {127, 0, 0, 1};
+  entry.client_port = 53123;
+  entry.recursion_desired = true;
+  entry.response_code = ResponseCode::NX_DOMAIN;
+  entry.service_time_ns = 4242;
+  entry.question_size = question->size();
+  std::copy(question->begin(), question->end(), entry.question.begin());
+  return entry;
+}
+
+std::string TracePath(std::string_view name) {
+  return testing::TempDir() + "/" + std::string(name);
+}
+
+TEST(RawQuestionTest, ReturnsQuestionSection) {
+  const std::array<uint8_t, 512> request = CreateRequest("a.example", QueryType::A);
+  const absl::StatusOr<std::span<const uint8_t>> question = RawQuestion(request);
+  ASSERT_THAT(question, IsOk());
+  // NOTE: 1a 7example 0, then QTYPE and QCLASS.
+  EXPECT_THAT(*question, SizeIs(11 + 4));
+  EXPECT_THAT(question->data(), Eq(request.data() + 12));
+
+  BufferReader reader(request, 12);
+  absl::StatusOr<Question> parsed = Question::FromBytes(reader);
+  ASSERT_THAT(parsed, IsOk());
+  EXPECT_THAT(parsed->qname, Eq("a.example"));
+}
+
+TEST(RawQuestionTest, ParseRawQuestionRoundTrips) {
+  const std::array<uint8_t, 512> request = CreateRequest("www.example.com", QueryType::AAAA);
+  const absl::StatusOr<std::span<const uint8_t>> raw_question = RawQuestion(request);
+  ASSERT_THAT(raw_question, IsOk());
+  const absl::StatusOr<Question> question = ParseRawQuestion(*raw_question);
+  ASSERT_THAT(question, IsOk());
+  EXPECT_THAT(question->qname, Eq("www.example.com"));
+  EXPECT_THAT(question->qtype, Eq(QueryType::AAAA));
+}
+
+TEST(RawQuestionTest, RejectsRequestsWithoutQuestion) {
+  DnsPacket request = {};
+  std::array<uint8_t, 512> bytes = {};
+  ASSERT_TRUE(request.ToBytes(bytes).ok());
+  EXPECT_THAT(RawQuestion(bytes), StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(QueryTraceTest, RoundTripsEntries) {
+  const std::string path = TracePath("round_trip.trace");
+  std::vector<TraceEntry> entries = {
+    CreateEntry("a.example", 1000),
+    CreateEntry("a-much-longer-name.service.internal.example", 2000),
+  };
+  {
+    absl::StatusOr<std::unique_ptr<TraceWriter>> writer = TraceWriter::Create(path);
+    ASSERT_THAT(writer, IsOk());
+    for (const TraceEntry& entry : entries) { (*writer)->Record(entry); }
+  }
+
+  absl::StatusOr<std::unique_ptr<TraceReader>> reader = TraceReader::Open(path);
+  ASSERT_THAT(reader, IsOk());
+  for (const TraceEntry& expected : entries) {
+    TraceEntry entry = {};
+    ASSERT_THAT((*reader)->Next(entry), IsOk());
+    EXPECT_THAT(entry.timestamp_ns, Eq(expected.timestamp_ns));
+    EXPECT_THAT(entry.client_addr, Eq(expected.client_addr));
+    EXPECT_THAT(entry.client_port, Eq(expected.client_port));
+    EXPECT_THAT(entry.recursion_desired, Eq(expected.recursion_desired));
+    EXPECT_THAT(entry.response_code, Eq(expected.response_code));
+    EXPECT_THAT(entry.service_time_ns, Eq(expected.service_time_ns));
+    EXPECT_THAT(entry.Question(), ElementsAreArray(expected.Question()));
+  }
+  TraceEntry entry = {};
+  absl::StatusOr<bool> more = (*reader)->Next(entry);
+  ASSERT_THAT(more, IsOk());
+  EXPECT_FALSE(*more);
+}
+
+TEST(QueryTraceTest, DropsEntriesWhenRingIsFull) {
+  const std::string path = TracePath("full.trace");
+  // NOTE: the flush thread might drain some entries while recording, so only
+  // check that everything was either written or dropped.
+  absl::StatusOr<std::unique_ptr<TraceWriter>> writer = TraceWriter::Create(path, 2);
+  ASSERT_THAT(writer, IsOk());
+  for (int64_t i = 0; i < 1000; i++) { (*writer)->Record(CreateEntry("a.example", i)); }
+  EXPECT_GT((*writer)->dropped(), 0);
+  const uint64_t recorded = 1000 - (*writer)->dropped();
+  writer->reset();
+
+  absl::StatusOr<std::unique_ptr<TraceReader>> reader = TraceReader::Open(path);
+  ASSERT_THAT(reader, IsOk());
+  size_t count = 0;
+  TraceEntry entry = {};
+  while (true) {
+    absl::StatusOr<bool> more = (*reader)->Next(entry);
+    ASSERT_THAT(more, IsOk());
+    if (!*more) { break; }
+    count++;
+  }
+  EXPECT_THAT(count, Eq(recorded));
+}
+
+TEST(QueryTraceTest, RejectsOtherFiles) {
+  const std::string path = TracePath("not_a.trace");
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  fputs("definitely not a trace", file);
+  fclose(file);
+  EXPECT_THAT(TraceReader::Open(path), StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(QueryTraceTest, ReportsTruncatedEntries) {
+  const std::string path = TracePath("truncated.trace");
+  {
+    absl::StatusOr<std::unique_ptr<TraceWriter>> writer = TraceWriter::Create(path);
+    ASSERT_THAT(writer, IsOk());
+    (*writer)->Record(CreateEntry("a.example", 1));
+  }
+  FILE* file = fopen(path.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fclose(file);
+  ASSERT_EQ(truncate(path.c_str(), size - 3), 0);
+
+  absl::StatusOr<std::unique_ptr<TraceReader>> reader = TraceReader::Open(path);
+  ASSERT_THAT(reader, IsOk());
+  TraceEntry entry = {};
+  EXPECT_THAT((*reader)->Next(entry), StatusIs(absl::StatusCode::kDataLoss));
+}
+
+} // namespace
+} // tiny_dns
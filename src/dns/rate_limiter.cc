@@ -0,0 +1,76 @@
+#include "src/dns/rate_limiter.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <arpa/inet.h>
+
+#include "absl/hash/hash.h"
+#include "src/common/token_bucket_sketch.h"
+#include "src/dns/dns_packet.h"
+
+namespace tiny_dns {
+namespace {
+
+std::unique_ptr<TokenBucketSketch> CreateSketch(
+    double rate, const RateLimiterOptions& options) {
+  if (rate <= 0) { return nullptr; }
+  return std::make_unique<TokenBucketSketch>(
+      options.cells_per_row, rate, rate * options.window_seconds);
+}
+
+uint32_t PrefixMask(uint32_t prefix_length) {
+  if (prefix_length == 0) { return 0; }
+  return ~uint32_t{0} << (32 - std::min<uint32_t>(prefix_length, 32));
+}
+
+} // namespace
+
+RateLimiter::RateLimiter(RateLimiterOptions options) :
+  options_(options), prefix_mask_(PrefixMask(options.ipv4_prefix_length)),
+  queries_(CreateSketch(options.queries_per_second, options)),
+  responses_(CreateSketch(options.responses_per_second, options)),
+  limited_(0) {}
+
+uint32_t RateLimiter::Prefix(const struct sockaddr_in& client) const {
+  return ntohl(client.sin_addr.s_addr) & prefix_mask_;
+}
+
+RateLimitAction RateLimiter::Limited() {
+  if (options_.slip == 0) { return RateLimitAction::kDrop; }
+  const uint64_t limited = limited_.fetch_add(1, std::memory_order_relaxed) + 1;
+  return limited % options_.slip == 0 ? RateLimitAction::kSlip : RateLimitAction::kDrop;
+}
+
+RateLimitAction RateLimiter::CheckQuery(const struct sockaddr_in& client, int64_t now_ns) {
+  if (queries_ == nullptr) { return RateLimitAction::kSend; }
+  if (queries_->TryTake(absl::HashOf(Prefix(client)), now_ns)) { return RateLimitAction::kSend; }
+  return Limited();
+}
+
+RateLimitAction RateLimiter::CheckResponse(
+    const struct sockaddr_in& client, std::span<const uint8_t> question,
+    ResponseCode response_code, int64_t now_ns) {
+  if (responses_ == nullptr) { return RateLimitAction::kSend; }
+  // NOTE: names compare case insensitively, so varying the case of the
+  // query (e.g. 0x20 randomization) doesn't dodge the limit. Length bytes
+  // are below 64, and so left alone.
+  std::array<char, 512> lowered;
+  const size_t size = std::min(question.size(), lowered.size());
+  for (size_t i = 0; i < size; i++) { lowered[i] = std::tolower(question[i]); }
+  const uint64_t hash = absl::HashOf(
+      Prefix(client), std::string_view(lowered.data(), size), ResponseCodeToByte(response_code));
+  if (responses_->TryTake(hash, now_ns)) { return RateLimitAction::kSend; }
+  return Limited();
+}
+
+size_t RateLimiter::MemoryBytes() const {
+  return (queries_ != nullptr ? queries_->MemoryBytes() : 0)
+    + (responses_ != nullptr ? responses_->MemoryBytes() : 0);
+}
+
+} // tiny_dns
@@ -0,0 +1,84 @@
+#ifndef SRC_DNS_RATE_LIMITER_H_
+#define SRC_DNS_RATE_LIMITER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <arpa/inet.h>
+
+#include "src/common/token_bucket_sketch.h"
+#include "src/dns/dns_packet.h"
+
+// Response rate limiting, after BIND's RRL: stops one client, or a victim
+// whose address is spoofed for reflection, from soaking up the server.
+//
+// Two limits, both token buckets in a TokenBucketSketch, so memory is fixed
+// however many source addresses show up:
+// * queries per client prefix, checked on receipt, before a thread is spent
+//   on the query.
+// * responses per client prefix and response (question and response code),
+//   checked before sending, so a flood of identical answers is cut down while
+//   the same client's other queries still get through.
+//
+// Over a limit, responses are dropped, except for 1 in every slip which is
+// sent truncated (TC=1, no records). A genuine client then retries, over TCP
+// or another server, while a reflection victim gets nothing bigger than the
+// spoofed query.
+
+namespace tiny_dns {
+
+struct RateLimiterOptions {
+  // NOTE: 0 for no limit.
+  double queries_per_second = 0;
+  // NOTE: 0 for no limit.
+  double responses_per_second = 0;
+  // NOTE: the burst allowed, in seconds' worth of the rate.
+  double window_seconds = 5;
+  // NOTE: 0 drops every limited response, 1 sends each truncated.
+  uint32_t slip = 2;
+  // NOTE: clients are grouped by this many leading bits of their address.
+  uint32_t ipv4_prefix_length = 24;
+  // NOTE: per row of each sketch, see TokenBucketSketch.
+  size_t cells_per_row = 1 << 16;
+};
+
+enum class RateLimitAction {
+  kSend,
+  kDrop,
+  // NOTE: send a truncated response instead.
+  kSlip,
+};
+
+class RateLimiter {
+ public:
+  explicit RateLimiter(RateLimiterOptions options);
+
+  bool enabled() const { return queries_ != nullptr || responses_ != nullptr; }
+
+  // NOTE: now_ns is on the steady clock, see MonotonicNanos().
+  RateLimitAction CheckQuery(const struct sockaddr_in& client, int64_t now_ns);
+  // NOTE: question is the raw question of the request (see RawQuestion), empty
+  // if it had none.
+  RateLimitAction CheckResponse(
+      const struct sockaddr_in& client, std::span<const uint8_t> question,
+      ResponseCode response_code, int64_t now_ns);
+
+  size_t MemoryBytes() const;
+
+ private:
+  uint32_t Prefix(const struct sockaddr_in& client) const;
+  RateLimitAction Limited();
+
+  const RateLimiterOptions options_;
+  const uint32_t prefix_mask_;
+  std::unique_ptr<TokenBucketSketch> queries_;
+  std::unique_ptr<TokenBucketSketch> responses_;
+  // NOTE: limited responses so far, for picking the ones to slip.
+  std::atomic<uint64_t> limited_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_RATE_LIMITER_H_
@@ -0,0 +1,110 @@
+#include "src/dns/rate_limiter.h"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+
+constexpr int64_t kSecond = 1'000'000'000;
+
+struct sockaddr_in Address(std::string_view ip) {
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, std::string(ip).c_str(), &addr.sin_addr);
+  return addr;
+}
+
+std::vector<uint8_t> WireQuestion(std::string_view qname) {
+  std::vector<uint8_t> raw;
+  size_t start = 0;
+  while (start <= qname.size()) {
+    size_t dot = qname.find('.', start);
+    if (dot == std::string_view::npos) { dot = qname.size(); }
+    raw.push_back(dot - start);
+    raw.insert(raw.end(), qname.begin() + start, qname.begin() + dot);
+    start = dot + 1;
+  }
+  raw.insert(raw.end(), {0, 0, 1, 0, 1});
+  return raw;
+}
+
+TEST(RateLimiterTest, DisabledByDefault) {
+  RateLimiter limiter({});
+  EXPECT_FALSE(limiter.enabled());
+  EXPECT_THAT(limiter.MemoryBytes(), Eq(0));
+  for (int i = 0; i < 100; i++) {
+    EXPECT_THAT(limiter.CheckQuery(Address("192.0.2.1"), kSecond), Eq(RateLimitAction::kSend));
+  }
+}
+
+TEST(RateLimiterTest, LimitsQueriesPerPrefix) {
+  RateLimiterOptions options;
+  options.queries_per_second = 2;
+  options.window_seconds = 1;
+  options.slip = 0;
+  RateLimiter limiter(options);
+  EXPECT_TRUE(limiter.enabled());
+
+  EXPECT_THAT(limiter.CheckQuery(Address("192.0.2.1"), kSecond), Eq(RateLimitAction::kSend));
+  // NOTE: the same /24.
+  EXPECT_THAT(limiter.CheckQuery(Address("192.0.2.200"), kSecond), Eq(RateLimitAction::kSend));
+  EXPECT_THAT(limiter.CheckQuery(Address("192.0.2.3"), kSecond), Eq(RateLimitAction::kDrop));
+  EXPECT_THAT(limiter.CheckQuery(Address("198.51.100.1"), kSecond), Eq(RateLimitAction::kSend));
+  EXPECT_THAT(limiter.CheckQuery(Address("192.0.2.3"), 2 * kSecond), Eq(RateLimitAction::kSend));
+}
+
+TEST(RateLimiterTest, LimitsIdenticalResponses) {
+  RateLimiterOptions options;
+  options.responses_per_second = 1;
+  options.window_seconds = 1;
+  options.slip = 0;
+  RateLimiter limiter(options);
+  const struct sockaddr_in client = Address("192.0.2.1");
+  const std::vector<uint8_t> question = WireQuestion("www.example.com");
+
+  EXPECT_THAT(limiter.CheckResponse(client, question, ResponseCode::NO_ERROR, kSecond),
+      Eq(RateLimitAction::kSend));
+  EXPECT_THAT(limiter.CheckResponse(client, question, ResponseCode::NO_ERROR, kSecond),
+      Eq(RateLimitAction::kDrop));
+  // NOTE: the case of the name doesn't matter.
+  EXPECT_THAT(limiter.CheckResponse(
+        client, WireQuestion("WWW.example.com"), ResponseCode::NO_ERROR, kSecond),
+      Eq(RateLimitAction::kDrop));
+  // NOTE: other responses to the same client are limited separately.
+  EXPECT_THAT(limiter.CheckResponse(
+        client, WireQuestion("mail.example.com"), ResponseCode::NO_ERROR, kSecond),
+      Eq(RateLimitAction::kSend));
+  EXPECT_THAT(limiter.CheckResponse(client, question, ResponseCode::NX_DOMAIN, kSecond),
+      Eq(RateLimitAction::kSend));
+  EXPECT_THAT(limiter.CheckResponse(
+        Address("203.0.113.1"), question, ResponseCode::NO_ERROR, kSecond),
+      Eq(RateLimitAction::kSend));
+}
+
+TEST(RateLimiterTest, SlipsOneInEverySlipLimitedResponses) {
+  RateLimiterOptions options;
+  options.queries_per_second = 1;
+  options.window_seconds = 1;
+  options.slip = 3;
+  RateLimiter limiter(options);
+  const struct sockaddr_in client = Address("192.0.2.1");
+  EXPECT_THAT(limiter.CheckQuery(client, kSecond), Eq(RateLimitAction::kSend));
+  for (int i = 1; i <= 9; i++) {
+    EXPECT_THAT(limiter.CheckQuery(client, kSecond),
+        Eq(i % 3 == 0 ? RateLimitAction::kSlip : RateLimitAction::kDrop)) << i;
+  }
+}
+
+} // namespace
+} // tiny_dns
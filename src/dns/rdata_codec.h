@@ -0,0 +1,375 @@
+#ifndef SRC_DNS_RDATA_CODEC_H_
+#define SRC_DNS_RDATA_CODEC_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "src/common/status_macros.h"
+#include "src/dns/dns_packet.h"
+
+// Table-driven encoding / decoding of record data (RDATA).
+//
+// The wire layout of each Record::Data type is declared once below, as a list
+// of field descriptors in an RdataSchema specialization. Decode, encode, copy
+// and debug routines are generated from the schemas, and collected into a
+// dispatch table indexed by QueryType. To support a new record type, add its
+// struct to Record::Data, its value to QueryType, and a schema here.
+
+namespace tiny_dns {
+
+enum class FieldKind : uint8_t {
+  kU16,
+  kU32,
+  kName,
+  kIpv4,
+  kIpv6,
+  // NOTE: the remainder of the RDATA, must be the last field.
+  kOpaque,
+};
+
+template <FieldKind Kind> struct FieldStorage;
+template <> struct FieldStorage<FieldKind::kU16> { using type = uint16_t; };
+template <> struct FieldStorage<FieldKind::kU32> { using type = uint32_t; };
+template <> struct FieldStorage<FieldKind::kName> { using type = std::pmr::string; };
+template <> struct FieldStorage<FieldKind::kIpv4> { using type = std::array<uint8_t, 4>; };
+template <> struct FieldStorage<FieldKind::kIpv6> { using type = std::array<uint16_t, 8>; };
+template <> struct FieldStorage<FieldKind::kOpaque> { using type = std::pmr::vector<uint8_t>; };
+
+template <typename M> struct MemberPointerTraits;
+template <typename C, typename T> struct MemberPointerTraits<T C::*> {
+  using Class = C;
+  using Type = T;
+};
+
+template <auto Member, FieldKind Kind>
+struct Field {
+  using Class = typename MemberPointerTraits<decltype(Member)>::Class;
+  static_assert(std::is_same_v<
+      typename MemberPointerTraits<decltype(Member)>::Type,
+      typename FieldStorage<Kind>::type>,
+      "Field kind does not match the member's type.");
+  static constexpr auto kMember = Member;
+  static constexpr FieldKind kKind = Kind;
+
+  std::string_view name;
+};
+
+template <typename T> struct RdataSchema;
+
+template <> struct RdataSchema<Record::UNKNOWN> {
+  static constexpr QueryType kType = QueryType::UNKNOWN;
+  static constexpr std::string_view kName = "UNKNOWN";
+  static constexpr bool kCompressNames = false;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::UNKNOWN::bytes, FieldKind::kOpaque>{"bytes"});
+};
+
+template <> struct RdataSchema<Record::A> {
+  static constexpr QueryType kType = QueryType::A;
+  static constexpr std::string_view kName = "A";
+  static constexpr bool kCompressNames = false;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::A::ip_address, FieldKind::kIpv4>{"ip_address"});
+};
+
+template <> struct RdataSchema<Record::NS> {
+  static constexpr QueryType kType = QueryType::NS;
+  static constexpr std::string_view kName = "NS";
+  static constexpr bool kCompressNames = true;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::NS::host, FieldKind::kName>{"host"});
+};
+
+template <> struct RdataSchema<Record::CNAME> {
+  static constexpr QueryType kType = QueryType::CNAME;
+  static constexpr std::string_view kName = "CNAME";
+  static constexpr bool kCompressNames = true;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::CNAME::host, FieldKind::kName>{"host"});
+};
+
+template <> struct RdataSchema<Record::MX> {
+  static constexpr QueryType kType = QueryType::MX;
+  static constexpr std::string_view kName = "MX";
+  static constexpr bool kCompressNames = true;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::MX::priority, FieldKind::kU16>{"priority"},
+      Field<&Record::MX::host, FieldKind::kName>{"host"});
+};
+
+template <> struct RdataSchema<Record::AAAA> {
+  static constexpr QueryType kType = QueryType::AAAA;
+  static constexpr std::string_view kName = "AAAA";
+  static constexpr bool kCompressNames = false;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::AAAA::ip_address, FieldKind::kIpv6>{"ip_address"});
+};
+
+// NOTE: the target is encoded as a (compressed) name, as it always has been
+// here, rather than as the opaque string RFC 7553 describes.
+template <> struct RdataSchema<Record::URI> {
+  static constexpr QueryType kType = QueryType::URI;
+  static constexpr std::string_view kName = "URI";
+  static constexpr bool kCompressNames = true;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::URI::priority, FieldKind::kU16>{"priority"},
+      Field<&Record::URI::weight, FieldKind::kU16>{"weight"},
+      Field<&Record::URI::target, FieldKind::kName>{"target"});
+};
+
+template <> struct RdataSchema<Record::SOA> {
+  static constexpr QueryType kType = QueryType::SOA;
+  static constexpr std::string_view kName = "SOA";
+  static constexpr bool kCompressNames = true;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::SOA::mname, FieldKind::kName>{"mname"},
+      Field<&Record::SOA::rname, FieldKind::kName>{"rname"},
+      Field<&Record::SOA::serial, FieldKind::kU32>{"serial"},
+      Field<&Record::SOA::refresh, FieldKind::kU32>{"refresh"},
+      Field<&Record::SOA::retry, FieldKind::kU32>{"retry"},
+      Field<&Record::SOA::expire, FieldKind::kU32>{"expire"},
+      Field<&Record::SOA::minimum, FieldKind::kU32>{"minimum"});
+};
+
+template <> struct RdataSchema<Record::PTR> {
+  static constexpr QueryType kType = QueryType::PTR;
+  static constexpr std::string_view kName = "PTR";
+  static constexpr bool kCompressNames = true;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::PTR::host, FieldKind::kName>{"host"});
+};
+
+template <> struct RdataSchema<Record::TXT> {
+  static constexpr QueryType kType = QueryType::TXT;
+  static constexpr std::string_view kName = "TXT";
+  static constexpr bool kCompressNames = false;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::TXT::bytes, FieldKind::kOpaque>{"bytes"});
+};
+
+// NOTE: RFC 2782, the target must not be compressed.
+template <> struct RdataSchema<Record::SRV> {
+  static constexpr QueryType kType = QueryType::SRV;
+  static constexpr std::string_view kName = "SRV";
+  static constexpr bool kCompressNames = false;
+  static constexpr auto kFields = std::make_tuple(
+      Field<&Record::SRV::priority, FieldKind::kU16>{"priority"},
+      Field<&Record::SRV::weight, FieldKind::kU16>{"weight"},
+      Field<&Record::SRV::port, FieldKind::kU16>{"port"},
+      Field<&Record::SRV::target, FieldKind::kName>{"target"});
+};
+
+namespace rdata_internal {
+
+template <typename F>
+absl::Status DecodeField(
+    typename F::Class& rdata, BufferReader& reader, size_t rdata_end,
+    std::pmr::memory_resource* resource) {
+  auto& value = rdata.*F::kMember;
+  if constexpr (F::kKind == FieldKind::kU16) {
+    ASSIGN_OR_RETURN(value, reader.ReadU16());
+  } else if constexpr (F::kKind == FieldKind::kU32) {
+    ASSIGN_OR_RETURN(value, reader.ReadU32());
+  } else if constexpr (F::kKind == FieldKind::kName) {
+    ASSIGN_OR_RETURN(value, reader.ReadQName(resource));
+  } else if constexpr (F::kKind == FieldKind::kIpv4) {
+    RETURN_IF_ERROR(reader.ReadBytes(value.data(), value.size()));
+  } else if constexpr (F::kKind == FieldKind::kIpv6) {
+    for (uint16_t& part : value) {
+      ASSIGN_OR_RETURN(part, reader.ReadU16());
+    }
+  } else if constexpr (F::kKind == FieldKind::kOpaque) {
+    if (reader.Position() > rdata_end) {
+      return absl::InvalidArgumentError("RDATA overruns its declared length.");
+    }
+    value.resize(rdata_end - reader.Position());
+    RETURN_IF_ERROR(reader.ReadBytes(value.data(), value.size()));
+  }
+  return absl::OkStatus();
+}
+
+template <typename F, bool kCompressNames>
+absl::Status EncodeField(const typename F::Class& rdata, BufferWriter& writer) {
+  const auto& value = rdata.*F::kMember;
+  if constexpr (F::kKind == FieldKind::kU16) {
+    return writer.WriteU16(value);
+  } else if constexpr (F::kKind == FieldKind::kU32) {
+    return writer.WriteU32(value);
+  } else if constexpr (F::kKind == FieldKind::kName) {
+    return writer.WriteQName(value, kCompressNames).status();
+  } else if constexpr (F::kKind == FieldKind::kIpv4) {
+    return writer.WriteBytes(value.data(), value.size());
+  } else if constexpr (F::kKind == FieldKind::kIpv6) {
+    for (const uint16_t part : value) {
+      RETURN_IF_ERROR(writer.WriteU16(part));
+    }
+    return absl::OkStatus();
+  } else if constexpr (F::kKind == FieldKind::kOpaque) {
+    return writer.WriteBytes(value.data(), value.size());
+  }
+}
+
+template <typename F>
+void DebugField(const typename F::Class& rdata, std::string_view name, std::string& out) {
+  const auto& value = rdata.*F::kMember;
+  if constexpr (F::kKind == FieldKind::kIpv4) {
+    absl::StrAppend(&out, name, ": ", value[0], ".", value[1], ".", value[2], ".", value[3], " ");
+  } else if constexpr (F::kKind == FieldKind::kIpv6) {
+    absl::StrAppendFormat(
+        &out, "%s: %0x:%0x:%0x:%0x:%0x:%0x:%0x:%0x ", name,
+        value[0], value[1], value[2], value[3], value[4], value[5], value[6], value[7]);
+  } else if constexpr (F::kKind == FieldKind::kOpaque) {
+    absl::StrAppend(&out, name, " length: ", value.size(), " ");
+  } else {
+    absl::StrAppend(&out, name, ": ", value, " ");
+  }
+}
+
+// NOTE: containers can only be given an allocator on construction, so rebuild
+// them in place. Everything else is left value-initialized.
+template <typename T>
+T EmptyRdata(const Record::allocator_type& alloc) {
+  T rdata = {};
+  std::apply([&](const auto&... field) {
+    ([&]<typename F>(const F&) {
+      if constexpr (F::kKind == FieldKind::kName || F::kKind == FieldKind::kOpaque) {
+        auto* value = &(rdata.*F::kMember);
+        std::destroy_at(value);
+        std::construct_at(value, alloc);
+      }
+    }(field), ...);
+  }, RdataSchema<T>::kFields);
+  return rdata;
+}
+
+template <typename T>
+absl::Status Decode(
+    BufferReader& reader, uint16_t rdlength,
+    std::pmr::memory_resource* resource, Record::Data& data) {
+  if (reader.Remaining() < rdlength) {
+    return absl::InvalidArgumentError(
+        "Malformed packet detected! RDATA length exceeds the buffer.");
+  }
+  const size_t rdata_end = reader.Position() + rdlength;
+  T rdata = EmptyRdata<T>(resource);
+  absl::Status status = absl::OkStatus();
+  std::apply([&]<typename... F>(const F&...) {
+    (... && (status = DecodeField<F>(rdata, reader, rdata_end, resource)).ok());
+  }, RdataSchema<T>::kFields);
+  RETURN_IF_ERROR(status);
+  if (reader.Position() != rdata_end) {
+    return absl::InvalidArgumentError(absl::StrCat(
+          "Unexpected RDATA length for type ", RdataSchema<T>::kName, ": ", rdlength));
+  }
+  // NOTE: emplace rather than assign, assignment would not keep the allocator.
+  data.emplace<T>(std::move(rdata));
+  return absl::OkStatus();
+}
+
+template <typename T>
+absl::Status Encode(const Record::Data& data, BufferWriter& writer) {
+  const T& rdata = *std::get_if<T>(&data);
+  const size_t length_pos = writer.Position();
+  RETURN_IF_ERROR(writer.WriteU16(0));
+  absl::Status status = absl::OkStatus();
+  std::apply([&]<typename... F>(const F&...) {
+    (... && (status = EncodeField<F, RdataSchema<T>::kCompressNames>(rdata, writer)).ok());
+  }, RdataSchema<T>::kFields);
+  RETURN_IF_ERROR(status);
+  return writer.PatchU16(length_pos, writer.Position() - length_pos - 2);
+}
+
+template <typename T>
+Record::Data Copy(const Record::Data& data, const Record::allocator_type& alloc) {
+  const T& rdata = *std::get_if<T>(&data);
+  T copy = EmptyRdata<T>(alloc);
+  std::apply([&]<typename... F>(const F&...) {
+    ((copy.*F::kMember = rdata.*F::kMember), ...);
+  }, RdataSchema<T>::kFields);
+  return Record::Data(std::in_place_type<T>, std::move(copy));
+}
+
+template <typename T>
+void Debug(const Record::Data& data, std::string& out) {
+  const T& rdata = *std::get_if<T>(&data);
+  std::apply([&]<typename... F>(const F&... field) {
+    (DebugField<F>(rdata, absl::StrCat(RdataSchema<T>::kName, " ", field.name), out), ...);
+  }, RdataSchema<T>::kFields);
+}
+
+} // namespace rdata_internal
+
+// Generated codec for a single Record::Data alternative.
+struct RdataCodec {
+  QueryType type;
+  std::string_view name;
+  absl::Status (*decode)(
+      BufferReader& reader, uint16_t rdlength,
+      std::pmr::memory_resource* resource, Record::Data& data);
+  absl::Status (*encode)(const Record::Data& data, BufferWriter& writer);
+  Record::Data (*copy)(const Record::Data& data, const Record::allocator_type& alloc);
+  void (*debug)(const Record::Data& data, std::string& out);
+};
+
+template <typename T>
+constexpr RdataCodec MakeRdataCodec() {
+  return RdataCodec {
+    .type = RdataSchema<T>::kType,
+    .name = RdataSchema<T>::kName,
+    .decode = &rdata_internal::Decode<T>,
+    .encode = &rdata_internal::Encode<T>,
+    .copy = &rdata_internal::Copy<T>,
+    .debug = &rdata_internal::Debug<T>,
+  };
+}
+
+template <size_t... I>
+constexpr std::array<RdataCodec, sizeof...(I)> MakeRdataCodecs(std::index_sequence<I...>) {
+  return {{ MakeRdataCodec<std::variant_alternative_t<I, Record::Data>>()... }};
+}
+
+// NOTE: indexed by Record::Data::index().
+inline constexpr std::array<RdataCodec, std::variant_size_v<Record::Data>> kRdataCodecs =
+  MakeRdataCodecs(std::make_index_sequence<std::variant_size_v<Record::Data>>());
+static_assert(kRdataCodecs[0].type == QueryType::UNKNOWN,
+              "UNKNOWN must be the first (default) alternative.");
+
+// NOTE: every type with a codec fits in the dense table. Types beyond it, or
+// without a codec, map to UNKNOWN (index 0).
+inline constexpr size_t kMaxDenseQueryType = 256;
+inline constexpr std::array<uint8_t, kMaxDenseQueryType + 1> kRdataCodecIndex = [] {
+  std::array<uint8_t, kMaxDenseQueryType + 1> index = {};
+  for (size_t i = 0; i < kRdataCodecs.size(); i++) {
+    const size_t type = static_cast<uint16_t>(kRdataCodecs[i].type);
+    if (type > kMaxDenseQueryType) { throw "QueryType does not fit the codec table."; }
+    if (i != 0 && index[type] != 0) { throw "QueryType has more than one codec."; }
+    index[type] = i;
+  }
+  return index;
+}();
+
+inline size_t RdataCodecIndex(QueryType type) {
+  const uint16_t raw = static_cast<uint16_t>(type);
+  return raw <= kMaxDenseQueryType ? kRdataCodecIndex[raw] : 0;
+}
+
+inline const RdataCodec& RdataCodecFor(QueryType type) {
+  return kRdataCodecs[RdataCodecIndex(type)];
+}
+
+} // tiny_dns
+
+#endif // SRC_DNS_RDATA_CODEC_H_
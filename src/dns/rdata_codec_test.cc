@@ -0,0 +1,226 @@
+#include "src/dns/rdata_codec.h"
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status_matchers.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/legacy_record_codec.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::absl_testing::StatusIs;
+using ::testing::ContainerEq;
+
+// NOTE: names are drawn from a small vocabulary, so that records regularly
+// share suffixes and exercise name compression.
+std::string RandomName(std::mt19937& rng) {
+  static const std::array<std::string, 6> kLabels = {
+    "www", "mail", "svc", "internal", "example", "a-much-longer-label" };
+  std::uniform_int_distribution<size_t> num_labels(1, 4);
+  std::uniform_int_distribution<size_t> label(0, kLabels.size() - 1);
+  std::string name;
+  for (size_t i = num_labels(rng); i > 0; i--) {
+    if (!name.empty()) { name += '.'; }
+    name += kLabels[label(rng)];
+  }
+  return name;
+}
+
+std::pmr::vector<uint8_t> RandomBytes(std::mt19937& rng) {
+  std::uniform_int_distribution<size_t> length(0, 32);
+  std::pmr::vector<uint8_t> bytes(length(rng));
+  for (uint8_t& byte : bytes) { byte = rng(); }
+  return bytes;
+}
+
+// NOTE: only types the legacy codec understands.
+Record RandomLegacyRecord(std::mt19937& rng) {
+  Record record = {};
+  record.qname = RandomName(rng);
+  record.ttl = rng();
+  record.dns_class = 1;
+  switch (std::uniform_int_distribution<int>(0, 6)(rng)) {
+    case 0: {
+      record.qtype = QueryType::A;
+      record.data = Record::A { .ip_address = {
+        (uint8_t) rng(), (uint8_t) rng(), (uint8_t) rng(), (uint8_t) rng() } };
+    } break;
+    case 1: {
+      record.qtype = QueryType::NS;
+      record.data = Record::NS { .host = std::pmr::string(RandomName(rng)) };
+    } break;
+    case 2: {
+      record.qtype = QueryType::CNAME;
+      record.data = Record::CNAME { .host = std::pmr::string(RandomName(rng)) };
+    } break;
+    case 3: {
+      record.qtype = QueryType::MX;
+      record.data = Record::MX {
+        .priority = (uint16_t) rng(), .host = std::pmr::string(RandomName(rng)) };
+    } break;
+    case 4: {
+      record.qtype = QueryType::AAAA;
+      Record::AAAA aaaa = {};
+      for (uint16_t& part : aaaa.ip_address) { part = rng(); }
+      record.data = aaaa;
+    } break;
+    case 5: {
+      record.qtype = QueryType::URI;
+      record.data = Record::URI {
+        .priority = (uint16_t) rng(), .weight = (uint16_t) rng(),
+        .target = std::pmr::string(RandomName(rng)) };
+    } break;
+    default: {
+      // NOTE: a type neither codec knows about.
+      record.qtype = QueryTypeFromShort(4000 + (rng() % 100));
+      record.data = Record::UNKNOWN { .bytes = RandomBytes(rng) };
+    } break;
+  }
+  return record;
+}
+
+void ExpectRecordEq(const Record& actual, const Record& expected) {
+  EXPECT_EQ(actual.qname, expected.qname);
+  EXPECT_EQ(actual.qtype, expected.qtype);
+  EXPECT_EQ(actual.dns_class, expected.dns_class);
+  EXPECT_EQ(actual.ttl, expected.ttl);
+  EXPECT_TRUE(actual.data == expected.data) << actual.DebugString() << " vs " << expected.DebugString();
+}
+
+std::vector<uint8_t> ToVector(std::span<const uint8_t> bytes) {
+  return std::vector<uint8_t>(bytes.begin(), bytes.end());
+}
+
+TEST(RdataCodecTest, ByteIdenticalToLegacyCodec) {
+  std::mt19937 rng(1234);
+  for (size_t iteration = 0; iteration < 1000; iteration++) {
+    std::vector<Record> records;
+    std::array<uint8_t, 512> legacy_bytes = {};
+    std::array<uint8_t, 512> bytes = {};
+    BufferWriter legacy_writer(legacy_bytes);
+    BufferWriter writer(bytes);
+    // NOTE: several records per buffer, until it (almost) fills up.
+    while (writer.Position() < 300) {
+      Record record = RandomLegacyRecord(rng);
+      ASSERT_TRUE(LegacyRecordToBytes(record, legacy_writer).ok());
+      ASSERT_TRUE(record.ToBytes(writer).ok());
+      records.push_back(std::move(record));
+    }
+    ASSERT_THAT(ToVector(writer.Written()), ContainerEq(ToVector(legacy_writer.Written())));
+
+    BufferReader legacy_reader(bytes);
+    BufferReader reader(bytes);
+    for (const Record& expected : records) {
+      absl::StatusOr<Record> legacy_record = LegacyRecordFromBytes(legacy_reader);
+      absl::StatusOr<Record> record = Record::FromBytes(reader);
+      ASSERT_TRUE(legacy_record.ok());
+      ASSERT_TRUE(record.ok());
+      ExpectRecordEq(*record, expected);
+      ExpectRecordEq(*record, *legacy_record);
+    }
+  }
+}
+
+TEST(RdataCodecTest, NewTypesRoundTrip) {
+  std::vector<Record> records;
+  {
+    Record record = {};
+    record.qname = "example.com";
+    record.qtype = QueryType::SOA;
+    record.ttl = 3600;
+    record.data = Record::SOA {
+      .mname = "ns1.example.com", .rname = "hostmaster.example.com",
+      .serial = 2024010101, .refresh = 7200, .retry = 3600,
+      .expire = 1209600, .minimum = 300 };
+    records.push_back(std::move(record));
+  }
+  {
+    Record record = {};
+    record.qname = "1.0.0.10.in-addr.arpa";
+    record.qtype = QueryType::PTR;
+    record.ttl = 60;
+    record.data = Record::PTR { .host = "svc.example.com" };
+    records.push_back(std::move(record));
+  }
+  {
+    Record record = {};
+    record.qname = "example.com";
+    record.qtype = QueryType::TXT;
+    record.ttl = 60;
+    record.data = Record::TXT { .bytes = { 5, 'h', 'e', 'l', 'l', 'o' } };
+    records.push_back(std::move(record));
+  }
+  {
+    Record record = {};
+    record.qname = "_grpc._tcp.example.com";
+    record.qtype = QueryType::SRV;
+    record.ttl = 60;
+    record.data = Record::SRV {
+      .priority = 10, .weight = 5, .port = 4000, .target = "svc.example.com" };
+    records.push_back(std::move(record));
+  }
+
+  std::array<uint8_t, 512> bytes = {};
+  BufferWriter writer(bytes);
+  for (const Record& record : records) {
+    ASSERT_TRUE(record.ToBytes(writer).ok());
+  }
+  BufferReader reader(bytes);
+  for (const Record& expected : records) {
+    absl::StatusOr<Record> record = Record::FromBytes(reader);
+    ASSERT_TRUE(record.ok());
+    ExpectRecordEq(*record, expected);
+  }
+}
+
+TEST(RdataCodecTest, SrvTargetIsNotCompressed) {
+  std::array<uint8_t, 512> bytes = {};
+  BufferWriter writer(bytes);
+  ASSERT_TRUE(writer.WriteQName("svc.example").ok());
+  Record record = {};
+  record.qname = "svc.example";
+  record.qtype = QueryType::SRV;
+  record.data = Record::SRV { .priority = 1, .weight = 2, .port = 3, .target = "svc.example" };
+  const size_t rdata_pos = writer.Position() + 2 + 2 + 2 + 4;
+  ASSERT_TRUE(record.ToBytes(writer).ok());
+  // NOTE: rdlength, then 3 u16s, then the full 13 byte name.
+  EXPECT_EQ(bytes[rdata_pos + 1], 6 + 13);
+  EXPECT_EQ(writer.Position(), rdata_pos + 2 + 6 + 13);
+}
+
+TEST(RdataCodecTest, RdataLengthMismatchIsRejected) {
+  std::array<uint8_t, 512> bytes = {
+    0,
+    0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x10,
+    0x00, 0x05, 10, 0, 0, 1, 0 };
+  BufferReader reader(bytes);
+  EXPECT_THAT(Record::FromBytes(reader), StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(RdataCodecTest, MismatchedDataIsAnError) {
+  std::array<uint8_t, 512> bytes = {};
+  BufferWriter writer(bytes);
+  Record record = {};
+  record.qname = "example";
+  record.qtype = QueryType::MX;
+  record.data = Record::A { .ip_address = {1, 2, 3, 4} };
+  EXPECT_THAT(record.ToBytes(writer), StatusIs(absl::StatusCode::kInternal));
+}
+
+TEST(RdataCodecTest, UnknownTypesAreNamedByNumber) {
+  EXPECT_EQ(QueryTypeToString(QueryType::SRV), "SRV");
+  EXPECT_EQ(QueryTypeToString(QueryTypeFromShort(65)), "TYPE65");
+  EXPECT_EQ(QueryTypeToString(QueryTypeFromShort(4000)), "TYPE4000");
+}
+
+} // namespace
+} // tiny_dns
@@ -1,105 +1,445 @@
 #include "src/dns/record_store.h"
 
+#include <algorithm>
 #include <chrono>
 #include <ctime>
-#include <thread>
+#include <functional>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "absl/log/log.h"
-#include "absl/strings/str_join.h"
+#include "src/common/cpu_affinity.h"
+#include "src/common/parallel_for.h"
 #include "src/dns/dns_packet.h"
+#include "src/dns/name_trie.h"
 
 namespace tiny_dns {
 
-void RemoveRecordAfterTtl(RecordStore* store, const Record record) {
-  LOG(INFO) << "Scheduling removal of: " << record.DebugString()
-    << " in: " << record.ttl << "s.";
-  std::this_thread::sleep_for(std::chrono::seconds(record.ttl));
-  store->Remove(record);
+std::unique_lock<std::mutex> RecordStoreShard::Lock() {
+  std::unique_lock lock(mutex_, std::try_to_lock);
+  if (lock.owns_lock()) { return lock; }
+  const auto start = std::chrono::steady_clock::now();
+  lock.lock();
+  const auto waited = std::chrono::steady_clock::now() - start;
+  lock_wait_ns_.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count(),
+      std::memory_order_relaxed);
+  return lock;
 }
 
 bool RecordStoreShard::InsertOrUpdate(Record to_insert) {
-  std::scoped_lock lock(mutex_);
-  for (size_t i = 0; i < stored_records_.size(); i++) {
-    const Record& record = stored_records_[i].record;
+  const time_t now = time(nullptr);
+  const time_t expires_at = now + to_insert.ttl;
+  std::unique_lock lock = Lock();
+  return InsertOrUpdateLocked(std::move(to_insert), expires_at);
+}
+
+void RecordStoreShard::InsertOrUpdateBatch(
+    std::span<Record> records, std::span<const size_t> indices, std::vector<bool>& updated) {
+  const time_t now = time(nullptr);
+  for (size_t begin = 0; begin < indices.size(); begin += kMaxBatchRecordsPerLock) {
+    const std::span<const size_t> chunk =
+      indices.subspan(begin, std::min(kMaxBatchRecordsPerLock, indices.size() - begin));
+    std::unique_lock lock = Lock();
+    for (const size_t i : chunk) {
+      const time_t expires_at = now + records[i].ttl;
+      updated[i] = InsertOrUpdateLocked(std::move(records[i]), expires_at);
+    }
+  }
+}
+
+void RecordStoreShard::InsertStatic(std::span<Record> records, std::span<const size_t> indices) {
+  std::vector<const std::string*> new_names;
+  std::unique_lock lock = Lock();
+  // NOTE: so the keys new_names points to stay put.
+  records_by_name_.reserve(records_by_name_.size() + indices.size());
+  for (const size_t i : indices) {
+    const std::string* new_name = nullptr;
+    InsertOrUpdateLocked(std::move(records[i]), kNeverExpires, &new_name);
+    if (new_name != nullptr) { new_names.push_back(new_name); }
+  }
+  IndexNames(new_names);
+}
+
+bool RecordStoreShard::InsertOrUpdateLocked(
+    Record to_insert, time_t expires_at, const std::string** new_static_name) {
+  auto [it, inserted] = records_by_name_.try_emplace(std::string_view(to_insert.qname));
+  StoredName& stored_name = it->second;
+  const auto count_static = [&] {
+    if (expires_at != kNeverExpires) { return; }
+    if (stored_name.static_records++ == 0 && new_static_name != nullptr) {
+      *new_static_name = &it->first;
+    }
+  };
+  const auto queue_expiry = [&] {
+    if (expires_at >= stored_name.next_expiry) { return; }
+    stored_name.next_expiry = expires_at;
+    expiry_queue_.emplace_back(expires_at, it->first);
+    std::push_heap(expiry_queue_.begin(), expiry_queue_.end(), std::greater<>());
+    pending_expirations_.store(expiry_queue_.size(), std::memory_order_relaxed);
+  };
+  std::vector<StoredRecord>& stored_records = stored_name.records;
+  for (StoredRecord& stored_record : stored_records) {
+    const Record& record = stored_record.record;
     if (to_insert.qtype != record.qtype) { continue; }
-    if (to_insert.qname != record.qname) { continue; }
     if (to_insert.data != record.data) { continue; }
 
-    stored_records_[i].record = to_insert;
+    // NOTE: a static record stays as loaded, e.g. an upstream answer cached
+    // for a zone's name doesn't make it expire or change its ttl.
+    if (stored_record.expires_at == kNeverExpires) { return true; }
+    stored_record.expires_at = expires_at;
+    stored_record.record = std::move(to_insert);
+    count_static();
+    queue_expiry();
     return true;
   }
-  stored_records_.push_back(StoredRecord {
-      .ttl_check = time(nullptr),
-      .record = to_insert,
+  stored_records.push_back(StoredRecord {
+      .expires_at = expires_at,
+      .record = std::move(to_insert),
       });
+  size_.fetch_add(1, std::memory_order_relaxed);
+  count_static();
+  queue_expiry();
   return false;
 }
 
+void RecordStoreShard::IndexNames(std::span<const std::string* const> names) {
+  if (names_ == nullptr || names.empty()) { return; }
+  std::unique_lock lock(names_->mutex);
+  for (const std::string* name : names) { names_->trie.Insert(*name); }
+  names_->wildcards.store(names_->trie.wildcard_count(), std::memory_order_relaxed);
+}
+
+void RecordStoreShard::UnindexName(std::string_view name) {
+  if (names_ == nullptr) { return; }
+  std::unique_lock lock(names_->mutex);
+  names_->trie.Erase(name);
+  names_->wildcards.store(names_->trie.wildcard_count(), std::memory_order_relaxed);
+}
+
 bool RecordStoreShard::Remove(const Record& to_remove) {
-  std::scoped_lock lock(mutex_);
-  for (size_t i = 0; i < stored_records_.size(); i++) {
-    const Record& record = stored_records_[i].record;
+  std::unique_lock lock = Lock();
+  auto it = records_by_name_.find(std::string_view(to_remove.qname));
+  if (it == records_by_name_.end()) { return false; }
+  std::vector<StoredRecord>& stored_records = it->second.records;
+  for (size_t i = 0; i < stored_records.size(); i++) {
+    const Record& record = stored_records[i].record;
     if (to_remove.qtype != record.qtype) { continue; }
-    if (to_remove.qname != record.qname) { continue; }
     if (to_remove.data != record.data) { continue; }
 
-    stored_records_[i] = stored_records_.back();
-    stored_records_.pop_back();
+    if (stored_records[i].expires_at == kNeverExpires && --it->second.static_records == 0) {
+      UnindexName(it->first);
+    }
+    stored_records[i] = std::move(stored_records.back());
+    stored_records.pop_back();
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    if (stored_records.empty()) { records_by_name_.erase(it); }
     return true;
   }
   return false;
 }
 
-std::vector<Record> RecordStoreShard::Query(const Question& question) {
-  std::scoped_lock lock(mutex_);
-  std::vector<Record> hits;
-  time_t current_time = time(nullptr);
-  for (StoredRecord& stored_record : stored_records_) {
-    Record& record = stored_record.record;
+std::pmr::vector<Record> RecordStoreShard::Query(
+    const Question& question, std::pmr::memory_resource* resource) {
+  std::pmr::vector<Record> hits(resource);
+  const time_t current_time = time(nullptr);
+  std::unique_lock lock = Lock();
+  QueryLocked(question, current_time, hits);
+  return hits;
+}
+
+std::pmr::vector<Record> RecordStoreShard::QueryStatic(
+    const Question& question, std::pmr::memory_resource* resource) {
+  std::pmr::vector<Record> hits(resource);
+  std::unique_lock lock = Lock();
+  QueryLocked(question, 0, hits, /*static_only=*/true);
+  return hits;
+}
+
+void RecordStoreShard::QueryBatch(
+    std::span<const Question> questions, std::span<const size_t> indices,
+    std::vector<std::pmr::vector<Record>>& hits) {
+  const time_t current_time = time(nullptr);
+  std::unique_lock lock = Lock();
+  for (const size_t i : indices) { QueryLocked(questions[i], current_time, hits[i]); }
+}
+
+void RecordStoreShard::QueryLocked(
+    const Question& question, time_t current_time, std::pmr::vector<Record>& hits,
+    bool static_only) {
+  auto it = records_by_name_.find(std::string_view(question.qname));
+  if (it == records_by_name_.end()) { return; }
+  if (static_only && it->second.static_records == 0) { return; }
+  for (const StoredRecord& stored_record : it->second.records) {
+    const Record& record = stored_record.record;
     if (question.qtype != record.qtype && record.qtype != QueryType::CNAME) { continue; }
-    if (question.qname != record.qname) { continue; }
+    if (static_only && stored_record.expires_at != kNeverExpires) { continue; }
+    // NOTE: assume the expiry thread will take care of removal
+    if (current_time > stored_record.expires_at) { continue; }
+    Record& hit = hits.emplace_back(record);
+    if (stored_record.expires_at != kNeverExpires) {
+      hit.ttl = stored_record.expires_at - current_time;
+    }
+  }
+}
+
+size_t RecordStoreShard::RemoveExpired(time_t now) {
+  size_t removed = 0;
+  bool due = true;
+  while (due) {
+    std::unique_lock lock = Lock();
+    for (size_t visited = 0; visited < kMaxExpiredNamesPerLock; visited++) {
+      // NOTE: records expire once now is past expires_at, see QueryLocked.
+      due = !expiry_queue_.empty() && expiry_queue_.front().first < now;
+      if (!due) { break; }
+      std::pop_heap(expiry_queue_.begin(), expiry_queue_.end(), std::greater<>());
+      auto [queued_at, name] = std::move(expiry_queue_.back());
+      expiry_queue_.pop_back();
 
-    uint16_t ttl_delta = current_time - stored_record.ttl_check;
-    stored_record.ttl_check = current_time;
-    // NOTE: assume removal thread will take care of removal
-    if (ttl_delta > record.ttl) { continue; }
-    record.ttl -= ttl_delta;
-    hits.push_back(record);
+      auto it = records_by_name_.find(name);
+      if (it == records_by_name_.end() || it->second.next_expiry != queued_at) { continue; }
+      StoredName& stored_name = it->second;
+      time_t next_expiry = kNeverExpires;
+      std::erase_if(stored_name.records, [&](const StoredRecord& stored_record) {
+        if (now <= stored_record.expires_at) {
+          next_expiry = std::min(next_expiry, stored_record.expires_at);
+          return false;
+        }
+        VLOG(1) << "Expired record: " << stored_record.record.DebugString();
+        removed++;
+        return true;
+      });
+      // NOTE: static records never expire, so a name left without any had
+      // none, and was never indexed.
+      if (stored_name.records.empty()) {
+        records_by_name_.erase(it);
+        continue;
+      }
+      stored_name.next_expiry = next_expiry;
+      if (next_expiry == kNeverExpires) { continue; }
+      expiry_queue_.emplace_back(next_expiry, std::move(name));
+      std::push_heap(expiry_queue_.begin(), expiry_queue_.end(), std::greater<>());
+    }
+    pending_expirations_.store(expiry_queue_.size(), std::memory_order_relaxed);
+  }
+  size_.fetch_sub(removed, std::memory_order_relaxed);
+  expired_.fetch_add(removed, std::memory_order_relaxed);
+  return removed;
+}
+
+void RecordStoreShard::AddStats(RecordStoreStats& stats) const {
+  stats.size += size_.load(std::memory_order_relaxed);
+  stats.expired += expired_.load(std::memory_order_relaxed);
+  stats.pending_expirations += pending_expirations_.load(std::memory_order_relaxed);
+}
+
+RecordStore::RecordStore(size_t shard_count, std::vector<std::vector<int>> shard_node_cpus) :
+  names_(), shards_(), shard_cpus_(), hasher_(), shard_generations_(), generation_(0),
+  expiry_mutex_(), expiry_cv_(), stopping_(false), expiry_thread_() {
+  // NOTE: at least one shard, or ShardIndex() would divide by zero.
+  shard_count = std::max<size_t>(shard_count, 1);
+  shards_.resize(shard_count);
+  shard_generations_ = std::make_unique<ShardGeneration[]>(shard_count);
+  if (shard_node_cpus.empty()) {
+    for (size_t i = 0; i < shard_count; i++) {
+      shards_[i] = std::make_unique<RecordStoreShard>(&names_);
+    }
+  } else {
+    const size_t nodes = shard_node_cpus.size();
+    shard_cpus_.resize(shard_count);
+    for (size_t i = 0; i < shard_count; i++) { shard_cpus_[i] = shard_node_cpus[i % nodes]; }
+    ParallelFor(nodes, nodes, [&](size_t node) {
+      ScopedCpuAffinity pinned(shard_node_cpus[node]);
+      for (size_t i = node; i < shard_count; i += nodes) {
+        shards_[i] = std::make_unique<RecordStoreShard>(&names_);
+      }
+    });
+  }
+  expiry_thread_ = std::thread(&RecordStore::ExpireRecords, this);
+}
+
+RecordStore::~RecordStore() {
+  {
+    std::scoped_lock lock(expiry_mutex_);
+    stopping_ = true;
+  }
+  expiry_cv_.notify_all();
+  expiry_thread_.join();
+}
+
+size_t RecordStore::ShardIndex(std::string_view qname) const {
+  return hasher_(qname) % shards_.size();
+}
+
+RecordStoreShard& RecordStore::ShardFor(std::string_view qname) {
+  return *shards_[ShardIndex(qname)];
+}
+
+void RecordStore::ExpireRecords() {
+  std::unique_lock lock(expiry_mutex_);
+  while (!expiry_cv_.wait_for(lock, std::chrono::seconds(1), [this] { return stopping_; })) {
+    lock.unlock();
+    const time_t now = time(nullptr);
+    size_t removed = 0;
+    for (std::unique_ptr<RecordStoreShard>& shard : shards_) {
+      removed += shard->RemoveExpired(now);
+    }
+    if (removed > 0) { LOG(INFO) << "Removed " << removed << " expired records."; }
+    lock.lock();
   }
-  return hits;
 }
 
 bool RecordStore::InsertOrUpdate(Record to_insert) {
-  const size_t hash = hasher_(to_insert.qname);
-  bool updated = shards_[hash % kShardCount].InsertOrUpdate(to_insert);
-  if (updated) { LOG(INFO) << "Updated record: " << to_insert.DebugString(); }
-  else { LOG(INFO) << "Inserted record: " << to_insert.DebugString(); }
-  // NOTE: update may lower the ttl, spawn another thread to attempt removal.
-  // TODO: should probably update the live thread instead?
-  auto remove_after_ttl = std::thread(RemoveRecordAfterTtl, this, to_insert);
-  remove_after_ttl.detach();
+  // NOTE: only build the debug strings when asked for, these come in bulk.
+  VLOG(1) << "Inserting or updating record: " << to_insert.DebugString();
+  const size_t shard = ShardIndex(to_insert.qname);
+  bool updated = shards_[shard]->InsertOrUpdate(std::move(to_insert));
+  BumpGeneration(shard);
+  VLOG(1) << (updated ? "Updated" : "Inserted") << " record.";
+  return updated;
+}
+
+std::vector<size_t> RecordStore::GroupByShard(
+    size_t count, absl::FunctionRef<std::string_view(size_t)> qname,
+    std::vector<size_t>& shard_end) const {
+  // NOTE: a counting sort of the indices by shard, so each shard's entries
+  // are one contiguous run of indices.
+  std::vector<size_t> shard_of(count);
+  shard_end.assign(shards_.size() + 1, 0);
+  for (size_t i = 0; i < count; i++) {
+    shard_of[i] = ShardIndex(qname(i));
+    shard_end[shard_of[i] + 1]++;
+  }
+  for (size_t shard = 0; shard < shards_.size(); shard++) {
+    shard_end[shard + 1] += shard_end[shard];
+  }
+  std::vector<size_t> indices(count);
+  std::vector<size_t> next = shard_end;
+  for (size_t i = 0; i < count; i++) { indices[next[shard_of[i]]++] = i; }
+  return indices;
+}
+
+std::vector<bool> RecordStore::InsertOrUpdateBatch(std::vector<Record> records) {
+  std::vector<size_t> shard_end;
+  const std::vector<size_t> indices = GroupByShard(
+      records.size(), [&](size_t i) { return std::string_view(records[i].qname); }, shard_end);
+
+  std::vector<bool> updated(records.size(), false);
+  for (size_t shard = 0; shard < shards_.size(); shard++) {
+    const std::span<const size_t> shard_indices(
+        indices.data() + shard_end[shard], shard_end[shard + 1] - shard_end[shard]);
+    if (shard_indices.empty()) { continue; }
+    shards_[shard]->InsertOrUpdateBatch(records, shard_indices, updated);
+    BumpGeneration(shard);
+  }
+  VLOG(1) << "Inserted or updated a batch of " << records.size() << " records.";
   return updated;
 }
 
+void RecordStore::InsertStatic(std::vector<std::vector<Record>> parts, size_t threads) {
+  std::vector<std::vector<size_t>> part_indices(parts.size());
+  std::vector<std::vector<size_t>> part_shard_ends(parts.size());
+  ParallelFor(parts.size(), threads, [&](size_t p) {
+    const std::vector<Record>& records = parts[p];
+    part_indices[p] = GroupByShard(
+        records.size(), [&](size_t i) { return std::string_view(records[i].qname); },
+        part_shard_ends[p]);
+  });
+  ParallelFor(shards_.size(), threads, [&](size_t shard) {
+    ScopedCpuAffinity pinned(
+        shard_cpus_.empty() ? std::span<const int>() : std::span<const int>(shard_cpus_[shard]));
+    for (size_t p = 0; p < parts.size(); p++) {
+      const std::vector<size_t>& shard_end = part_shard_ends[p];
+      const std::span<const size_t> shard_indices(
+          part_indices[p].data() + shard_end[shard], shard_end[shard + 1] - shard_end[shard]);
+      if (shard_indices.empty()) { continue; }
+      shards_[shard]->InsertStatic(parts[p], shard_indices);
+    }
+  });
+  BumpGeneration();
+}
+
+std::vector<std::pmr::vector<Record>> RecordStore::QueryBatch(
+    std::span<const Question> questions, std::pmr::memory_resource* resource) {
+  std::vector<size_t> shard_end;
+  const std::vector<size_t> indices = GroupByShard(
+      questions.size(), [&](size_t i) { return std::string_view(questions[i].qname); },
+      shard_end);
+
+  std::vector<std::pmr::vector<Record>> hits;
+  hits.reserve(questions.size());
+  for (size_t i = 0; i < questions.size(); i++) { hits.emplace_back(resource); }
+  for (size_t shard = 0; shard < shards_.size(); shard++) {
+    const std::span<const size_t> shard_indices(
+        indices.data() + shard_end[shard], shard_end[shard + 1] - shard_end[shard]);
+    if (shard_indices.empty()) { continue; }
+    shards_[shard]->QueryBatch(questions, shard_indices, hits);
+  }
+  if (names_.wildcards.load(std::memory_order_relaxed) > 0) {
+    for (size_t i = 0; i < questions.size(); i++) {
+      if (hits[i].empty()) { QueryWildcard(questions[i], hits[i]); }
+    }
+  }
+  VLOG(1) << "Queried a batch of " << questions.size() << " questions.";
+  return hits;
+}
+
 bool RecordStore::Remove(const Record& to_remove) {
-  const size_t hash = hasher_(to_remove.qname);
-  bool removed = shards_[hash % kShardCount].Remove(to_remove);
-  if (removed) { LOG(INFO) << "Removal succeeded for record: " << to_remove.DebugString(); }
-  else { LOG(INFO) << "Removal failed (not found) for record: " << to_remove.DebugString(); }
+  bool removed = ShardFor(to_remove.qname).Remove(to_remove);
+  if (removed) { BumpGeneration(); }
+  if (removed) { VLOG(1) << "Removal succeeded for record: " << to_remove.DebugString(); }
+  else { VLOG(1) << "Removal failed (not found) for record: " << to_remove.DebugString(); }
   return removed;
 }
 
-std::vector<Record> RecordStore::Query(const Question& question) {
-  const size_t hash = hasher_(question.qname);
-  const std::vector<Record> hits = shards_[hash % kShardCount].Query(question);
-  std::vector<std::string> hit_qnames;
-  hit_qnames.reserve(hits.size());
-  for (const Record& hit : hits) { hit_qnames.push_back(hit.qname); }
-  LOG(INFO) << "For question: " << question.DebugString()
-    << ", record store contained: [ " << absl::StrJoin(hit_qnames, ", ") << " ].";
+std::pmr::vector<Record> RecordStore::Query(
+    const Question& question, std::pmr::memory_resource* resource) {
+  std::pmr::vector<Record> hits = ShardFor(question.qname).Query(question, resource);
+  if (hits.empty() && names_.wildcards.load(std::memory_order_relaxed) > 0) {
+    QueryWildcard(question, hits);
+  }
+  // NOTE: this is the hot path, only build the debug strings when asked for.
+  VLOG(1) << "For question: " << question.DebugString()
+    << ", record store contained " << hits.size() << " records.";
   return hits;
 }
 
+void RecordStore::QueryWildcard(const Question& question, std::pmr::vector<Record>& hits) {
+  Question wildcard = question;
+  {
+    std::shared_lock lock(names_.mutex);
+    const NameTrie::Match match = names_.trie.Lookup(question.qname);
+    if (!match.wildcard) { return; }
+    wildcard.qname = "*";
+    if (!match.closest_encloser.empty()) {
+      wildcard.qname.append(".").append(match.closest_encloser);
+    }
+  }
+  hits = ShardFor(wildcard.qname).QueryStatic(wildcard, hits.get_allocator().resource());
+  for (Record& hit : hits) { hit.qname = question.qname; }
+}
+
+uint64_t RecordStore::LockWaitNanos() const {
+  uint64_t total = 0;
+  for (const std::unique_ptr<RecordStoreShard>& shard : shards_) {
+    total += shard->LockWaitNanos();
+  }
+  return total;
+}
+
+RecordStoreStats RecordStore::GetStats() const {
+  RecordStoreStats stats;
+  for (const std::unique_ptr<RecordStoreShard>& shard : shards_) {
+    shard->AddStats(stats);
+  }
+  return stats;
+}
+
 } // tiny_dns
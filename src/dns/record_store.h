@@ -1,11 +1,26 @@
 #ifndef SRC_DNS_RECORD_STORE_H_
 #define SRC_DNS_RECORD_STORE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <ctime>
+#include <limits>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
 #include "src/dns/dns_packet.h"
+#include "src/dns/name_trie.h"
 
 // This is a really simple in-memory lookup table for
 // DNS records. Failed lookups get shunted and then cached here.
@@ -14,37 +29,213 @@
 namespace tiny_dns {
 
 // TODO: LRU cache to ensure shards don't become too large.
-static constexpr size_t kShardCount = 32;
+inline constexpr size_t kDefaultShardCount = 32;
+inline constexpr size_t kMaxExpiredNamesPerLock = 256;
+inline constexpr size_t kMaxBatchRecordsPerLock = 256;
+
+// NOTE: expired counts the records the expiry thread has removed for
+// outliving their ttl, since the store was created. pending_expirations is
+// the length of the expiry queues, including entries for names removed or
+// requeued since, which are skipped when due.
+struct RecordStoreStats {
+  size_t size = 0;
+  uint64_t expired = 0;
+  size_t pending_expirations = 0;
+};
+
+// NOTE: the expiry of static records, e.g. loaded from a zone file. They're
+// answered with their own ttl.
+inline constexpr time_t kNeverExpires = std::numeric_limits<time_t>::max();
+
+// NOTE: every owner name with static records, across all shards, so a
+// question the shards have no name for can be answered from a zone's
+// wildcard (RFC 4592). Cached names aren't indexed: they'd take the
+// store-wide lock on every insert, and a cached answer isn't the zone's to
+// synthesize from. wildcards mirrors trie.wildcard_count() so queries can
+// skip the lock when there are none, the usual case for a cache.
+struct NameIndex {
+  std::shared_mutex mutex;
+  NameTrie trie;
+  std::atomic<size_t> wildcards = 0;
+};
 
 struct StoredRecord {
-  time_t ttl_check;
+  time_t expires_at;
   Record record;
 };
 
+struct StoredName {
+  std::vector<StoredRecord> records;
+  // NOTE: the records that never expire, the name is indexed while any do.
+  uint32_t static_records = 0;
+  // NOTE: when the name is next due in the shard's expiry queue,
+  // kNeverExpires if it isn't queued.
+  time_t next_expiry = kNeverExpires;
+};
+
 class RecordStoreShard {
  public:
-  RecordStoreShard() : stored_records_(), mutex_() {}
+  // NOTE: names the shard has static records for are kept in names, if
+  // given.
+  explicit RecordStoreShard(NameIndex* names = nullptr)
+    : records_by_name_(), expiry_queue_(), mutex_(), lock_wait_ns_(0), size_(0), expired_(0),
+      pending_expirations_(0), names_(names) {}
 
   bool InsertOrUpdate(Record record); // NOTE: true on update
+  // NOTE: inserts records[i] for every i in indices, setting updated[i].
+  // Takes the lock once per kMaxBatchRecordsPerLock records, so a large
+  // batch doesn't stall queries to the shard.
+  void InsertOrUpdateBatch(
+      std::span<Record> records, std::span<const size_t> indices, std::vector<bool>& updated);
+  // NOTE: as InsertOrUpdateBatch, but the records never expire.
+  void InsertStatic(std::span<Record> records, std::span<const size_t> indices);
   bool Remove(const Record& record);
-  std::vector<Record> Query(const Question& question);
+  // NOTE: hits are allocated from the given resource.
+  std::pmr::vector<Record> Query(
+      const Question& question, std::pmr::memory_resource* resource);
+  // NOTE: as Query, but only static records, e.g. a zone's wildcard.
+  std::pmr::vector<Record> QueryStatic(
+      const Question& question, std::pmr::memory_resource* resource);
+  // NOTE: appends the hits for questions[i] to hits[i] for every i in
+  // indices, under a single lock acquisition.
+  void QueryBatch(
+      std::span<const Question> questions, std::span<const size_t> indices,
+      std::vector<std::pmr::vector<Record>>& hits);
+  // NOTE: returns the number of records removed. Only visits the names due
+  // in the expiry queue, and takes the lock again every
+  // kMaxExpiredNamesPerLock of them so a mass expiry doesn't stall queries.
+  size_t RemoveExpired(time_t now);
+  // NOTE: adds this shard's counts to stats. They're kept as records come
+  // and go, so this doesn't take the lock.
+  void AddStats(RecordStoreStats& stats) const;
+
+  uint64_t LockWaitNanos() const { return lock_wait_ns_.load(std::memory_order_relaxed); }
 
  private:
-  std::vector<StoredRecord> stored_records_;
+  // NOTE: uncontended acquisitions only pay for a try_lock, the clock is only
+  // read when we actually have to wait.
+  std::unique_lock<std::mutex> Lock();
+  // NOTE: if given, sets new_static_name to the key of the record's name if
+  // this is its first static record. A static record is never updated.
+  bool InsertOrUpdateLocked(
+      Record record, time_t expires_at, const std::string** new_static_name = nullptr);
+  // NOTE: the names are keys of records_by_name_, so must be indexed before
+  // it can rehash.
+  void IndexNames(std::span<const std::string* const> names);
+  void UnindexName(std::string_view name);
+  // NOTE: with static_only, now is ignored.
+  void QueryLocked(
+      const Question& question, time_t now, std::pmr::vector<Record>& hits,
+      bool static_only = false);
+
+  absl::flat_hash_map<std::string, StoredName> records_by_name_;
+  // NOTE: a min-heap of (due, name), each name queued once, for its
+  // next_expiry; entries for names removed or requeued since are skipped.
+  std::vector<std::pair<time_t, std::string>> expiry_queue_;
   std::mutex mutex_;
+  std::atomic<uint64_t> lock_wait_ns_;
+  // NOTE: only written under the lock.
+  std::atomic<size_t> size_;
+  std::atomic<uint64_t> expired_;
+  // NOTE: expiry_queue_.size(), only written under the lock.
+  std::atomic<size_t> pending_expirations_;
+  NameIndex* names_;
 };
 
 class RecordStore {
  public:
-  RecordStore() : shards_(), hasher_() {}
+  // NOTE: with shard_node_cpus (the CPUs of each NUMA node, see
+  // NumaNodeCpus), shard i is built on a thread pinned to node i % nodes,
+  // and InsertStatic's loads into it run there, so its memory is spread
+  // evenly across the nodes rather than all landing on the constructing
+  // thread's. Records cached later are allocated wherever they're inserted
+  // from. A shard_count of 0 is taken as 1.
+  explicit RecordStore(
+      size_t shard_count = kDefaultShardCount,
+      std::vector<std::vector<int>> shard_node_cpus = {});
+  ~RecordStore();
+
+  RecordStore(const RecordStore&) = delete;
+  RecordStore& operator=(const RecordStore&) = delete;
 
   bool InsertOrUpdate(Record record); // NOTE: true on update
+  // NOTE: groups the records by shard and takes each shard's lock once per
+  // chunk of them. Returns whether each record was an update, in order.
+  std::vector<bool> InsertOrUpdateBatch(std::vector<Record> records);
+  // NOTE: for bulk loads of static records, which never expire. The records
+  // can come in any number of parts; the parts are grouped by shard and the
+  // shards filled in parallel, on up to threads threads (0 for one per core).
+  void InsertStatic(std::vector<std::vector<Record>> parts, size_t threads = 0);
   bool Remove(const Record& record);
-  std::vector<Record> Query(const Question& question);
+  // NOTE: a question for a name the store doesn't have is answered from the
+  // static wildcard covering it, if any, with the records renamed to the
+  // question's.
+  std::pmr::vector<Record> Query(
+      const Question& question,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+  // NOTE: groups the questions by shard and takes each shard's lock once.
+  // Returns the hits for each question, in order.
+  std::vector<std::pmr::vector<Record>> QueryBatch(
+      std::span<const Question> questions,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+  // NOTE: the generation of the answers read from a shard, bumped after
+  // every write that could change one: inserts and updates to the shard,
+  // and store-wide, static inserts and removals, which can change the
+  // wildcards synthesized from other shards. Not sweeping expired records,
+  // which queries already skip. A copy of an answer read from the shard,
+  // and only it, made while it read g is current for as long as it still
+  // reads g. Each is written only by writes, so between them its cache line
+  // stays shared by every reader rather than bouncing.
+  uint64_t Generation(size_t shard) const {
+    return shard_generations_[shard].value.load(std::memory_order_acquire)
+      + generation_.load(std::memory_order_acquire);
+  }
+
+  size_t ShardCount() const { return shards_.size(); }
+  // NOTE: the shard qname's records are kept in.
+  size_t ShardIndex(std::string_view qname) const;
+  // NOTE: total time spent blocked on shard locks, summed over all shards.
+  uint64_t LockWaitNanos() const;
+  RecordStoreStats GetStats() const;
 
  private:
-  std::array<RecordStoreShard, kShardCount> shards_;
-  std::hash<std::string> hasher_;
+  // NOTE: returns the indices 0..count ordered by the shard of qname(i);
+  // shard s's run is [shard_end[s], shard_end[s + 1]).
+  std::vector<size_t> GroupByShard(
+      size_t count, absl::FunctionRef<std::string_view(size_t)> qname,
+      std::vector<size_t>& shard_end) const;
+  RecordStoreShard& ShardFor(std::string_view qname);
+  // NOTE: for a question no shard has the name of, replaces hits with those
+  // synthesized from the static wildcard covering it, if any.
+  void QueryWildcard(const Question& question, std::pmr::vector<Record>& hits);
+  // NOTE: runs on expiry_thread_, removes every shard's expired records once
+  // a second.
+  void ExpireRecords();
+  void BumpGeneration() { generation_.fetch_add(1, std::memory_order_release); }
+  void BumpGeneration(size_t shard) {
+    shard_generations_[shard].value.fetch_add(1, std::memory_order_release);
+  }
+
+  // NOTE: outlives the shards, which update it.
+  NameIndex names_;
+  std::vector<std::unique_ptr<RecordStoreShard>> shards_;
+  // NOTE: empty, or the CPUs of each shard's node.
+  std::vector<std::vector<int>> shard_cpus_;
+  std::hash<std::string_view> hasher_;
+  // NOTE: each on a cache line of its own, so a write to one shard doesn't
+  // bounce the others' readers.
+  struct alignas(64) ShardGeneration {
+    std::atomic<uint64_t> value = 0;
+  };
+  std::unique_ptr<ShardGeneration[]> shard_generations_;
+  // NOTE: the store-wide part of every shard's generation.
+  alignas(64) std::atomic<uint64_t> generation_;
+
+  std::mutex expiry_mutex_;
+  std::condition_variable expiry_cv_;
+  bool stopping_;
+  std::thread expiry_thread_;
 };
 
 } // tiny_dns
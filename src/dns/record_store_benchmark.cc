@@ -0,0 +1,194 @@
+#include "src/dns/record_store.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "src/common/histogram.h"
+#include "src/common/zipfian.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/request_arena.h"
+
+// Contention benchmarks for RecordStore. Each benchmark thread issues a mix of
+// Query, InsertOrUpdate and Remove against one shared, pre-populated store,
+// picking keys with Zipfian popularity (the same skew YCSB uses by default).
+//
+// Arguments are the store size, the percentage of reads and the shard count;
+// the thread count is swept from 1 to the number of CPUs. Reported:
+// * items_per_second: operations per second, across all threads.
+// * p50_ns / p99_ns / p999_ns: per-operation latency, across all threads.
+// * lock_wait_ns/op: time spent blocked on shard locks per operation.
+//
+// Writes alternate between an InsertOrUpdate that refreshes an existing record
+// and a Remove followed by re-inserting it, so the store size stays constant.
+// NOTE: latencies include two steady_clock reads, a few tens of ns.
+
+namespace tiny_dns {
+namespace {
+
+constexpr double kZipfTheta = 0.99;
+constexpr uint32_t kTtl = 24 * 60 * 60;
+
+// NOTE: short enough to stay within the small string buffer.
+std::string KeyName(uint64_t key) { return absl::StrCat("h", key, ".zone"); }
+
+void FillRecord(uint64_t key, Record& record) {
+  record.qname = KeyName(key);
+  record.qtype = QueryType::A;
+  record.ttl = kTtl;
+  record.data = Record::A { .ip_address = {
+    10, static_cast<uint8_t>(key >> 16), static_cast<uint8_t>(key >> 8),
+    static_cast<uint8_t>(key) } };
+}
+
+// NOTE: the store is shared by all threads of a run, and kept between runs
+// with the same size and shard count since populating 10M records is slow.
+struct SharedState {
+  std::unique_ptr<RecordStore> store;
+  std::unique_ptr<ZipfianGenerator> zipf;
+  size_t size = 0;
+  size_t shard_count = 0;
+
+  std::mutex mutex;
+  Histogram latencies;
+  int threads_done = 0;
+  uint64_t lock_wait_start = 0;
+};
+
+SharedState& Shared() {
+  static SharedState* shared = new SharedState();
+  return *shared;
+}
+
+void SetUpStore(SharedState& shared, size_t size, size_t shard_count) {
+  if (shared.store != nullptr && shared.size == size && shared.shard_count == shard_count) {
+    return;
+  }
+  shared.store.reset();
+  if (shared.size != size) { shared.zipf = std::make_unique<ZipfianGenerator>(size, kZipfTheta); }
+  shared.store = std::make_unique<RecordStore>(shard_count);
+  shared.size = size;
+  shared.shard_count = shard_count;
+  Record record = {};
+  for (uint64_t key = 0; key < size; key++) {
+    FillRecord(key, record);
+    CHECK(!shared.store->InsertOrUpdate(record));
+  }
+}
+
+void BM_RecordStore(benchmark::State& state) {
+  const size_t size = state.range(0);
+  const int64_t read_percent = state.range(1);
+  const size_t shard_count = state.range(2);
+  SharedState& shared = Shared();
+  if (state.thread_index() == 0) {
+    SetUpStore(shared, size, shard_count);
+    shared.latencies.Reset();
+    shared.threads_done = 0;
+    shared.lock_wait_start = shared.store->LockWaitNanos();
+  }
+
+  // NOTE: everything the loop touches is per thread, except for the store.
+  std::mt19937_64 rng(state.thread_index() + 1);
+  std::uniform_int_distribution<int64_t> percent(0, 99);
+  Histogram latencies;
+  RequestArena arena;
+  Question question = {};
+  question.qtype = QueryType::A;
+  Record record = {};
+  uint64_t writes = 0;
+
+  for (auto _ : state) {
+    const uint64_t key = (*shared.zipf)(rng);
+    const bool is_read = percent(rng) < read_percent;
+    if (is_read) { question.qname = KeyName(key); }
+    else { FillRecord(key, record); }
+
+    const auto start = std::chrono::steady_clock::now();
+    if (is_read) {
+      benchmark::DoNotOptimize(shared.store->Query(question, arena.resource()));
+    } else if (writes++ % 2 == 0) {
+      benchmark::DoNotOptimize(shared.store->InsertOrUpdate(record));
+    } else {
+      benchmark::DoNotOptimize(shared.store->Remove(record));
+      benchmark::DoNotOptimize(shared.store->InsertOrUpdate(record));
+    }
+    const auto end = std::chrono::steady_clock::now();
+    latencies.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    arena.Reset();
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  // NOTE: counters are summed over threads, so only the last thread to finish
+  // reports the merged ones.
+  std::scoped_lock lock(shared.mutex);
+  shared.latencies.Merge(latencies);
+  if (++shared.threads_done < state.threads()) { return; }
+  state.counters["p50_ns"] = shared.latencies.Percentile(50);
+  state.counters["p99_ns"] = shared.latencies.Percentile(99);
+  state.counters["p999_ns"] = shared.latencies.Percentile(99.9);
+  const uint64_t lock_wait = shared.store->LockWaitNanos() - shared.lock_wait_start;
+  state.counters["lock_wait_ns/op"] =
+    static_cast<double>(lock_wait) / std::max<uint64_t>(shared.latencies.Count(), 1);
+}
+
+int MaxThreads() {
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// NOTE: store sizes and read/write mixes at the default shard count.
+BENCHMARK(BM_RecordStore)
+  ->ArgNames({"size", "read_pct", "shards"})
+  ->ArgsProduct({
+      {1'000, 10'000, 100'000, 1'000'000, 10'000'000},
+      {100, 95, 50},
+      {static_cast<int64_t>(kDefaultShardCount)}})
+  ->ThreadRange(1, MaxThreads())
+  ->UseRealTime();
+
+// NOTE: shard counts at a fixed size and a read heavy mix.
+BENCHMARK(BM_RecordStore)
+  ->Name("BM_RecordStoreShards")
+  ->ArgNames({"size", "read_pct", "shards"})
+  ->ArgsProduct({{100'000}, {95}, {1, 4, 16, 32, 128}})
+  ->ThreadRange(1, MaxThreads())
+  ->UseRealTime();
+
+// NOTE: bulk registration, e.g. a fleet re-registering after a restart, one
+// InsertOrUpdate per record against one InsertOrUpdateBatch per batch.
+void BM_BulkInsert(benchmark::State& state) {
+  const size_t batch_size = state.range(0);
+  const bool batched = state.range(1) != 0;
+  RecordStore store;
+  std::vector<Record> batch(batch_size);
+  uint64_t key = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    batch.resize(batch_size);
+    for (Record& record : batch) { FillRecord(key++ % 100'000, record); }
+    state.ResumeTiming();
+    if (batched) {
+      benchmark::DoNotOptimize(store.InsertOrUpdateBatch(std::move(batch)));
+    } else {
+      for (Record& record : batch) {
+        benchmark::DoNotOptimize(store.InsertOrUpdate(std::move(record)));
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+BENCHMARK(BM_BulkInsert)
+  ->ArgNames({"batch", "batched"})
+  ->ArgsProduct({{64, 1024}, {0, 1}});
+
+} // namespace
+} // tiny_dns
@@ -0,0 +1,388 @@
+#include "src/dns/record_store.h"
+
+#include <algorithm>
+#include <ctime>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/common/cpu_affinity.h"
+#include "src/dns/dns_packet.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::Le;
+using ::testing::SizeIs;
+
+Record CreateRecord(std::string_view qname, uint8_t last_octet, uint32_t ttl = 300) {
+  Record record = {};
+  record.qname = qname;
+  record.qtype = QueryType::A;
+  record.ttl = ttl;
+  record.data = Record::A { .ip_address = {10, 0, 0, last_octet} };
+  return record;
+}
+
+Question CreateQuestion(std::string_view qname, QueryType qtype) {
+  Question question = {};
+  question.qname = qname;
+  question.qtype = qtype;
+  return question;
+}
+
+TEST(RecordStoreTest, QueryReturnsInsertedRecords) {
+  RecordStore store;
+  EXPECT_FALSE(store.InsertOrUpdate(CreateRecord("a.example", 1)));
+  EXPECT_FALSE(store.InsertOrUpdate(CreateRecord("a.example", 2)));
+  EXPECT_FALSE(store.InsertOrUpdate(CreateRecord("b.example", 3)));
+
+  std::pmr::vector<Record> hits = store.Query(CreateQuestion("a.example", QueryType::A));
+  ASSERT_THAT(hits, SizeIs(2));
+  EXPECT_THAT(hits[0].data, Eq(CreateRecord("a.example", 1).data));
+  EXPECT_THAT(hits[1].data, Eq(CreateRecord("a.example", 2).data));
+  EXPECT_THAT(hits[0].ttl, Le(300));
+  EXPECT_THAT(store.Query(CreateQuestion("a.example", QueryType::AAAA)), IsEmpty());
+  EXPECT_THAT(store.Query(CreateQuestion("c.example", QueryType::A)), IsEmpty());
+}
+
+TEST(RecordStoreTest, InsertingSameDataUpdatesTtl) {
+  RecordStore store;
+  EXPECT_FALSE(store.InsertOrUpdate(CreateRecord("a.example", 1, 10)));
+  EXPECT_TRUE(store.InsertOrUpdate(CreateRecord("a.example", 1, 1000)));
+
+  std::pmr::vector<Record> hits = store.Query(CreateQuestion("a.example", QueryType::A));
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].ttl, Eq(1000));
+}
+
+TEST(RecordStoreTest, CnameMatchesAnyType) {
+  RecordStore store;
+  Record cname = CreateRecord("alias.example", 0);
+  cname.qtype = QueryType::CNAME;
+  cname.data = Record::CNAME { .host = "a.example" };
+  store.InsertOrUpdate(cname);
+
+  std::pmr::vector<Record> hits = store.Query(CreateQuestion("alias.example", QueryType::AAAA));
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].qtype, Eq(QueryType::CNAME));
+}
+
+TEST(RecordStoreTest, RemoveOnlyRemovesMatchingRecord) {
+  RecordStore store;
+  store.InsertOrUpdate(CreateRecord("a.example", 1));
+  store.InsertOrUpdate(CreateRecord("a.example", 2));
+
+  EXPECT_TRUE(store.Remove(CreateRecord("a.example", 1)));
+  EXPECT_FALSE(store.Remove(CreateRecord("a.example", 1)));
+  EXPECT_FALSE(store.Remove(CreateRecord("b.example", 2)));
+
+  std::pmr::vector<Record> hits = store.Query(CreateQuestion("a.example", QueryType::A));
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].data, Eq(CreateRecord("a.example", 2).data));
+}
+
+TEST(RecordStoreTest, WritesBumpTheGeneration) {
+  RecordStore store;
+  const size_t shard = store.ShardIndex("a.example");
+  // NOTE: a name in another shard.
+  std::string other = "b.example";
+  for (int i = 0; store.ShardIndex(other) == shard; i++) {
+    other = "b" + std::to_string(i) + ".example";
+  }
+  const size_t other_shard = store.ShardIndex(other);
+
+  uint64_t generation = store.Generation(shard);
+  uint64_t other_generation = store.Generation(other_shard);
+  store.InsertOrUpdate(CreateRecord("a.example", 1));
+  EXPECT_GT(store.Generation(shard), generation);
+  // NOTE: writes only change the answers read from their own shard.
+  EXPECT_THAT(store.Generation(other_shard), Eq(other_generation));
+  generation = store.Generation(shard);
+  store.Query(CreateQuestion("a.example", QueryType::A));
+  EXPECT_THAT(store.Generation(shard), Eq(generation));
+  EXPECT_FALSE(store.Remove(CreateRecord(other, 1)));
+  EXPECT_THAT(store.Generation(shard), Eq(generation));
+  EXPECT_TRUE(store.Remove(CreateRecord("a.example", 1)));
+  EXPECT_GT(store.Generation(shard), generation);
+  generation = store.Generation(shard);
+  store.InsertOrUpdateBatch({CreateRecord("a.example", 1)});
+  EXPECT_GT(store.Generation(shard), generation);
+  generation = store.Generation(shard);
+  other_generation = store.Generation(other_shard);
+  store.InsertOrUpdateBatch({CreateRecord(other, 1)});
+  EXPECT_THAT(store.Generation(shard), Eq(generation));
+  EXPECT_GT(store.Generation(other_shard), other_generation);
+  // NOTE: static records can be synthesized from for any shard's names.
+  other_generation = store.Generation(other_shard);
+  store.InsertStatic({{CreateRecord(other, 2)}});
+  EXPECT_GT(store.Generation(shard), generation);
+  EXPECT_GT(store.Generation(other_shard), other_generation);
+}
+
+TEST(RecordStoreShardTest, RemoveExpiredDropsOnlyExpiredRecords) {
+  RecordStoreShard shard;
+  shard.InsertOrUpdate(CreateRecord("a.example", 1, 0));
+  shard.InsertOrUpdate(CreateRecord("a.example", 2, 1000));
+  shard.InsertOrUpdate(CreateRecord("b.example", 3, 0));
+
+  EXPECT_THAT(shard.RemoveExpired(time(nullptr) + 10), Eq(2));
+  std::pmr::vector<Record> hits = shard.Query(
+      CreateQuestion("a.example", QueryType::A), std::pmr::get_default_resource());
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].data, Eq(CreateRecord("a.example", 2).data));
+  EXPECT_THAT(shard.RemoveExpired(time(nullptr) + 10), Eq(0));
+}
+
+TEST(RecordStoreShardTest, RefreshedRecordsExpireAtTheirNewTime) {
+  RecordStoreShard shard;
+  const time_t now = time(nullptr);
+  shard.InsertOrUpdate(CreateRecord("a.example", 1, 10));
+  shard.InsertOrUpdate(CreateRecord("a.example", 1, 100));
+  EXPECT_THAT(shard.RemoveExpired(now + 50), Eq(0));
+  EXPECT_THAT(shard.Query(CreateQuestion("a.example", QueryType::A),
+                          std::pmr::get_default_resource()), SizeIs(1));
+  EXPECT_THAT(shard.RemoveExpired(now + 200), Eq(1));
+  EXPECT_THAT(shard.Query(CreateQuestion("a.example", QueryType::A),
+                          std::pmr::get_default_resource()), IsEmpty());
+}
+
+TEST(RecordStoreShardTest, RemoveExpiredTakesTheLockInChunks) {
+  RecordStoreShard shard;
+  const size_t count = 3 * kMaxExpiredNamesPerLock + 1;
+  for (size_t i = 0; i < count; i++) {
+    shard.InsertOrUpdate(CreateRecord("host-" + std::to_string(i) + ".example", 1, 0));
+  }
+  EXPECT_THAT(shard.RemoveExpired(time(nullptr) + 10), Eq(count));
+  EXPECT_THAT(shard.RemoveExpired(time(nullptr) + 10), Eq(0));
+}
+
+TEST(RecordStoreShardTest, StatsFollowInsertsRemovalsAndExpiry) {
+  RecordStoreShard shard;
+  shard.InsertOrUpdate(CreateRecord("a.example", 1, 0));
+  shard.InsertOrUpdate(CreateRecord("a.example", 2, 1000));
+  shard.InsertOrUpdate(CreateRecord("b.example", 3, 0));
+  shard.InsertOrUpdate(CreateRecord("c.example", 4, 1000));
+  // NOTE: an update isn't a new record.
+  shard.InsertOrUpdate(CreateRecord("c.example", 4, 1000));
+  RecordStoreStats stats;
+  shard.AddStats(stats);
+  EXPECT_THAT(stats.size, Eq(4));
+  EXPECT_THAT(stats.expired, Eq(0));
+  // NOTE: one per name with expiring records, however many it has.
+  EXPECT_THAT(stats.pending_expirations, Eq(3));
+
+  EXPECT_TRUE(shard.Remove(CreateRecord("c.example", 4)));
+  EXPECT_THAT(shard.RemoveExpired(time(nullptr) + 10), Eq(2));
+  stats = {};
+  shard.AddStats(stats);
+  EXPECT_THAT(stats.size, Eq(1));
+  EXPECT_THAT(stats.expired, Eq(2));
+  // NOTE: a.example is requeued for its other record, and c.example's entry
+  // is only skipped once due.
+  EXPECT_THAT(stats.pending_expirations, Eq(2));
+}
+
+TEST(RecordStoreTest, InsertOrUpdateBatchReportsUpdatesInOrder) {
+  RecordStore store(4);
+  store.InsertOrUpdate(CreateRecord("host-3.example", 3));
+  std::vector<Record> batch;
+  for (uint8_t i = 0; i < 8; i++) {
+    batch.push_back(CreateRecord("host-" + std::to_string(i) + ".example", i));
+  }
+  batch.push_back(CreateRecord("host-0.example", 0));
+
+  const std::vector<bool> updated = store.InsertOrUpdateBatch(std::move(batch));
+  ASSERT_THAT(updated, SizeIs(9));
+  for (uint8_t i = 0; i < 8; i++) { EXPECT_THAT(updated[i], Eq(i == 3)) << int(i); }
+  EXPECT_TRUE(updated[8]);
+  for (uint8_t i = 0; i < 8; i++) {
+    EXPECT_THAT(store.Query(CreateQuestion(
+            "host-" + std::to_string(i) + ".example", QueryType::A)), SizeIs(1));
+  }
+}
+
+TEST(RecordStoreShardTest, InsertOrUpdateBatchSpansChunks) {
+  RecordStoreShard shard;
+  const size_t count = 2 * kMaxBatchRecordsPerLock + 1;
+  std::vector<Record> records;
+  for (size_t i = 0; i < count; i++) {
+    records.push_back(CreateRecord("host-" + std::to_string(i) + ".example", 1));
+  }
+  // NOTE: an update of a record inserted by an earlier chunk.
+  records.push_back(CreateRecord("host-0.example", 1));
+  std::vector<size_t> indices(records.size());
+  for (size_t i = 0; i < indices.size(); i++) { indices[i] = i; }
+  std::vector<bool> updated(records.size(), false);
+  shard.InsertOrUpdateBatch(records, indices, updated);
+
+  EXPECT_THAT(std::count(updated.begin(), updated.end(), true), Eq(1));
+  EXPECT_TRUE(updated.back());
+  RecordStoreStats stats;
+  shard.AddStats(stats);
+  EXPECT_THAT(stats.size, Eq(count));
+}
+
+TEST(RecordStoreTest, QueryBatchReturnsHitsInOrder) {
+  RecordStore store(4);
+  for (uint8_t i = 0; i < 8; i += 2) {
+    store.InsertOrUpdate(CreateRecord("host-" + std::to_string(i) + ".example", i));
+  }
+  std::vector<Question> questions;
+  for (uint8_t i = 0; i < 8; i++) {
+    questions.push_back(CreateQuestion("host-" + std::to_string(i) + ".example", QueryType::A));
+  }
+
+  const std::vector<std::pmr::vector<Record>> hits = store.QueryBatch(questions);
+  ASSERT_THAT(hits, SizeIs(8));
+  for (uint8_t i = 0; i < 8; i++) {
+    if (i % 2 == 1) {
+      EXPECT_THAT(hits[i], IsEmpty()) << int(i);
+      continue;
+    }
+    ASSERT_THAT(hits[i], SizeIs(1)) << int(i);
+    EXPECT_THAT(hits[i][0].qname, Eq(questions[i].qname));
+  }
+}
+
+TEST(RecordStoreTest, InsertStaticFillsShardsFromEveryPart) {
+  RecordStore store(4);
+  std::vector<std::vector<Record>> parts(3);
+  for (uint8_t i = 0; i < 30; i++) {
+    parts[i % 3].push_back(CreateRecord("host-" + std::to_string(i) + ".example", i, 60));
+  }
+  store.InsertStatic(std::move(parts), /*threads=*/2);
+
+  for (uint8_t i = 0; i < 30; i++) {
+    const std::pmr::vector<Record> hits = store.Query(
+        CreateQuestion("host-" + std::to_string(i) + ".example", QueryType::A));
+    ASSERT_THAT(hits, SizeIs(1)) << int(i);
+    // NOTE: static records are answered with their own ttl.
+    EXPECT_THAT(hits[0].ttl, Eq(60));
+  }
+  RecordStoreStats stats = store.GetStats();
+  EXPECT_THAT(stats.size, Eq(30));
+}
+
+TEST(RecordStoreShardTest, StaticRecordsNeverExpire) {
+  RecordStoreShard shard;
+  std::vector<Record> records = {CreateRecord("static.example", 1, 1)};
+  const std::vector<size_t> indices = {0};
+  shard.InsertStatic(records, indices);
+  EXPECT_THAT(shard.RemoveExpired(time(nullptr) + 3600), Eq(0));
+  EXPECT_THAT(shard.Query(CreateQuestion("static.example", QueryType::A),
+        std::pmr::get_default_resource()), SizeIs(1));
+}
+
+TEST(RecordStoreShardTest, UpdatesDoNotMakeStaticRecordsExpire) {
+  RecordStoreShard shard;
+  std::vector<Record> records = {CreateRecord("static.example", 1, 3600)};
+  const std::vector<size_t> indices = {0};
+  shard.InsertStatic(records, indices);
+  // NOTE: e.g. the same record cached from an upstream answer.
+  EXPECT_TRUE(shard.InsertOrUpdate(CreateRecord("static.example", 1, 1)));
+  EXPECT_THAT(shard.RemoveExpired(time(nullptr) + 60), Eq(0));
+  const std::pmr::vector<Record> hits = shard.Query(
+      CreateQuestion("static.example", QueryType::A), std::pmr::get_default_resource());
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].ttl, Eq(3600));
+}
+
+TEST(RecordStoreTest, WildcardsAnswerNamesTheStoreDoesNotHave) {
+  RecordStore store(4);
+  store.InsertStatic({{
+      CreateRecord("*.svc.internal", 1),
+      CreateRecord("db.svc.internal", 2),
+      CreateRecord("a.b.svc.internal", 3),
+      }});
+
+  std::pmr::vector<Record> hits = store.Query(CreateQuestion("web.svc.internal", QueryType::A));
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].qname, Eq("web.svc.internal"));
+  EXPECT_THAT(hits[0].data, Eq(CreateRecord("", 1).data));
+  EXPECT_THAT(store.Query(CreateQuestion("x.y.svc.internal", QueryType::A)), SizeIs(1));
+
+  // NOTE: names that exist, even as empty non-terminals, aren't synthesized.
+  EXPECT_THAT(store.Query(CreateQuestion("db.svc.internal", QueryType::AAAA)), IsEmpty());
+  EXPECT_THAT(store.Query(CreateQuestion("b.svc.internal", QueryType::A)), IsEmpty());
+  // NOTE: the closest encloser is b.svc.internal, which has no wildcard.
+  EXPECT_THAT(store.Query(CreateQuestion("c.b.svc.internal", QueryType::A)), IsEmpty());
+
+  const std::vector<Question> questions = {
+    CreateQuestion("db.svc.internal", QueryType::A),
+    CreateQuestion("api.svc.internal", QueryType::A),
+    CreateQuestion("other.internal", QueryType::A),
+  };
+  const std::vector<std::pmr::vector<Record>> batch = store.QueryBatch(questions);
+  ASSERT_THAT(batch[1], SizeIs(1));
+  EXPECT_THAT(batch[1][0].qname, Eq("api.svc.internal"));
+  EXPECT_THAT(batch[0], SizeIs(1));
+  EXPECT_THAT(batch[2], IsEmpty());
+
+  EXPECT_TRUE(store.Remove(CreateRecord("*.svc.internal", 1)));
+  EXPECT_THAT(store.Query(CreateQuestion("web.svc.internal", QueryType::A)), IsEmpty());
+}
+
+TEST(RecordStoreTest, OnlyStaticRecordsAreSynthesized) {
+  RecordStore store(4);
+  // NOTE: a cached wildcard, e.g. forwarded, is only an answer for itself.
+  store.InsertOrUpdate(CreateRecord("*.cache.internal", 1, 60));
+  EXPECT_THAT(store.Query(CreateQuestion("*.cache.internal", QueryType::A)), SizeIs(1));
+  EXPECT_THAT(store.Query(CreateQuestion("web.cache.internal", QueryType::A)), IsEmpty());
+
+  store.InsertStatic({{CreateRecord("*.svc.internal", 1)}});
+  store.InsertOrUpdate(CreateRecord("*.svc.internal", 2, 60));
+  std::pmr::vector<Record> hits = store.Query(CreateQuestion("web.svc.internal", QueryType::A));
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].data, Eq(CreateRecord("", 1).data));
+  // NOTE: the cached record doesn't keep the name indexed.
+  EXPECT_TRUE(store.Remove(CreateRecord("*.svc.internal", 1)));
+  EXPECT_THAT(store.Query(CreateQuestion("web.svc.internal", QueryType::A)), IsEmpty());
+  EXPECT_THAT(store.Query(CreateQuestion("*.svc.internal", QueryType::A)), SizeIs(1));
+}
+
+TEST(RecordStoreTest, ShardCountIsConfigurable) {
+  RecordStore store(4);
+  EXPECT_THAT(store.ShardCount(), Eq(4));
+  for (uint8_t i = 0; i < 64; i++) {
+    store.InsertOrUpdate(CreateRecord("host-" + std::to_string(i) + ".example", i));
+  }
+  for (uint8_t i = 0; i < 64; i++) {
+    EXPECT_THAT(store.Query(CreateQuestion(
+            "host-" + std::to_string(i) + ".example", QueryType::A)), SizeIs(1));
+  }
+}
+
+TEST(RecordStoreTest, ZeroShardsIsOneShard) {
+  RecordStore store(0);
+  EXPECT_THAT(store.ShardCount(), Eq(1));
+  store.InsertOrUpdate(CreateRecord("a.example", 1));
+  EXPECT_THAT(store.Query(CreateQuestion("a.example", QueryType::A)), SizeIs(1));
+}
+
+TEST(RecordStoreTest, ShardsCanBePlacedOnNodes) {
+  // NOTE: two "nodes" of every CPU, so this runs anywhere.
+  const std::vector<std::vector<int>> nodes = NumaNodeCpus();
+  RecordStore store(5, {nodes[0], nodes[0]});
+  EXPECT_THAT(store.ShardCount(), Eq(5));
+  std::vector<std::vector<Record>> parts(1);
+  for (uint8_t i = 0; i < 30; i++) {
+    parts[0].push_back(CreateRecord("host-" + std::to_string(i) + ".example", i, 60));
+  }
+  store.InsertStatic(std::move(parts), /*threads=*/2);
+  store.InsertOrUpdate(CreateRecord("dynamic.example", 1));
+  for (uint8_t i = 0; i < 30; i++) {
+    EXPECT_THAT(store.Query(CreateQuestion(
+            "host-" + std::to_string(i) + ".example", QueryType::A)), SizeIs(1));
+  }
+  EXPECT_THAT(store.Query(CreateQuestion("dynamic.example", QueryType::A)), SizeIs(1));
+}
+
+} // namespace
+} // tiny_dns
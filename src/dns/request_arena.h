@@ -0,0 +1,36 @@
+#ifndef SRC_DNS_REQUEST_ARENA_H_
+#define SRC_DNS_REQUEST_ARENA_H_
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+namespace tiny_dns {
+
+// Scratch memory for serving a single request. Decoding the request, the
+// record store lookup and building the response all allocate from here, and
+// everything is released at once by Reset() after the response has been sent.
+// Requests that outgrow the inline buffer fall back to the global heap.
+// Not thread safe; intended to be owned by a single worker.
+class RequestArena {
+ public:
+  // NOTE: comfortably fits a 512 byte packet's worth of decoded records.
+  static constexpr size_t kInlineBytes = 16 * 1024;
+
+  RequestArena()
+    : buffer_(), resource_(buffer_.data(), buffer_.size(),
+                           std::pmr::new_delete_resource()) {}
+  RequestArena(const RequestArena&) = delete;
+  RequestArena& operator=(const RequestArena&) = delete;
+
+  std::pmr::memory_resource* resource() { return &resource_; }
+  void Reset() { resource_.release(); }
+
+ private:
+  alignas(std::max_align_t) std::array<std::byte, kInlineBytes> buffer_;
+  std::pmr::monotonic_buffer_resource resource_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_REQUEST_ARENA_H_
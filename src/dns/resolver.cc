@@ -0,0 +1,333 @@
+#include "src/dns/resolver.h"
+
+#include <array>
+#include <cstdint>
+#include <future>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "src/common/status_macros.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/record_store.h"
+#include "src/dns/server_metrics.h"
+
+namespace tiny_dns {
+
+DnsPacket Resolver::Resolve(
+    const DnsPacket& request, std::pmr::memory_resource* resource,
+    StageTimer& timer, RequestOutcome* outcome, int64_t deadline_ns) {
+  bool needs_forward = false;
+  absl::StatusOr<DnsPacket> response = Lookup(request, resource, &needs_forward);
+  timer.Lap(metrics_->lookup_ns);
+  if (outcome != nullptr) {
+    outcome->cache_hit =
+      response.ok() && response->header.response_code == ResponseCode::NO_ERROR;
+  }
+  // NOTE: the lookup itself never forwards, a miss or a hit whose CNAME
+  // target misses is forwarded here, after the lookup stage.
+  if ((!response.ok() || needs_forward) && request.header.recursion_desired) {
+    if (!TryStartForward()) {
+      metrics_->shed_forwards.Increment();
+      // NOTE: a hit is still answered, with the chain as far as it goes.
+      if (!response.ok()) {
+        return CreateResponseTemplate(request.header.id, shed_response_code_, resource);
+      }
+      return *std::move(response);
+    }
+    const int64_t forward_start_ns = MonotonicNanos();
+    if (!response.ok()) {
+      VLOG(1) << "Error retrieving results locally: " << response.status();
+      metrics_->forwards.Increment();
+      response = Forward(request, deadline_ns);
+      if (!response.ok()) { metrics_->forward_errors.Increment(); }
+    }
+    if (response.ok() && response->header.response_code == ResponseCode::NO_ERROR) {
+      ForwardCnameTargets(request.questions[0], *response, resource, deadline_ns);
+    }
+    FinishForward();
+    timer.Lap(metrics_->forward_ns);
+    if (outcome != nullptr) {
+      outcome->forwarded = true;
+      outcome->upstream_rtt_ns = MonotonicNanos() - forward_start_ns;
+    }
+  }
+  if (!response.ok()) {
+    LOG_EVERY_N_SEC(WARNING, 1) << "Returning SERV_FAIL response: " << response.status();
+    return CreateResponseTemplate(request.header.id, ResponseCode::SERV_FAIL, resource);
+  }
+  return *std::move(response);
+}
+
+absl::StatusOr<DnsPacket> Resolver::ResolveLocally(
+    const DnsPacket& request, std::pmr::memory_resource* resource,
+    StageTimer& timer, RequestOutcome* outcome) {
+  bool needs_forward = false;
+  absl::StatusOr<DnsPacket> response = Lookup(request, resource, &needs_forward);
+  timer.Lap(metrics_->lookup_ns);
+  if (response.ok() && !needs_forward) {
+    if (outcome != nullptr) {
+      outcome->cache_hit = response->header.response_code == ResponseCode::NO_ERROR;
+    }
+    return response;
+  }
+  if (request.header.recursion_desired) {
+    return absl::NotFoundError("Request needs forwarding.");
+  }
+  LOG_EVERY_N_SEC(WARNING, 1) << "Returning SERV_FAIL response: " << response.status();
+  return CreateResponseTemplate(request.header.id, ResponseCode::SERV_FAIL, resource);
+}
+
+void Resolver::CompleteForward(DnsPacket& response, std::pmr::memory_resource* resource) {
+  CacheAnswers(response);
+  if (response.header.response_code != ResponseCode::NO_ERROR
+      || response.questions.size() != 1) {
+    return;
+  }
+  ChaseCnames(response.questions[0], response, resource);
+}
+
+absl::StatusOr<DnsPacket> Resolver::Lookup(
+    const DnsPacket& request, std::pmr::memory_resource* resource, bool* needs_forward) {
+  if (request.questions.size() != 1) {
+    LOG_EVERY_N_SEC(WARNING, 1) << "Malformatted request detected.";
+    return CreateResponseTemplate(request.header.id, ResponseCode::FORM_ERROR, resource);
+  }
+
+  const Question& question = request.questions[0];
+  std::pmr::vector<Record> answers = record_store_->Query(question, resource);
+  if (answers.size() == 0) {
+    metrics_->cache_misses.Increment();
+    return absl::NotFoundError(
+        absl::StrCat("No records found for qname: ", question.qname));
+  }
+
+  metrics_->cache_hits.Increment();
+  DnsPacket response = CreateResponseTemplate(
+      request.header.id, ResponseCode::NO_ERROR, resource);
+  response.questions = request.questions;
+  response.answers = std::move(answers);
+  const bool unanswered = ChaseCnames(question, response, resource).has_value();
+  if (unanswered && request.header.recursion_desired && needs_forward != nullptr) {
+    *needs_forward = true;
+  }
+  VLOG(1) << "Returning response: " << response.DebugString();
+  return response;
+}
+
+bool Resolver::TryStartForward() {
+  size_t inflight = inflight_forwards_.load(std::memory_order_relaxed);
+  do {
+    if (max_inflight_forwards_ != 0 && inflight >= max_inflight_forwards_) { return false; }
+  } while (!inflight_forwards_.compare_exchange_weak(
+        inflight, inflight + 1, std::memory_order_relaxed));
+  return true;
+}
+
+absl::StatusOr<DnsPacket> Resolver::Forward(const DnsPacket& request, int64_t deadline_ns) {
+  if (forwarder_ == nullptr) {
+    return absl::UnavailableError("Fallback DNS is not configured.");
+  }
+  VLOG(1) << "Forwarding request to fallback DNS server.";
+  std::array<uint8_t, 512> request_buffer = {};
+  ASSIGN_OR_RETURN(const std::span<const uint8_t> request_raw, request.ToBytes(request_buffer));
+  const absl::StatusOr<std::array<uint8_t, 512>> response_raw =
+    forwarder_->Forward(request_raw, deadline_ns).get();
+  // NOTE: forwards queue up in the forwarder behind a slow fallback DNS
+  // server, by the deadline the client will have retried.
+  if (absl::IsDeadlineExceeded(response_raw.status())) { metrics_->shed_deadlines.Increment(); }
+  RETURN_IF_ERROR(response_raw.status());
+  return ParseForwarded(*response_raw);
+}
+
+absl::StatusOr<DnsPacket> Resolver::ParseForwarded(
+    const std::array<uint8_t, 512>& response_raw) {
+  ASSIGN_OR_RETURN(DnsPacket response, DnsPacket::FromBytes(response_raw));
+  CacheAnswers(response);
+  return response;
+}
+
+std::vector<absl::StatusOr<DnsPacket>> Resolver::ResolveBatch(
+    std::span<const Question> questions, bool recursion_desired,
+    std::pmr::memory_resource* resource) {
+  std::vector<std::pmr::vector<Record>> hits = record_store_->QueryBatch(questions, resource);
+  std::vector<absl::StatusOr<DnsPacket>> results(questions.size());
+  std::vector<size_t> misses;
+  for (size_t i = 0; i < questions.size(); i++) {
+    if (hits[i].empty()) {
+      metrics_->cache_misses.Increment();
+      results[i] = absl::NotFoundError(
+          absl::StrCat("No records found for qname: ", questions[i].qname));
+      misses.push_back(i);
+      continue;
+    }
+    metrics_->cache_hits.Increment();
+    DnsPacket response = CreateResponseTemplate(0, ResponseCode::NO_ERROR, resource);
+    response.questions.push_back(questions[i]);
+    response.answers = std::move(hits[i]);
+    results[i] = std::move(response);
+  }
+  if (recursion_desired && !misses.empty()) { ForwardBatch(questions, misses, results); }
+  // NOTE: after the batch, so the targets of forwarded answers are found too.
+  for (size_t i = 0; i < questions.size(); i++) {
+    if (!results[i].ok() || results[i]->header.response_code != ResponseCode::NO_ERROR) {
+      continue;
+    }
+    if (!ChaseCnames(questions[i], *results[i], resource).has_value() || !recursion_desired) {
+      continue;
+    }
+    if (!TryStartForward()) {
+      metrics_->shed_forwards.Increment();
+      continue;
+    }
+    ForwardCnameTargets(questions[i], *results[i], resource);
+    FinishForward();
+  }
+  return results;
+}
+
+void Resolver::ForwardBatch(
+    std::span<const Question> questions, std::span<const size_t> misses,
+    std::vector<absl::StatusOr<DnsPacket>>& results) {
+  if (forwarder_ == nullptr) { return; }
+  VLOG(1) << "Forwarding " << misses.size() << " requests to fallback DNS server.";
+  // NOTE: all submitted before waiting on any, so the batch takes about one
+  // round trip rather than one per miss.
+  std::vector<std::future<absl::StatusOr<std::array<uint8_t, 512>>>> pending(misses.size());
+  std::array<uint8_t, 512> buffer = {};
+  for (size_t k = 0; k < misses.size(); k++) {
+    DnsPacket request = {};
+    request.header.recursion_desired = true;
+    request.questions.push_back(questions[misses[k]]);
+    const absl::StatusOr<std::span<const uint8_t>> request_raw = request.ToBytes(buffer);
+    if (!request_raw.ok()) {
+      results[misses[k]] = request_raw.status();
+      continue;
+    }
+    if (!TryStartForward()) {
+      metrics_->shed_forwards.Increment();
+      results[misses[k]] = absl::ResourceExhaustedError("Too many forwards in flight.");
+      continue;
+    }
+    metrics_->forwards.Increment();
+    pending[k] = forwarder_->Forward(*request_raw);
+  }
+
+  for (size_t k = 0; k < misses.size(); k++) {
+    if (!pending[k].valid()) { continue; }
+    const absl::StatusOr<std::array<uint8_t, 512>> response_raw = pending[k].get();
+    FinishForward();
+    if (!response_raw.ok()) {
+      results[misses[k]] = response_raw.status();
+      continue;
+    }
+    results[misses[k]] = ParseForwarded(*response_raw);
+  }
+  for (size_t k = 0; k < misses.size(); k++) {
+    if (!results[misses[k]].ok() && !absl::IsResourceExhausted(results[misses[k]].status())) {
+      metrics_->forward_errors.Increment();
+    }
+  }
+}
+
+void Resolver::CacheAnswers(const DnsPacket& response) {
+  for (const Record& record : response.answers) {
+    record_store_->InsertOrUpdate(record);
+  }
+}
+
+std::optional<Question> Resolver::ChaseCnames(
+    const Question& question, DnsPacket& response, std::pmr::memory_resource* resource) {
+  if (question.qtype == QueryType::CNAME) { return std::nullopt; }
+  // NOTE: the targets followed, from resource so a hit that needs no chasing
+  // still doesn't allocate. Reserved up front so name stays valid.
+  std::pmr::vector<std::pmr::string> visited(resource);
+  std::string_view name = question.qname;
+  for (size_t chased = 0;; chased++) {
+    const Record* cname = nullptr;
+    for (const Record& record : response.answers) {
+      if (std::string_view(record.qname) != name) { continue; }
+      if (record.qtype == question.qtype) { return std::nullopt; }
+      if (record.qtype == QueryType::CNAME && cname == nullptr) { cname = &record; }
+    }
+    if (cname == nullptr) { return std::nullopt; }
+    const std::string_view target = std::get<Record::CNAME>(cname->data).host;
+    if (target == question.qname || absl::c_linear_search(visited, target)) {
+      LOG_EVERY_N_SEC(WARNING, 1) << "CNAME loop for: " << question.qname << " at: " << target;
+      return std::nullopt;
+    }
+    if (chased == kMaxCnameChain) {
+      LOG_EVERY_N_SEC(WARNING, 1) << "CNAME chain too long for: " << question.qname;
+      return std::nullopt;
+    }
+    if (visited.empty()) { visited.reserve(kMaxCnameChain); }
+    name = visited.emplace_back(target);
+    // NOTE: e.g. the fallback DNS server returned the rest of the chain.
+    if (absl::c_any_of(response.answers, [&](const Record& record) {
+          return std::string_view(record.qname) == name; })) {
+      continue;
+    }
+
+    Question next(question, resource);
+    next.qname.assign(name);
+    std::pmr::vector<Record> answers = record_store_->Query(next, resource);
+    if (answers.empty()) { return next; }
+    metrics_->cname_chases.Increment();
+    response.answers.insert(response.answers.end(),
+        std::make_move_iterator(answers.begin()), std::make_move_iterator(answers.end()));
+  }
+}
+
+void Resolver::ForwardCnameTargets(
+    const Question& question, DnsPacket& response, std::pmr::memory_resource* resource,
+    int64_t deadline_ns) {
+  // NOTE: each forward answers one more link of the chain, and ChaseCnames
+  // stops at loops and long chains, so this ends.
+  for (std::optional<Question> target = ChaseCnames(question, response, resource);
+       target.has_value(); target = ChaseCnames(question, response, resource)) {
+    DnsPacket request = {};
+    request.header.recursion_desired = true;
+    request.questions.push_back(*target);
+    metrics_->forwards.Increment();
+    absl::StatusOr<DnsPacket> forwarded = Forward(request, deadline_ns);
+    if (!forwarded.ok()) {
+      metrics_->forward_errors.Increment();
+      VLOG(1) << "Error forwarding CNAME target: " << forwarded.status();
+      return;
+    }
+    if (forwarded->header.response_code != ResponseCode::NO_ERROR) {
+      VLOG(1) << "No answer from fallback DNS server for CNAME target: " << target->qname;
+      return;
+    }
+    // NOTE: only the target's own records, a record for any other name is
+    // no part of this chain, whatever the fallback DNS server sent.
+    const size_t answered = response.answers.size();
+    for (Record& record : forwarded->answers) {
+      if (std::string_view(record.qname) != std::string_view(target->qname)) { continue; }
+      response.answers.push_back(std::move(record));
+    }
+    if (response.answers.size() == answered) { return; }
+    metrics_->cname_chases.Increment();
+  }
+}
+
+DnsPacket Resolver::CreateResponseTemplate(
+    uint16_t id, ResponseCode response_code, std::pmr::memory_resource* resource) {
+  DnsPacket response(resource);
+  response.header.id = id;
+  response.header.response_code = response_code;
+  response.header.query_response = true;
+  response.header.recursion_available = (forwarder_ != nullptr);
+  return response;
+}
+
+} // tiny_dns
@@ -0,0 +1,139 @@
+#ifndef SRC_DNS_RESOLVER_H_
+#define SRC_DNS_RESOLVER_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+#include "src/dns/record_store.h"
+#include "src/dns/server_metrics.h"
+
+namespace tiny_dns {
+
+// NOTE: the most CNAMEs followed for one question, past the first.
+inline constexpr size_t kMaxCnameChain = 8;
+
+// NOTE: how a request was resolved.
+struct RequestOutcome {
+  bool cache_hit = false;
+  bool forwarded = false;
+  uint32_t upstream_rtt_ns = 0;
+};
+
+// Answers parsed DNS requests: from the record store, else (if recursion is
+// desired) from the fallback DNS server through the forwarder, caching what
+// it returns. An answer that ends in a CNAME is completed with the records of
+// its target, found the same way, so the client gets the whole chain in one
+// response. Shared by
+// the UDP server and the admin service, so both see the same answers and
+// update the same cache hit / miss / forward counters.
+//
+// Thread safe: the UDP server's threads and the admin service's gRPC threads
+// all resolve through the same one. Their forwards share the forwarder, which
+// has many in flight at once, so a thread waiting on upstream holds up no
+// other.
+class Resolver {
+ public:
+  Resolver(
+      std::shared_ptr<RecordStore> record_store, std::shared_ptr<Forwarder> forwarder,
+      std::shared_ptr<ServerMetrics> metrics) :
+    record_store_(std::move(record_store)), forwarder_(std::move(forwarder)),
+    metrics_(std::move(metrics)) {}
+
+  // NOTE: must be called before serving. Beyond max_inflight forwards at
+  // once (0 for no limit), misses are answered with shed_response_code
+  // straight away rather than forwarded, so a slow fallback DNS server can't
+  // tie up every serving thread while cache hits wait behind it.
+  void LimitForwards(size_t max_inflight, ResponseCode shed_response_code) {
+    max_inflight_forwards_ = max_inflight;
+    shed_response_code_ = shed_response_code;
+  }
+
+  // NOTE: never fails, errors are answered with a SERV_FAIL or FORM_ERROR
+  // response. Allocations come from resource. The lookup and forward stages
+  // are lapped on timer; if given, outcome is filled in. A forward still
+  // queued at deadline_ns (on the steady clock, 0 for none) isn't sent.
+  DnsPacket Resolve(
+      const DnsPacket& request, std::pmr::memory_resource* resource,
+      StageTimer& timer, RequestOutcome* outcome = nullptr, int64_t deadline_ns = 0);
+
+  // NOTE: as Resolve, but never forwards, so never waits on the fallback DNS
+  // server: a request that would need a forward (a miss, or a CNAME target
+  // that misses, with recursion desired) fails with NotFound instead, for the
+  // caller to forward some other way.
+  absl::StatusOr<DnsPacket> ResolveLocally(
+      const DnsPacket& request, std::pmr::memory_resource* resource,
+      StageTimer& timer, RequestOutcome* outcome = nullptr);
+  // NOTE: for a response to a forward the caller made itself, e.g. submitted
+  // to forwarder() by the UDP server's pipeline: caches its answers and completes a CNAME chain it ends in
+  // from the record store, without forwarding again.
+  void CompleteForward(DnsPacket& response, std::pmr::memory_resource* resource);
+
+  // NOTE: resolves each question as if it were its own request. Hits come
+  // from a single RecordStore::QueryBatch. If recursion is desired, the
+  // misses are all sent to the fallback DNS server before waiting on any of
+  // their responses. Results are in question order; a question that couldn't
+  // be answered gets an error.
+  std::vector<absl::StatusOr<DnsPacket>> ResolveBatch(
+      std::span<const Question> questions, bool recursion_desired,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+  DnsPacket CreateResponseTemplate(
+      uint16_t id, ResponseCode response_code,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+  // NOTE: null without a fallback DNS server.
+  std::shared_ptr<Forwarder> forwarder() const { return forwarder_; }
+
+ private:
+  // NOTE: never forwards. Given needs_forward, sets it if recursion is
+  // desired and the answer ends in a CNAME whose target misses.
+  absl::StatusOr<DnsPacket> Lookup(
+      const DnsPacket& request, std::pmr::memory_resource* resource,
+      bool* needs_forward = nullptr);
+  // NOTE: waits on the forwarder for the response.
+  absl::StatusOr<DnsPacket> Forward(const DnsPacket& request, int64_t deadline_ns = 0);
+  // NOTE: parses a response from the forwarder and caches its answers.
+  absl::StatusOr<DnsPacket> ParseForwarded(const std::array<uint8_t, 512>& response_raw);
+  // NOTE: takes a slot of the forward budget, false if there's none left.
+  // Every slot taken must be given back with FinishForward().
+  bool TryStartForward();
+  void FinishForward() { inflight_forwards_.fetch_sub(1, std::memory_order_relaxed); }
+  // NOTE: sets results[i] for every i in misses.
+  void ForwardBatch(
+      std::span<const Question> questions, std::span<const size_t> misses,
+      std::vector<absl::StatusOr<DnsPacket>>& results);
+  void CacheAnswers(const DnsPacket& response);
+  // NOTE: while the answers for question end in a CNAME whose target they
+  // don't cover, appends the target's answers from the store. Never
+  // forwards. Stops at loops and after kMaxCnameChain CNAMEs; when a target
+  // misses, returns it for the caller to forward.
+  std::optional<Question> ChaseCnames(
+      const Question& question, DnsPacket& response, std::pmr::memory_resource* resource);
+  // NOTE: as ChaseCnames, but forwards the targets that miss, appending the
+  // answered records owned by the target. On the caller's forward slot.
+  void ForwardCnameTargets(
+      const Question& question, DnsPacket& response, std::pmr::memory_resource* resource,
+      int64_t deadline_ns = 0);
+
+  std::shared_ptr<RecordStore> record_store_;
+  std::shared_ptr<Forwarder> forwarder_;
+  std::shared_ptr<ServerMetrics> metrics_;
+
+  size_t max_inflight_forwards_ = 0;
+  ResponseCode shed_response_code_ = ResponseCode::SERV_FAIL;
+  std::atomic<size_t> inflight_forwards_ = 0;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_RESOLVER_H_
@@ -0,0 +1,348 @@
+#include "src/dns/resolver.h"
+
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+#include "src/dns/mock_upstream.h"
+#include "src/dns/record_store.h"
+#include "src/dns/server_metrics.h"
+#include "src/dns/test_util.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::testing::Eq;
+using ::testing::SizeIs;
+
+Record CreateCnameRecord(std::string_view qname, std::string_view host) {
+  Record record = {};
+  record.qname = qname;
+  record.qtype = QueryType::CNAME;
+  record.ttl = 300;
+  record.data = Record::CNAME { .host = std::pmr::string(host) };
+  return record;
+}
+
+class ResolverTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    record_store_ = std::make_shared<RecordStore>();
+    metrics_ = std::make_shared<ServerMetrics>();
+    resolver_ = std::make_shared<Resolver>(record_store_, nullptr, metrics_);
+  }
+
+  DnsPacket Resolve(
+      const DnsPacket& request, RequestOutcome* outcome = nullptr, int64_t deadline_ns = 0) {
+    StageTimer timer(/*enabled=*/false);
+    return resolver_->Resolve(
+        request, std::pmr::get_default_resource(), timer, outcome, deadline_ns);
+  }
+
+  // NOTE: starts upstream_, and resolves through a Forwarder to it. Wrap in
+  // ASSERT_NO_FATAL_FAILURE().
+  void UseUpstream(
+      MockUpstreamOptions options,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(200)) {
+    absl::StatusOr<std::unique_ptr<MockUpstream>> upstream =
+      MockUpstream::Create(std::move(options));
+    ASSERT_TRUE(upstream.ok());
+    upstream_ = std::move(*upstream);
+    absl::StatusOr<std::unique_ptr<Forwarder>> forwarder = Forwarder::Create(
+        "127.0.0.1", "127.0.0.1", upstream_->port(), { .timeout = timeout });
+    ASSERT_TRUE(forwarder.ok());
+    resolver_ = std::make_shared<Resolver>(record_store_, std::move(*forwarder), metrics_);
+  }
+
+  std::shared_ptr<RecordStore> record_store_;
+  std::shared_ptr<ServerMetrics> metrics_;
+  std::unique_ptr<MockUpstream> upstream_;
+  std::shared_ptr<Resolver> resolver_;
+};
+
+TEST_F(ResolverTest, AnswersFromRecordStore) {
+  record_store_->InsertOrUpdate(CreateARecord("hit.example", 1));
+
+  RequestOutcome outcome;
+  const DnsPacket response = Resolve(CreateRequestPacket("hit.example", QueryType::A), &outcome);
+  EXPECT_THAT(response.header.id, Eq(0x1234));
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::NO_ERROR));
+  ASSERT_THAT(response.answers, SizeIs(1));
+  EXPECT_THAT(response.answers[0].qname, Eq("hit.example"));
+  EXPECT_THAT(
+      std::get<Record::A>(response.answers[0].data),
+      Eq(std::get<Record::A>(CreateARecord("hit.example", 1).data)));
+  EXPECT_TRUE(outcome.cache_hit);
+  EXPECT_FALSE(outcome.forwarded);
+  EXPECT_THAT(metrics_->cache_hits.Value(), Eq(1));
+}
+
+TEST_F(ResolverTest, MissWithoutRecursionIsServFail) {
+  const DnsPacket response = Resolve(CreateRequestPacket("miss.example", QueryType::A));
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::SERV_FAIL));
+  EXPECT_THAT(response.answers, SizeIs(0));
+  EXPECT_THAT(metrics_->cache_misses.Value(), Eq(1));
+}
+
+TEST_F(ResolverTest, MultipleQuestionsAreFormError) {
+  DnsPacket request = CreateRequestPacket("a.example", QueryType::A);
+  request.questions.push_back(request.questions[0]);
+  const DnsPacket response = Resolve(request);
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::FORM_ERROR));
+}
+
+TEST_F(ResolverTest, ForwardsAndCachesMisses) {
+  ASSERT_NO_FATAL_FAILURE(UseUpstream({ .synthesize_answers = true }));
+
+  RequestOutcome outcome;
+  const DnsPacket forwarded = Resolve(
+      CreateRequestPacket("upstream.example", QueryType::A, /*recursion_desired=*/true), &outcome);
+  EXPECT_THAT(forwarded.header.response_code, Eq(ResponseCode::NO_ERROR));
+  ASSERT_THAT(forwarded.answers, SizeIs(1));
+  EXPECT_TRUE(outcome.forwarded);
+
+  // NOTE: answered from the store this time, the upstream sees no new query.
+  RequestOutcome cached_outcome;
+  const DnsPacket cached = Resolve(
+      CreateRequestPacket("upstream.example", QueryType::A, /*recursion_desired=*/true),
+      &cached_outcome);
+  EXPECT_THAT(cached.answers, SizeIs(1));
+  EXPECT_TRUE(cached_outcome.cache_hit);
+  EXPECT_FALSE(cached_outcome.forwarded);
+  EXPECT_THAT(upstream_->stats().queries, Eq(1));
+  EXPECT_THAT(metrics_->forwards.Value(), Eq(1));
+}
+
+TEST_F(ResolverTest, ConcurrentForwardsGetTheirOwnAnswers) {
+  ASSERT_NO_FATAL_FAILURE(UseUpstream(
+      { .synthesize_answers = true, .delay = std::chrono::microseconds(200) },
+      std::chrono::milliseconds(1000)));
+
+  // NOTE: e.g. UDP serving threads and admin Lookups at once, every request
+  // a miss, with the same ID.
+  constexpr int kThreads = 8;
+  constexpr int kRequests = 20;
+  std::vector<int> wrong(kThreads, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kRequests; i++) {
+        const std::string qname =
+          "host-" + std::to_string(t) + "-" + std::to_string(i) + ".example";
+        const DnsPacket response =
+          Resolve(CreateRequestPacket(qname, QueryType::A, /*recursion_desired=*/true));
+        if (response.header.response_code != ResponseCode::NO_ERROR
+            || response.answers.size() != 1
+            || std::string_view(response.answers[0].qname) != qname) {
+          wrong[t]++;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+  EXPECT_THAT(wrong, Eq(std::vector<int>(kThreads, 0)));
+  EXPECT_THAT(upstream_->stats().queries, Eq(kThreads * kRequests));
+}
+
+TEST_F(ResolverTest, ResolveBatchForwardsMissesAndKeepsOrder) {
+  // NOTE: sent together, so the batch takes about one delay rather than three.
+  ASSERT_NO_FATAL_FAILURE(UseUpstream(
+      { .synthesize_answers = true, .delay = std::chrono::milliseconds(20) }));
+  record_store_->InsertOrUpdate(CreateARecord("hit.example", 1));
+
+  std::vector<Question> questions;
+  for (std::string_view qname :
+      {"miss-1.example", "hit.example", "miss-2.example", "miss-3.example"}) {
+    questions.push_back(CreateRequestPacket(qname, QueryType::A).questions[0]);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<absl::StatusOr<DnsPacket>> results =
+    resolver_->ResolveBatch(questions, /*recursion_desired=*/true);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(60));
+
+  ASSERT_THAT(results, SizeIs(4));
+  for (size_t i = 0; i < results.size(); i++) {
+    ASSERT_TRUE(results[i].ok()) << results[i].status();
+    EXPECT_THAT(results[i]->header.response_code, Eq(ResponseCode::NO_ERROR));
+    ASSERT_THAT(results[i]->answers, SizeIs(1));
+    EXPECT_THAT(results[i]->answers[0].qname, Eq(questions[i].qname));
+  }
+  EXPECT_THAT(upstream_->stats().queries, Eq(3));
+  EXPECT_THAT(metrics_->cache_hits.Value(), Eq(1));
+  EXPECT_THAT(metrics_->forwards.Value(), Eq(3));
+  // NOTE: the forwarded answers were cached.
+  EXPECT_THAT(record_store_->Query(questions[2]), SizeIs(1));
+}
+
+TEST_F(ResolverTest, ResolveBatchWithoutRecursionReportsMisses) {
+  record_store_->InsertOrUpdate(CreateARecord("hit.example", 1));
+  std::vector<Question> questions = {
+    CreateRequestPacket("miss.example", QueryType::A).questions[0],
+    CreateRequestPacket("hit.example", QueryType::A).questions[0],
+  };
+  const std::vector<absl::StatusOr<DnsPacket>> results =
+    resolver_->ResolveBatch(questions, /*recursion_desired=*/false);
+  ASSERT_THAT(results, SizeIs(2));
+  EXPECT_TRUE(absl::IsNotFound(results[0].status()));
+  ASSERT_TRUE(results[1].ok());
+  EXPECT_THAT(results[1]->answers, SizeIs(1));
+}
+
+TEST_F(ResolverTest, ChasesCnameChainsInRecordStore) {
+  record_store_->InsertOrUpdate(CreateCnameRecord("www.example", "lb.example"));
+  record_store_->InsertOrUpdate(CreateCnameRecord("lb.example", "host.example"));
+  record_store_->InsertOrUpdate(CreateARecord("host.example", 1));
+
+  const DnsPacket response = Resolve(CreateRequestPacket("www.example", QueryType::A));
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::NO_ERROR));
+  ASSERT_THAT(response.answers, SizeIs(3));
+  EXPECT_THAT(response.answers[0].qname, Eq("www.example"));
+  EXPECT_THAT(response.answers[1].qname, Eq("lb.example"));
+  EXPECT_THAT(response.answers[2].qname, Eq("host.example"));
+  EXPECT_THAT(response.answers[2].qtype, Eq(QueryType::A));
+  EXPECT_THAT(metrics_->cname_chases.Value(), Eq(2));
+
+  // NOTE: asking for the CNAME itself doesn't chase it.
+  EXPECT_THAT(Resolve(CreateRequestPacket("www.example", QueryType::CNAME)).answers, SizeIs(1));
+}
+
+TEST_F(ResolverTest, StopsAtCnameLoops) {
+  record_store_->InsertOrUpdate(CreateCnameRecord("a.example", "b.example"));
+  record_store_->InsertOrUpdate(CreateCnameRecord("b.example", "a.example"));
+
+  const DnsPacket response = Resolve(CreateRequestPacket("a.example", QueryType::A));
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::NO_ERROR));
+  EXPECT_THAT(response.answers, SizeIs(2));
+}
+
+TEST_F(ResolverTest, BoundsCnameChainLength) {
+  for (int i = 0; i < 20; i++) {
+    record_store_->InsertOrUpdate(CreateCnameRecord(
+          "c" + std::to_string(i) + ".example", "c" + std::to_string(i + 1) + ".example"));
+  }
+  const DnsPacket response = Resolve(CreateRequestPacket("c0.example", QueryType::A));
+  EXPECT_THAT(response.answers, SizeIs(kMaxCnameChain + 1));
+}
+
+TEST_F(ResolverTest, ChasesCnameTargetsThroughFallback) {
+  ASSERT_NO_FATAL_FAILURE(UseUpstream({ .synthesize_answers = true }));
+  record_store_->InsertOrUpdate(CreateCnameRecord("alias.example", "cdn.upstream.example"));
+
+  const DnsPacket response = Resolve(
+      CreateRequestPacket("alias.example", QueryType::A, /*recursion_desired=*/true));
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::NO_ERROR));
+  ASSERT_THAT(response.answers, SizeIs(2));
+  EXPECT_THAT(response.answers[1].qname, Eq("cdn.upstream.example"));
+  EXPECT_THAT(response.answers[1].qtype, Eq(QueryType::A));
+  EXPECT_THAT(upstream_->stats().queries, Eq(1));
+
+  // NOTE: without recursion the answer stops at the alias.
+  record_store_->InsertOrUpdate(CreateCnameRecord("other.example", "cdn2.upstream.example"));
+  EXPECT_THAT(Resolve(CreateRequestPacket("other.example", QueryType::A)).answers, SizeIs(1));
+}
+
+TEST_F(ResolverTest, StopsAtCnameTargetsTheFallbackFails) {
+  ASSERT_NO_FATAL_FAILURE(UseUpstream({ .synthesize_answers = true, .serv_fail_rate = 1 }));
+  record_store_->InsertOrUpdate(CreateCnameRecord("alias.example", "cdn.upstream.example"));
+
+  RequestOutcome outcome;
+  const DnsPacket response = Resolve(
+      CreateRequestPacket("alias.example", QueryType::A, /*recursion_desired=*/true), &outcome);
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::NO_ERROR));
+  EXPECT_THAT(response.answers, SizeIs(1));
+  EXPECT_TRUE(outcome.cache_hit);
+  EXPECT_TRUE(outcome.forwarded);
+  EXPECT_THAT(upstream_->stats().queries, Eq(1));
+  EXPECT_THAT(metrics_->cname_chases.Value(), Eq(0));
+}
+
+TEST_F(ResolverTest, ResolveLocallyNeverForwards) {
+  ASSERT_NO_FATAL_FAILURE(UseUpstream({ .synthesize_answers = true }));
+  record_store_->InsertOrUpdate(CreateARecord("hit.example", 1));
+  record_store_->InsertOrUpdate(CreateCnameRecord("alias.example", "cdn.upstream.example"));
+  StageTimer timer(/*enabled=*/false);
+  std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+
+  RequestOutcome outcome;
+  absl::StatusOr<DnsPacket> response = resolver_->ResolveLocally(
+      CreateRequestPacket("hit.example", QueryType::A, true), resource, timer, &outcome);
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(response->answers, SizeIs(1));
+  EXPECT_TRUE(outcome.cache_hit);
+
+  EXPECT_TRUE(absl::IsNotFound(resolver_->ResolveLocally(
+          CreateRequestPacket("miss.example", QueryType::A, true), resource, timer).status()));
+  // NOTE: a CNAME target to forward counts as a miss.
+  EXPECT_TRUE(absl::IsNotFound(resolver_->ResolveLocally(
+          CreateRequestPacket("alias.example", QueryType::A, true), resource, timer).status()));
+  response = resolver_->ResolveLocally(
+      CreateRequestPacket("miss.example", QueryType::A), resource, timer);
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(response->header.response_code, Eq(ResponseCode::SERV_FAIL));
+  EXPECT_THAT(upstream_->stats().queries, Eq(0));
+}
+
+TEST_F(ResolverTest, CompleteForwardCachesAnswers) {
+  DnsPacket response = CreateRequestPacket("fwd.example", QueryType::A);
+  response.header.query_response = true;
+  response.answers.push_back(CreateCnameRecord("fwd.example", "host.example"));
+  record_store_->InsertOrUpdate(CreateARecord("host.example", 1));
+
+  resolver_->CompleteForward(response, std::pmr::get_default_resource());
+  EXPECT_THAT(response.answers, SizeIs(2));
+  EXPECT_THAT(record_store_->Query(response.questions[0]), SizeIs(1));
+}
+
+TEST_F(ResolverTest, ShedsMissesOverForwardBudget) {
+  ASSERT_NO_FATAL_FAILURE(UseUpstream(
+      { .synthesize_answers = true, .delay = std::chrono::milliseconds(300) },
+      std::chrono::milliseconds(2000)));
+  resolver_->LimitForwards(1, ResponseCode::REFUSED);
+  record_store_->InsertOrUpdate(CreateARecord("hit.example", 1));
+
+  DnsPacket slow_response;
+  std::thread slow([&] {
+    slow_response = Resolve(CreateRequestPacket("slow.example", QueryType::A, true));
+  });
+  while (upstream_->stats().queries == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  // NOTE: the one forward allowed is taken, misses are shed but hits answered.
+  EXPECT_THAT(Resolve(CreateRequestPacket("shed.example", QueryType::A, true)).header.response_code,
+      Eq(ResponseCode::REFUSED));
+  EXPECT_THAT(Resolve(CreateRequestPacket("hit.example", QueryType::A, true)).answers, SizeIs(1));
+  slow.join();
+  EXPECT_THAT(slow_response.header.response_code, Eq(ResponseCode::NO_ERROR));
+  EXPECT_THAT(metrics_->shed_forwards.Value(), Eq(1));
+  EXPECT_THAT(metrics_->forwards.Value(), Eq(1));
+
+  // NOTE: the budget is given back once the forward is done.
+  EXPECT_THAT(Resolve(CreateRequestPacket("shed.example", QueryType::A, true)).header.response_code,
+      Eq(ResponseCode::NO_ERROR));
+  EXPECT_THAT(upstream_->stats().queries, Eq(2));
+}
+
+TEST_F(ResolverTest, DropsForwardsQueuedPastDeadline) {
+  ASSERT_NO_FATAL_FAILURE(UseUpstream({ .synthesize_answers = true }));
+
+  const DnsPacket response = Resolve(
+      CreateRequestPacket("late.example", QueryType::A, true), nullptr, MonotonicNanos() - 1);
+  EXPECT_THAT(response.header.response_code, Eq(ResponseCode::SERV_FAIL));
+  EXPECT_THAT(metrics_->shed_deadlines.Value(), Eq(1));
+  EXPECT_THAT(upstream_->stats().queries, Eq(0));
+}
+
+} // namespace
+} // tiny_dns
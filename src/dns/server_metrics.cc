@@ -0,0 +1,115 @@
+#include "src/dns/server_metrics.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "src/common/histogram.h"
+#include "src/common/metrics.h"
+
+namespace tiny_dns {
+namespace {
+
+// NOTE: Prometheus bucket bounds in nanoseconds, 1us through 1s.
+constexpr std::array<uint64_t, 19> kLatencyBucketsNs = {
+  1'000, 2'500, 5'000, 10'000, 25'000, 50'000, 100'000, 250'000, 500'000,
+  1'000'000, 2'500'000, 5'000'000, 10'000'000, 25'000'000, 50'000'000,
+  100'000'000, 250'000'000, 500'000'000, 1'000'000'000,
+};
+
+void AppendCounter(
+    std::string& out, std::string_view name, std::string_view help, uint64_t value) {
+  absl::StrAppend(&out, "# HELP ", name, " ", help, "\n");
+  absl::StrAppend(&out, "# TYPE ", name, " counter\n");
+  absl::StrAppend(&out, name, " ", value, "\n");
+}
+
+void AppendGauge(
+    std::string& out, std::string_view name, std::string_view help, uint64_t value) {
+  absl::StrAppend(&out, "# HELP ", name, " ", help, "\n");
+  absl::StrAppend(&out, "# TYPE ", name, " gauge\n");
+  absl::StrAppend(&out, name, " ", value, "\n");
+}
+
+void AppendStage(std::string& out, std::string_view stage, const ShardedHistogram& stage_ns) {
+  static constexpr std::string_view kName = "tiny_dns_stage_latency_seconds";
+  const Histogram histogram = stage_ns.Snapshot();
+  for (const uint64_t bound : kLatencyBucketsNs) {
+    absl::StrAppend(&out, kName, "_bucket{stage=\"", stage, "\",le=\"",
+        absl::StrFormat("%g", bound / 1e9), "\"} ", histogram.CountAtOrBelow(bound), "\n");
+  }
+  absl::StrAppend(&out, kName, "_bucket{stage=\"", stage, "\",le=\"+Inf\"} ",
+      histogram.Count(), "\n");
+  absl::StrAppend(&out, kName, "_sum{stage=\"", stage, "\"} ",
+      absl::StrFormat("%.9f", stage_ns.Sum() / 1e9), "\n");
+  absl::StrAppend(&out, kName, "_count{stage=\"", stage, "\"} ", histogram.Count(), "\n");
+}
+
+} // namespace
+
+std::string PrometheusText(const ServerMetrics& metrics, const RecordStoreStats& store_stats) {
+  std::string out;
+  AppendCounter(out, "tiny_dns_queries_total",
+      "Queries received.", metrics.queries.Value());
+  AppendCounter(out, "tiny_dns_cache_hits_total",
+      "Queries answered from the record store.", metrics.cache_hits.Value());
+  AppendCounter(out, "tiny_dns_cache_misses_total",
+      "Queries with no answer in the record store.", metrics.cache_misses.Value());
+  AppendCounter(out, "tiny_dns_forwards_total",
+      "Queries forwarded to the fallback DNS server.", metrics.forwards.Value());
+  AppendCounter(out, "tiny_dns_forward_errors_total",
+      "Forwarded queries that failed.", metrics.forward_errors.Value());
+  AppendCounter(out, "tiny_dns_cname_chases_total",
+      "CNAMEs followed to complete an answer.", metrics.cname_chases.Value());
+  AppendCounter(out, "tiny_dns_rate_limit_drops_total",
+      "Responses dropped for being over a rate limit.", metrics.rate_limit_drops.Value());
+  AppendCounter(out, "tiny_dns_rate_limit_slips_total",
+      "Truncated responses sent for being over a rate limit.",
+      metrics.rate_limit_slips.Value());
+  AppendCounter(out, "tiny_dns_shed_forwards_total",
+      "Misses answered without forwarding, for too many forwards in flight.",
+      metrics.shed_forwards.Value());
+  AppendCounter(out, "tiny_dns_shed_deadlines_total",
+      "Requests abandoned for waiting past their queue deadline.",
+      metrics.shed_deadlines.Value());
+  AppendCounter(out, "tiny_dns_shed_overload_total",
+      "Requests shed on receipt for too many in flight.", metrics.shed_overload.Value());
+  AppendCounter(out, "tiny_dns_hot_name_hits_total",
+      "Queries answered from a serving thread's hot name cache.", metrics.hot_name_hits.Value());
+  AppendCounter(out, "tiny_dns_hot_name_misses_total",
+      "Hot name cache lookups that missed.", metrics.hot_name_misses.Value());
+  AppendCounter(out, "tiny_dns_hot_name_invalidations_total",
+      "Hot name cache misses on entries made stale by record store writes.",
+      metrics.hot_name_invalidations.Value());
+  AppendCounter(out, "tiny_dns_serv_fail_total",
+      "SERV_FAIL responses sent.", metrics.serv_fail.Value());
+  AppendCounter(out, "tiny_dns_form_error_total",
+      "FORM_ERROR responses sent.", metrics.form_error.Value());
+  AppendCounter(out, "tiny_dns_send_errors_total",
+      "Responses that could not be sent.", metrics.send_errors.Value());
+  AppendGauge(out, "tiny_dns_record_store_size",
+      "Records held in the record store.", store_stats.size);
+  AppendCounter(out, "tiny_dns_record_store_expired_total",
+      "Records removed from the record store for outliving their ttl.",
+      store_stats.expired);
+  AppendGauge(out, "tiny_dns_record_store_pending_expirations",
+      "Entries queued for the record store's expiry thread.",
+      store_stats.pending_expirations);
+
+  absl::StrAppend(&out, "# HELP tiny_dns_stage_latency_seconds "
+      "Per stage query latency, sampled 1 in ", kTimingSampleRate, " queries.\n");
+  absl::StrAppend(&out, "# TYPE tiny_dns_stage_latency_seconds histogram\n");
+  AppendStage(out, "receive", metrics.receive_ns);
+  AppendStage(out, "parse", metrics.parse_ns);
+  AppendStage(out, "lookup", metrics.lookup_ns);
+  AppendStage(out, "forward", metrics.forward_ns);
+  AppendStage(out, "encode", metrics.encode_ns);
+  AppendStage(out, "send", metrics.send_ns);
+  AppendStage(out, "total", metrics.total_ns);
+  return out;
+}
+
+} // tiny_dns
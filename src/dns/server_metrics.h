@@ -0,0 +1,88 @@
+#ifndef SRC_DNS_SERVER_METRICS_H_
+#define SRC_DNS_SERVER_METRICS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "src/common/metrics.h"
+#include "src/dns/record_store.h"
+
+// Everything the DNS server counts about the queries it serves. Counters are
+// updated for every query; stage latencies are only timed for one in every
+// kTimingSampleRate queries, since reading the clock at each stage boundary
+// would cost more than the rest of the instrumentation put together.
+
+namespace tiny_dns {
+
+inline constexpr uint64_t kTimingSampleRate = 64;
+
+struct ServerMetrics {
+  ShardedCounter queries;
+  ShardedCounter cache_hits;
+  ShardedCounter cache_misses;
+  ShardedCounter forwards;
+  ShardedCounter forward_errors;
+  // NOTE: CNAMEs followed to a target the answer didn't already include.
+  ShardedCounter cname_chases;
+  // NOTE: queries and responses over a rate limit, dropped or answered
+  // truncated ("slipped").
+  ShardedCounter rate_limit_drops;
+  ShardedCounter rate_limit_slips;
+  // NOTE: load shed by admission control: misses answered without a forward
+  // for want of forward budget, requests past their queue deadline, and
+  // requests dropped on receipt with too many already being served.
+  ShardedCounter shed_forwards;
+  ShardedCounter shed_deadlines;
+  ShardedCounter shed_overload;
+  // NOTE: lookups in the serving threads' hot name caches, see HotNameCache.
+  // Hits are also cache hits. Invalidations are misses on an entry for the
+  // request that a store write since made stale: the cost of invalidating.
+  ShardedCounter hot_name_hits;
+  ShardedCounter hot_name_misses;
+  ShardedCounter hot_name_invalidations;
+  ShardedCounter serv_fail;
+  ShardedCounter form_error;
+  ShardedCounter send_errors;
+
+  // NOTE: all in nanoseconds. receive is the time from recvfrom() returning
+  // to the request being picked up for handling.
+  ShardedHistogram receive_ns;
+  ShardedHistogram parse_ns;
+  ShardedHistogram lookup_ns;
+  ShardedHistogram forward_ns;
+  ShardedHistogram encode_ns;
+  ShardedHistogram send_ns;
+  ShardedHistogram total_ns;
+};
+
+inline int64_t MonotonicNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records the time between consecutive Lap() calls into a stage histogram.
+// A disabled timer never reads the clock.
+class StageTimer {
+ public:
+  explicit StageTimer(bool enabled) :
+    enabled_(enabled), last_ns_(enabled ? MonotonicNanos() : 0) {}
+
+  void Lap(ShardedHistogram& histogram) {
+    if (!enabled_) { return; }
+    const int64_t now = MonotonicNanos();
+    histogram.Record(now - last_ns_);
+    last_ns_ = now;
+  }
+
+ private:
+  bool enabled_;
+  int64_t last_ns_;
+};
+
+// NOTE: Prometheus text exposition format (version 0.0.4).
+std::string PrometheusText(const ServerMetrics& metrics, const RecordStoreStats& store_stats);
+
+} // tiny_dns
+
+#endif // SRC_DNS_SERVER_METRICS_H_
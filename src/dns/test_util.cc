@@ -0,0 +1,103 @@
+#include "src/dns/test_util.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <span>
+#include <string_view>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/status/statusor.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+
+namespace {
+
+std::atomic<size_t> live_counters = 0;
+std::atomic<size_t> allocation_count = 0;
+
+void CountAllocation() {
+  if (live_counters.load(std::memory_order_relaxed) > 0) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+  CountAllocation();
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) { throw std::bad_alloc(); }
+  return ptr;
+}
+// NOTE: std::pmr::new_delete_resource() goes through the aligned overloads.
+void* operator new(size_t size, std::align_val_t align) {
+  CountAllocation();
+  const size_t alignment = static_cast<size_t>(align);
+  void* ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+  if (ptr == nullptr) { throw std::bad_alloc(); }
+  return ptr;
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+namespace tiny_dns {
+
+DnsPacket CreateRequestPacket(
+    std::string_view qname, QueryType qtype, bool recursion_desired, uint16_t id) {
+  DnsPacket request = {};
+  request.header.id = id;
+  request.header.recursion_desired = recursion_desired;
+  Question question = {};
+  question.qname = qname;
+  question.qtype = qtype;
+  request.questions.push_back(std::move(question));
+  return request;
+}
+
+std::array<uint8_t, 512> CreateRequest(
+    std::string_view qname, QueryType qtype, bool recursion_desired, uint16_t id) {
+  std::array<uint8_t, 512> bytes = {};
+  CHECK_OK(CreateRequestPacket(qname, qtype, recursion_desired, id).ToBytes(bytes).status());
+  return bytes;
+}
+
+ForwardRequest CreateForwardRequest(std::string_view qname, uint16_t id) {
+  ForwardRequest forward;
+  const absl::StatusOr<std::span<const uint8_t>> query =
+    CreateRequestPacket(qname, QueryType::A, /*recursion_desired=*/true, id)
+    .ToBytes(forward.query);
+  CHECK_OK(query.status());
+  forward.query_size = query->size();
+  return forward;
+}
+
+Record CreateARecord(std::string_view qname, uint8_t last_octet, uint32_t ttl) {
+  Record record = {};
+  record.qname = qname;
+  record.qtype = QueryType::A;
+  record.ttl = ttl;
+  record.data = Record::A { .ip_address = {10, 0, 0, last_octet} };
+  return record;
+}
+
+AllocationCounter::AllocationCounter() {
+  live_counters.fetch_add(1, std::memory_order_relaxed);
+  start_ = allocation_count.load(std::memory_order_relaxed);
+}
+
+AllocationCounter::~AllocationCounter() {
+  live_counters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t AllocationCounter::Count() const {
+  return allocation_count.load(std::memory_order_relaxed) - start_;
+}
+
+} // tiny_dns
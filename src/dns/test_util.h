@@ -0,0 +1,54 @@
+#ifndef SRC_DNS_TEST_UTIL_H_
+#define SRC_DNS_TEST_UTIL_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "src/dns/dns_packet.h"
+#include "src/dns/forwarder.h"
+
+// Helpers shared by the tests and benchmarks: requests and records to feed
+// the code under test, and a count of the heap allocations it makes.
+//
+// Linking this library replaces the global operator new and delete, so that
+// AllocationCounter sees every allocation in the binary. While no counter is
+// alive they cost one relaxed load over malloc.
+
+namespace tiny_dns {
+
+// NOTE: a request for a single question.
+DnsPacket CreateRequestPacket(
+    std::string_view qname, QueryType qtype = QueryType::A, bool recursion_desired = false,
+    uint16_t id = 0x1234);
+// NOTE: as CreateRequestPacket, encoded.
+std::array<uint8_t, 512> CreateRequest(
+    std::string_view qname, QueryType qtype = QueryType::A, bool recursion_desired = false,
+    uint16_t id = 0x1234);
+// NOTE: a recursive request for an A record, to Submit() to a Forwarder.
+ForwardRequest CreateForwardRequest(std::string_view qname, uint16_t id = 0x1234);
+
+// NOTE: the A record 10.0.0.<last_octet>.
+Record CreateARecord(std::string_view qname, uint8_t last_octet, uint32_t ttl = 300);
+
+// NOTE: counts the heap allocations made through the global operator new,
+// on any thread, while alive.
+class AllocationCounter {
+ public:
+  AllocationCounter();
+  ~AllocationCounter();
+
+  AllocationCounter(const AllocationCounter&) = delete;
+  AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+  // NOTE: since construction.
+  size_t Count() const;
+
+ private:
+  size_t start_;
+};
+
+} // tiny_dns
+
+#endif // SRC_DNS_TEST_UTIL_H_
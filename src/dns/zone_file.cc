@@ -0,0 +1,553 @@
+#include "src/dns/zone_file.h"
+
+#include <algorithm>
+#include <array>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "src/common/parallel_for.h"
+#include "src/common/status_macros.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/rdata_codec.h"
+#include "src/dns/record_store.h"
+
+namespace tiny_dns {
+namespace {
+
+struct Token {
+  std::string_view text;
+  bool quoted = false;
+};
+
+// NOTE: what an entry inherits from the directives before it.
+struct ParserState {
+  // NOTE: without the trailing dot, as qnames are stored.
+  std::string origin;
+  std::optional<uint32_t> default_ttl;
+};
+
+struct Chunk {
+  size_t begin;
+  size_t end;
+  size_t first_line;
+  ParserState state;
+};
+
+bool IsBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+bool EndsBareToken(char c) {
+  return IsBlank(c) || c == '\n' || c == ';' || c == '(' || c == ')' || c == '"';
+}
+
+absl::Status LineError(size_t line, std::string_view message) {
+  return absl::InvalidArgumentError(absl::StrCat("Zone file line ", line, ": ", message));
+}
+
+// NOTE: reads the tokens of the next entry, which spans lines while inside
+// parentheses, skipping lines with nothing on them. Returns false at the end.
+absl::StatusOr<bool> NextEntry(
+    std::string_view text, size_t& pos, size_t& line,
+    std::vector<Token>& tokens, bool& blank_owner, size_t& entry_line) {
+  tokens.clear();
+  while (pos < text.size()) {
+    entry_line = line;
+    blank_owner = IsBlank(text[pos]);
+    int depth = 0;
+    while (pos < text.size()) {
+      const char c = text[pos];
+      if (c == '\n') {
+        pos++;
+        line++;
+        if (depth == 0) { break; }
+      } else if (IsBlank(c)) {
+        pos++;
+      } else if (c == ';') {
+        while (pos < text.size() && text[pos] != '\n') { pos++; }
+      } else if (c == '(') {
+        depth++;
+        pos++;
+      } else if (c == ')') {
+        if (depth == 0) { return LineError(line, "unbalanced ')'"); }
+        depth--;
+        pos++;
+      } else if (c == '"') {
+        const size_t start = ++pos;
+        while (pos < text.size() && text[pos] != '"' && text[pos] != '\n') {
+          pos += (text[pos] == '\\') ? 2 : 1;
+        }
+        if (pos >= text.size() || text[pos] != '"') {
+          return LineError(line, "unterminated quoted string");
+        }
+        tokens.push_back(Token { .text = text.substr(start, pos - start), .quoted = true });
+        pos++;
+      } else {
+        const size_t start = pos;
+        while (pos < text.size() && !EndsBareToken(text[pos])) {
+          pos += (text[pos] == '\\') ? 2 : 1;
+        }
+        pos = std::min(pos, text.size());
+        tokens.push_back(Token { .text = text.substr(start, pos - start) });
+      }
+    }
+    if (depth > 0) { return LineError(entry_line, "unbalanced '('"); }
+    if (!tokens.empty()) { return true; }
+  }
+  return false;
+}
+
+std::string ToName(std::string_view token, std::string_view origin) {
+  if (token == "@") { return std::string(origin); }
+  if (absl::EndsWith(token, ".")) { return std::string(token.substr(0, token.size() - 1)); }
+  if (origin.empty()) { return std::string(token); }
+  return absl::StrCat(token, ".", origin);
+}
+
+// NOTE: e.g. 3600, 1h or 1h30m.
+std::optional<uint32_t> ParseTtl(std::string_view token) {
+  uint64_t total = 0;
+  uint64_t value = 0;
+  bool has_digits = false;
+  for (size_t i = 0; i < token.size(); i++) {
+    const char c = token[i];
+    if (absl::ascii_isdigit(c)) {
+      value = value * 10 + (c - '0');
+      has_digits = true;
+      if (value > std::numeric_limits<uint32_t>::max()) { return std::nullopt; }
+      continue;
+    }
+    if (!has_digits) { return std::nullopt; }
+    uint64_t unit = 0;
+    switch (absl::ascii_tolower(c)) {
+      case 's': unit = 1; break;
+      case 'm': unit = 60; break;
+      case 'h': unit = 60 * 60; break;
+      case 'd': unit = 24 * 60 * 60; break;
+      case 'w': unit = 7 * 24 * 60 * 60; break;
+      default: return std::nullopt;
+    }
+    total += value * unit;
+    value = 0;
+    has_digits = false;
+  }
+  total += value;
+  if (token.empty() || total > std::numeric_limits<uint32_t>::max()) { return std::nullopt; }
+  return (uint32_t) total;
+}
+
+absl::StatusOr<QueryType> ParseType(std::string_view token) {
+  if (absl::StartsWithIgnoreCase(token, "TYPE")) {
+    uint32_t type = 0;
+    if (!absl::SimpleAtoi(token.substr(4), &type) || type > std::numeric_limits<uint16_t>::max()) {
+      return absl::InvalidArgumentError(absl::StrCat("invalid type: ", token));
+    }
+    return QueryTypeFromShort((uint16_t) type);
+  }
+  for (size_t i = 1; i < kRdataCodecs.size(); i++) {
+    if (absl::EqualsIgnoreCase(token, kRdataCodecs[i].name)) { return kRdataCodecs[i].type; }
+  }
+  return absl::InvalidArgumentError(absl::StrCat("unknown type: ", token));
+}
+
+template <typename T>
+absl::StatusOr<T> ParseUint(const Token& token) {
+  uint32_t value = 0;
+  if (!absl::SimpleAtoi(token.text, &value) || value > std::numeric_limits<T>::max()) {
+    return absl::InvalidArgumentError(absl::StrCat("invalid number: ", token.text));
+  }
+  return (T) value;
+}
+
+absl::StatusOr<uint32_t> ParseTtlToken(const Token& token) {
+  const std::optional<uint32_t> ttl = ParseTtl(token.text);
+  if (!ttl.has_value()) {
+    return absl::InvalidArgumentError(absl::StrCat("invalid ttl: ", token.text));
+  }
+  return *ttl;
+}
+
+// NOTE: resolves \X and \DDD escapes.
+absl::Status AppendCharacterString(const Token& token, std::pmr::vector<uint8_t>& bytes) {
+  const size_t size_pos = bytes.size();
+  bytes.push_back(0);
+  std::string_view text = token.text;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] != '\\' || i + 1 >= text.size()) {
+      bytes.push_back((uint8_t) text[i]);
+      continue;
+    }
+    uint32_t code = 0;
+    if (i + 3 < text.size() && absl::ascii_isdigit(text[i + 1])
+        && absl::ascii_isdigit(text[i + 2]) && absl::ascii_isdigit(text[i + 3])
+        && absl::SimpleAtoi(text.substr(i + 1, 3), &code) && code <= 255) {
+      bytes.push_back((uint8_t) code);
+      i += 3;
+      continue;
+    }
+    bytes.push_back((uint8_t) text[++i]);
+  }
+  const size_t size = bytes.size() - size_pos - 1;
+  if (size > std::numeric_limits<uint8_t>::max()) {
+    return absl::InvalidArgumentError("character-string longer than 255 bytes");
+  }
+  bytes[size_pos] = (uint8_t) size;
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<uint8_t>> ParseHex(std::span<const Token> tokens) {
+  std::string hex;
+  for (const Token& token : tokens) { hex += token.text; }
+  if (hex.size() % 2 != 0) { return absl::InvalidArgumentError("odd number of hex digits"); }
+  std::vector<uint8_t> bytes;
+  bytes.reserve(hex.size() / 2);
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    uint32_t byte = 0;
+    if (!absl::SimpleHexAtoi(std::string_view(hex).substr(i, 2), &byte)) {
+      return absl::InvalidArgumentError(absl::StrCat("invalid hex: ", hex.substr(i, 2)));
+    }
+    bytes.push_back((uint8_t) byte);
+  }
+  return bytes;
+}
+
+absl::Status ExpectTokens(std::span<const Token> rdata, size_t count, QueryType type) {
+  if (rdata.size() != count) {
+    return absl::InvalidArgumentError(absl::StrCat(
+          QueryTypeToString(type), " takes ", count, " fields, got ", rdata.size()));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<Record::Data> ParseRdata(
+    QueryType type, std::span<const Token> rdata, std::string_view origin) {
+  if (!rdata.empty() && rdata[0].text == "\\#" && !rdata[0].quoted) {
+    if (RdataCodecIndex(type) != 0) {
+      return absl::InvalidArgumentError(absl::StrCat(
+            "generic RDATA is only supported for types without a codec, not ",
+            QueryTypeToString(type)));
+    }
+    if (rdata.size() < 2) { return absl::InvalidArgumentError("missing RDATA length"); }
+    ASSIGN_OR_RETURN(const uint16_t length, ParseUint<uint16_t>(rdata[1]));
+    ASSIGN_OR_RETURN(const std::vector<uint8_t> bytes, ParseHex(rdata.subspan(2)));
+    if (bytes.size() != length) {
+      return absl::InvalidArgumentError(absl::StrCat(
+            "RDATA length ", length, " does not match ", bytes.size(), " bytes given"));
+    }
+    return Record::UNKNOWN { .bytes = std::pmr::vector<uint8_t>(bytes.begin(), bytes.end()) };
+  }
+
+  switch (type) {
+    case QueryType::A: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 1, type));
+      Record::A data = {};
+      if (inet_pton(AF_INET, std::string(rdata[0].text).c_str(), data.ip_address.data()) != 1) {
+        return absl::InvalidArgumentError(absl::StrCat("invalid IPv4 address: ", rdata[0].text));
+      }
+      return data;
+    }
+    case QueryType::AAAA: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 1, type));
+      std::array<uint8_t, 16> bytes = {};
+      if (inet_pton(AF_INET6, std::string(rdata[0].text).c_str(), bytes.data()) != 1) {
+        return absl::InvalidArgumentError(absl::StrCat("invalid IPv6 address: ", rdata[0].text));
+      }
+      Record::AAAA data = {};
+      for (size_t i = 0; i < data.ip_address.size(); i++) {
+        data.ip_address[i] = (uint16_t) (bytes[2 * i] << 8 | bytes[2 * i + 1]);
+      }
+      return data;
+    }
+    case QueryType::NS: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 1, type));
+      return Record::NS { .host = std::pmr::string(ToName(rdata[0].text, origin)) };
+    }
+    case QueryType::CNAME: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 1, type));
+      return Record::CNAME { .host = std::pmr::string(ToName(rdata[0].text, origin)) };
+    }
+    case QueryType::PTR: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 1, type));
+      return Record::PTR { .host = std::pmr::string(ToName(rdata[0].text, origin)) };
+    }
+    case QueryType::MX: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 2, type));
+      Record::MX data = {};
+      ASSIGN_OR_RETURN(data.priority, ParseUint<uint16_t>(rdata[0]));
+      data.host = ToName(rdata[1].text, origin);
+      return data;
+    }
+    case QueryType::SOA: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 7, type));
+      Record::SOA data = {};
+      data.mname = ToName(rdata[0].text, origin);
+      data.rname = ToName(rdata[1].text, origin);
+      ASSIGN_OR_RETURN(data.serial, ParseUint<uint32_t>(rdata[2]));
+      ASSIGN_OR_RETURN(data.refresh, ParseTtlToken(rdata[3]));
+      ASSIGN_OR_RETURN(data.retry, ParseTtlToken(rdata[4]));
+      ASSIGN_OR_RETURN(data.expire, ParseTtlToken(rdata[5]));
+      ASSIGN_OR_RETURN(data.minimum, ParseTtlToken(rdata[6]));
+      return data;
+    }
+    case QueryType::TXT: {
+      if (rdata.empty()) { return absl::InvalidArgumentError("TXT takes at least 1 string"); }
+      Record::TXT data = {};
+      for (const Token& token : rdata) { RETURN_IF_ERROR(AppendCharacterString(token, data.bytes)); }
+      return data;
+    }
+    case QueryType::SRV: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 4, type));
+      Record::SRV data = {};
+      ASSIGN_OR_RETURN(data.priority, ParseUint<uint16_t>(rdata[0]));
+      ASSIGN_OR_RETURN(data.weight, ParseUint<uint16_t>(rdata[1]));
+      ASSIGN_OR_RETURN(data.port, ParseUint<uint16_t>(rdata[2]));
+      data.target = ToName(rdata[3].text, origin);
+      return data;
+    }
+    case QueryType::URI: {
+      RETURN_IF_ERROR(ExpectTokens(rdata, 3, type));
+      Record::URI data = {};
+      ASSIGN_OR_RETURN(data.priority, ParseUint<uint16_t>(rdata[0]));
+      ASSIGN_OR_RETURN(data.weight, ParseUint<uint16_t>(rdata[1]));
+      data.target = rdata[2].text;
+      return data;
+    }
+    default: {
+      return absl::InvalidArgumentError(absl::StrCat(
+            QueryTypeToString(type), " RDATA must use the \\# generic syntax"));
+    }
+  }
+}
+
+// NOTE: tokens[0] is the directive.
+absl::Status ApplyDirective(std::span<const Token> tokens, ParserState& state) {
+  if (absl::EqualsIgnoreCase(tokens[0].text, "$ORIGIN") && tokens.size() == 2) {
+    state.origin = ToName(tokens[1].text, state.origin);
+    return absl::OkStatus();
+  }
+  if (absl::EqualsIgnoreCase(tokens[0].text, "$TTL") && tokens.size() == 2) {
+    ASSIGN_OR_RETURN(state.default_ttl, ParseTtlToken(tokens[1]));
+    return absl::OkStatus();
+  }
+  return absl::InvalidArgumentError(absl::StrCat("unsupported directive: ", tokens[0].text));
+}
+
+absl::StatusOr<Record> ParseRecord(
+    std::span<const Token> tokens, bool blank_owner,
+    const ParserState& state, std::string& last_owner) {
+  size_t i = 0;
+  if (!blank_owner) { last_owner = ToName(tokens[i++].text, state.origin); }
+  if (last_owner.empty() && blank_owner) {
+    return absl::InvalidArgumentError("entry has no owner, and there is no previous one");
+  }
+  std::optional<uint32_t> ttl;
+  for (size_t fields = 0; fields < 2 && i < tokens.size(); fields++) {
+    const std::string_view field = tokens[i].text;
+    if (!field.empty() && absl::ascii_isdigit(field[0])) {
+      ASSIGN_OR_RETURN(ttl, ParseTtlToken(tokens[i]));
+      i++;
+    } else if (absl::EqualsIgnoreCase(field, "IN")) {
+      i++;
+    } else if (absl::EqualsIgnoreCase(field, "CH") || absl::EqualsIgnoreCase(field, "HS")
+        || absl::EqualsIgnoreCase(field, "CS")) {
+      return absl::InvalidArgumentError(absl::StrCat("unsupported class: ", field));
+    } else {
+      break;
+    }
+  }
+  if (i >= tokens.size()) { return absl::InvalidArgumentError("missing type"); }
+  if (!ttl.has_value()) { ttl = state.default_ttl; }
+  if (!ttl.has_value()) { return absl::InvalidArgumentError("missing ttl, and no $TTL set"); }
+
+  Record record = {};
+  record.qname = last_owner;
+  ASSIGN_OR_RETURN(record.qtype, ParseType(tokens[i++].text));
+  record.dns_class = 1;
+  record.ttl = *ttl;
+  ASSIGN_OR_RETURN(record.data, ParseRdata(record.qtype, tokens.subspan(i), state.origin));
+  return record;
+}
+
+absl::Status ParseChunk(std::string_view text, const Chunk& chunk, std::vector<Record>& records) {
+  ParserState state = chunk.state;
+  std::string last_owner;
+  std::vector<Token> tokens;
+  size_t pos = chunk.begin;
+  size_t line = chunk.first_line;
+  bool blank_owner = false;
+  size_t entry_line = line;
+  const std::string_view chunk_text = text.substr(0, chunk.end);
+  while (true) {
+    ASSIGN_OR_RETURN(const bool more,
+        NextEntry(chunk_text, pos, line, tokens, blank_owner, entry_line));
+    if (!more) { return absl::OkStatus(); }
+    if (!blank_owner && absl::StartsWith(tokens[0].text, "$")) {
+      const absl::Status status = ApplyDirective(tokens, state);
+      if (!status.ok()) { return LineError(entry_line, status.message()); }
+      continue;
+    }
+    absl::StatusOr<Record> record = ParseRecord(tokens, blank_owner, state, last_owner);
+    if (!record.ok()) { return LineError(entry_line, record.status().message()); }
+    records.push_back(*std::move(record));
+  }
+}
+
+// NOTE: a quick serial pass that only tracks what's needed to find chunk
+// boundaries: parentheses, quotes, comments and directives. A chunk only
+// ever starts on a line that names its owner, outside any parentheses.
+absl::StatusOr<std::vector<Chunk>> SplitChunks(
+    std::string_view text, const ZoneFileOptions& options) {
+  std::vector<Chunk> chunks;
+  ParserState state = { .origin = ToName(options.origin, ""), .default_ttl = std::nullopt };
+  chunks.push_back(Chunk { .begin = 0, .end = text.size(), .first_line = 1, .state = state });
+  std::vector<Token> tokens;
+  size_t pos = 0;
+  size_t line = 1;
+  int depth = 0;
+  while (pos < text.size()) {
+    if (depth == 0) {
+      const char c = text[pos];
+      if (pos - chunks.back().begin >= options.chunk_size
+          && !IsBlank(c) && c != '\n' && c != ';' && c != '$') {
+        chunks.back().end = pos;
+        chunks.push_back(Chunk { .begin = pos, .end = text.size(), .first_line = line, .state = state });
+      }
+      if (c == '$') {
+        bool blank_owner = false;
+        size_t entry_line = line;
+        ASSIGN_OR_RETURN(const bool more,
+            NextEntry(text, pos, line, tokens, blank_owner, entry_line));
+        if (!more) { break; }
+        const absl::Status status = ApplyDirective(tokens, state);
+        if (!status.ok()) { return LineError(entry_line, status.message()); }
+        continue;
+      }
+    }
+    while (pos < text.size() && text[pos] != '\n') {
+      switch (text[pos]) {
+        case '(': depth++; break;
+        case ')': depth = std::max(0, depth - 1); break;
+        case '\\': pos++; break;
+        case ';': {
+          while (pos + 1 < text.size() && text[pos + 1] != '\n') { pos++; }
+        } break;
+        case '"': {
+          pos++;
+          while (pos < text.size() && text[pos] != '"' && text[pos] != '\n') {
+            if (text[pos] == '\\') { pos++; }
+            pos++;
+          }
+          // NOTE: an unterminated quote stops at the newline, for ParseChunk to report.
+          if (pos < text.size() && text[pos] == '\n') { continue; }
+        } break;
+        default: break;
+      }
+      pos++;
+    }
+    pos++;
+    line++;
+  }
+  return chunks;
+}
+
+absl::StatusOr<std::vector<std::vector<Record>>> ParseZoneParts(
+    std::string_view text, const ZoneFileOptions& options, size_t& chunk_count) {
+  ASSIGN_OR_RETURN(const std::vector<Chunk> chunks, SplitChunks(text, options));
+  chunk_count = chunks.size();
+  std::vector<std::vector<Record>> parts(chunks.size());
+  std::vector<absl::Status> statuses(chunks.size());
+  ParallelFor(chunks.size(), options.threads, [&](size_t i) {
+    statuses[i] = ParseChunk(text, chunks[i], parts[i]);
+  });
+  for (const absl::Status& status : statuses) { RETURN_IF_ERROR(status); }
+  return parts;
+}
+
+int64_t NanosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+double ZoneLoadStats::SecondsPerMillionRecords() const {
+  if (records == 0) { return 0; }
+  return (parse_ns + insert_ns) / 1e9 * (1e6 / records);
+}
+
+absl::StatusOr<std::vector<Record>> ParseZone(
+    std::string_view text, const ZoneFileOptions& options) {
+  size_t chunk_count = 0;
+  ASSIGN_OR_RETURN(std::vector<std::vector<Record>> parts,
+      ParseZoneParts(text, options, chunk_count));
+  std::vector<Record> records;
+  for (std::vector<Record>& part : parts) {
+    std::move(part.begin(), part.end(), std::back_inserter(records));
+  }
+  return records;
+}
+
+absl::StatusOr<ZoneLoadStats> LoadZoneFile(
+    const std::string& path, RecordStore& store, const ZoneFileOptions& options) {
+  const auto start = std::chrono::steady_clock::now();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(absl::StrCat("Unable to open ", path, ": ", strerror(errno)));
+  }
+  absl::Cleanup close_fd = [fd] { close(fd); };
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0) {
+    return absl::FailedPreconditionError(absl::StrCat("Unable to stat ", path, ": ", strerror(errno)));
+  }
+  ZoneLoadStats stats;
+  stats.bytes = file_stat.st_size;
+  std::string_view text;
+  void* mapped = nullptr;
+  if (stats.bytes > 0) {
+    mapped = mmap(nullptr, stats.bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      return absl::FailedPreconditionError(absl::StrCat("Unable to map ", path, ": ", strerror(errno)));
+    }
+    // NOTE: chunks are read in parallel, so read ahead of all of them.
+    madvise(mapped, stats.bytes, MADV_WILLNEED);
+    text = std::string_view(static_cast<const char*>(mapped), stats.bytes);
+  }
+  absl::Cleanup unmap = [mapped, &stats] { if (mapped != nullptr) { munmap(mapped, stats.bytes); } };
+
+  ASSIGN_OR_RETURN(std::vector<std::vector<Record>> parts,
+      ParseZoneParts(text, options, stats.chunks));
+  for (const std::vector<Record>& part : parts) { stats.records += part.size(); }
+  stats.parse_ns = NanosSince(start);
+
+  const auto insert_start = std::chrono::steady_clock::now();
+  store.InsertStatic(std::move(parts), options.threads);
+  stats.insert_ns = NanosSince(insert_start);
+  LOG(INFO) << "Loaded " << stats.records << " records (" << stats.bytes << " bytes, "
+    << stats.chunks << " chunks) from zone file " << path << " in "
+    << (stats.parse_ns + stats.insert_ns) / 1e9 << "s, "
+    << stats.SecondsPerMillionRecords() << "s per million records.";
+  return stats;
+}
+
+} // tiny_dns
@@ -0,0 +1,61 @@
+#ifndef SRC_DNS_ZONE_FILE_H_
+#define SRC_DNS_ZONE_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/record_store.h"
+
+// Loads RFC 1035 master ("zone") files into a RecordStore as static records,
+// i.e. ones that never expire.
+//
+// The file is memory mapped and split into chunks at entries that name their
+// owner, so no chunk depends on the previous one for it. Each chunk is
+// handed the $ORIGIN and $TTL in effect where it starts, and the chunks are
+// parsed in parallel. The parsed records then go straight into the store's
+// shards, each shard filled once, in parallel (see RecordStore::InsertStatic).
+//
+// Supported: $ORIGIN and $TTL; relative, absolute and "@" names; blank
+// owners; optional TTL (with s/m/h/d/w units) and class IN, in either order;
+// parentheses; comments; quoted strings; the types with a codec in
+// rdata_codec.h; and RFC 3597 TYPEnnn with \# generic RDATA for the rest.
+// Not supported: $INCLUDE, $GENERATE, other classes and escapes in names.
+// An entry without a TTL takes $TTL, which must then have been set.
+
+namespace tiny_dns {
+
+struct ZoneFileOptions {
+  // NOTE: for relative names ahead of the file's first $ORIGIN.
+  std::string origin = "";
+  // NOTE: 0 for one per core.
+  size_t threads = 0;
+  // NOTE: the approximate size of the chunks parsed in parallel.
+  size_t chunk_size = 1 << 20;
+};
+
+struct ZoneLoadStats {
+  size_t records = 0;
+  size_t bytes = 0;
+  size_t chunks = 0;
+  int64_t parse_ns = 0;
+  int64_t insert_ns = 0;
+
+  double SecondsPerMillionRecords() const;
+};
+
+// NOTE: parses text as if it were a zone file, without loading it anywhere.
+// Records are in file order.
+absl::StatusOr<std::vector<Record>> ParseZone(
+    std::string_view text, const ZoneFileOptions& options = {});
+
+absl::StatusOr<ZoneLoadStats> LoadZoneFile(
+    const std::string& path, RecordStore& store, const ZoneFileOptions& options = {});
+
+} // tiny_dns
+
+#endif // SRC_DNS_ZONE_FILE_H_
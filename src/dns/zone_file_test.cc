@@ -0,0 +1,143 @@
+#include "src/dns/zone_file.h"
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/status_matchers.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/record_store.h"
+
+namespace tiny_dns {
+namespace {
+
+using ::absl_testing::IsOk;
+using ::absl_testing::StatusIs;
+using ::testing::Eq;
+using ::testing::HasSubstr;
+using ::testing::SizeIs;
+
+constexpr std::string_view kZone = R"zone($ORIGIN example.com.
+$TTL 1h
+@       IN  SOA ns1 hostmaster (
+                2024010101 ; serial
+                2h 15m 2w 300 )
+        IN  NS  ns1
+ns1     300 IN  A   192.0.2.1
+www         IN  AAAA 2001:db8::1
+            IN  A   192.0.2.2
+mail    IN  60  MX  10 mx.other.example.
+_sip._udp   SRV 5 10 5060 sip
+text        TXT "hello \"world\"" plain \065
+legacy      TYPE65 \# 4 0001 0203
+$ORIGIN sub.example.com.
+alias       CNAME www.example.com.
+)zone";
+
+TEST(ZoneFileTest, ParsesRecords) {
+  absl::StatusOr<std::vector<Record>> records = ParseZone(kZone);
+  ASSERT_THAT(records, IsOk());
+  ASSERT_THAT(*records, SizeIs(10));
+
+  const Record& soa = (*records)[0];
+  EXPECT_THAT(soa.qname, Eq("example.com"));
+  EXPECT_THAT(soa.ttl, Eq(3600));
+  EXPECT_THAT(std::get<Record::SOA>(soa.data), Eq(Record::SOA {
+        .mname = std::pmr::string("ns1.example.com"),
+        .rname = std::pmr::string("hostmaster.example.com"),
+        .serial = 2024010101, .refresh = 7200, .retry = 900, .expire = 1209600, .minimum = 300,
+  }));
+  // NOTE: a blank owner is the previous entry's.
+  EXPECT_THAT((*records)[1].qname, Eq("example.com"));
+  EXPECT_THAT(std::get<Record::NS>((*records)[1].data).host, Eq("ns1.example.com"));
+  EXPECT_THAT((*records)[2].ttl, Eq(300));
+  EXPECT_THAT(std::get<Record::A>((*records)[2].data).ip_address,
+      Eq(std::array<uint8_t, 4> {192, 0, 2, 1}));
+  EXPECT_THAT(std::get<Record::AAAA>((*records)[3].data).ip_address,
+      Eq(std::array<uint16_t, 8> {0x2001, 0xdb8, 0, 0, 0, 0, 0, 1}));
+  EXPECT_THAT((*records)[4].qname, Eq("www.example.com"));
+
+  const Record& mx = (*records)[5];
+  EXPECT_THAT(mx.ttl, Eq(60));
+  EXPECT_THAT(std::get<Record::MX>(mx.data).host, Eq("mx.other.example"));
+  EXPECT_THAT(std::get<Record::SRV>((*records)[6].data).target, Eq("sip.example.com"));
+
+  const std::pmr::vector<uint8_t>& txt = std::get<Record::TXT>((*records)[7].data).bytes;
+  EXPECT_THAT(std::string(txt.begin(), txt.end()), Eq("\x0dhello \"world\"\x05plain\x01" "A"));
+  EXPECT_THAT((*records)[8].qtype, Eq(QueryTypeFromShort(65)));
+  EXPECT_THAT(std::get<Record::UNKNOWN>((*records)[8].data).bytes,
+      Eq(std::pmr::vector<uint8_t> {0, 1, 2, 3}));
+  EXPECT_THAT((*records)[9].qname, Eq("alias.sub.example.com"));
+  EXPECT_THAT(std::get<Record::CNAME>((*records)[9].data).host, Eq("www.example.com"));
+}
+
+TEST(ZoneFileTest, ChunkedParseMatchesSerialParse) {
+  std::string zone = "$ORIGIN example.com.\n$TTL 300\n";
+  for (int i = 0; i < 500; i++) {
+    absl::StrAppend(&zone, "host-", i, " IN A 10.0.", i / 256, ".", i % 256, "\n");
+    if (i % 100 == 0) { absl::StrAppend(&zone, "  60 TXT \"(not a paren\"\n"); }
+    if (i == 250) { absl::StrAppend(&zone, "$ORIGIN other.example.\n$TTL 600\n"); }
+  }
+  absl::StatusOr<std::vector<Record>> serial = ParseZone(zone);
+  absl::StatusOr<std::vector<Record>> chunked = ParseZone(
+      zone, ZoneFileOptions { .threads = 4, .chunk_size = 64 });
+  ASSERT_THAT(serial, IsOk());
+  ASSERT_THAT(chunked, IsOk());
+  ASSERT_THAT(*chunked, SizeIs(serial->size()));
+  for (size_t i = 0; i < serial->size(); i++) {
+    EXPECT_THAT((*chunked)[i].qname, Eq((*serial)[i].qname)) << i;
+    EXPECT_THAT((*chunked)[i].ttl, Eq((*serial)[i].ttl)) << i;
+    EXPECT_TRUE((*chunked)[i].data == (*serial)[i].data) << i;
+  }
+  EXPECT_THAT(serial->back().qname, Eq("host-499.other.example"));
+  EXPECT_THAT(serial->back().ttl, Eq(600));
+}
+
+TEST(ZoneFileTest, ReportsErrorsWithLineNumbers) {
+  EXPECT_THAT(ParseZone("$TTL 60\na A 10.0.0.1\nb A 10.0.0\n"),
+      StatusIs(absl::StatusCode::kInvalidArgument, HasSubstr("line 3")));
+  EXPECT_THAT(ParseZone("a A 10.0.0.1\n"),
+      StatusIs(absl::StatusCode::kInvalidArgument, HasSubstr("no $TTL")));
+  EXPECT_THAT(ParseZone("$TTL 60\na MX ( 10\n"),
+      StatusIs(absl::StatusCode::kInvalidArgument, HasSubstr("unbalanced")));
+  EXPECT_THAT(ParseZone("$INCLUDE other.zone\n"),
+      StatusIs(absl::StatusCode::kInvalidArgument, HasSubstr("unsupported directive")));
+}
+
+TEST(ZoneFileTest, LoadsFileIntoStore) {
+  const std::string path = testing::TempDir() + "/zone_file_test.zone";
+  FILE* file = fopen(path.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fputs(std::string(kZone).c_str(), file);
+  fclose(file);
+
+  RecordStore store(4);
+  absl::StatusOr<ZoneLoadStats> stats =
+    LoadZoneFile(path, store, ZoneFileOptions { .threads = 2, .chunk_size = 64 });
+  ASSERT_THAT(stats, IsOk());
+  EXPECT_THAT(stats->records, Eq(10));
+  EXPECT_THAT(stats->bytes, Eq(kZone.size()));
+  EXPECT_THAT(stats->chunks, Eq(5));
+
+  Question question = {};
+  question.qname = "www.example.com";
+  question.qtype = QueryType::A;
+  const std::pmr::vector<Record> hits = store.Query(question);
+  ASSERT_THAT(hits, SizeIs(1));
+  EXPECT_THAT(hits[0].ttl, Eq(3600));
+  EXPECT_THAT(store.GetStats().size, Eq(10));
+
+  EXPECT_THAT(LoadZoneFile(path + ".missing", store), StatusIs(absl::StatusCode::kNotFound));
+}
+
+} // namespace
+} // tiny_dns
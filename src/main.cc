@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <cstring>
 #include <thread>
@@ -10,14 +11,22 @@
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
+#include "absl/log/globals.h"
 #include "absl/log/initialize.h"
 #include "absl/log/log.h"
+#include "absl/log/log_sink_registry.h"
 #include "absl/log/check.h"
 #include "grpcpp/grpcpp.h"
 #include "grpcpp/ext/proto_server_reflection_plugin.h"
+#include "src/common/async_log_sink.h"
+#include "src/common/cpu_affinity.h"
 #include "src/dns/record_store.h"
-#include "src/dns/client.h"
 #include "src/dns/dns_server.h"
+#include "src/dns/forwarder.h"
+#include "src/dns/query_log.h"
+#include "src/dns/query_trace.h"
+#include "src/dns/rate_limiter.h"
+#include "src/dns/zone_file.h"
 #include "src/admin/dns_admin_service_impl.h"
 
 ABSL_FLAG(std::string, addr, "0.0.0.0",
@@ -30,6 +39,86 @@ ABSL_FLAG(std::string, fallback_dns_addr, "8.8.8.8",
           "If not empty, will forward failed resolution requests to this server.");
 ABSL_FLAG(int32_t, fallback_dns_port, 53,
           "fallback DNS server port.");
+ABSL_FLAG(int32_t, fallback_dns_timeout_ms, 2000,
+          "How long to wait for the fallback DNS server, 0 waits forever.");
+ABSL_FLAG(bool, async_logging, true,
+          "Write logs from a background thread instead of the logging thread. "
+          "Lines are dropped rather than block when the writer falls behind.");
+ABSL_FLAG(int32_t, async_log_buffer_lines, 4096,
+          "Log lines buffered for the background log writer.");
+ABSL_FLAG(std::string, trace_file, "",
+          "If not empty, every served query is recorded to this trace file.");
+ABSL_FLAG(int32_t, trace_buffer_entries, 16 * 1024,
+          "Queries buffered for the trace writer before new ones are dropped.");
+ABSL_FLAG(std::string, zone_file, "",
+          "If not empty, static records are loaded from this RFC 1035 zone file "
+          "before serving starts.");
+ABSL_FLAG(std::string, zone_origin, "",
+          "The origin for relative names ahead of the zone file's first $ORIGIN.");
+ABSL_FLAG(std::string, admin_zone_dir, "",
+          "If not empty, the admin LoadZoneFile RPC loads zone files from under "
+          "this directory. It's refused otherwise.");
+ABSL_FLAG(double, rrl_queries_per_second, 0,
+          "Queries accepted per second from each client prefix, 0 for no limit.");
+ABSL_FLAG(double, rrl_responses_per_second, 0,
+          "Identical responses sent per second to each client prefix, 0 for no limit.");
+ABSL_FLAG(double, rrl_window_seconds, 5,
+          "The burst allowed over the rate limits, in seconds' worth of the rate.");
+ABSL_FLAG(int32_t, rrl_slip, 2,
+          "1 in this many rate limited responses is sent truncated rather than "
+          "dropped, 0 drops them all.");
+ABSL_FLAG(int32_t, rrl_prefix_length, 24,
+          "Clients are rate limited together by this many leading address bits.");
+ABSL_FLAG(int32_t, max_inflight_forwards, 0,
+          "Misses beyond this many forwarded at once are answered without "
+          "forwarding, 0 for no limit.");
+ABSL_FLAG(bool, shed_refused, false,
+          "Misses shed for max_inflight_forwards or max_inflight_requests are "
+          "answered REFUSED rather than SERV_FAIL.");
+ABSL_FLAG(int32_t, max_queue_time_ms, 0,
+          "Requests still waiting to be served this long after being received "
+          "are dropped, 0 for no deadline.");
+ABSL_FLAG(bool, async_forwarding, false,
+          "Answer cache hits on the receiving thread and forward misses "
+          "asynchronously, instead of serving each request on its own thread.");
+ABSL_FLAG(int32_t, forwarder_max_inflight, 1024,
+          "Misses forwarded to the fallback DNS server at once; more are queued.");
+ABSL_FLAG(int32_t, forwarder_max_queued, 4096,
+          "Misses queued to forward before more are shed.");
+ABSL_FLAG(int32_t, max_inflight_requests, 0,
+          "Requests received with this many already being served are answered "
+          "from the record store on the receiving thread, and shed if they'd "
+          "be forwarded, 0 for no limit.");
+// NOTE: entries are invalidated through the generation of the record store
+// shard they were read from, which every write to the shard bumps, forwarded
+// answers being cached included. Answers read from several shards, i.e.
+// chased CNAMEs, aren't cached.
+ABSL_FLAG(int32_t, hot_name_cache_entries, 256,
+          "Each thread of the worker pool (see --worker_threads), or with "
+          "--async_forwarding the receiving thread, answers repeat queries "
+          "from a cache of its own of this many encoded responses, 0 for "
+          "none. Serving a thread per request, there is none. Writes to the "
+          "record store, including caching forwarded answers, clear the "
+          "entries in the shard written to.");
+ABSL_FLAG(std::string, io_cpus, "",
+          "If not empty, CPUs (e.g. \"0-3,8\") for the threads receiving "
+          "requests and forwarding them.");
+ABSL_FLAG(std::string, worker_cpus, "",
+          "If not empty, CPUs for a pool of threads serving requests, rather "
+          "than a thread per request.");
+ABSL_FLAG(int32_t, worker_threads, 0,
+          "If not 0, serve requests from a pool of this many threads rather "
+          "than a thread per request; with --worker_cpus, 0 is 8 per CPU. "
+          "Keep --max_inflight_forwards below it, so misses waiting on the "
+          "fallback DNS server can't tie up every thread.");
+ABSL_FLAG(std::string, housekeeping_cpus, "",
+          "If not empty, CPUs for every other thread: the admin gRPC server, "
+          "record expiry, logging and tracing.");
+ABSL_FLAG(bool, numa_shards, false,
+          "Spread the record store's shards across the NUMA nodes of "
+          "worker_cpus (or of the host), each allocated on its own node. Only "
+          "zone records, which are bulk loaded, are placed; cached answers are "
+          "allocated on whichever node inserts them.");
 
 using namespace tiny_dns;
 
@@ -37,52 +126,113 @@ int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
   absl::InitializeLog();
 
+  absl::StatusOr<std::vector<int>> io_cpus = ParseCpuList(absl::GetFlag(FLAGS_io_cpus));
+  CHECK_OK(io_cpus);
+  absl::StatusOr<std::vector<int>> worker_cpus = ParseCpuList(absl::GetFlag(FLAGS_worker_cpus));
+  CHECK_OK(worker_cpus);
+  absl::StatusOr<std::vector<int>> housekeeping_cpus =
+    ParseCpuList(absl::GetFlag(FLAGS_housekeeping_cpus));
+  CHECK_OK(housekeeping_cpus);
+  // NOTE: before any threads are started, they inherit it. The DNS threads
+  // pin themselves to their own CPUs.
+  CHECK_OK(PinCurrentThread(*housekeeping_cpus));
+
+  if (absl::GetFlag(FLAGS_async_logging)) {
+    // NOTE: the sink takes over writing to stderr from absl's own sink. It is
+    // deliberately leaked, detached serving threads may log until exit.
+    absl::SetStderrThreshold(absl::LogSeverityAtLeast::kInfinity);
+    absl::AddLogSink(new AsyncLogSink(
+          STDERR_FILENO, absl::GetFlag(FLAGS_async_log_buffer_lines)));
+  }
+
   srand(time(nullptr));
 
-  auto record_store = std::make_shared<RecordStore>();
+  std::vector<std::vector<int>> shard_node_cpus;
+  if (absl::GetFlag(FLAGS_numa_shards)) {
+    shard_node_cpus = NumaNodeCpus(*worker_cpus);
+    LOG(INFO) << "Spreading record store shards over " << shard_node_cpus.size() << " nodes.";
+  }
+  auto record_store = std::make_shared<RecordStore>(kDefaultShardCount, shard_node_cpus);
+  if (!absl::GetFlag(FLAGS_zone_file).empty()) {
+    LOG(INFO) << "Loading zone file: " << absl::GetFlag(FLAGS_zone_file);
+    ZoneFileOptions zone_options;
+    zone_options.origin = absl::GetFlag(FLAGS_zone_origin);
+    CHECK_OK(LoadZoneFile(absl::GetFlag(FLAGS_zone_file), *record_store, zone_options));
+  }
 
   LOG(INFO) << "Starting DNS UDP server: "
     << absl::GetFlag(FLAGS_addr) << ":" << absl::GetFlag(FLAGS_dns_port);
-  std::shared_ptr<Client> fallback_dns = nullptr;
+  std::shared_ptr<Forwarder> forwarder = nullptr;
   if (!absl::GetFlag(FLAGS_fallback_dns_addr).empty()) {
     LOG(INFO) << "Initiating fallback DNS lookup server connection: "
       << absl::GetFlag(FLAGS_fallback_dns_addr) << ":"
       << absl::GetFlag(FLAGS_fallback_dns_port);
-    absl::StatusOr<std::shared_ptr<Client>> temp_fallback_dns =
-      Client::Create(
+    ForwarderOptions forwarder_options;
+    forwarder_options.max_inflight = absl::GetFlag(FLAGS_forwarder_max_inflight);
+    forwarder_options.max_queued = absl::GetFlag(FLAGS_forwarder_max_queued);
+    forwarder_options.timeout =
+      std::chrono::milliseconds(absl::GetFlag(FLAGS_fallback_dns_timeout_ms));
+    forwarder_options.cpus = *io_cpus;
+    absl::StatusOr<std::unique_ptr<Forwarder>> temp_forwarder =
+      Forwarder::Create(
           absl::GetFlag(FLAGS_addr),
           absl::GetFlag(FLAGS_fallback_dns_addr),
-          absl::GetFlag(FLAGS_fallback_dns_port));
-    if (!temp_fallback_dns.ok()) {
+          absl::GetFlag(FLAGS_fallback_dns_port),
+          forwarder_options);
+    if (!temp_forwarder.ok()) {
       LOG(ERROR) << "Error initiating fallback DNS connection: "
-        << temp_fallback_dns.status();
-      fallback_dns = nullptr;
+        << temp_forwarder.status();
     } else {
-      fallback_dns = std::move(*temp_fallback_dns);
+      forwarder = std::move(*temp_forwarder);
     }
   }
+  const bool async_forwarding = absl::GetFlag(FLAGS_async_forwarding) && forwarder != nullptr;
   absl::StatusOr<std::shared_ptr<DnsServer>> dns_server =
     DnsServer::Create(
         absl::GetFlag(FLAGS_addr),
         absl::GetFlag(FLAGS_dns_port),
-        std::move(fallback_dns), record_store);
+        std::move(forwarder), record_store);
   CHECK_OK(dns_server);
+  if (!absl::GetFlag(FLAGS_trace_file).empty()) {
+    LOG(INFO) << "Recording query trace to: " << absl::GetFlag(FLAGS_trace_file);
+    absl::StatusOr<std::unique_ptr<TraceWriter>> trace_writer = TraceWriter::Create(
+        absl::GetFlag(FLAGS_trace_file), absl::GetFlag(FLAGS_trace_buffer_entries));
+    CHECK_OK(trace_writer);
+    (*dns_server)->EnableTracing(std::move(*trace_writer));
+  }
+  auto query_log = std::make_shared<QueryLog>();
+  (*dns_server)->EnableQueryLog(query_log);
+  RateLimiterOptions rate_limiter_options;
+  rate_limiter_options.queries_per_second = absl::GetFlag(FLAGS_rrl_queries_per_second);
+  rate_limiter_options.responses_per_second = absl::GetFlag(FLAGS_rrl_responses_per_second);
+  rate_limiter_options.window_seconds = absl::GetFlag(FLAGS_rrl_window_seconds);
+  rate_limiter_options.slip = absl::GetFlag(FLAGS_rrl_slip);
+  rate_limiter_options.ipv4_prefix_length = absl::GetFlag(FLAGS_rrl_prefix_length);
+  auto rate_limiter = std::make_shared<RateLimiter>(rate_limiter_options);
+  if (rate_limiter->enabled()) {
+    LOG(INFO) << "Rate limiting with " << rate_limiter->MemoryBytes() << " bytes of buckets.";
+    (*dns_server)->EnableRateLimiting(std::move(rate_limiter));
+  }
+  AdmissionOptions admission_options;
+  admission_options.max_inflight_forwards = absl::GetFlag(FLAGS_max_inflight_forwards);
+  admission_options.shed_response_code =
+    absl::GetFlag(FLAGS_shed_refused) ? ResponseCode::REFUSED : ResponseCode::SERV_FAIL;
+  admission_options.max_queue_time =
+    std::chrono::milliseconds(absl::GetFlag(FLAGS_max_queue_time_ms));
+  admission_options.max_inflight_requests = absl::GetFlag(FLAGS_max_inflight_requests);
+  (*dns_server)->EnableAdmissionControl(admission_options);
+  (*dns_server)->PinThreads(*io_cpus, *worker_cpus, absl::GetFlag(FLAGS_worker_threads));
+  (*dns_server)->EnableHotNameCache(absl::GetFlag(FLAGS_hot_name_cache_entries));
+  if (async_forwarding) { CHECK_OK((*dns_server)->EnableAsyncForwarding()); }
   auto dns_thread = std::thread([&]{ (*dns_server)->Wait(); });
 
   LOG(INFO) << "Starting DNS Admin gRPC server: "
     << absl::GetFlag(FLAGS_addr) << ":" << absl::GetFlag(FLAGS_admin_port);
-  absl::StatusOr<std::shared_ptr<Client>> dns_server_client = Client::Create(
-      absl::GetFlag(FLAGS_addr),
-      absl::GetFlag(FLAGS_addr),
-      absl::GetFlag(FLAGS_dns_port));
-  if (!dns_server_client.ok()) {
-    LOG(ERROR) << "Unable to create client connection to local server: "
-      << dns_server_client.status();
-    exit(1);
-  }
   grpc::reflection::InitProtoReflectionServerBuilderPlugin();
   grpc::ServerBuilder builder;
-  DnsAdminServiceImpl admin_service(record_store, std::move(*dns_server_client));
+  DnsAdminServiceImpl admin_service(
+      record_store, (*dns_server)->resolver(), (*dns_server)->metrics(), query_log,
+      absl::GetFlag(FLAGS_admin_zone_dir));
   builder.RegisterService(&admin_service);
   std::string admin_address = absl::StrCat(
       absl::GetFlag(FLAGS_addr), ":", absl::GetFlag(FLAGS_admin_port));
@@ -0,0 +1,482 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/initialize.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "src/common/cpu_affinity.h"
+#include "src/common/histogram.h"
+#include "src/common/status_macros.h"
+#include "src/common/zipfian.h"
+#include "src/dns/dns_packet.h"
+#include "src/tools/udp_source.h"
+
+// A dnsperf style load generator for tiny_dns. Queries are built once up front
+// with DnsPacket, then sent over many UDP source sockets with only the ID
+// patched per query. Two modes:
+// * closed: each socket keeps its share of --concurrency queries outstanding,
+//   sending the next one as soon as a response (or timeout) frees a slot.
+// * open: queries go out at a fixed --qps no matter how the server keeps up.
+//   Latency is measured from when a query was scheduled, not when it actually
+//   went out, so a stalled sender doesn't hide queueing delay.
+//
+// Reports latency percentiles, throughput, bandwidth, the timeout rate and a
+// breakdown of response codes. Intended to be run on localhost against
+// //src:main, e.g.
+//
+//   bazel run //src:main -- --fallback_dns_addr=
+//   bazel run //src/tools:dns_loadgen -- --mode=open --qps=50000 --sockets=64
+//
+// NOTE: without --recursion_desired the server never forwards, so names it
+// doesn't have come back as SERV_FAIL rather than hitting an upstream.
+
+ABSL_FLAG(std::string, server_addr, "127.0.0.1",
+          "Address of the DNS server under test.");
+ABSL_FLAG(int32_t, server_port, 4000,
+          "UDP port of the DNS server under test.");
+ABSL_FLAG(std::string, local_addr, "127.0.0.1",
+          "Address to send queries from.");
+ABSL_FLAG(std::string, names_file, "",
+          "File with one `qname [type]` per line. If empty, --num_names names "
+          "of the form host-<i>.<zone> are generated instead.");
+ABSL_FLAG(int32_t, num_names, 1000,
+          "Number of names to generate when --names_file is empty.");
+ABSL_FLAG(std::string, zone, "loadgen.test",
+          "Zone generated names live under.");
+ABSL_FLAG(std::string, qtype, "A",
+          "Query type for generated names, and lines without one.");
+ABSL_FLAG(double, zipf_theta, 0.99,
+          "Skew of name popularity in [0, 1), 0 is uniform.");
+ABSL_FLAG(bool, recursion_desired, false,
+          "Set the RD bit, allowing the server to forward misses.");
+ABSL_FLAG(std::string, mode, "closed",
+          "closed: fixed number of outstanding queries. open: fixed query rate.");
+ABSL_FLAG(int32_t, concurrency, 64,
+          "closed mode: outstanding queries, across all sockets.");
+ABSL_FLAG(double, qps, 10000,
+          "open mode: queries per second, across all sockets.");
+ABSL_FLAG(int32_t, sockets, 16,
+          "Number of UDP source sockets.");
+ABSL_FLAG(int32_t, threads, 1,
+          "Number of sending threads, sockets are spread across them.");
+ABSL_FLAG(std::string, cpus, "",
+          "If not empty, CPUs (e.g. \"8-15\") to run the sending threads on, "
+          "keeping them off the server's CPUs.");
+ABSL_FLAG(int32_t, duration_s, 10,
+          "How long to send queries for.");
+ABSL_FLAG(int32_t, timeout_ms, 1000,
+          "How long to wait for a response before counting a timeout.");
+
+namespace tiny_dns {
+namespace {
+
+constexpr size_t kResponseCodeCount = 6;
+
+enum class Mode { CLOSED, OPEN };
+
+struct Config {
+  Mode mode;
+  int32_t concurrency;
+  double qps;
+  int32_t sockets;
+  int32_t threads;
+  std::vector<int> cpus;
+  int64_t duration_ns;
+  int64_t timeout_ns;
+  std::string local_addr;
+  std::string server_addr;
+  int32_t server_port;
+};
+
+// NOTE: encoded once up front, only the ID differs between sends.
+struct Query {
+  std::array<uint8_t, 512> bytes;
+  size_t size;
+};
+
+struct Stats {
+  Histogram latency_ns;
+  uint64_t sent = 0;
+  uint64_t received = 0;
+  uint64_t timeouts = 0;
+  uint64_t unmatched = 0; // NOTE: late (already timed out) or unknown IDs.
+  uint64_t malformed = 0;
+  uint64_t send_errors = 0;
+  uint64_t dropped = 0; // NOTE: open mode, every ID on the socket was in use.
+  // NOTE: UDP payloads, of every query sent and every datagram received.
+  uint64_t bytes_sent = 0;
+  uint64_t bytes_received = 0;
+  std::array<uint64_t, kResponseCodeCount> response_codes = {};
+
+  void Merge(const Stats& other) {
+    latency_ns.Merge(other.latency_ns);
+    sent += other.sent;
+    received += other.received;
+    timeouts += other.timeouts;
+    unmatched += other.unmatched;
+    malformed += other.malformed;
+    send_errors += other.send_errors;
+    dropped += other.dropped;
+    bytes_sent += other.bytes_sent;
+    bytes_received += other.bytes_received;
+    for (size_t i = 0; i < kResponseCodeCount; i++) {
+      response_codes[i] += other.response_codes[i];
+    }
+  }
+};
+
+absl::StatusOr<QueryType> ParseQueryType(std::string_view name) {
+  std::string upper = absl::AsciiStrToUpper(name);
+  std::string_view type = upper;
+  uint32_t raw = 0;
+  if (absl::ConsumePrefix(&type, "TYPE") && absl::SimpleAtoi(type, &raw) && raw <= 0xffff) {
+    return QueryTypeFromShort(raw);
+  }
+  for (uint32_t i = 1; i <= QueryTypeToShort(QueryType::URI); i++) {
+    if (QueryTypeToString(QueryTypeFromShort(i)) == upper) { return QueryTypeFromShort(i); }
+  }
+  return absl::InvalidArgumentError(absl::StrCat("Unknown query type: ", upper));
+}
+
+absl::StatusOr<Query> EncodeQuery(std::string_view qname, QueryType qtype) {
+  DnsPacket packet = {};
+  packet.header.recursion_desired = absl::GetFlag(FLAGS_recursion_desired);
+  Question question = {};
+  question.qname = qname;
+  question.qtype = qtype;
+  packet.questions.push_back(std::move(question));
+  Query query = {};
+  ASSIGN_OR_RETURN(const std::span<const uint8_t> encoded, packet.ToBytes(query.bytes));
+  query.size = encoded.size();
+  return query;
+}
+
+absl::StatusOr<std::vector<Query>> LoadQueries() {
+  ASSIGN_OR_RETURN(const QueryType default_qtype, ParseQueryType(absl::GetFlag(FLAGS_qtype)));
+  std::vector<Query> queries;
+  const std::string names_file = absl::GetFlag(FLAGS_names_file);
+  if (names_file.empty()) {
+    for (int32_t i = 0; i < absl::GetFlag(FLAGS_num_names); i++) {
+      ASSIGN_OR_RETURN(Query query, EncodeQuery(
+            absl::StrCat("host-", i, ".", absl::GetFlag(FLAGS_zone)), default_qtype));
+      queries.push_back(std::move(query));
+    }
+  } else {
+    std::ifstream file(names_file);
+    if (!file.is_open()) {
+      return absl::NotFoundError(absl::StrCat("Unable to open: ", names_file));
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+      std::vector<std::string_view> fields =
+        absl::StrSplit(line, absl::ByAnyChar(" \t"), absl::SkipWhitespace());
+      if (fields.empty() || absl::StartsWith(fields[0], "#")) { continue; }
+      QueryType qtype = default_qtype;
+      if (fields.size() > 1) { ASSIGN_OR_RETURN(qtype, ParseQueryType(fields[1])); }
+      ASSIGN_OR_RETURN(Query query, EncodeQuery(fields[0], qtype));
+      queries.push_back(std::move(query));
+    }
+  }
+  if (queries.empty()) { return absl::InvalidArgumentError("No names to query."); }
+  return queries;
+}
+
+class Worker {
+ public:
+  Worker(const Config& config, const std::vector<Query>& queries,
+         const ZipfianGenerator& zipf, size_t index)
+    : config_(config), queries_(queries), zipf_(zipf), rng_(index + 1), sources_(),
+      windows_(), poll_fds_(), stats_(), sending_end_(0) {}
+
+  ~Worker() {
+    for (Source<std::monostate>& source : sources_) {
+      if (source.socket_fd >= 0) { close(source.socket_fd); }
+    }
+  }
+
+  absl::Status AddSource(size_t window) {
+    ASSIGN_OR_RETURN(const int32_t socket_fd, OpenSocket(
+          config_.local_addr, config_.server_addr, config_.server_port));
+    Source<std::monostate>& source = sources_.emplace_back();
+    source.socket_fd = socket_fd;
+    source.outstanding.reserve(
+        config_.mode == Mode::CLOSED ? window : kMaxOutstandingPerSource / 4);
+    windows_.push_back(window);
+    poll_fds_.push_back(pollfd { .fd = socket_fd, .events = POLLIN, .revents = 0 });
+    return absl::OkStatus();
+  }
+
+  void Run(int64_t start, int64_t end) {
+    if (sources_.empty()) { return; }
+    // NOTE: at least 1, or a --qps over a billion per thread would truncate
+    // to 0 and the send loop below would never advance.
+    const int64_t interval_ns = config_.mode == Mode::OPEN ?
+      std::max<int64_t>(1, static_cast<int64_t>(1e9 * config_.threads / config_.qps)) : 0;
+    int64_t next_send = start;
+    size_t next_source = 0;
+    while (true) {
+      const int64_t now = NowNanos();
+      const bool sending = now < end;
+      if (!sending && sending_end_ == 0) { sending_end_ = now; }
+      if (sending && config_.mode == Mode::CLOSED) {
+        for (size_t i = 0; i < sources_.size(); i++) {
+          while (sources_[i].outstanding.size() < windows_[i] && Send(sources_[i], now)) {}
+        }
+      } else if (sending) {
+        for (; next_send <= now && next_send < end; next_send += interval_ns) {
+          Send(sources_[next_source++ % sources_.size()], next_send);
+        }
+      }
+
+      bool idle = true;
+      int64_t wait_ns = sending && config_.mode == Mode::OPEN ?
+        next_send - now : config_.timeout_ns;
+      for (Source<std::monostate>& source : sources_) {
+        stats_.timeouts += source.ExpireTimeouts(now, config_.timeout_ns);
+        if (source.sent_order.empty()) { continue; }
+        idle = false;
+        wait_ns = std::min(
+            wait_ns, source.sent_order.front().second + config_.timeout_ns - now);
+      }
+      if (!sending && idle) { return; }
+      if (sending) { wait_ns = std::min(wait_ns, end - now); }
+
+      const struct timespec timeout = {
+        .tv_sec = std::max<int64_t>(wait_ns, 0) / 1'000'000'000,
+        .tv_nsec = std::max<int64_t>(wait_ns, 0) % 1'000'000'000,
+      };
+      if (ppoll(poll_fds_.data(), poll_fds_.size(), &timeout, nullptr) <= 0) { continue; }
+      for (size_t i = 0; i < sources_.size(); i++) {
+        if (poll_fds_[i].revents & POLLIN) { Receive(sources_[i]); }
+      }
+    }
+  }
+
+  const Stats& stats() const { return stats_; }
+  // NOTE: when Run() stopped sending, which can be after end if it stalled.
+  int64_t sending_end() const { return sending_end_; }
+
+ private:
+  // NOTE: false if the query couldn't be sent.
+  bool Send(Source<std::monostate>& source, int64_t scheduled) {
+    const std::optional<uint16_t> id = source.NextId();
+    if (!id.has_value()) {
+      stats_.dropped++;
+      return false;
+    }
+
+    // NOTE: the queries are shared between threads, so the ID goes out from
+    // a buffer of its own rather than being patched in place.
+    const Query& query = queries_[zipf_(rng_) % queries_.size()];
+    std::array<uint8_t, 2> id_bytes = { static_cast<uint8_t>(*id >> 8), static_cast<uint8_t>(*id) };
+    std::array<struct iovec, 2> iov = {{
+      { .iov_base = id_bytes.data(), .iov_len = id_bytes.size() },
+      { .iov_base = const_cast<uint8_t*>(query.bytes.data()) + 2, .iov_len = query.size - 2 },
+    }};
+    struct msghdr message = {};
+    message.msg_iov = iov.data();
+    message.msg_iovlen = iov.size();
+    if (sendmsg(source.socket_fd, &message, 0) < 0) {
+      stats_.send_errors++;
+      return false;
+    }
+    source.Track(*id, scheduled, std::monostate());
+    stats_.sent++;
+    stats_.bytes_sent += query.size;
+    return true;
+  }
+
+  void Receive(Source<std::monostate>& source) {
+    std::array<uint8_t, 512> response = {};
+    ssize_t size;
+    while ((size = recv(
+            source.socket_fd, response.data(), response.size(), MSG_DONTWAIT)) > 0) {
+      const int64_t now = NowNanos();
+      stats_.bytes_received += size;
+      BufferReader reader(response);
+      uint16_t questions_count, answers_count, authorities_count, additional_count;
+      const absl::StatusOr<Header> header = Header::FromBytes(
+          reader, questions_count, answers_count, authorities_count, additional_count);
+      if (!header.ok() || !header->query_response) {
+        stats_.malformed++;
+        continue;
+      }
+      auto it = source.outstanding.find(header->id);
+      if (it == source.outstanding.end()) {
+        stats_.unmatched++;
+        continue;
+      }
+      stats_.latency_ns.Record(now - it->second.sent_ns);
+      stats_.received++;
+      stats_.response_codes[ResponseCodeToByte(header->response_code)]++;
+      source.outstanding.erase(it);
+    }
+  }
+
+  const Config& config_;
+  const std::vector<Query>& queries_;
+  const ZipfianGenerator& zipf_;
+  std::mt19937_64 rng_;
+  std::vector<Source<std::monostate>> sources_;
+  // NOTE: closed mode, the queries each source keeps outstanding.
+  std::vector<size_t> windows_;
+  std::vector<struct pollfd> poll_fds_;
+  Stats stats_;
+  int64_t sending_end_;
+};
+
+void PrintReport(const Config& config, const Stats& stats, int64_t elapsed_ns) {
+  if (config.mode == Mode::CLOSED) {
+    absl::PrintF("mode: closed loop, %d outstanding", config.concurrency);
+  } else {
+    absl::PrintF("mode: open loop, %.0f qps target", config.qps);
+  }
+  absl::PrintF(", %d sockets, %d threads, against %s:%d\n",
+               config.sockets, config.threads, config.server_addr, config.server_port);
+  const double elapsed_s = elapsed_ns / 1e9;
+  absl::PrintF("duration:       %.2fs\n", elapsed_s);
+  absl::PrintF("queries sent:   %d\n", stats.sent);
+  absl::PrintF("responses:      %d (%.2f%%)\n", stats.received, Percent(stats.received, stats.sent));
+  absl::PrintF("timeouts:       %d (%.2f%%)\n", stats.timeouts, Percent(stats.timeouts, stats.sent));
+  absl::PrintF("unmatched:      %d\n", stats.unmatched);
+  absl::PrintF("malformed:      %d\n", stats.malformed);
+  absl::PrintF("send errors:    %d\n", stats.send_errors);
+  if (config.mode == Mode::OPEN) { absl::PrintF("dropped:        %d\n", stats.dropped); }
+  absl::PrintF("throughput:     %.0f qps sent, %.0f qps answered\n",
+               stats.sent / elapsed_s, stats.received / elapsed_s);
+  absl::PrintF("bytes:          %d sent, %d received\n", stats.bytes_sent, stats.bytes_received);
+  absl::PrintF("bandwidth:      %.2f Mbit/s sent, %.2f Mbit/s received\n",
+               stats.bytes_sent * 8 / elapsed_s / 1e6, stats.bytes_received * 8 / elapsed_s / 1e6);
+
+  absl::PrintF("\nlatency (us):\n");
+  const Histogram& latency = stats.latency_ns;
+  absl::PrintF("  %-8s %10.1f\n", "min", latency.Min() / 1e3);
+  for (const double percentile : {50.0, 75.0, 90.0, 95.0, 99.0, 99.9, 99.99}) {
+    absl::PrintF("  %-8s %10.1f\n", absl::StrCat("p", percentile),
+                 latency.Percentile(percentile) / 1e3);
+  }
+  absl::PrintF("  %-8s %10.1f\n", "max", latency.Max() / 1e3);
+  absl::PrintF("  %-8s %10.1f\n", "mean", latency.Mean() / 1e3);
+
+  absl::PrintF("\nresponse codes:\n");
+  for (size_t i = 0; i < kResponseCodeCount; i++) {
+    if (stats.response_codes[i] == 0) { continue; }
+    absl::PrintF("  %-10s %10d (%.2f%%)\n", ResponseCodeToString(ResponseCodeFromByte(i)),
+                 stats.response_codes[i], Percent(stats.response_codes[i], stats.received));
+  }
+}
+
+absl::StatusOr<Config> ConfigFromFlags() {
+  Config config = {
+    .mode = Mode::CLOSED,
+    .concurrency = absl::GetFlag(FLAGS_concurrency),
+    .qps = absl::GetFlag(FLAGS_qps),
+    .sockets = absl::GetFlag(FLAGS_sockets),
+    .threads = absl::GetFlag(FLAGS_threads),
+    .duration_ns = absl::GetFlag(FLAGS_duration_s) * int64_t{1'000'000'000},
+    .timeout_ns = absl::GetFlag(FLAGS_timeout_ms) * int64_t{1'000'000},
+    .local_addr = absl::GetFlag(FLAGS_local_addr),
+    .server_addr = absl::GetFlag(FLAGS_server_addr),
+    .server_port = absl::GetFlag(FLAGS_server_port),
+  };
+  ASSIGN_OR_RETURN(config.cpus, ParseCpuList(absl::GetFlag(FLAGS_cpus)));
+  const std::string mode = absl::GetFlag(FLAGS_mode);
+  if (mode == "open") { config.mode = Mode::OPEN; }
+  else if (mode != "closed") {
+    return absl::InvalidArgumentError(absl::StrCat("Unknown --mode: ", mode));
+  }
+  if (config.sockets < 1 || config.threads < 1 || config.concurrency < 1 || config.qps <= 0) {
+    return absl::InvalidArgumentError(
+        "--sockets, --threads, --concurrency and --qps must be positive.");
+  }
+  if (config.mode == Mode::CLOSED &&
+      config.concurrency > config.sockets * static_cast<int64_t>(kMaxOutstandingPerSource)) {
+    return absl::InvalidArgumentError("--concurrency is more than the sockets have IDs for.");
+  }
+  const double theta = absl::GetFlag(FLAGS_zipf_theta);
+  if (theta < 0 || theta >= 1) {
+    return absl::InvalidArgumentError("--zipf_theta must be in [0, 1).");
+  }
+  config.threads = std::min(config.threads, config.sockets);
+  return config;
+}
+
+absl::Status Run() {
+  ASSIGN_OR_RETURN(const Config config, ConfigFromFlags());
+  ASSIGN_OR_RETURN(const std::vector<Query> queries, LoadQueries());
+  const ZipfianGenerator zipf(queries.size(), absl::GetFlag(FLAGS_zipf_theta));
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int32_t i = 0; i < config.threads; i++) {
+    workers.push_back(std::make_unique<Worker>(config, queries, zipf, i));
+  }
+  // NOTE: concurrency is split as evenly as possible over the sockets.
+  for (int32_t i = 0; i < config.sockets; i++) {
+    const size_t window = config.concurrency / config.sockets +
+      (i < config.concurrency % config.sockets ? 1 : 0);
+    RETURN_IF_ERROR(workers[i % config.threads]->AddSource(window));
+  }
+
+  LOG(INFO) << "Sending " << queries.size() << " distinct queries for "
+    << absl::GetFlag(FLAGS_duration_s) << "s.";
+  // NOTE: the sending threads inherit it.
+  RETURN_IF_ERROR(PinCurrentThread(config.cpus));
+  const int64_t start = NowNanos();
+  const int64_t end = start + config.duration_ns;
+  std::vector<std::thread> threads;
+  for (std::unique_ptr<Worker>& worker : workers) {
+    threads.emplace_back([&worker, start, end] { worker->Run(start, end); });
+  }
+  for (std::thread& thread : threads) { thread.join(); }
+
+  // NOTE: rates are over the time actually spent sending, measured rather
+  // than assumed to be --duration_s, but not the wait for stragglers after.
+  Stats stats;
+  int64_t sending_end = start;
+  for (const std::unique_ptr<Worker>& worker : workers) {
+    stats.Merge(worker->stats());
+    sending_end = std::max(sending_end, worker->sending_end());
+  }
+  PrintReport(config, stats, std::max<int64_t>(sending_end - start, 1));
+  return absl::OkStatus();
+}
+
+} // namespace
+} // tiny_dns
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  const absl::Status status = tiny_dns::Run();
+  if (!status.ok()) {
+    LOG(ERROR) << "Load generation failed: " << status;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/initialize.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "src/common/histogram.h"
+#include "src/common/status_macros.h"
+#include "src/dns/dns_packet.h"
+#include "src/dns/query_trace.h"
+#include "src/tools/udp_source.h"
+
+// Replays a query trace recorded with `//src:main --trace_file=...` against a
+// running server, and compares what comes back with what was recorded:
+// * response codes, with a breakdown of every recorded -> replayed mismatch,
+// * the recorded service time against the replayed round trip time.
+//
+// --speed=1 keeps the recorded inter-arrival times, --speed=N compresses them
+// N times, and --speed=0 replays as fast as possible with up to --concurrency
+// queries outstanding. e.g.
+//
+//   bazel run //src/tools:dns_replay -- --trace_file=/tmp/prod.trace --speed=4
+//
+// NOTE: recorded latencies are measured inside the server, replayed ones are
+// round trips as seen by this tool, so expect the latter to be a bit higher.
+
+ABSL_FLAG(std::string, trace_file, "",
+          "Trace to replay.");
+ABSL_FLAG(std::string, server_addr, "127.0.0.1",
+          "Address of the DNS server to replay against.");
+ABSL_FLAG(int32_t, server_port, 4000,
+          "UDP port of the DNS server to replay against.");
+ABSL_FLAG(std::string, local_addr, "127.0.0.1",
+          "Address to send queries from.");
+ABSL_FLAG(double, speed, 1.0,
+          "Replay speed relative to the trace, 0 for as fast as possible.");
+ABSL_FLAG(int32_t, concurrency, 64,
+          "Outstanding queries when --speed=0.");
+ABSL_FLAG(int32_t, sockets, 16,
+          "Number of UDP source sockets.");
+ABSL_FLAG(int32_t, timeout_ms, 1000,
+          "How long to wait for a response before counting a timeout.");
+ABSL_FLAG(int64_t, limit, 0,
+          "Replay at most this many entries, 0 for the whole trace.");
+
+namespace tiny_dns {
+namespace {
+
+constexpr size_t kResponseCodeCount = 6;
+
+struct Stats {
+  Histogram recorded_ns;
+  Histogram replayed_ns;
+  uint64_t sent = 0;
+  uint64_t received = 0;
+  uint64_t timeouts = 0;
+  uint64_t unmatched = 0;
+  uint64_t skipped = 0; // NOTE: entries that couldn't be sent.
+  // NOTE: [recorded][replayed].
+  std::array<std::array<uint64_t, kResponseCodeCount>, kResponseCodeCount> response_codes = {};
+  int64_t first_timestamp_ns = 0;
+  int64_t last_timestamp_ns = 0;
+};
+
+class Replayer {
+ public:
+  Replayer(std::unique_ptr<TraceReader> reader, std::vector<Source<ResponseCode>> sources)
+    : reader_(std::move(reader)), sources_(std::move(sources)), poll_fds_(), stats_(),
+      speed_(absl::GetFlag(FLAGS_speed)), concurrency_(absl::GetFlag(FLAGS_concurrency)),
+      timeout_ns_(absl::GetFlag(FLAGS_timeout_ms) * int64_t{1'000'000}),
+      limit_(absl::GetFlag(FLAGS_limit)), outstanding_(0), next_source_(0) {
+    for (const Source<ResponseCode>& source : sources_) {
+      poll_fds_.push_back(pollfd { .fd = source.socket_fd, .events = POLLIN, .revents = 0 });
+    }
+  }
+
+  ~Replayer() {
+    for (Source<ResponseCode>& source : sources_) { close(source.socket_fd); }
+  }
+
+  absl::Status Run() {
+    TraceEntry entry;
+    ASSIGN_OR_RETURN(bool has_next, Next(entry));
+    if (has_next) { stats_.first_timestamp_ns = entry.timestamp_ns; }
+    const int64_t start = NowNanos();
+    while (has_next || outstanding_ > 0) {
+      int64_t now = NowNanos();
+      while (has_next && (speed_ > 0 ? DueAt(entry, start) <= now : outstanding_ < concurrency_)) {
+        Send(entry, now);
+        const bool limited = limit_ > 0 && stats_.sent + stats_.skipped >= static_cast<uint64_t>(limit_);
+        if (limited) { has_next = false; break; }
+        ASSIGN_OR_RETURN(has_next, Next(entry));
+      }
+
+      int64_t wait_ns = has_next && speed_ > 0 ? DueAt(entry, start) - now : timeout_ns_;
+      for (Source<ResponseCode>& source : sources_) {
+        const size_t expired = source.ExpireTimeouts(now, timeout_ns_);
+        stats_.timeouts += expired;
+        outstanding_ -= expired;
+        if (source.sent_order.empty()) { continue; }
+        wait_ns = std::min(wait_ns, source.sent_order.front().second + timeout_ns_ - now);
+      }
+      const struct timespec timeout = {
+        .tv_sec = std::max<int64_t>(wait_ns, 0) / 1'000'000'000,
+        .tv_nsec = std::max<int64_t>(wait_ns, 0) % 1'000'000'000,
+      };
+      if (ppoll(poll_fds_.data(), poll_fds_.size(), &timeout, nullptr) <= 0) { continue; }
+      for (size_t i = 0; i < sources_.size(); i++) {
+        if (poll_fds_[i].revents & POLLIN) { Receive(sources_[i]); }
+      }
+    }
+    elapsed_ns_ = NowNanos() - start;
+    return absl::OkStatus();
+  }
+
+  void PrintReport() const;
+
+ private:
+  // NOTE: the server is usually killed rather than shut down, so the trace may
+  // end in a partially written entry; treat that as the end of the trace.
+  absl::StatusOr<bool> Next(TraceEntry& entry) {
+    absl::StatusOr<bool> has_next = reader_->Next(entry);
+    if (has_next.status().code() == absl::StatusCode::kDataLoss) {
+      LOG(WARNING) << "Stopping at the end of the trace: " << has_next.status();
+      return false;
+    }
+    return has_next;
+  }
+
+  int64_t DueAt(const TraceEntry& entry, int64_t start) const {
+    return start + static_cast<int64_t>((entry.timestamp_ns - stats_.first_timestamp_ns) / speed_);
+  }
+
+  void Send(const TraceEntry& entry, int64_t now) {
+    Source<ResponseCode>& source = sources_[next_source_++ % sources_.size()];
+    // NOTE: replaying faster than the server answers can use up every ID.
+    const std::optional<uint16_t> id = source.NextId();
+    if (!id.has_value()) {
+      stats_.skipped++;
+      return;
+    }
+
+    // NOTE: the recorded question goes out as is, behind a fresh header.
+    std::array<uint8_t, 512> request = {};
+    BufferWriter writer(request);
+    Header header = {};
+    header.id = *id;
+    header.recursion_desired = entry.recursion_desired;
+    const std::span<const uint8_t> question = entry.Question();
+    if (!header.ToBytes(writer, 1, 0, 0, 0).ok() ||
+        !writer.WriteBytes(question.data(), question.size()).ok() ||
+        send(source.socket_fd, request.data(), writer.Position(), 0) < 0) {
+      stats_.skipped++;
+      return;
+    }
+    stats_.recorded_ns.Record(entry.service_time_ns);
+    stats_.last_timestamp_ns = entry.timestamp_ns;
+    source.Track(*id, now, entry.response_code);
+    stats_.sent++;
+    outstanding_++;
+  }
+
+  void Receive(Source<ResponseCode>& source) {
+    std::array<uint8_t, 512> response = {};
+    while (recv(source.socket_fd, response.data(), response.size(), MSG_DONTWAIT) > 0) {
+      const int64_t now = NowNanos();
+      BufferReader reader(response);
+      uint16_t questions_count, answers_count, authorities_count, additional_count;
+      const absl::StatusOr<Header> header = Header::FromBytes(
+          reader, questions_count, answers_count, authorities_count, additional_count);
+      auto it = header.ok() ? source.outstanding.find(header->id) : source.outstanding.end();
+      if (it == source.outstanding.end()) {
+        stats_.unmatched++;
+        continue;
+      }
+      stats_.replayed_ns.Record(now - it->second.sent_ns);
+      stats_.received++;
+      stats_.response_codes[ResponseCodeToByte(it->second.data)]
+        [ResponseCodeToByte(header->response_code)]++;
+      source.outstanding.erase(it);
+      outstanding_--;
+    }
+  }
+
+  std::unique_ptr<TraceReader> reader_;
+  std::vector<Source<ResponseCode>> sources_;
+  std::vector<struct pollfd> poll_fds_;
+  Stats stats_;
+  const double speed_;
+  const int64_t concurrency_;
+  const int64_t timeout_ns_;
+  const int64_t limit_;
+  int64_t outstanding_;
+  size_t next_source_;
+  int64_t elapsed_ns_ = 0;
+};
+
+std::string ResponseCodeName(size_t code) {
+  return ResponseCodeToString(ResponseCodeFromByte(code));
+}
+
+void Replayer::PrintReport() const {
+  const double elapsed_s = elapsed_ns_ / 1e9;
+  const double recorded_s = (stats_.last_timestamp_ns - stats_.first_timestamp_ns) / 1e9;
+  absl::PrintF("replayed:       %d entries in %.2fs (recorded over %.2fs)\n",
+               stats_.sent, elapsed_s, recorded_s);
+  absl::PrintF("rate:           %.0f qps replayed, %.0f qps recorded\n",
+               elapsed_s > 0 ? stats_.sent / elapsed_s : 0.0,
+               recorded_s > 0 ? stats_.sent / recorded_s : 0.0);
+  absl::PrintF("responses:      %d (%.2f%%)\n", stats_.received, Percent(stats_.received, stats_.sent));
+  absl::PrintF("timeouts:       %d (%.2f%%)\n", stats_.timeouts, Percent(stats_.timeouts, stats_.sent));
+  absl::PrintF("unmatched:      %d\n", stats_.unmatched);
+  absl::PrintF("skipped:        %d\n", stats_.skipped);
+
+  uint64_t matches = 0;
+  for (size_t i = 0; i < kResponseCodeCount; i++) { matches += stats_.response_codes[i][i]; }
+  absl::PrintF("\nresponse codes: %d match (%.2f%%), %d differ\n",
+               matches, Percent(matches, stats_.received), stats_.received - matches);
+  for (size_t recorded = 0; recorded < kResponseCodeCount; recorded++) {
+    for (size_t replayed = 0; replayed < kResponseCodeCount; replayed++) {
+      const uint64_t count = stats_.response_codes[recorded][replayed];
+      if (count == 0) { continue; }
+      absl::PrintF("  %-10s -> %-10s %10d\n",
+                   ResponseCodeName(recorded), ResponseCodeName(replayed), count);
+    }
+  }
+
+  absl::PrintF("\nlatency (us):   %12s %12s\n", "recorded", "replayed");
+  absl::PrintF("  %-12s %12.1f %12.1f\n", "min",
+               stats_.recorded_ns.Min() / 1e3, stats_.replayed_ns.Min() / 1e3);
+  for (const double percentile : {50.0, 90.0, 99.0, 99.9, 99.99}) {
+    absl::PrintF("  %-12s %12.1f %12.1f\n", absl::StrCat("p", percentile),
+                 stats_.recorded_ns.Percentile(percentile) / 1e3,
+                 stats_.replayed_ns.Percentile(percentile) / 1e3);
+  }
+  absl::PrintF("  %-12s %12.1f %12.1f\n", "max",
+               stats_.recorded_ns.Max() / 1e3, stats_.replayed_ns.Max() / 1e3);
+  absl::PrintF("  %-12s %12.1f %12.1f\n", "mean",
+               stats_.recorded_ns.Mean() / 1e3, stats_.replayed_ns.Mean() / 1e3);
+}
+
+absl::Status Run() {
+  if (absl::GetFlag(FLAGS_trace_file).empty()) {
+    return absl::InvalidArgumentError("--trace_file is required.");
+  }
+  if (absl::GetFlag(FLAGS_speed) < 0 || absl::GetFlag(FLAGS_sockets) < 1 ||
+      absl::GetFlag(FLAGS_concurrency) < 1) {
+    return absl::InvalidArgumentError(
+        "--speed must not be negative, --sockets and --concurrency must be positive.");
+  }
+  if (absl::GetFlag(FLAGS_concurrency) >
+      absl::GetFlag(FLAGS_sockets) * static_cast<int64_t>(kMaxOutstandingPerSource)) {
+    return absl::InvalidArgumentError("--concurrency is more than the sockets have IDs for.");
+  }
+  ASSIGN_OR_RETURN(std::unique_ptr<TraceReader> reader,
+                   TraceReader::Open(absl::GetFlag(FLAGS_trace_file)));
+  std::vector<Source<ResponseCode>> sources(absl::GetFlag(FLAGS_sockets));
+  for (Source<ResponseCode>& source : sources) {
+    absl::StatusOr<int32_t> socket_fd = OpenSocket(
+        absl::GetFlag(FLAGS_local_addr), absl::GetFlag(FLAGS_server_addr),
+        absl::GetFlag(FLAGS_server_port));
+    if (!socket_fd.ok()) {
+      for (Source<ResponseCode>& opened : sources) {
+        if (opened.socket_fd >= 0) { close(opened.socket_fd); }
+      }
+      return socket_fd.status();
+    }
+    source.socket_fd = *socket_fd;
+  }
+
+  Replayer replayer(std::move(reader), std::move(sources));
+  RETURN_IF_ERROR(replayer.Run());
+  replayer.PrintReport();
+  return absl::OkStatus();
+}
+
+} // namespace
+} // tiny_dns
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  const absl::Status status = tiny_dns::Run();
+  if (!status.ok()) {
+    LOG(ERROR) << "Replay failed: " << status;
+    return 1;
+  }
+  return 0;
+}
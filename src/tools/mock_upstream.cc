@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/initialize.h"
+#include "absl/log/log.h"
+#include "absl/status/statusor.h"
+#include "src/dns/mock_upstream.h"
+
+// Runs a MockUpstream until killed, e.g. as the fallback for //src:main:
+//
+//   bazel run //src/tools:mock_upstream -- --port=5300 --delay_us=2000 --loss_rate=0.01
+//   bazel run //src:main -- --fallback_dns_addr=127.0.0.1 --fallback_dns_port=5300
+//
+// Every A/AAAA question is answered with synthesized records, see
+// MockUpstreamOptions for the fault injection knobs.
+
+ABSL_FLAG(std::string, addr, "127.0.0.1",
+          "Address to serve from.");
+ABSL_FLAG(int32_t, port, 5300,
+          "UDP port to serve from.");
+ABSL_FLAG(int32_t, answers_per_query, 1,
+          "Records in each synthesized answer.");
+ABSL_FLAG(int32_t, ttl, 300,
+          "TTL of synthesized records.");
+ABSL_FLAG(int32_t, delay_us, 0,
+          "Fixed delay added to every response.");
+ABSL_FLAG(int32_t, delay_jitter_us, 0,
+          "Mean of an exponentially distributed delay added on top of --delay_us.");
+ABSL_FLAG(double, loss_rate, 0,
+          "Fraction of queries to drop.");
+ABSL_FLAG(double, truncation_rate, 0,
+          "Fraction of responses to truncate (TC set, answers stripped).");
+ABSL_FLAG(double, serv_fail_rate, 0,
+          "Fraction of queries to answer with SERV_FAIL.");
+ABSL_FLAG(int32_t, stats_interval_s, 10,
+          "How often to log counters, 0 to disable.");
+
+using namespace tiny_dns;
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  MockUpstreamOptions options = {
+    .addr = absl::GetFlag(FLAGS_addr),
+    .port = absl::GetFlag(FLAGS_port),
+    .synthesize_answers = true,
+    .synthesized_answers_per_query = static_cast<size_t>(absl::GetFlag(FLAGS_answers_per_query)),
+    .synthesized_ttl = static_cast<uint32_t>(absl::GetFlag(FLAGS_ttl)),
+    .delay = std::chrono::microseconds(absl::GetFlag(FLAGS_delay_us)),
+    .delay_jitter_mean = std::chrono::microseconds(absl::GetFlag(FLAGS_delay_jitter_us)),
+    .loss_rate = absl::GetFlag(FLAGS_loss_rate),
+    .truncation_rate = absl::GetFlag(FLAGS_truncation_rate),
+    .serv_fail_rate = absl::GetFlag(FLAGS_serv_fail_rate),
+  };
+  absl::StatusOr<std::unique_ptr<MockUpstream>> upstream =
+    MockUpstream::Create(std::move(options));
+  if (!upstream.ok()) {
+    LOG(ERROR) << "Unable to start mock upstream: " << upstream.status();
+    return 1;
+  }
+  LOG(INFO) << "Mock upstream serving on: "
+    << absl::GetFlag(FLAGS_addr) << ":" << (*upstream)->port();
+
+  const int32_t stats_interval_s = absl::GetFlag(FLAGS_stats_interval_s);
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(stats_interval_s > 0 ? stats_interval_s : 60));
+    if (stats_interval_s <= 0) { continue; }
+    const MockUpstream::Stats stats = (*upstream)->stats();
+    LOG(INFO) << "queries: " << stats.queries << ", dropped: " << stats.dropped
+      << ", truncated: " << stats.truncated << ", serv_failed: " << stats.serv_failed;
+  }
+  return 0;
+}
@@ -0,0 +1,55 @@
+#include "src/tools/udp_source.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+
+namespace tiny_dns {
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double Percent(uint64_t part, uint64_t total) {
+  return total == 0 ? 0.0 : 100.0 * part / total;
+}
+
+absl::StatusOr<int32_t> OpenSocket(
+    const std::string& local_addr, const std::string& server_addr, int32_t server_port) {
+  int32_t socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socket_fd < 0) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Unable to open socket: ", socket_fd));
+  }
+  struct sockaddr_in src_addr;
+  memset(&src_addr, 0, sizeof(src_addr));
+  src_addr.sin_family = AF_INET;
+  src_addr.sin_port = htons(0);
+  struct sockaddr_in dest_addr;
+  memset(&dest_addr, 0, sizeof(dest_addr));
+  dest_addr.sin_family = AF_INET;
+  dest_addr.sin_port = htons(server_port);
+  if (inet_pton(AF_INET, local_addr.c_str(), &src_addr.sin_addr) <= 0 ||
+      inet_pton(AF_INET, server_addr.c_str(), &dest_addr.sin_addr) <= 0) {
+    close(socket_fd);
+    return absl::InvalidArgumentError("Unable to translate addresses.");
+  }
+  if (bind(socket_fd, (struct sockaddr*) &src_addr, sizeof(src_addr)) < 0 ||
+      connect(socket_fd, (struct sockaddr*) &dest_addr, sizeof(dest_addr)) < 0) {
+    close(socket_fd);
+    return absl::FailedPreconditionError(
+        absl::StrCat("Unable to connect to: ", server_addr, ":", server_port));
+  }
+  return socket_fd;
+}
+
+} // tiny_dns
@@ -0,0 +1,80 @@
+#ifndef SRC_TOOLS_UDP_SOURCE_H_
+#define SRC_TOOLS_UDP_SOURCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+
+// The pieces dns_loadgen and dns_replay share: UDP source sockets connected
+// to the server under test, each tracking the queries it has in flight by
+// DNS ID, and a few helpers for their reports.
+
+namespace tiny_dns {
+
+// NOTE: one per DNS ID.
+inline constexpr size_t kMaxOutstandingPerSource = 1 << 16;
+
+int64_t NowNanos();
+
+double Percent(uint64_t part, uint64_t total);
+
+// NOTE: bound to local_addr and connected to the server, so the kernel
+// filters out datagrams from anyone else.
+absl::StatusOr<int32_t> OpenSocket(
+    const std::string& local_addr, const std::string& server_addr, int32_t server_port);
+
+// NOTE: a connected UDP socket, and the queries it has in flight keyed by ID,
+// each with when it was sent and whatever the tool keeps about it.
+template <typename T>
+struct Source {
+  struct Query {
+    int64_t sent_ns;
+    T data;
+  };
+
+  int32_t socket_fd = -1;
+  uint16_t next_id = 0;
+  absl::flat_hash_map<uint16_t, Query> outstanding;
+  // NOTE: send order, so timeouts can be found from the front.
+  std::deque<std::pair<uint16_t, int64_t>> sent_order;
+
+  // NOTE: the next ID not in flight, nullopt if every one is.
+  std::optional<uint16_t> NextId() {
+    if (outstanding.size() >= kMaxOutstandingPerSource) { return std::nullopt; }
+    while (outstanding.contains(next_id)) { next_id++; }
+    return next_id++;
+  }
+
+  void Track(uint16_t id, int64_t sent_ns, T data) {
+    outstanding[id] = Query { .sent_ns = sent_ns, .data = std::move(data) };
+    sent_order.emplace_back(id, sent_ns);
+  }
+
+  // NOTE: forgets the queries sent timeout_ns or more before now that are
+  // still unanswered, returns how many.
+  size_t ExpireTimeouts(int64_t now, int64_t timeout_ns) {
+    size_t expired = 0;
+    while (!sent_order.empty()) {
+      const auto [id, sent] = sent_order.front();
+      auto it = outstanding.find(id);
+      const bool answered = it == outstanding.end() || it->second.sent_ns != sent;
+      if (!answered && sent + timeout_ns > now) { break; }
+      if (!answered) {
+        outstanding.erase(it);
+        expired++;
+      }
+      sent_order.pop_front();
+    }
+    return expired;
+  }
+};
+
+} // tiny_dns
+
+#endif // SRC_TOOLS_UDP_SOURCE_H_